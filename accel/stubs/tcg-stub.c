@@ -16,6 +16,8 @@
 #include "tcg/tcg.h"
 #include "exec/cpu-common.h"
 #include "exec/exec-all.h"
+#include "qapi/error.h"
+#include "qmp-commands.h"
 
 void tb_flush(CPUState *cpu)
 {
@@ -28,3 +30,9 @@ void tb_unlock(void)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
 }
+
+TbHashInfo *qmp_x_query_tb_hash(Error **errp)
+{
+    error_setg(errp, "TB hash statistics require the TCG accelerator");
+    return NULL;
+}
@@ -145,10 +145,11 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, TranslationBlock *itb)
     int tb_exit;
     uint8_t *tb_ptr = itb->tc.ptr;
 
-    qemu_log_mask_and_addr(CPU_LOG_EXEC, itb->pc,
-                           "Trace %p [%d: " TARGET_FMT_lx "] %s\n",
-                           itb->tc.ptr, cpu->cpu_index, itb->pc,
-                           lookup_symbol(itb->pc));
+    if (unlikely(qemu_loglevel_mask(CPU_LOG_EXEC)) &&
+        qemu_log_in_addr_range(itb->pc)) {
+        qemu_log_exec_tb(itb->tc.ptr, cpu->cpu_index, itb->pc,
+                         TARGET_LONG_BITS, lookup_symbol(itb->pc));
+    }
 
 #if defined(DEBUG_DISAS)
     if (qemu_loglevel_mask(CPU_LOG_TB_CPU)
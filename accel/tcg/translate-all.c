@@ -59,6 +59,8 @@
 #include "qemu/main-loop.h"
 #include "exec/log.h"
 #include "sysemu/cpus.h"
+#include "qapi/error.h"
+#include "qmp-commands.h"
 
 /* #define DEBUG_TB_INVALIDATE */
 /* #define DEBUG_TB_FLUSH */
@@ -1150,12 +1152,13 @@ static void build_page_bitmap(PageDesc *p)
 }
 #endif
 
-/* add the tb in the target page and protect it if necessary
+/* add the tb in the target page and protect it if necessary; @protect is
+ * false when the guest takes care of code coherency itself
  *
  * Called with mmap_lock held for user-mode emulation.
  */
-static inline void tb_alloc_page(TranslationBlock *tb,
-                                 unsigned int n, tb_page_addr_t page_addr)
+static inline void tb_alloc_page(TranslationBlock *tb, unsigned int n,
+                                 tb_page_addr_t page_addr, bool protect)
 {
     PageDesc *p;
 #ifndef CONFIG_USER_ONLY
@@ -1203,7 +1206,7 @@ static inline void tb_alloc_page(TranslationBlock *tb,
     /* if some code is already present, then the pages are already
        protected. So we handle the case where only the first TB is
        allocated in a physical page */
-    if (!page_already_protected) {
+    if (protect && !page_already_protected) {
         tlb_protect_code(page_addr);
     }
 #endif
@@ -1215,16 +1218,16 @@ static inline void tb_alloc_page(TranslationBlock *tb,
  * Called with mmap_lock held for user-mode emulation.
  */
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
-                         tb_page_addr_t phys_page2)
+                         tb_page_addr_t phys_page2, bool protect)
 {
     uint32_t h;
 
     assert_memory_lock();
 
     /* add in the page list */
-    tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
+    tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK, protect);
     if (phys_page2 != -1) {
-        tb_alloc_page(tb, 1, phys_page2);
+        tb_alloc_page(tb, 1, phys_page2, protect);
     } else {
         tb->page_addr[1] = -1;
     }
@@ -1395,7 +1398,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      * memory barrier is required before tb_link_page() makes the TB visible
      * through the physical hash table and physical page list.
      */
-    tb_link_page(tb, phys_pc, phys_page2);
+    tb_link_page(tb, phys_pc, phys_page2, !cpu->explicit_code_coherency);
     g_tree_insert(tb_ctx.tb_tree, &tb->tc, tb);
     return tb;
 }
@@ -1691,6 +1694,30 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
     tb_unlock();
     rcu_read_unlock();
 }
+
+/* Invalidate the TBs that intersect [@addr, @addr + @len), which must not
+ * cross a page boundary; used by targets that implement cache maintenance
+ * instructions.
+ */
+void tb_invalidate_phys_addr_range(AddressSpace *as, hwaddr addr, hwaddr len)
+{
+    ram_addr_t ram_addr;
+    MemoryRegion *mr;
+    hwaddr l = len;
+
+    rcu_read_lock();
+    mr = address_space_translate(as, addr, &addr, &l, false);
+    if (!(memory_region_is_ram(mr)
+          || memory_region_is_romd(mr))) {
+        rcu_read_unlock();
+        return;
+    }
+    ram_addr = memory_region_get_ram_addr(mr) + addr;
+    tb_lock();
+    tb_invalidate_phys_page_range(ram_addr, ram_addr + l, 0);
+    tb_unlock();
+    rcu_read_unlock();
+}
 #endif /* !defined(CONFIG_USER_ONLY) */
 
 /* Called with tb_lock held.  */
@@ -1844,6 +1871,53 @@ static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
     cpu_fprintf(f, "TB hash avg chain   %0.3f buckets. Histogram: %s\n",
                 qdist_avg(&hst.chain), hgram);
     g_free(hgram);
+
+    if (hst.pending_buckets) {
+        cpu_fprintf(f, "TB hash resize      %zu head buckets left to copy\n",
+                    hst.pending_buckets);
+    }
+}
+
+TbHashInfo *qmp_x_query_tb_hash(Error **errp)
+{
+    TbHashChainCountList *chain;
+    TbHashOccupancyCountList *occ;
+    struct qht_stats hst;
+    TbHashInfo *info;
+    size_t i;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB hash statistics require the TCG accelerator");
+        return NULL;
+    }
+
+    qht_statistics_init(&tb_ctx.htable, &hst);
+    info = g_new0(TbHashInfo, 1);
+    info->head_buckets = hst.head_buckets;
+    info->used_head_buckets = hst.used_head_buckets;
+    info->entries = hst.entries;
+    info->pending_buckets = hst.pending_buckets;
+
+    /* build the lists backwards to keep them in ascending order */
+    for (i = hst.chain.n; i-- > 0; ) {
+        chain = g_new0(TbHashChainCountList, 1);
+        chain->value = g_new0(TbHashChainCount, 1);
+        chain->value->buckets = hst.chain.entries[i].x;
+        chain->value->chains = hst.chain.entries[i].count;
+        chain->next = info->chain_length;
+        info->chain_length = chain;
+    }
+    for (i = hst.occupancy.n; i-- > 0; ) {
+        occ = g_new0(TbHashOccupancyCountList, 1);
+        occ->value = g_new0(TbHashOccupancyCount, 1);
+        occ->value->occupancy = hst.occupancy.entries[i].x;
+        occ->value->chains = hst.occupancy.entries[i].count;
+        occ->next = info->occupancy;
+        info->occupancy = occ;
+    }
+
+    qht_statistics_destroy(&hst);
+    return info;
 }
 
 struct tb_tree_stats {
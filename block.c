@@ -42,6 +42,7 @@
 #include "qapi-event.h"
 #include "qemu/cutils.h"
 #include "qemu/id.h"
+#include "qemu/rcu_queue.h"
 
 #ifdef CONFIG_BSD
 #include <sys/ioctl.h>
@@ -1117,7 +1118,7 @@ static void bdrv_assign_node_name(BlockDriverState *bs,
 
     /* copy node name into the bs and insert it into the graph list */
     pstrcpy(bs->node_name, sizeof(bs->node_name), node_name);
-    QTAILQ_INSERT_TAIL(&graph_bdrv_states, bs, node_list);
+    QTAILQ_INSERT_TAIL_RCU(&graph_bdrv_states, bs, node_list);
 out:
     g_free(gen_node_name);
 }
@@ -1982,7 +1983,7 @@ static void bdrv_replace_child_noperm(BdrvChild *child,
         QLIST_REMOVE(child, next_parent);
     }
 
-    child->bs = new_bs;
+    atomic_rcu_set(&child->bs, new_bs);
 
     if (new_bs) {
         QLIST_INSERT_HEAD(&new_bs->parents, child, next_parent);
@@ -2096,7 +2097,7 @@ static void bdrv_detach_child(BdrvChild *child)
     bdrv_replace_child(child, NULL);
 
     g_free(child->name);
-    g_free(child);
+    g_free_rcu(child, rcu);
 }
 
 void bdrv_root_unref_child(BdrvChild *child)
@@ -3396,11 +3397,12 @@ static void bdrv_delete(BlockDriverState *bs)
 
     /* remove from list, if necessary */
     if (bs->node_name[0] != '\0') {
-        QTAILQ_REMOVE(&graph_bdrv_states, bs, node_list);
+        QTAILQ_REMOVE_RCU(&graph_bdrv_states, bs, node_list);
     }
     QTAILQ_REMOVE(&all_bdrv_states, bs, bs_list);
 
-    g_free(bs);
+    /* Lockless readers of graph_bdrv_states may still look at it */
+    g_free_rcu(bs, rcu);
 }
 
 /*
@@ -3868,12 +3870,19 @@ bool bdrv_chain_contains(BlockDriverState *top, BlockDriverState *base)
     return top != NULL;
 }
 
+/*
+ * Return the named node after @bs, or the first one if @bs is null.
+ *
+ * Besides the main loop, this can be called under rcu_read_lock()
+ * without the BQL; a node that is deleted meanwhile stays readable
+ * until rcu_read_unlock().
+ */
 BlockDriverState *bdrv_next_node(BlockDriverState *bs)
 {
     if (!bs) {
-        return QTAILQ_FIRST(&graph_bdrv_states);
+        return QTAILQ_FIRST_RCU(&graph_bdrv_states);
     }
-    return QTAILQ_NEXT(bs, node_list);
+    return QTAILQ_NEXT_RCU(bs, node_list);
 }
 
 const char *bdrv_get_node_name(const BlockDriverState *bs)
@@ -19,6 +19,7 @@
 #include "sysemu/sysemu.h"
 #include "qapi-event.h"
 #include "qemu/id.h"
+#include "qemu/rcu_queue.h"
 #include "trace.h"
 #include "migration/misc.h"
 
@@ -30,6 +31,8 @@
 static AioContext *blk_aiocb_get_aio_context(BlockAIOCB *acb);
 
 struct BlockBackend {
+    /* Freed after an RCU grace period, see blk_next() */
+    struct rcu_head rcu;
     char *name;
     int refcnt;
     BdrvChild *root;
@@ -92,10 +95,18 @@ static QTAILQ_HEAD(, BlockBackend) block_backends =
     QTAILQ_HEAD_INITIALIZER(block_backends);
 
 /* All BlockBackends referenced by the monitor and which are iterated through by
- * blk_next() */
+ * blk_next().  Modified under the BQL, can be read under rcu_read_lock(). */
 static QTAILQ_HEAD(, BlockBackend) monitor_block_backends =
     QTAILQ_HEAD_INITIALIZER(monitor_block_backends);
 
+/* A name that monitor_remove_blk() took away from a BlockBackend, and
+ * that lockless readers may still be looking at.
+ */
+typedef struct BlockBackendOldName {
+    struct rcu_head rcu;
+    char *name;
+} BlockBackendOldName;
+
 static void blk_root_inherit_options(int *child_flags, QDict *child_options,
                                      int parent_flags, QDict *parent_options)
 {
@@ -337,6 +348,12 @@ BlockBackend *blk_new_open(const char *filename, const char *reference,
     return blk;
 }
 
+static void blk_free_rcu(BlockBackend *blk)
+{
+    block_acct_cleanup(&blk->stats);
+    g_free(blk);
+}
+
 static void blk_delete(BlockBackend *blk)
 {
     assert(!blk->refcnt);
@@ -356,8 +373,7 @@ static void blk_delete(BlockBackend *blk)
     assert(QLIST_EMPTY(&blk->insert_bs_notifiers.notifiers));
     QTAILQ_REMOVE(&block_backends, blk, link);
     drive_info_del(blk->legacy_dinfo);
-    block_acct_cleanup(&blk->stats);
-    g_free(blk);
+    call_rcu(blk, blk_free_rcu, rcu);
 }
 
 static void drive_info_del(DriveInfo *dinfo)
@@ -433,11 +449,15 @@ void blk_remove_all_bs(void)
  * for (blk = blk_next(NULL); blk; blk = blk_next(blk)) {
  *     ...
  * }
+ *
+ * Besides the main loop, this can be called under rcu_read_lock()
+ * without the BQL.  BlockBackends that are removed meanwhile, and
+ * their names, stay readable until rcu_read_unlock().
  */
 BlockBackend *blk_next(BlockBackend *blk)
 {
-    return blk ? QTAILQ_NEXT(blk, monitor_link)
-               : QTAILQ_FIRST(&monitor_block_backends);
+    return blk ? QTAILQ_NEXT_RCU(blk, monitor_link)
+               : QTAILQ_FIRST_RCU(&monitor_block_backends);
 }
 
 /* Iterates over all top-level BlockDriverStates, i.e. BDSs that are owned by
@@ -556,23 +576,33 @@ bool monitor_add_blk(BlockBackend *blk, const char *name, Error **errp)
     }
 
     blk->name = g_strdup(name);
-    QTAILQ_INSERT_TAIL(&monitor_block_backends, blk, monitor_link);
+    QTAILQ_INSERT_TAIL_RCU(&monitor_block_backends, blk, monitor_link);
     return true;
 }
 
+static void blk_free_old_name(BlockBackendOldName *old)
+{
+    g_free(old->name);
+    g_free(old);
+}
+
 /*
  * Remove a BlockBackend from the list of backends referenced by the monitor.
  * Strictly for use by blockdev.c.
  */
 void monitor_remove_blk(BlockBackend *blk)
 {
+    BlockBackendOldName *old;
+
     if (!blk->name) {
         return;
     }
 
-    QTAILQ_REMOVE(&monitor_block_backends, blk, monitor_link);
-    g_free(blk->name);
-    blk->name = NULL;
+    QTAILQ_REMOVE_RCU(&monitor_block_backends, blk, monitor_link);
+    old = g_new(BlockBackendOldName, 1);
+    old->name = blk->name;
+    atomic_set(&blk->name, NULL);
+    call_rcu(old, blk_free_old_name, rcu);
 }
 
 /*
@@ -581,7 +611,7 @@ void monitor_remove_blk(BlockBackend *blk)
  */
 const char *blk_name(const BlockBackend *blk)
 {
-    return blk->name ?: "";
+    return atomic_rcu_read(&blk->name) ?: "";
 }
 
 /*
@@ -603,10 +633,13 @@ BlockBackend *blk_by_name(const char *name)
 
 /*
  * Return the BlockDriverState attached to @blk if any, else null.
+ * This can also be used under rcu_read_lock(), see blk_next().
  */
 BlockDriverState *blk_bs(BlockBackend *blk)
 {
-    return blk->root ? blk->root->bs : NULL;
+    BdrvChild *root = atomic_rcu_read(&blk->root);
+
+    return root ? atomic_rcu_read(&root->bs) : NULL;
 }
 
 static BlockBackend *bdrv_first_blk(BlockDriverState *bs)
@@ -725,8 +758,9 @@ void blk_remove_bs(BlockBackend *blk)
 int blk_insert_bs(BlockBackend *blk, BlockDriverState *bs, Error **errp)
 {
     ThrottleGroupMember *tgm = &blk->public.throttle_group_member;
-    blk->root = bdrv_root_attach_child(bs, "root", &child_root,
-                                       blk->perm, blk->shared_perm, blk, errp);
+    atomic_rcu_set(&blk->root,
+                   bdrv_root_attach_child(bs, "root", &child_root, blk->perm,
+                                          blk->shared_perm, blk, errp));
     if (blk->root == NULL) {
         return -EPERM;
     }
@@ -456,24 +456,37 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     }
 }
 
+/* The node behind bs->file or bs->backing, read under rcu_read_lock() */
+static BlockDriverState *bdrv_child_bs_rcu(BdrvChild **pchild)
+{
+    BdrvChild *child = atomic_rcu_read(pchild);
+
+    return child ? atomic_rcu_read(&child->bs) : NULL;
+}
+
+/*
+ * Called under rcu_read_lock(), possibly without the BQL: the graph can
+ * change under our feet, but nodes and BdrvChild objects are only freed
+ * after a grace period.
+ */
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
                                         bool blk_level)
 {
+    BlockDriverState *child_bs;
     BlockStats *s = NULL;
 
     s = g_malloc0(sizeof(*s));
     s->stats = g_malloc0(sizeof(*s->stats));
 
-    if (!bs) {
-        return s;
-    }
-
     /* Skip automatically inserted nodes that the user isn't aware of in
      * a BlockBackend-level command. Stay at the exact node for a node-level
      * command. */
-    while (blk_level && bs->drv && bs->implicit) {
-        bs = backing_bs(bs);
-        assert(bs);
+    while (blk_level && bs && bs->drv && bs->implicit) {
+        bs = bdrv_child_bs_rcu(&bs->backing);
+    }
+
+    if (!bs) {
+        return s;
     }
 
     if (bdrv_get_node_name(bs)[0]) {
@@ -483,14 +496,16 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
-    if (bs->file) {
+    child_bs = bdrv_child_bs_rcu(&bs->file);
+    if (child_bs) {
         s->has_parent = true;
-        s->parent = bdrv_query_bds_stats(bs->file->bs, blk_level);
+        s->parent = bdrv_query_bds_stats(child_bs, blk_level);
     }
 
-    if (blk_level && bs->backing) {
+    child_bs = blk_level ? bdrv_child_bs_rcu(&bs->backing) : NULL;
+    if (child_bs) {
         s->has_backing = true;
-        s->backing = bdrv_query_bds_stats(bs->backing->bs, blk_level);
+        s->backing = bdrv_query_bds_stats(child_bs, blk_level);
     }
 
     return s;
@@ -533,6 +548,12 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
     BlockBackend *blk;
     BlockDriverState *bs;
 
+    /* This command can run out-of-band, without the BQL.  The lists of
+     * nodes and BlockBackends are RCU-protected, and the AioContext lock
+     * keeps the statistics of each device consistent as before.
+     */
+    rcu_read_lock();
+
     /* Just to be safe if query_nodes is not always initialized */
     if (has_query_nodes && query_nodes) {
         for (bs = bdrv_next_node(NULL); bs; bs = bdrv_next_node(bs)) {
@@ -565,6 +586,7 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
         }
     }
 
+    rcu_read_unlock();
     return head;
 }
 
@@ -1302,12 +1302,20 @@ static void deal_with_unplugged_cpus(void)
  * elsewhere.
  */
 
+/* Set in a forked child, whose round-robin thread reuses the parent's
+ * TCG context.  */
+static bool tcg_rr_forked;
+
 static void *qemu_tcg_rr_cpu_thread_fn(void *arg)
 {
     CPUState *cpu = arg;
 
     rcu_register_thread();
-    tcg_register_thread();
+    if (tcg_rr_forked) {
+        tcg_adopt_thread_context(0);
+    } else {
+        tcg_register_thread();
+    }
 
     qemu_mutex_lock_iothread();
     qemu_thread_get_self(cpu->thread);
@@ -1716,6 +1724,33 @@ static void qemu_tcg_init_vcpu(CPUState *cpu)
     }
 }
 
+/*
+ * Only the thread that called fork() exists in the child, so the stopped
+ * vCPUs need a new round-robin TCG thread before the VM can be resumed.
+ * Must be called with the iothread lock held and all vCPUs stopped.
+ */
+void qemu_tcg_rr_restart_after_fork(void)
+{
+    QemuThread *thread = g_malloc0(sizeof(QemuThread));
+    CPUState *cpu;
+
+    g_assert(tcg_enabled() && !qemu_tcg_mttcg_enabled());
+
+    /* The old thread may have been waiting on it.  */
+    qemu_cond_init(first_cpu->halt_cond);
+    CPU_FOREACH(cpu) {
+        cpu->thread = thread;
+        cpu->created = false;
+    }
+
+    tcg_rr_forked = true;
+    qemu_thread_create(thread, "ALL CPUs/TCG", qemu_tcg_rr_cpu_thread_fn,
+                       first_cpu, QEMU_THREAD_JOINABLE);
+    while (!first_cpu->created) {
+        qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+    }
+}
+
 static void qemu_hax_start_vcpu(CPUState *cpu)
 {
     char thread_name[VCPU_THREAD_NAME_SIZE];
@@ -2,3 +2,7 @@
 
 CONFIG_COLDFIRE=y
 CONFIG_PTIMER=y
+CONFIG_VIRTIO=y
+CONFIG_GOLDFISH_PIC=y
+CONFIG_GOLDFISH_RTC=y
+CONFIG_M68K_VIRT=y
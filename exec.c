@@ -185,7 +185,8 @@ typedef struct PhysPageMap {
 } PhysPageMap;
 
 struct AddressSpaceDispatch {
-    MemoryRegionSection *mru_section;
+    /* Distinguishes this dispatch from earlier ones at the same address.  */
+    uint64_t gen;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -403,19 +404,52 @@ bool memory_region_is_unassigned(MemoryRegion *mr)
         && mr != &io_mem_watch;
 }
 
+/* Recently looked up sections.  The cache is per thread, so that vCPUs
+ * and device threads working on different parts of memory neither evict
+ * each other's entries nor bounce a shared cache line.  Entries are only
+ * valid for the dispatch generation they were filled from.
+ */
+#define SECTION_CACHE_SIZE 4
+
+typedef struct SectionCacheEntry {
+    AddressSpaceDispatch *d;
+    uint64_t gen;
+    MemoryRegionSection *section;
+} SectionCacheEntry;
+
+static __thread SectionCacheEntry section_cache[SECTION_CACHE_SIZE];
+static __thread unsigned section_cache_next;
+
 /* Called from RCU critical section */
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = atomic_read(&d->mru_section);
+    MemoryRegionSection *section;
+    SectionCacheEntry *e;
     subpage_t *subpage;
+    int i;
 
-    if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
-        !section_covers_addr(section, addr)) {
-        section = phys_page_find(d, addr);
-        atomic_set(&d->mru_section, section);
+    for (i = 0; i < SECTION_CACHE_SIZE; i++) {
+        e = &section_cache[i];
+        if (e->d == d && e->gen == d->gen &&
+            section_covers_addr(e->section, addr)) {
+            section = e->section;
+            goto found;
+        }
+    }
+
+    section = phys_page_find(d, addr);
+    /* The unassigned section covers everything, don't let it shadow
+     * other entries.  */
+    if (section != &d->map.sections[PHYS_SECTION_UNASSIGNED]) {
+        e = &section_cache[section_cache_next++ % SECTION_CACHE_SIZE];
+        e->d = d;
+        e->gen = d->gen;
+        e->section = section;
     }
+
+found:
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
         section = &d->map.sections[subpage->sub_section[SUBPAGE_IDX(addr)]];
@@ -2749,9 +2783,12 @@ static void io_mem_init(void)
 
 AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
 {
+    static uint64_t dispatch_gen;
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
+    d->gen = ++dispatch_gen;
+
     n = dummy_section(&d->map, fv, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
     n = dummy_section(&d->map, fv, &io_mem_notdirty);
@@ -3478,9 +3515,34 @@ int64_t address_space_cache_init(MemoryRegionCache *cache,
                                  hwaddr len,
                                  bool is_write)
 {
-    cache->len = len;
+    AddressSpace *target_as = NULL;
+    MemoryRegionSection section;
+    hwaddr l = len;
+
     cache->as = as;
-    cache->xlat = addr;
+    cache->addr = addr;
+    cache->len = len;
+    cache->ptr = NULL;
+    cache->mr = NULL;
+    cache->map_len = 0;
+    cache->is_write = is_write;
+
+    /* Map the RAM at the start of the range once.  Anything past it, or
+     * behind an IOMMU, goes through the address space on each access.
+     */
+    rcu_read_lock();
+    section = flatview_do_translate(address_space_to_flatview(as), addr,
+                                    &cache->xlat, &l, NULL, is_write, true,
+                                    &target_as);
+    if (!target_as && !xen_enabled() &&
+        memory_access_is_direct(section.mr, is_write)) {
+        cache->mr = section.mr;
+        memory_region_ref(cache->mr);
+        cache->map_len = l;
+        cache->ptr = qemu_map_ram_ptr(cache->mr->ram_block, cache->xlat);
+    }
+    rcu_read_unlock();
+
     return len;
 }
 
@@ -3488,19 +3550,42 @@ void address_space_cache_invalidate(MemoryRegionCache *cache,
                                     hwaddr addr,
                                     hwaddr access_len)
 {
+    if (cache->ptr && addr < cache->map_len) {
+        invalidate_and_set_dirty(cache->mr, cache->xlat + addr,
+                                 MIN(access_len, cache->map_len - addr));
+    }
 }
 
 void address_space_cache_destroy(MemoryRegionCache *cache)
 {
+    if (cache->mr) {
+        memory_region_unref(cache->mr);
+    }
+    cache->mr = NULL;
+    cache->ptr = NULL;
     cache->as = NULL;
 }
 
+/* Called from RCU critical section */
+static inline MemoryRegion *
+address_space_translate_cached(MemoryRegionCache *cache, hwaddr addr,
+                               hwaddr *xlat, hwaddr *plen, bool is_write)
+{
+    if (cache->ptr && (cache->is_write || !is_write) &&
+        addr < cache->map_len && *plen <= cache->map_len - addr) {
+        *xlat = cache->xlat + addr;
+        return cache->mr;
+    }
+    return address_space_translate(cache->as, cache->addr + addr,
+                                   xlat, plen, is_write);
+}
+
 #define ARG1_DECL                MemoryRegionCache *cache
 #define ARG1                     cache
 #define SUFFIX                   _cached
-#define TRANSLATE(addr, ...)     \
-    address_space_translate(cache->as, cache->xlat + (addr), __VA_ARGS__)
-#define IS_DIRECT(mr, is_write)  true
+#define TRANSLATE(...)           \
+    address_space_translate_cached(cache, __VA_ARGS__)
+#define IS_DIRECT(mr, is_write)  memory_access_is_direct(mr, is_write)
 #define MAP_RAM(mr, ofs)         qemu_map_ram_ptr((mr)->ram_block, ofs)
 #define INVALIDATE(mr, ofs, len) invalidate_and_set_dirty(mr, ofs, len)
 #define RCU_READ_LOCK()          rcu_read_lock()
@@ -3727,14 +3812,13 @@ void mtree_print_dispatch(fprintf_function mon, void *f,
         const char *names[] = { " [unassigned]", " [not dirty]",
                                 " [ROM]", " [watch]" };
 
-        mon(f, "      #%d @" TARGET_FMT_plx ".." TARGET_FMT_plx " %s%s%s%s%s",
+        mon(f, "      #%d @" TARGET_FMT_plx ".." TARGET_FMT_plx " %s%s%s%s",
             i,
             s->offset_within_address_space,
             s->offset_within_address_space + MR_SIZE(s->mr->size),
             s->mr->name ? s->mr->name : "(noname)",
             i < ARRAY_SIZE(names) ? names[i] : "",
             s->mr == root ? " [ROOT]" : "",
-            s == d->mru_section ? " [MRU]" : "",
             s->mr->is_iommu ? " [iommu]" : "");
 
         if (s->mr->alias) {
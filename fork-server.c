@@ -0,0 +1,479 @@
+/*
+ * Run test cases in copy-on-write children of a paused VM
+ *
+ * Once a guest has booted to a known state, every test case can start
+ * from a fork() of the QEMU process instead of a fresh boot or a loadvm.
+ * The child shares RAM and device state with its parent until it writes
+ * to them, so starting a case costs little more than the fork itself.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "qapi-event.h"
+#include "qmp-commands.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qom/cpu.h"
+#include "sysemu/fork-server.h"
+#include "sysemu/sysemu.h"
+
+#ifdef CONFIG_POSIX
+
+#include "qemu/log.h"
+#include "qemu/rcu.h"
+#include "block/aio.h"
+#include "block/block.h"
+#include "block/thread-pool.h"
+#include "chardev/char-fd.h"
+#include "io/channel-file.h"
+#include "monitor/monitor.h"
+#include "sysemu/cpus.h"
+#include "sysemu/iothread.h"
+#include "sysemu/qtest.h"
+
+typedef enum {
+    FORK_SERVER_IDLE,
+    FORK_SERVER_ARMED,          /* waiting for the guest's checkpoint */
+    FORK_SERVER_STOPPING,       /* checkpoint reached, VM stopping */
+    FORK_SERVER_RUNNING,
+} ForkServerState;
+
+typedef struct ForkServer ForkServer;
+
+typedef struct ForkServerJob {
+    ForkServer *fs;
+    pid_t pid;                  /* 0 if the slot is free */
+    int64_t deadline;           /* QEMU_CLOCK_REALTIME, 0 for none */
+} ForkServerJob;
+
+struct ForkServer {
+    ForkServerState state;
+    int64_t count;
+    int64_t jobs;
+    int64_t timeout;
+    char *output_dir;
+    bool resume;
+    ForkServerCaseFunc *func;
+    void *opaque;
+    QEMUBH *bh;
+
+    /* Progress of the current run; children are reaped from the SIGCHLD
+     * bottom half, so the main loop keeps running meanwhile.  */
+    ForkServerJob *slots;
+    int64_t started;
+    int64_t finished;
+    int64_t failed;
+    int64_t start_time;
+    QEMUTimer *timeout_timer;
+};
+
+static ForkServer fork_server;
+static NotifierList fork_server_prepare_notifiers =
+    NOTIFIER_LIST_INITIALIZER(fork_server_prepare_notifiers);
+
+void fork_server_add_prepare_notifier(Notifier *n)
+{
+    notifier_list_add(&fork_server_prepare_notifiers, n);
+}
+
+/* A child only has the thread that called fork(), but it inherits the
+ * state of all others, including any lock they held.  Threads that can
+ * be stopped and started again on demand are handled in
+ * fork_server_prepare(), the rest must not exist at all.  Checked both
+ * when the fork server starts and before each fork, since -object and
+ * the log options can be changed from the monitor in between.  */
+static bool fork_server_check(Error **errp)
+{
+    bool ambiguous = false;
+
+    if (monitor_has_io_thread()) {
+        error_setg(errp, "The fork server does not support out-of-band "
+                   "monitors");
+        return false;
+    }
+    if (object_resolve_path_type("", TYPE_IOTHREAD, &ambiguous) ||
+        ambiguous) {
+        error_setg(errp, "The fork server does not support I/O threads");
+        return false;
+    }
+    if (atomic_read(&qemu_log_binary)) {
+        error_setg(errp, "The fork server does not support binary logs");
+        return false;
+    }
+#ifdef CONFIG_TRACE_SIMPLE
+    /* The children would wait forever for the writeout thread at exit.  */
+    error_setg(errp, "The fork server does not support the simple trace "
+               "backend");
+    return false;
+#endif
+    return true;
+}
+
+/* Runs in the parent before each fork().  */
+static bool fork_server_prepare(Error **errp)
+{
+    if (!fork_server_check(errp)) {
+        return false;
+    }
+
+    /* Idle thread pool workers exit, and are started again on demand in
+     * the parent and in each child.  */
+    bdrv_drain_all();
+    thread_pool_stop_workers(aio_get_thread_pool(qemu_get_aio_context()));
+
+    /* Output buffered in the parent would otherwise be written once by
+     * the parent and once more by every child.  */
+    notifier_list_notify(&fork_server_prepare_notifiers, NULL);
+    qemu_log_flush();
+    return true;
+}
+
+/* Give the child its own copy of a notifier that the parent and the other
+ * children would otherwise consume wakeups from.  */
+static void fork_server_unshare_notifier(EventNotifier *e)
+{
+    EventNotifier n;
+
+    if (event_notifier_init(&n, false) < 0) {
+        error_report("fork server: cannot create event notifier");
+        exit(1);
+    }
+    dup2(n.rfd, e->rfd);
+    if (e->wfd != e->rfd) {
+        dup2(n.wfd, e->wfd);
+    }
+    event_notifier_cleanup(&n);
+}
+
+static void fork_server_redirect_fd(int fd, const char *path)
+{
+    int out = qemu_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+
+    if (out < 0) {
+        error_report("fork server: cannot open '%s': %s",
+                     path, strerror(errno));
+        return;
+    }
+    dup2(out, fd);
+    close(out);
+}
+
+typedef struct {
+    const char *dir;
+    int64_t index;
+} ForkServerOutput;
+
+static int fork_server_redirect_chardev(Object *obj, void *opaque)
+{
+    ForkServerOutput *out = opaque;
+    char *path;
+
+    if (!object_dynamic_cast(obj, TYPE_CHARDEV_FILE)) {
+        return 0;
+    }
+    path = g_strdup_printf("%s/%s.%" PRId64, out->dir, CHARDEV(obj)->label,
+                           out->index);
+    fork_server_redirect_fd(QIO_CHANNEL_FILE(FD_CHARDEV(obj)->ioc_out)->fd,
+                            path);
+    g_free(path);
+    return 0;
+}
+
+static void fork_server_child(ForkServer *fs, int64_t index)
+{
+    fork_server_unshare_notifier(&qemu_get_aio_context()->notifier);
+    fork_server_unshare_notifier(&iohandler_get_aio_context()->notifier);
+
+    /* The monitor and qtest connections belong to the parent.  There is
+     * no monitor I/O thread to stop here, because fork_server_check()
+     * refuses to fork with one.  */
+    monitor_cleanup();
+    qtest_server_detach();
+
+    if (fs->output_dir) {
+        ForkServerOutput out = { .dir = fs->output_dir, .index = index };
+        char *path;
+
+        object_child_foreach(container_get(object_get_root(), "/chardevs"),
+                             fork_server_redirect_chardev, &out);
+        path = g_strdup_printf("%s/stderr.%" PRId64, fs->output_dir, index);
+        fork_server_redirect_fd(STDERR_FILENO, path);
+        g_free(path);
+    }
+
+    qemu_tcg_rr_restart_after_fork();
+
+    if (fs->func) {
+        fs->func(index, fs->opaque);
+    }
+    fs->state = FORK_SERVER_IDLE;
+    fs->func = NULL;
+    vm_start();
+}
+
+static void fork_server_finish(ForkServer *fs)
+{
+    timer_del(fs->timeout_timer);
+    g_free(fs->slots);
+    fs->slots = NULL;
+
+    qapi_event_send_fork_server_done(fs->count, fs->failed,
+                                     get_clock() - fs->start_time,
+                                     &error_abort);
+
+    if (fs->func) {
+        fs->func(-1, fs->opaque);
+    }
+    fs->state = FORK_SERVER_IDLE;
+    fs->func = NULL;
+    if (fs->resume) {
+        vm_start();
+    }
+}
+
+/* Arm the timeout timer for the earliest deadline of a running case.  */
+static void fork_server_update_timer(ForkServer *fs)
+{
+    int64_t deadline = INT64_MAX;
+    int i;
+
+    for (i = 0; i < fs->jobs; i++) {
+        if (fs->slots[i].pid && fs->slots[i].deadline) {
+            deadline = MIN(deadline, fs->slots[i].deadline);
+        }
+    }
+    if (deadline == INT64_MAX) {
+        timer_del(fs->timeout_timer);
+    } else {
+        timer_mod(fs->timeout_timer, deadline);
+    }
+}
+
+static void fork_server_timeout(void *opaque)
+{
+    ForkServer *fs = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int i;
+
+    /* Killed children are reaped, and counted as failed, by
+     * fork_server_child_exited.  */
+    for (i = 0; i < fs->jobs; i++) {
+        if (fs->slots[i].pid && fs->slots[i].deadline &&
+            now >= fs->slots[i].deadline) {
+            kill(fs->slots[i].pid, SIGKILL);
+            fs->slots[i].deadline = 0;
+        }
+    }
+    fork_server_update_timer(fs);
+}
+
+/* Give up on the cases that have not started yet and kill the running
+ * ones; the run ends once they have all been reaped.  */
+static void fork_server_abort(ForkServer *fs)
+{
+    int i;
+
+    fs->failed += fs->count - fs->started;
+    fs->finished += fs->count - fs->started;
+    fs->started = fs->count;
+    for (i = 0; i < fs->jobs; i++) {
+        if (fs->slots[i].pid) {
+            kill(fs->slots[i].pid, SIGKILL);
+            fs->slots[i].deadline = 0;
+        }
+    }
+}
+
+static void fork_server_child_exited(pid_t pid, int status, void *opaque);
+
+/* Start cases in the free slots.  Returns true in the children.  */
+static bool fork_server_fill(ForkServer *fs)
+{
+    ForkServerJob *job;
+    Error *local_err = NULL;
+    pid_t pid;
+    int i;
+
+    for (i = 0; i < fs->jobs && fs->started < fs->count; i++) {
+        job = &fs->slots[i];
+        if (job->pid) {
+            continue;
+        }
+        if (!fork_server_prepare(&local_err)) {
+            error_report_err(local_err);
+            fork_server_abort(fs);
+            break;
+        }
+        rcu_enable_atfork();
+        pid = fork();
+        rcu_disable_atfork();
+        if (pid == 0) {
+            int64_t index = fs->started;
+
+            /* The parent's bookkeeping is of no use in a child; the
+             * watches on its siblings simply never fire here.  */
+            timer_del(fs->timeout_timer);
+            g_free(fs->slots);
+            fs->slots = NULL;
+            fork_server_child(fs, index);
+            return true;
+        }
+        if (pid < 0) {
+            error_report("fork server: fork failed: %s", strerror(errno));
+            fork_server_abort(fs);
+            break;
+        }
+        fs->started++;
+        job->pid = pid;
+        job->deadline = fs->timeout ?
+            qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+            fs->timeout * NANOSECONDS_PER_SECOND : 0;
+        qemu_add_child_watch_full(pid, fork_server_child_exited, job);
+    }
+    return false;
+}
+
+static void fork_server_child_exited(pid_t pid, int status, void *opaque)
+{
+    ForkServerJob *job = opaque;
+    ForkServer *fs = job->fs;
+
+    job->pid = 0;
+    job->deadline = 0;
+    fs->finished++;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fs->failed++;
+    }
+
+    if (fork_server_fill(fs)) {
+        return;
+    }
+    if (fs->finished == fs->count) {
+        fork_server_finish(fs);
+    } else {
+        fork_server_update_timer(fs);
+    }
+}
+
+static void fork_server_run(void *opaque)
+{
+    ForkServer *fs = opaque;
+    int i;
+
+    fs->slots = g_new0(ForkServerJob, fs->jobs);
+    for (i = 0; i < fs->jobs; i++) {
+        fs->slots[i].fs = fs;
+    }
+    fs->started = fs->finished = fs->failed = 0;
+    fs->start_time = get_clock();
+
+    if (fork_server_fill(fs)) {
+        return;
+    }
+    if (fs->finished == fs->count) {
+        /* Every fork failed.  */
+        fork_server_finish(fs);
+    } else {
+        fork_server_update_timer(fs);
+    }
+}
+
+static void fork_server_vm_state_change(void *opaque, int running,
+                                        RunState state)
+{
+    ForkServer *fs = opaque;
+
+    if (!running && fs->state == FORK_SERVER_STOPPING) {
+        fs->state = FORK_SERVER_RUNNING;
+        qemu_bh_schedule(fs->bh);
+    }
+}
+
+bool fork_server_checkpoint(ForkServerCaseFunc *func, void *opaque)
+{
+    ForkServer *fs = &fork_server;
+
+    if (fs->state != FORK_SERVER_ARMED) {
+        return false;
+    }
+    fs->state = FORK_SERVER_STOPPING;
+    fs->func = func;
+    fs->opaque = opaque;
+    fs->resume = true;
+    vm_stop(RUN_STATE_PAUSED);
+    return true;
+}
+
+void qmp_x_fork_server(int64_t count, bool has_jobs, int64_t jobs,
+                       bool has_timeout, int64_t timeout,
+                       bool has_output_dir, const char *output_dir,
+                       bool has_checkpoint, bool checkpoint, Error **errp)
+{
+    ForkServer *fs = &fork_server;
+
+    if (!tcg_enabled() || qemu_tcg_mttcg_enabled()) {
+        error_setg(errp, "The fork server requires single-threaded TCG");
+        return;
+    }
+    if (!fork_server_check(errp)) {
+        return;
+    }
+    if (fs->state != FORK_SERVER_IDLE) {
+        error_setg(errp, "The fork server is already active");
+        return;
+    }
+    if (count < 1 || (has_jobs && jobs < 1) || (has_timeout && timeout < 0)) {
+        error_setg(errp, "Parameter out of range");
+        return;
+    }
+
+    fs->count = count;
+    fs->jobs = has_jobs ? jobs : 1;
+    fs->timeout = has_timeout ? timeout : 0;
+    g_free(fs->output_dir);
+    fs->output_dir = has_output_dir ? g_strdup(output_dir) : NULL;
+
+    if (!fs->bh) {
+        fs->bh = qemu_bh_new(fork_server_run, fs);
+        fs->timeout_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                         fork_server_timeout, fs);
+        qemu_add_vm_change_state_handler(fork_server_vm_state_change, fs);
+    }
+
+    if (has_checkpoint && checkpoint) {
+        fs->state = FORK_SERVER_ARMED;
+        return;
+    }
+
+    fs->state = FORK_SERVER_RUNNING;
+    fs->func = NULL;
+    fs->resume = runstate_is_running();
+    vm_stop(RUN_STATE_PAUSED);
+    qemu_bh_schedule(fs->bh);
+}
+
+#else
+
+bool fork_server_checkpoint(ForkServerCaseFunc *func, void *opaque)
+{
+    return false;
+}
+
+void fork_server_add_prepare_notifier(Notifier *n)
+{
+}
+
+void qmp_x_fork_server(int64_t count, bool has_jobs, int64_t jobs,
+                       bool has_timeout, int64_t timeout,
+                       bool has_output_dir, const char *output_dir,
+                       bool has_checkpoint, bool checkpoint, Error **errp)
+{
+    error_setg(errp, "The fork server is not supported on this host");
+}
+
+#endif
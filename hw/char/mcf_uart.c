@@ -12,6 +12,13 @@
 #include "chardev/char-fe.h"
 #include "exec/address-spaces.h"
 #include "qapi/error.h"
+#include "qemu/log.h"
+
+/* Transmit ring between the holding register and the chardev back-end.  */
+#define MCF_UART_TX_FIFO_SIZE   256
+/* The hardware receiver FIFO is 4 bytes deep; "rx-fifo-size" can raise it.  */
+#define MCF_UART_RX_FIFO_SIZE   4
+#define MCF_UART_RX_FIFO_MAX    4096
 
 typedef struct {
     SysBusDevice parent_obj;
@@ -23,10 +30,15 @@ typedef struct {
     uint8_t imr;
     uint8_t bg1;
     uint8_t bg2;
-    uint8_t fifo[4];
-    uint8_t tb;
+    uint8_t *rx_fifo;
+    uint32_t rx_head;
+    uint32_t rx_count;
+    uint32_t rx_fifo_size;
+    uint8_t tx_fifo[MCF_UART_TX_FIFO_SIZE];
+    uint32_t tx_head;
+    uint32_t tx_count;
+    guint watch_tag;
     int current_mr;
-    int fifo_len;
     int tx_enabled;
     int rx_enabled;
     qemu_irq irq;
@@ -86,17 +98,15 @@ uint64_t mcf_uart_read(void *opaque, hwaddr addr,
     case 0x0c:
         {
             uint8_t val;
-            int i;
 
-            if (s->fifo_len == 0)
+            if (s->rx_count == 0)
                 return 0;
 
-            val = s->fifo[0];
-            s->fifo_len--;
-            for (i = 0; i < s->fifo_len; i++)
-                s->fifo[i] = s->fifo[i + 1];
+            val = s->rx_fifo[s->rx_head];
+            s->rx_head = (s->rx_head + 1) % s->rx_fifo_size;
+            s->rx_count--;
             s->sr &= ~MCF_UART_FFULL;
-            if (s->fifo_len == 0)
+            if (s->rx_count == 0)
                 s->sr &= ~MCF_UART_RxRDY;
             mcf_uart_update(s);
             qemu_chr_fe_accept_input(&s->chr);
@@ -116,22 +126,82 @@ uint64_t mcf_uart_read(void *opaque, hwaddr addr,
     }
 }
 
-/* Update TxRDY flag and set data if present and enabled.  */
-static void mcf_uart_do_tx(mcf_uart_state *s)
+/* Update TxRDY/TxEMP from the state of the transmit ring.  */
+static void mcf_uart_tx_status(mcf_uart_state *s)
 {
-    if (s->tx_enabled && (s->sr & MCF_UART_TxEMP) == 0) {
-        /* XXX this blocks entire thread. Rewrite to use
-         * qemu_chr_fe_write and background I/O callbacks */
-        qemu_chr_fe_write_all(&s->chr, (unsigned char *)&s->tb, 1);
+    if (s->tx_count == 0) {
         s->sr |= MCF_UART_TxEMP;
+    } else {
+        s->sr &= ~MCF_UART_TxEMP;
     }
-    if (s->tx_enabled) {
+    if (s->tx_enabled && s->tx_count < MCF_UART_TX_FIFO_SIZE) {
         s->sr |= MCF_UART_TxRDY;
     } else {
         s->sr &= ~MCF_UART_TxRDY;
     }
 }
 
+static void mcf_uart_tx_flush(mcf_uart_state *s)
+{
+    if (s->watch_tag) {
+        g_source_remove(s->watch_tag);
+        s->watch_tag = 0;
+    }
+    s->tx_head = 0;
+    s->tx_count = 0;
+}
+
+/* Hand as much of the transmit ring to the back-end as it will take
+ * without blocking, and wait for G_IO_OUT to send the rest.  */
+static gboolean mcf_uart_xmit(GIOChannel *chan, GIOCondition cond,
+                              void *opaque)
+{
+    mcf_uart_state *s = opaque;
+    int ret;
+
+    s->watch_tag = 0;
+
+    /* instant drain the fifo when there's no back-end */
+    if (!qemu_chr_fe_backend_connected(&s->chr)) {
+        s->tx_head = 0;
+        s->tx_count = 0;
+    }
+
+    while (s->tx_enabled && s->tx_count) {
+        int len = MIN(s->tx_count, MCF_UART_TX_FIFO_SIZE - s->tx_head);
+
+        ret = qemu_chr_fe_write(&s->chr, s->tx_fifo + s->tx_head, len);
+        if (ret <= 0) {
+            break;
+        }
+        s->tx_head = (s->tx_head + ret) % MCF_UART_TX_FIFO_SIZE;
+        s->tx_count -= ret;
+        if (ret < len) {
+            break;
+        }
+    }
+
+    if (s->tx_enabled && s->tx_count) {
+        s->watch_tag = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
+                                             mcf_uart_xmit, s);
+        if (!s->watch_tag) {
+            s->tx_head = 0;
+            s->tx_count = 0;
+        }
+    }
+
+    mcf_uart_tx_status(s);
+    mcf_uart_update(s);
+    return FALSE;
+}
+
+static void mcf_uart_do_tx(mcf_uart_state *s)
+{
+    if (!s->watch_tag) {
+        mcf_uart_xmit(NULL, G_IO_OUT, s);
+    }
+}
+
 static void mcf_do_command(mcf_uart_state *s, uint8_t cmd)
 {
     /* Misc command.  */
@@ -143,13 +213,14 @@ static void mcf_do_command(mcf_uart_state *s, uint8_t cmd)
         break;
     case 2: /* Reset receiver.  */
         s->rx_enabled = 0;
-        s->fifo_len = 0;
+        s->rx_head = 0;
+        s->rx_count = 0;
         s->sr &= ~(MCF_UART_RxRDY | MCF_UART_FFULL);
         break;
     case 3: /* Reset transmitter.  */
         s->tx_enabled = 0;
-        s->sr |= MCF_UART_TxEMP;
-        s->sr &= ~MCF_UART_TxRDY;
+        mcf_uart_tx_flush(s);
+        mcf_uart_tx_status(s);
         break;
     case 4: /* Reset error status.  */
         break;
@@ -171,7 +242,7 @@ static void mcf_do_command(mcf_uart_state *s, uint8_t cmd)
         break;
     case 2: /* Disable.  */
         s->tx_enabled = 0;
-        mcf_uart_do_tx(s);
+        mcf_uart_tx_status(s);
         break;
     case 3: /* Reserved.  */
         fprintf(stderr, "mcf_uart: Bad TX command\n");
@@ -184,6 +255,7 @@ static void mcf_do_command(mcf_uart_state *s, uint8_t cmd)
         break;
     case 1: /* Enable.  */
         s->rx_enabled = 1;
+        qemu_chr_fe_accept_input(&s->chr);
         break;
     case 2:
         s->rx_enabled = 0;
@@ -210,9 +282,17 @@ void mcf_uart_write(void *opaque, hwaddr addr,
         mcf_do_command(s, val);
         break;
     case 0x0c: /* Transmit Buffer.  */
-        s->sr &= ~MCF_UART_TxEMP;
-        s->tb = val;
-        mcf_uart_do_tx(s);
+        if (s->tx_count == MCF_UART_TX_FIFO_SIZE) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "mcf_uart: write to full transmit buffer\n");
+            break;
+        }
+        s->tx_fifo[(s->tx_head + s->tx_count) % MCF_UART_TX_FIFO_SIZE] = val;
+        s->tx_count++;
+        mcf_uart_tx_status(s);
+        if (s->tx_enabled) {
+            mcf_uart_do_tx(s);
+        }
         break;
     case 0x10:
         /* ACR is ignored.  */
@@ -230,7 +310,9 @@ static void mcf_uart_reset(DeviceState *dev)
 {
     mcf_uart_state *s = MCF_UART(dev);
 
-    s->fifo_len = 0;
+    mcf_uart_tx_flush(s);
+    s->rx_head = 0;
+    s->rx_count = 0;
     s->mr[0] = 0;
     s->mr[1] = 0;
     s->sr = MCF_UART_TxEMP;
@@ -243,16 +325,14 @@ static void mcf_uart_reset(DeviceState *dev)
 static void mcf_uart_push_byte(mcf_uart_state *s, uint8_t data)
 {
     /* Break events overwrite the last byte if the fifo is full.  */
-    if (s->fifo_len == 4)
-        s->fifo_len--;
+    if (s->rx_count == s->rx_fifo_size)
+        s->rx_count--;
 
-    s->fifo[s->fifo_len] = data;
-    s->fifo_len++;
+    s->rx_fifo[(s->rx_head + s->rx_count) % s->rx_fifo_size] = data;
+    s->rx_count++;
     s->sr |= MCF_UART_RxRDY;
-    if (s->fifo_len == 4)
+    if (s->rx_count == s->rx_fifo_size)
         s->sr |= MCF_UART_FFULL;
-
-    mcf_uart_update(s);
 }
 
 static void mcf_uart_event(void *opaque, int event)
@@ -263,6 +343,7 @@ static void mcf_uart_event(void *opaque, int event)
     case CHR_EVENT_BREAK:
         s->isr |= MCF_UART_DBINT;
         mcf_uart_push_byte(s, 0);
+        mcf_uart_update(s);
         break;
     default:
         break;
@@ -273,14 +354,18 @@ static int mcf_uart_can_receive(void *opaque)
 {
     mcf_uart_state *s = (mcf_uart_state *)opaque;
 
-    return s->rx_enabled && (s->sr & MCF_UART_FFULL) == 0;
+    return s->rx_enabled ? s->rx_fifo_size - s->rx_count : 0;
 }
 
 static void mcf_uart_receive(void *opaque, const uint8_t *buf, int size)
 {
     mcf_uart_state *s = (mcf_uart_state *)opaque;
+    int i;
 
-    mcf_uart_push_byte(s, buf[0]);
+    for (i = 0; i < size; i++) {
+        mcf_uart_push_byte(s, buf[i]);
+    }
+    mcf_uart_update(s);
 }
 
 static const MemoryRegionOps mcf_uart_ops = {
@@ -304,12 +389,22 @@ static void mcf_uart_realize(DeviceState *dev, Error **errp)
 {
     mcf_uart_state *s = MCF_UART(dev);
 
+    if (s->rx_fifo_size < MCF_UART_RX_FIFO_SIZE ||
+        s->rx_fifo_size > MCF_UART_RX_FIFO_MAX) {
+        error_setg(errp, "rx-fifo-size must be between %d and %d",
+                   MCF_UART_RX_FIFO_SIZE, MCF_UART_RX_FIFO_MAX);
+        return;
+    }
+    s->rx_fifo = g_malloc0(s->rx_fifo_size);
+
     qemu_chr_fe_set_handlers(&s->chr, mcf_uart_can_receive, mcf_uart_receive,
                              mcf_uart_event, NULL, s, NULL, true);
 }
 
 static Property mcf_uart_properties[] = {
     DEFINE_PROP_CHR("chardev", mcf_uart_state, chr),
+    DEFINE_PROP_UINT32("rx-fifo-size", mcf_uart_state, rx_fifo_size,
+                       MCF_UART_RX_FIFO_SIZE),
     DEFINE_PROP_END_OF_LIST(),
 };
 
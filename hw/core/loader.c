@@ -55,6 +55,7 @@
 #include "exec/address-spaces.h"
 #include "hw/boards.h"
 #include "qemu/cutils.h"
+#include "crypto/hash.h"
 
 #include <zlib.h>
 
@@ -593,6 +594,25 @@ ssize_t gunzip(void *dst, size_t dstlen, uint8_t *src, size_t srclen)
     return dstbytes;
 }
 
+/* With -machine kernel-cache=DIR, decompressed payloads are kept in DIR
+ * under the SHA-256 of the compressed payload.  Returns NULL if there is
+ * no cache.
+ */
+static char *uimage_cache_path(const uint8_t *data, size_t len)
+{
+    const char *dir = current_machine ? current_machine->kernel_cache : NULL;
+    char *digest, *path;
+
+    if (!dir ||
+        qcrypto_hash_digest(QCRYPTO_HASH_ALG_SHA256, (const char *)data, len,
+                            &digest, NULL) < 0) {
+        return NULL;
+    }
+    path = g_strdup_printf("%s/uimage-%s.bin", dir, digest);
+    g_free(digest);
+    return path;
+}
+
 /* Load a U-Boot image.  */
 static int load_uboot_image(const char *filename, hwaddr *ep, hwaddr *loadaddr,
                             int *is_linux, uint8_t image_type,
@@ -685,13 +705,37 @@ static int load_uboot_image(const char *filename, hwaddr *ep, hwaddr *loadaddr,
         uint8_t *compressed_data;
         size_t max_bytes;
         ssize_t bytes;
+        char *cache_path;
+        gchar *cached = NULL;
+        gsize cached_len;
 
         compressed_data = data;
-        max_bytes = UBOOT_MAX_GUNZIP_BYTES;
-        data = g_malloc(max_bytes);
-
-        bytes = gunzip(data, max_bytes, compressed_data, hdr->ih_size);
+        cache_path = uimage_cache_path(compressed_data, hdr->ih_size);
+        if (cache_path &&
+            g_file_get_contents(cache_path, &cached, &cached_len, NULL) &&
+            (cached_len == 0 || cached_len > UBOOT_MAX_GUNZIP_BYTES)) {
+            /* Not something gunzip() could have produced; replace it.  */
+            warn_report("ignoring kernel cache file %s of %" G_GSIZE_FORMAT
+                        " bytes", cache_path, cached_len);
+            g_free(cached);
+            cached = NULL;
+        }
+        if (cached) {
+            data = (uint8_t *)cached;
+            bytes = cached_len;
+        } else {
+            max_bytes = UBOOT_MAX_GUNZIP_BYTES;
+            data = g_malloc(max_bytes);
+
+            bytes = gunzip(data, max_bytes, compressed_data, hdr->ih_size);
+            if (bytes > 0 && cache_path &&
+                !g_file_set_contents(cache_path, (const gchar *)data, bytes,
+                                     NULL)) {
+                warn_report("cannot write kernel cache file %s", cache_path);
+            }
+        }
         g_free(compressed_data);
+        g_free(cache_path);
         if (bytes < 0) {
             fprintf(stderr, "Unable to decompress gzipped image!\n");
             goto out;
@@ -248,6 +248,22 @@ static void machine_set_mem_merge(Object *obj, bool value, Error **errp)
     ms->mem_merge = value;
 }
 
+static char *machine_get_kernel_cache(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return g_strdup(ms->kernel_cache);
+}
+
+static void machine_set_kernel_cache(Object *obj, const char *value,
+                                     Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    g_free(ms->kernel_cache);
+    ms->kernel_cache = g_strdup(value);
+}
+
 static bool machine_get_usb(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -565,6 +581,11 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "mem-merge",
         "Enable/disable memory merge support", &error_abort);
 
+    object_class_property_add_str(oc, "kernel-cache",
+        machine_get_kernel_cache, machine_set_kernel_cache, &error_abort);
+    object_class_property_set_description(oc, "kernel-cache",
+        "Directory caching decompressed kernel images", &error_abort);
+
     object_class_property_add_bool(oc, "usb",
         machine_get_usb, machine_set_usb, &error_abort);
     object_class_property_set_description(oc, "usb",
@@ -638,6 +659,7 @@ static void machine_finalize(Object *obj)
     g_free(ms->dumpdtb);
     g_free(ms->dt_compatible);
     g_free(ms->firmware);
+    g_free(ms->kernel_cache);
 }
 
 bool machine_usb(MachineState *machine)
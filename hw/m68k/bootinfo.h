@@ -0,0 +1,134 @@
+/*
+ * Linux/m68k bootinfo records.
+ *
+ * Layout from linux/arch/m68k/include/uapi/asm/bootinfo.h and
+ * bootinfo-virt.h.  The kernel finds the list right after its own image
+ * (at the end of the bss section, rounded up) and walks it until BI_LAST.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_M68K_BOOTINFO_H
+#define HW_M68K_BOOTINFO_H
+
+struct bi_record {
+    uint16_t tag;        /* tag ID */
+    uint16_t size;       /* size of record */
+    uint32_t data[0];    /* data */
+};
+
+/* machine independent tags */
+
+#define BI_LAST         0x0000 /* last record */
+#define BI_MACHTYPE     0x0001 /* machine type (u_long) */
+#define BI_CPUTYPE      0x0002 /* cpu type (u_long) */
+#define BI_FPUTYPE      0x0003 /* fpu type (u_long) */
+#define BI_MMUTYPE      0x0004 /* mmu type (u_long) */
+#define BI_MEMCHUNK     0x0005 /* memory chunk address and size */
+                               /* (struct mem_info) */
+#define BI_RAMDISK      0x0006 /* ramdisk address and size */
+                               /* (struct mem_info) */
+#define BI_COMMAND_LINE 0x0007 /* kernel command line parameters */
+                               /* (string) */
+
+/* virt specific tags */
+
+#define BI_VIRT_QEMU_VERSION    0x8000
+#define BI_VIRT_GF_PIC_BASE     0x8001
+#define BI_VIRT_GF_RTC_BASE     0x8002
+#define BI_VIRT_GF_TTY_BASE     0x8003
+#define BI_VIRT_VIRTIO_BASE     0x8004
+#define BI_VIRT_CTRL_BASE       0x8005
+
+/* machine types */
+
+#define MACH_VIRT   14
+
+/* CPU, FPU and MMU types (BI_CPUTYPE, BI_FPUTYPE, BI_MMUTYPE) */
+
+#define CPUB_68020     0
+#define CPUB_68030     1
+#define CPUB_68040     2
+#define CPUB_68060     3
+
+#define CPU_68020      (1 << CPUB_68020)
+#define CPU_68030      (1 << CPUB_68030)
+#define CPU_68040      (1 << CPUB_68040)
+#define CPU_68060      (1 << CPUB_68060)
+
+#define FPUB_68881     0
+#define FPUB_68882     1
+#define FPUB_68040     2    /* Internal FPU */
+#define FPUB_68060     3    /* Internal FPU */
+
+#define FPU_68881      (1 << FPUB_68881)
+#define FPU_68882      (1 << FPUB_68882)
+#define FPU_68040      (1 << FPUB_68040)
+#define FPU_68060      (1 << FPUB_68060)
+
+#define MMUB_68851     0
+#define MMUB_68030     1    /* Internal MMU */
+#define MMUB_68040     2    /* Internal MMU */
+#define MMUB_68060     3    /* Internal MMU */
+
+#define MMU_68851      (1 << MMUB_68851)
+#define MMU_68030      (1 << MMUB_68030)
+#define MMU_68040      (1 << MMUB_68040)
+#define MMU_68060      (1 << MMUB_68060)
+
+/*
+ * Helpers to append records at guest physical address @base, which is
+ * advanced past the record.  Records are padded to a multiple of 4 bytes
+ * and @base should start 4-aligned; the padding is counted from the start
+ * of the record so that its size field always matches how far @base moves.
+ */
+
+#define BOOTINFO0(as, base, id) \
+    do { \
+        stw_phys(as, base, id); \
+        base += 2; \
+        stw_phys(as, base, sizeof(struct bi_record)); \
+        base += 2; \
+    } while (0)
+
+#define BOOTINFO1(as, base, id, value) \
+    do { \
+        stw_phys(as, base, id); \
+        base += 2; \
+        stw_phys(as, base, sizeof(struct bi_record) + 4); \
+        base += 2; \
+        stl_phys(as, base, value); \
+        base += 4; \
+    } while (0)
+
+#define BOOTINFO2(as, base, id, value1, value2) \
+    do { \
+        stw_phys(as, base, id); \
+        base += 2; \
+        stw_phys(as, base, sizeof(struct bi_record) + 8); \
+        base += 2; \
+        stl_phys(as, base, value1); \
+        base += 4; \
+        stl_phys(as, base, value2); \
+        base += 4; \
+    } while (0)
+
+#define BOOTINFOSTR(as, base, id, string) \
+    do { \
+        int i; \
+        uint16_t size = \
+            (sizeof(struct bi_record) + strlen(string) + 4) & ~3; \
+        hwaddr end = base + size; \
+        stw_phys(as, base, id); \
+        base += 2; \
+        stw_phys(as, base, size); \
+        base += 2; \
+        for (i = 0; string[i]; i++) { \
+            stb_phys(as, base++, string[i]); \
+        } \
+        stb_phys(as, base++, 0); \
+        base = end; \
+    } while (0)
+
+#endif
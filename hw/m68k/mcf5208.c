@@ -43,6 +43,13 @@ typedef struct {
     uint16_t pcsr;
     uint16_t pmr;
     uint16_t pcntr;
+    uint32_t freq;
+    uint32_t limit;
+    /* While asleep the ptimer is stopped; count and PIF are derived from
+     * the virtual clock when the guest next touches the timer.  */
+    bool asleep;
+    int64_t sleep_start;
+    uint32_t sleep_count;
 } m5208_timer_state;
 
 static void m5208_timer_update(m5208_timer_state *s)
@@ -53,12 +60,52 @@ static void m5208_timer_update(m5208_timer_state *s)
         qemu_irq_lower(s->irq);
 }
 
+/*
+ * Once PIF is latched, or while PIE is clear, further expirations cannot
+ * change the interrupt line.  Stop the periodic ptimer in that case so an
+ * idle guest does not wake the host on every tick.
+ */
+static void m5208_timer_sleep(m5208_timer_state *s)
+{
+    if (s->asleep || !(s->pcsr & PCSR_EN) || s->limit == 0 ||
+        ((s->pcsr & (PCSR_PIE | PCSR_PIF)) == PCSR_PIE)) {
+        return;
+    }
+    s->sleep_count = ptimer_get_count(s->timer);
+    s->sleep_start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    ptimer_stop(s->timer);
+    s->asleep = true;
+}
+
+/* Account for the ticks that elapsed while asleep and restart the ptimer.  */
+static void m5208_timer_wake(m5208_timer_state *s)
+{
+    uint64_t ticks, count;
+
+    if (!s->asleep) {
+        return;
+    }
+    s->asleep = false;
+
+    ticks = muldiv64(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - s->sleep_start,
+                     s->freq, NANOSECONDS_PER_SECOND);
+    if (ticks < s->sleep_count) {
+        count = s->sleep_count - ticks;
+    } else {
+        s->pcsr |= PCSR_PIF;
+        count = s->limit - (ticks - s->sleep_count) % s->limit;
+    }
+    ptimer_set_count(s->timer, count);
+    ptimer_run(s->timer, 0);
+}
+
 static void m5208_timer_write(void *opaque, hwaddr offset,
                               uint64_t value, unsigned size)
 {
     m5208_timer_state *s = (m5208_timer_state *)opaque;
     int prescale;
-    int limit;
+
+    m5208_timer_wake(s);
     switch (offset) {
     case 0:
         /* The PIF bit is set-to-clear.  */
@@ -70,6 +117,7 @@ static void m5208_timer_write(void *opaque, hwaddr offset,
         if (((s->pcsr ^ value) & ~PCSR_PIE) == 0) {
             s->pcsr = value;
             m5208_timer_update(s);
+            m5208_timer_sleep(s);
             return;
         }
 
@@ -79,12 +127,13 @@ static void m5208_timer_write(void *opaque, hwaddr offset,
         s->pcsr = value;
 
         prescale = 1 << ((s->pcsr & PCSR_PRE_MASK) >> PCSR_PRE_SHIFT);
-        ptimer_set_freq(s->timer, (SYS_FREQ / 2) / prescale);
+        s->freq = (SYS_FREQ / 2) / prescale;
+        ptimer_set_freq(s->timer, s->freq);
         if (s->pcsr & PCSR_RLD)
-            limit = s->pmr;
+            s->limit = s->pmr;
         else
-            limit = 0xffff;
-        ptimer_set_limit(s->timer, limit, 0);
+            s->limit = 0xffff;
+        ptimer_set_limit(s->timer, s->limit, 0);
 
         if (s->pcsr & PCSR_EN)
             ptimer_run(s->timer, 0);
@@ -96,6 +145,7 @@ static void m5208_timer_write(void *opaque, hwaddr offset,
             if (s->pcsr & PCSR_OVW)
                 ptimer_set_count(s->timer, value);
         } else {
+            s->limit = value;
             ptimer_set_limit(s->timer, value, s->pcsr & PCSR_OVW);
         }
         break;
@@ -106,6 +156,7 @@ static void m5208_timer_write(void *opaque, hwaddr offset,
         break;
     }
     m5208_timer_update(s);
+    m5208_timer_sleep(s);
 }
 
 static void m5208_timer_trigger(void *opaque)
@@ -113,23 +164,33 @@ static void m5208_timer_trigger(void *opaque)
     m5208_timer_state *s = (m5208_timer_state *)opaque;
     s->pcsr |= PCSR_PIF;
     m5208_timer_update(s);
+    m5208_timer_sleep(s);
 }
 
 static uint64_t m5208_timer_read(void *opaque, hwaddr addr,
                                  unsigned size)
 {
     m5208_timer_state *s = (m5208_timer_state *)opaque;
+    uint64_t val;
+
+    m5208_timer_wake(s);
     switch (addr) {
     case 0:
-        return s->pcsr;
+        val = s->pcsr;
+        break;
     case 2:
-        return s->pmr;
+        val = s->pmr;
+        break;
     case 4:
-        return ptimer_get_count(s->timer);
+        val = ptimer_get_count(s->timer);
+        break;
     default:
         hw_error("m5208_timer_read: Bad offset 0x%x\n", (int)addr);
         return 0;
     }
+    m5208_timer_update(s);
+    m5208_timer_sleep(s);
+    return val;
 }
 
 static const MemoryRegionOps m5208_timer_ops = {
@@ -12,6 +12,7 @@
 #include "hw/sysbus.h"
 #include "hw/m68k/mcf.h"
 #include "exec/address-spaces.h"
+#include "trace.h"
 
 #define TYPE_MCF_INTC "mcf-intc"
 #define MCF_INTC(obj) OBJECT_CHECK(mcf_intc_state, (obj), TYPE_MCF_INTC)
@@ -27,29 +28,75 @@ typedef struct {
     uint8_t icr[64];
     M68kCPU *cpu;
     int active_vector;
+
+    /* Sources grouped by ICR value, highest value first; rebuilt when an
+     * ICR is written.  Only enabled (non-zero ICR) sources are listed.  */
+    int nr_groups;
+    uint8_t group_level[64];
+    uint64_t group_mask[64];
+
+    /* What the CPU was last told; -1 forces the next update through.  */
+    int cpu_level;
+    int cpu_vector;
+
+    uint64_t updates;
+    uint64_t notifies;
 } mcf_intc_state;
 
+static void mcf_intc_build_groups(mcf_intc_state *s)
+{
+    uint64_t left = s->enabled;
+    int i, level;
+
+    s->nr_groups = 0;
+    while (left) {
+        level = 0;
+        for (i = 0; i < 64; i++) {
+            if ((left & (1ull << i)) && s->icr[i] > level) {
+                level = s->icr[i];
+            }
+        }
+        s->group_level[s->nr_groups] = level;
+        s->group_mask[s->nr_groups] = 0;
+        for (i = 0; i < 64; i++) {
+            if (s->icr[i] == level) {
+                s->group_mask[s->nr_groups] |= 1ull << i;
+            }
+        }
+        left &= ~s->group_mask[s->nr_groups];
+        s->nr_groups++;
+    }
+}
+
 static void mcf_intc_update(mcf_intc_state *s)
 {
-    uint64_t active;
+    uint64_t active, pending;
     int i;
-    int best;
-    int best_level;
+    int best_level = 0;
+    int vector = 24;
 
+    s->updates++;
     active = (s->ipr | s->ifr) & s->enabled & ~s->imr;
-    best_level = 0;
-    best = 64;
-    if (active) {
-        for (i = 0; i < 64; i++) {
-            if ((active & 1) != 0 && s->icr[i] >= best_level) {
-                best_level = s->icr[i];
-                best = i;
-            }
-            active >>= 1;
+    for (i = 0; active && i < s->nr_groups; i++) {
+        pending = active & s->group_mask[i];
+        if (pending) {
+            /* Within a level the highest numbered source wins.  */
+            best_level = s->group_level[i];
+            vector = 64 + 63 - clz64(pending);
+            break;
         }
     }
-    s->active_vector = ((best == 64) ? 24 : (best + 64));
-    m68k_set_irq_level(s->cpu, best_level, s->active_vector);
+    s->active_vector = vector;
+    trace_mcf_intc_update(active, best_level, vector);
+
+    if (best_level == s->cpu_level && vector == s->cpu_vector) {
+        return;
+    }
+    s->cpu_level = best_level;
+    s->cpu_vector = vector;
+    s->notifies++;
+    trace_mcf_intc_notify(best_level, vector, s->updates, s->notifies);
+    m68k_set_irq_level(s->cpu, best_level, vector);
 }
 
 static uint64_t mcf_intc_read(void *opaque, hwaddr addr,
@@ -98,6 +145,7 @@ static void mcf_intc_write(void *opaque, hwaddr addr,
             s->enabled &= ~(1ull << n);
         else
             s->enabled |= (1ull << n);
+        mcf_intc_build_groups(s);
         mcf_intc_update(s);
         return;
     }
@@ -135,12 +183,19 @@ static void mcf_intc_write(void *opaque, hwaddr addr,
 static void mcf_intc_set_irq(void *opaque, int irq, int level)
 {
     mcf_intc_state *s = (mcf_intc_state *)opaque;
+    uint64_t ipr;
+
     if (irq >= 64)
         return;
     if (level)
-        s->ipr |= 1ull << irq;
+        ipr = s->ipr | (1ull << irq);
     else
-        s->ipr &= ~(1ull << irq);
+        ipr = s->ipr & ~(1ull << irq);
+    trace_mcf_intc_set_irq(irq, level);
+    if (ipr == s->ipr) {
+        return;
+    }
+    s->ipr = ipr;
     mcf_intc_update(s);
 }
 
@@ -154,6 +209,9 @@ static void mcf_intc_reset(DeviceState *dev)
     s->enabled = 0;
     memset(s->icr, 0, 64);
     s->active_vector = 24;
+    s->nr_groups = 0;
+    s->cpu_level = -1;
+    s->cpu_vector = -1;
 }
 
 static const MemoryRegionOps mcf_intc_ops = {
@@ -0,0 +1,277 @@
+/*
+ * m68k paravirtual machine.
+ *
+ * A board without any real hardware: memory starts at 0, interrupts are
+ * routed through goldfish PICs, time is kept by goldfish RTCs and all I/O
+ * goes through virtio-mmio transports.  The layout is described to the
+ * kernel with Linux/m68k bootinfo records.
+ *
+ * The 68040 MMU is not emulated, so no BI_MMUTYPE record is passed and
+ * only payloads that run without an MMU (bare-metal tests, MMU-less
+ * kernels) can boot; a Linux/m68k kernel that enables translation cannot.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "hw/hw.h"
+#include "hw/boards.h"
+#include "hw/loader.h"
+#include "hw/sysbus.h"
+#include "hw/intc/goldfish_pic.h"
+#include "hw/timer/goldfish_rtc.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/qtest.h"
+#include "elf.h"
+#include "exec/address-spaces.h"
+#include "bootinfo.h"
+
+/*
+ * 6 goldfish-pic for CPU IRQ #1 to IRQ #6
+ * CPU IRQ #1 -> PIC #1
+ *               IRQ #1 to IRQ #31 -> unused
+ *               IRQ #32 -> reserved for a console
+ * CPU IRQ #2 -> PIC #2
+ *               IRQ #1 to IRQ #32 -> virtio-mmio from 1 to 32
+ * CPU IRQ #3 -> PIC #3
+ *               IRQ #1 to IRQ #32 -> virtio-mmio from 33 to 64
+ * CPU IRQ #4 -> PIC #4
+ *               IRQ #1 to IRQ #32 -> virtio-mmio from 65 to 96
+ * CPU IRQ #5 -> PIC #5
+ *               IRQ #1 to IRQ #32 -> virtio-mmio from 97 to 128
+ * CPU IRQ #6 -> PIC #6
+ *               IRQ #1 -> goldfish-rtc (timer)
+ *               IRQ #2 -> goldfish-rtc (wall clock)
+ *               IRQ #3 to IRQ #32 -> unused
+ * CPU IRQ #7 -> NMI
+ */
+
+#define PIC_IRQ_BASE(num)     (8 + (num - 1) * 32)
+#define PIC_IRQ(num, irq)     (PIC_IRQ_BASE(num) + irq - 1)
+#define PIC_GPIO(pic_irq)     (qdev_get_gpio_in(pic_dev[(pic_irq - 8) / 32], \
+                                                (pic_irq - 8) % 32))
+
+#define VIRT_GF_PIC_MMIO_BASE 0xff000000     /* MMIO: 0xff000000 - 0xff005fff */
+#define VIRT_GF_PIC_IRQ_BASE  1              /* IRQ: #1 -> #6 */
+#define VIRT_GF_PIC_NB        6
+
+/* 2 goldfish-rtc (and timer) */
+#define VIRT_GF_RTC_MMIO_BASE 0xff006000     /* MMIO: 0xff006000 - 0xff007fff */
+#define VIRT_GF_RTC_IRQ_BASE  PIC_IRQ(6, 1)  /* PIC: #6, IRQ: #1 */
+#define VIRT_GF_RTC_NB        2
+
+/* 4 x 32 virtio-mmio transports */
+#define VIRT_VIRTIO_MMIO_BASE 0xff010000     /* MMIO: 0xff010000 - 0xff01ffff */
+#define VIRT_VIRTIO_IRQ_BASE  PIC_IRQ(2, 1)  /* PIC: 2, 3, 4, 5, IRQ: ALL */
+#define VIRT_VIRTIO_NB        128
+#define VIRT_VIRTIO_SIZE      0x200
+
+typedef struct {
+    M68kCPU *cpu;
+    hwaddr initial_pc;
+    hwaddr initial_stack;
+    /* Bitmask of the CPU interrupt levels currently asserted.  */
+    uint8_t ipr;
+} VirtBoardState;
+
+static void virt_cpu_set_irq(void *opaque, int irq, int level)
+{
+    VirtBoardState *s = opaque;
+    int i;
+
+    if (level) {
+        s->ipr |= 1 << irq;
+    } else {
+        s->ipr &= ~(1 << irq);
+    }
+
+    /* Present the highest asserted level as an autovectored interrupt.  */
+    for (i = 7; i >= 1; i--) {
+        if (s->ipr & (1 << i)) {
+            m68k_set_irq_level(s->cpu, i, 24 + i);
+            return;
+        }
+    }
+    m68k_set_irq_level(s->cpu, 0, 0);
+}
+
+static void main_cpu_reset(void *opaque)
+{
+    VirtBoardState *s = opaque;
+    M68kCPU *cpu = s->cpu;
+    CPUState *cs = CPU(cpu);
+
+    cpu_reset(cs);
+    cpu->env.aregs[7] = s->initial_stack;
+    cpu->env.pc = s->initial_pc;
+}
+
+static void virt_init(MachineState *machine)
+{
+    ram_addr_t ram_size = machine->ram_size;
+    const char *kernel_filename = machine->kernel_filename;
+    const char *initrd_filename = machine->initrd_filename;
+    const char *kernel_cmdline = machine->kernel_cmdline;
+    M68kCPU *cpu;
+    CPUState *cs;
+    MemoryRegion *ram = g_new(MemoryRegion, 1);
+    VirtBoardState *s;
+    qemu_irq *cpu_irqs;
+    int32_t kernel_size;
+    uint64_t elf_entry;
+    uint64_t high;
+    hwaddr parameters_base;
+    ram_addr_t initrd_base;
+    int32_t initrd_size;
+    DeviceState *dev;
+    DeviceState *pic_dev[VIRT_GF_PIC_NB];
+    SysBusDevice *sysbus;
+    hwaddr io_base;
+    int i;
+
+    if (ram_size > 3399672 * K_BYTE) {
+        /*
+         * The physical memory can be up to 4 GiB - 16 MiB, but linux
+         * kernel crashes after this limit (~ 3.2 GiB)
+         */
+        error_report("Too much memory for this machine: %" PRId64 " KiB, "
+                     "maximum 3399672 KiB", ram_size / 1024);
+        exit(1);
+    }
+
+    s = g_new0(VirtBoardState, 1);
+
+    /* init CPUs */
+    cpu = M68K_CPU(cpu_create(machine->cpu_type));
+    cs = CPU(cpu);
+    s->cpu = cpu;
+    qemu_register_reset(main_cpu_reset, s);
+
+    /* RAM */
+    memory_region_allocate_system_memory(ram, NULL, "m68k_virt.ram", ram_size);
+    memory_region_add_subregion(get_system_memory(), 0, ram);
+
+    /* CPU interrupt levels, 1 to 7 */
+    cpu_irqs = qemu_allocate_irqs(virt_cpu_set_irq, s, 8);
+
+    /* goldfish-pic */
+    for (i = 0; i < VIRT_GF_PIC_NB; i++) {
+        pic_dev[i] = qdev_create(NULL, TYPE_GOLDFISH_PIC);
+        sysbus = SYS_BUS_DEVICE(pic_dev[i]);
+        qdev_init_nofail(pic_dev[i]);
+        sysbus_mmio_map(sysbus, 0, VIRT_GF_PIC_MMIO_BASE + 0x1000 * i);
+        sysbus_connect_irq(sysbus, 0, cpu_irqs[VIRT_GF_PIC_IRQ_BASE + i]);
+    }
+
+    /* goldfish-rtc */
+    for (i = 0; i < VIRT_GF_RTC_NB; i++) {
+        dev = qdev_create(NULL, TYPE_GOLDFISH_RTC);
+        sysbus = SYS_BUS_DEVICE(dev);
+        qdev_init_nofail(dev);
+        sysbus_mmio_map(sysbus, 0, VIRT_GF_RTC_MMIO_BASE + 0x1000 * i);
+        sysbus_connect_irq(sysbus, 0, PIC_GPIO(VIRT_GF_RTC_IRQ_BASE + i));
+    }
+
+    /*
+     * virtio-mmio.  Create the transports with increasing base addresses;
+     * -device virtio-*-device instances are plugged into the first free
+     * bus, so the guest sees them in command line order.
+     */
+    io_base = VIRT_VIRTIO_MMIO_BASE;
+    for (i = 0; i < VIRT_VIRTIO_NB; i++) {
+        sysbus_create_simple("virtio-mmio", io_base,
+                             PIC_GPIO(VIRT_VIRTIO_IRQ_BASE + i));
+        io_base += VIRT_VIRTIO_SIZE;
+    }
+
+    if (!kernel_filename) {
+        if (qtest_enabled()) {
+            return;
+        }
+        error_report("Kernel image must be specified");
+        exit(1);
+    }
+
+    /* load kernel */
+    kernel_size = load_elf(kernel_filename, NULL, NULL, &elf_entry,
+                           NULL, &high, 1, EM_68K, 0, 0);
+    if (kernel_size < 0) {
+        error_report("could not load kernel '%s'", kernel_filename);
+        exit(1);
+    }
+    s->initial_pc = elf_entry;
+
+    /* The bootinfo list follows the kernel image, 4-aligned.  */
+    parameters_base = (high + 3) & ~3;
+
+    BOOTINFO1(cs->as, parameters_base, BI_MACHTYPE, MACH_VIRT);
+    BOOTINFO1(cs->as, parameters_base, BI_FPUTYPE, FPU_68040);
+    BOOTINFO1(cs->as, parameters_base, BI_CPUTYPE, CPU_68040);
+    BOOTINFO2(cs->as, parameters_base, BI_MEMCHUNK, 0, ram_size);
+
+    BOOTINFO1(cs->as, parameters_base, BI_VIRT_QEMU_VERSION,
+              ((QEMU_VERSION_MAJOR << 24) | (QEMU_VERSION_MINOR << 16) |
+               (QEMU_VERSION_MICRO << 8)));
+    BOOTINFO2(cs->as, parameters_base, BI_VIRT_GF_PIC_BASE,
+              VIRT_GF_PIC_MMIO_BASE, VIRT_GF_PIC_IRQ_BASE);
+    BOOTINFO2(cs->as, parameters_base, BI_VIRT_GF_RTC_BASE,
+              VIRT_GF_RTC_MMIO_BASE, VIRT_GF_RTC_IRQ_BASE);
+    BOOTINFO2(cs->as, parameters_base, BI_VIRT_VIRTIO_BASE,
+              VIRT_VIRTIO_MMIO_BASE, VIRT_VIRTIO_IRQ_BASE);
+
+    if (kernel_cmdline) {
+        BOOTINFOSTR(cs->as, parameters_base, BI_COMMAND_LINE,
+                    kernel_cmdline);
+    }
+
+    /* load initrd at the top of RAM */
+    if (initrd_filename) {
+        initrd_size = get_image_size(initrd_filename);
+        if (initrd_size < 0) {
+            error_report("could not load initial ram disk '%s'",
+                         initrd_filename);
+            exit(1);
+        }
+
+        /* Leave room for the BI_RAMDISK and BI_LAST records.  */
+        if (initrd_size > ram_size ||
+            ((ram_size - initrd_size) & TARGET_PAGE_MASK) <
+            parameters_base + sizeof(struct bi_record) + 8 +
+            sizeof(struct bi_record)) {
+            error_report("initial ram disk '%s' (%d bytes) does not fit in "
+                         "RAM above the kernel", initrd_filename, initrd_size);
+            exit(1);
+        }
+
+        initrd_base = (ram_size - initrd_size) & TARGET_PAGE_MASK;
+        if (load_image_targphys(initrd_filename, initrd_base,
+                                ram_size - initrd_base) < 0) {
+            error_report("could not load initial ram disk '%s'",
+                         initrd_filename);
+            exit(1);
+        }
+        BOOTINFO2(cs->as, parameters_base, BI_RAMDISK, initrd_base,
+                  initrd_size);
+    }
+
+    BOOTINFO0(cs->as, parameters_base, BI_LAST);
+}
+
+static void virt_machine_init(MachineClass *mc)
+{
+    mc->desc = "QEMU M68K Virtual Machine";
+    mc->init = virt_init;
+    mc->default_cpu_type = M68K_CPU_TYPE_NAME("m68040");
+    mc->max_cpus = 1;
+    mc->no_floppy = 1;
+    mc->no_parallel = 1;
+    mc->default_ram_size = 128 * M_BYTE;
+}
+
+DEFINE_MACHINE("virt", virt_machine_init)
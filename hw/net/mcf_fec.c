@@ -12,6 +12,8 @@
 #include "hw/m68k/mcf_fec.h"
 #include "hw/net/mii.h"
 #include "hw/sysbus.h"
+#include "qemu/iov.h"
+#include "qemu/timer.h"
 /* For crc32 */
 #include <zlib.h>
 #include "exec/address-spaces.h"
@@ -28,6 +30,10 @@ do { printf("mcf_fec: " fmt , ## __VA_ARGS__); } while (0)
 #define FEC_MAX_DESC 1024
 #define FEC_MAX_FRAME_SIZE 2032
 #define FEC_MIB_SIZE 64
+/* Fragments of a TX frame that are handed to the net layer without a copy */
+#define FEC_MAX_TX_FRAGS 16
+/* RX interrupt timeout used when only rx-coalesce-frames is set */
+#define FEC_RX_COALESCE_DEFAULT_USECS 100
 
 typedef struct {
     SysBusDevice parent_obj;
@@ -53,6 +59,13 @@ typedef struct {
     uint32_t etdsr;
     uint32_t emrbr;
     uint32_t mib[FEC_MIB_SIZE];
+    /* A frame is queued in the peer; resume the TX ring when it is sent.  */
+    bool tx_waiting;
+    /* RX interrupt coalescing */
+    QEMUTimer *rx_coalesce_timer;
+    uint32_t rx_coalesce_frames;
+    uint32_t rx_coalesce_usecs;
+    uint32_t rx_coalesce_count;
 } mcf_fec_state;
 
 #define FEC_INT_HB   0x80000000
@@ -170,21 +183,58 @@ typedef struct {
 #define MIB_IEEE_R_FDXFC        55
 #define MIB_IEEE_R_OCTETS_OK    56
 
-static void mcf_fec_read_bd(mcf_fec_bd *bd, uint32_t addr)
+/* A descriptor ring is mapped once per walk, instead of looking up every
+ * descriptor access in the address space.  A guest can make the ring as
+ * long as it likes, descriptors past the mapped part are accessed the
+ * slow way.  */
+static void mcf_fec_ring_map(MemoryRegionCache *ring, uint32_t base)
 {
-    cpu_physical_memory_read(addr, bd, sizeof(*bd));
+    address_space_cache_init(ring, &address_space_memory, base,
+                             FEC_MAX_DESC * sizeof(mcf_fec_bd), true);
+}
+
+static bool mcf_fec_bd_in_ring(MemoryRegionCache *ring, uint32_t addr)
+{
+    return addr >= ring->addr &&
+           addr - ring->addr <= ring->len - sizeof(mcf_fec_bd);
+}
+
+static void mcf_fec_read_bd(mcf_fec_bd *bd, MemoryRegionCache *ring,
+                            uint32_t addr)
+{
+    if (mcf_fec_bd_in_ring(ring, addr)) {
+        address_space_read_cached(ring, addr - ring->addr, bd, sizeof(*bd));
+    } else {
+        cpu_physical_memory_read(addr, bd, sizeof(*bd));
+    }
     be16_to_cpus(&bd->flags);
     be16_to_cpus(&bd->length);
     be32_to_cpus(&bd->data);
 }
 
-static void mcf_fec_write_bd(mcf_fec_bd *bd, uint32_t addr)
+static void mcf_fec_write_bd(mcf_fec_bd *bd, MemoryRegionCache *ring,
+                             uint32_t addr)
 {
     mcf_fec_bd tmp;
     tmp.flags = cpu_to_be16(bd->flags);
     tmp.length = cpu_to_be16(bd->length);
     tmp.data = cpu_to_be32(bd->data);
-    cpu_physical_memory_write(addr, &tmp, sizeof(tmp));
+    if (mcf_fec_bd_in_ring(ring, addr)) {
+        address_space_write_cached(ring, addr - ring->addr, &tmp, sizeof(tmp));
+    } else {
+        cpu_physical_memory_write(addr, &tmp, sizeof(tmp));
+    }
+}
+
+/* Only the flags of a TX descriptor change, write back just those.  */
+static void mcf_fec_write_bd_flags(mcf_fec_bd *bd, MemoryRegionCache *ring,
+                                   uint32_t addr)
+{
+    if (mcf_fec_bd_in_ring(ring, addr)) {
+        stw_be_phys_cached(ring, addr - ring->addr, bd->flags);
+    } else {
+        stw_be_phys(&address_space_memory, addr, bd->flags);
+    }
 }
 
 static void mcf_fec_update(mcf_fec_state *s)
@@ -231,21 +281,104 @@ static void mcf_fec_tx_stats(mcf_fec_state *s, int size)
     s->mib[MIB_IEEE_T_OCTETS_OK] += size;
 }
 
+/* A TX frame being gathered from guest memory.  Buffers that are plain RAM
+ * are mapped and passed to the net layer as they are; anything else (or a
+ * frame split into too many fragments) is flattened into a bounce buffer.
+ */
+typedef struct {
+    struct iovec iov[FEC_MAX_TX_FRAGS];
+    int iovcnt;
+    bool linear;
+    int size;
+    uint8_t bounce[FEC_MAX_FRAME_SIZE];
+} mcf_fec_tx_frame;
+
+static void mcf_fec_tx_unmap(mcf_fec_tx_frame *f)
+{
+    int i;
+
+    if (!f->linear) {
+        for (i = 0; i < f->iovcnt; i++) {
+            address_space_unmap(&address_space_memory, f->iov[i].iov_base,
+                                f->iov[i].iov_len, false, f->iov[i].iov_len);
+        }
+    }
+    f->iovcnt = 0;
+    f->linear = false;
+    f->size = 0;
+}
+
+static void mcf_fec_tx_linearize(mcf_fec_tx_frame *f)
+{
+    int size = f->size;
+
+    iov_to_buf(f->iov, f->iovcnt, 0, f->bounce, size);
+    mcf_fec_tx_unmap(f);
+    f->size = size;
+    f->linear = true;
+}
+
+static void mcf_fec_tx_add(mcf_fec_tx_frame *f, hwaddr addr, int len)
+{
+    hwaddr plen = len;
+    void *p;
+
+    if (!f->linear && f->iovcnt < FEC_MAX_TX_FRAGS) {
+        p = address_space_map(&address_space_memory, addr, &plen, false);
+        if (p && plen == len) {
+            f->iov[f->iovcnt].iov_base = p;
+            f->iov[f->iovcnt].iov_len = len;
+            f->iovcnt++;
+            f->size += len;
+            return;
+        }
+        if (p) {
+            address_space_unmap(&address_space_memory, p, plen, false, 0);
+        }
+    }
+    if (!f->linear) {
+        mcf_fec_tx_linearize(f);
+    }
+    cpu_physical_memory_read(addr, f->bounce + f->size, len);
+    f->size += len;
+}
+
+static void mcf_fec_do_tx(mcf_fec_state *s);
+
+static void mcf_fec_tx_done(NetClientState *nc, ssize_t len)
+{
+    mcf_fec_state *s = qemu_get_nic_opaque(nc);
+
+    s->tx_waiting = false;
+    if (s->ecr & FEC_EN) {
+        mcf_fec_do_tx(s);
+        mcf_fec_update(s);
+    }
+}
+
+/* Walk the TX ring and send every frame the guest made ready, then let the
+ * caller update the interrupt lines once for the whole batch.  */
 static void mcf_fec_do_tx(mcf_fec_state *s)
 {
-    uint32_t addr;
+    NetClientState *nc = qemu_get_queue(s->nic);
+    uint32_t addr, frame_start;
+    MemoryRegionCache ring;
     mcf_fec_bd bd;
-    int frame_size;
-    int len, descnt = 0;
-    uint8_t frame[FEC_MAX_FRAME_SIZE];
-    uint8_t *ptr;
+    int len, descnt = 0, frame_descs = 0;
+    mcf_fec_tx_frame f;
+    ssize_t ret;
 
     DPRINTF("do_tx\n");
-    ptr = frame;
-    frame_size = 0;
-    addr = s->tx_descriptor;
+    if (s->tx_waiting) {
+        return;
+    }
+    f.iovcnt = 0;
+    f.linear = false;
+    f.size = 0;
+    mcf_fec_ring_map(&ring, s->etdsr);
+    frame_start = addr = s->tx_descriptor;
     while (descnt++ < FEC_MAX_DESC) {
-        mcf_fec_read_bd(&bd, addr);
+        mcf_fec_read_bd(&bd, &ring, addr);
         DPRINTF("tx_bd %x flags %04x len %d data %08x\n",
                 addr, bd.flags, bd.length, bd.data);
         if ((bd.flags & FEC_BD_R) == 0) {
@@ -253,42 +386,73 @@ static void mcf_fec_do_tx(mcf_fec_state *s)
             break;
         }
         len = bd.length;
-        if (frame_size + len > FEC_MAX_FRAME_SIZE) {
-            len = FEC_MAX_FRAME_SIZE - frame_size;
+        if (f.size + len > FEC_MAX_FRAME_SIZE) {
+            len = FEC_MAX_FRAME_SIZE - f.size;
             s->eir |= FEC_INT_BABT;
         }
-        cpu_physical_memory_read(bd.data, ptr, len);
-        ptr += len;
-        frame_size += len;
-        if (bd.flags & FEC_BD_L) {
-            /* Last buffer in frame.  */
-            DPRINTF("Sending packet\n");
-            qemu_send_packet(qemu_get_queue(s->nic), frame, frame_size);
-            mcf_fec_tx_stats(s, frame_size);
-            ptr = frame;
-            frame_size = 0;
-            s->eir |= FEC_INT_TXF;
+        if (len > 0) {
+            mcf_fec_tx_add(&f, bd.data, len);
         }
-        s->eir |= FEC_INT_TXB;
-        bd.flags &= ~FEC_BD_R;
-        /* Write back the modified descriptor.  */
-        mcf_fec_write_bd(&bd, addr);
+        frame_descs++;
         /* Advance to the next descriptor.  */
         if ((bd.flags & FEC_BD_W) != 0) {
             addr = s->etdsr;
         } else {
             addr += 8;
         }
+        if ((bd.flags & FEC_BD_L) == 0) {
+            continue;
+        }
+
+        /* Last buffer in frame.  */
+        DPRINTF("Sending packet\n");
+        if (f.linear) {
+            struct iovec iov = {
+                .iov_base = f.bounce,
+                .iov_len = f.size,
+            };
+            ret = qemu_sendv_packet_async(nc, &iov, 1, mcf_fec_tx_done);
+        } else {
+            ret = qemu_sendv_packet_async(nc, f.iov, f.iovcnt,
+                                          mcf_fec_tx_done);
+        }
+        mcf_fec_tx_stats(s, f.size);
+        /* The net layer has either consumed the data or copied it into the
+         * peer's queue, so the buffers can go back to the guest now.  */
+        mcf_fec_tx_unmap(&f);
+        for (; frame_descs > 0; frame_descs--) {
+            mcf_fec_read_bd(&bd, &ring, frame_start);
+            bd.flags &= ~FEC_BD_R;
+            mcf_fec_write_bd_flags(&bd, &ring, frame_start);
+            if ((bd.flags & FEC_BD_W) != 0) {
+                frame_start = s->etdsr;
+            } else {
+                frame_start += 8;
+            }
+        }
+        s->eir |= FEC_INT_TXB | FEC_INT_TXF;
+        if (ret == 0) {
+            /* Peer is full, wait for mcf_fec_tx_done.  */
+            s->tx_waiting = true;
+            break;
+        }
     }
-    s->tx_descriptor = addr;
+    /* Descriptors of an incomplete frame stay owned by the controller and
+     * are picked up again on the next TDAR write.  */
+    mcf_fec_tx_unmap(&f);
+    address_space_cache_destroy(&ring);
+    s->tx_descriptor = frame_start;
 }
 
 static void mcf_fec_enable_rx(mcf_fec_state *s)
 {
     NetClientState *nc = qemu_get_queue(s->nic);
+    MemoryRegionCache ring;
     mcf_fec_bd bd;
 
-    mcf_fec_read_bd(&bd, s->rx_descriptor);
+    mcf_fec_ring_map(&ring, s->erdsr);
+    mcf_fec_read_bd(&bd, &ring, s->rx_descriptor);
+    address_space_cache_destroy(&ring);
     s->rx_enabled = ((bd.flags & FEC_BD_E) != 0);
     if (s->rx_enabled) {
         qemu_flush_queued_packets(nc);
@@ -308,6 +472,9 @@ static void mcf_fec_reset(DeviceState *dev)
     s->tcr = 0;
     s->tfwr = 0;
     s->rfsr = 0x500;
+    s->tx_waiting = false;
+    timer_del(s->rx_coalesce_timer);
+    s->rx_coalesce_count = 0;
 }
 
 #define MMFR_WRITE_OP	(1 << 28)
@@ -519,7 +686,8 @@ static void mcf_fec_rx_stats(mcf_fec_state *s, int size)
     s->mib[MIB_IEEE_R_OCTETS_OK] += size;
 }
 
-static int mcf_fec_have_receive_space(mcf_fec_state *s, size_t want)
+static int mcf_fec_have_receive_space(mcf_fec_state *s,
+                                      MemoryRegionCache *ring, size_t want)
 {
     mcf_fec_bd bd;
     uint32_t addr;
@@ -527,7 +695,7 @@ static int mcf_fec_have_receive_space(mcf_fec_state *s, size_t want)
     /* Walk descriptor list to determine if we have enough buffer */
     addr = s->rx_descriptor;
     while (want > 0) {
-        mcf_fec_read_bd(&bd, addr);
+        mcf_fec_read_bd(&bd, ring, addr);
         if ((bd.flags & FEC_BD_E) == 0) {
             return 0;
         }
@@ -545,9 +713,71 @@ static int mcf_fec_have_receive_space(mcf_fec_state *s, size_t want)
     return 0;
 }
 
-static ssize_t mcf_fec_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+/* Copy @len bytes at @offset of the frame into the RX buffer at @addr.  */
+static void mcf_fec_rx_copy(uint32_t addr, const struct iovec *iov,
+                            int iovcnt, size_t offset, unsigned int len)
+{
+    hwaddr plen = len;
+    void *p;
+
+    p = address_space_map(&address_space_memory, addr, &plen, true);
+    if (p && plen == len) {
+        iov_to_buf(iov, iovcnt, offset, p, len);
+        address_space_unmap(&address_space_memory, p, plen, true, len);
+    } else {
+        uint8_t tmp[FEC_MAX_FRAME_SIZE];
+
+        if (p) {
+            address_space_unmap(&address_space_memory, p, plen, true, 0);
+        }
+        iov_to_buf(iov, iovcnt, offset, tmp, len);
+        cpu_physical_memory_write(addr, tmp, len);
+    }
+}
+
+static void mcf_fec_rx_coalesce_flush(mcf_fec_state *s)
+{
+    timer_del(s->rx_coalesce_timer);
+    s->rx_coalesce_count = 0;
+    mcf_fec_update(s);
+}
+
+static void mcf_fec_rx_coalesce_timer(void *opaque)
+{
+    mcf_fec_rx_coalesce_flush(opaque);
+}
+
+/* Signal a received frame.  With coalescing enabled the interrupt is held
+ * back until rx-coalesce-frames frames have arrived or rx-coalesce-usecs
+ * have passed since the first of them, whichever comes first; EIR itself
+ * is always current.  With only rx-coalesce-frames set, a partial batch is
+ * signalled after FEC_RX_COALESCE_DEFAULT_USECS so that light traffic is
+ * not held back indefinitely.  */
+static void mcf_fec_rx_notify(mcf_fec_state *s)
+{
+    uint32_t usecs;
+
+    if (!s->rx_coalesce_usecs && !s->rx_coalesce_frames) {
+        mcf_fec_update(s);
+        return;
+    }
+    s->rx_coalesce_count++;
+    if (s->rx_coalesce_frames &&
+        s->rx_coalesce_count >= s->rx_coalesce_frames) {
+        mcf_fec_rx_coalesce_flush(s);
+    } else if (!timer_pending(s->rx_coalesce_timer)) {
+        usecs = s->rx_coalesce_usecs ?: FEC_RX_COALESCE_DEFAULT_USECS;
+        timer_mod(s->rx_coalesce_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                  (int64_t)usecs * SCALE_US);
+    }
+}
+
+static ssize_t mcf_fec_receive_iov(NetClientState *nc,
+                                   const struct iovec *iov, int iovcnt)
 {
     mcf_fec_state *s = qemu_get_nic_opaque(nc);
+    MemoryRegionCache ring;
     mcf_fec_bd bd;
     uint32_t flags = 0;
     uint32_t addr;
@@ -555,16 +785,22 @@ static ssize_t mcf_fec_receive(NetClientState *nc, const uint8_t *buf, size_t si
     uint32_t buf_addr;
     uint8_t *crc_ptr;
     unsigned int buf_len;
-    size_t retsize;
+    size_t size, retsize, offset;
+    int i;
 
-    DPRINTF("do_rx len %d\n", size);
+    size = iov_size(iov, iovcnt);
+    DPRINTF("do_rx len %zd\n", size);
     if (!s->rx_enabled) {
         return -1;
     }
+    crc = ~0;
+    for (i = 0; i < iovcnt; i++) {
+        crc = crc32(crc, iov[i].iov_base, iov[i].iov_len);
+    }
+    crc = cpu_to_be32(crc);
+    crc_ptr = (uint8_t *)&crc;
     /* 4 bytes for the CRC.  */
     size += 4;
-    crc = cpu_to_be32(crc32(~0, buf, size));
-    crc_ptr = (uint8_t *)&crc;
     /* Huge frames are truncted.  */
     if (size > FEC_MAX_FRAME_SIZE) {
         size = FEC_MAX_FRAME_SIZE;
@@ -575,13 +811,19 @@ static ssize_t mcf_fec_receive(NetClientState *nc, const uint8_t *buf, size_t si
         flags |= FEC_BD_LG;
     }
     /* Check if we have enough space in current descriptors */
-    if (!mcf_fec_have_receive_space(s, size)) {
+    mcf_fec_ring_map(&ring, s->erdsr);
+    if (!mcf_fec_have_receive_space(s, &ring, size)) {
+        address_space_cache_destroy(&ring);
+        /* Let the guest see what is already in the ring so that it can
+         * hand buffers back.  */
+        mcf_fec_rx_coalesce_flush(s);
         return 0;
     }
     addr = s->rx_descriptor;
     retsize = size;
+    offset = 0;
     while (size > 0) {
-        mcf_fec_read_bd(&bd, addr);
+        mcf_fec_read_bd(&bd, &ring, addr);
         buf_len = (size <= s->emrbr) ? size: s->emrbr;
         bd.length = buf_len;
         size -= buf_len;
@@ -590,8 +832,8 @@ static ssize_t mcf_fec_receive(NetClientState *nc, const uint8_t *buf, size_t si
         if (size < 4)
             buf_len += size - 4;
         buf_addr = bd.data;
-        cpu_physical_memory_write(buf_addr, buf, buf_len);
-        buf += buf_len;
+        mcf_fec_rx_copy(buf_addr, iov, iovcnt, offset, buf_len);
+        offset += buf_len;
         if (size < 4) {
             cpu_physical_memory_write(buf_addr + buf_len, crc_ptr, 4 - size);
             crc_ptr += 4 - size;
@@ -605,7 +847,7 @@ static ssize_t mcf_fec_receive(NetClientState *nc, const uint8_t *buf, size_t si
         } else {
             s->eir |= FEC_INT_RXB;
         }
-        mcf_fec_write_bd(&bd, addr);
+        mcf_fec_write_bd(&bd, &ring, addr);
         /* Advance to the next descriptor.  */
         if ((bd.flags & FEC_BD_W) != 0) {
             addr = s->erdsr;
@@ -613,13 +855,34 @@ static ssize_t mcf_fec_receive(NetClientState *nc, const uint8_t *buf, size_t si
             addr += 8;
         }
     }
+    address_space_cache_destroy(&ring);
     s->rx_descriptor = addr;
     mcf_fec_rx_stats(s, retsize);
     mcf_fec_enable_rx(s);
-    mcf_fec_update(s);
+    mcf_fec_rx_notify(s);
     return retsize;
 }
 
+static int mcf_fec_can_receive(NetClientState *nc)
+{
+    mcf_fec_state *s = qemu_get_nic_opaque(nc);
+
+    /* Frames arriving while the ring is exhausted stay queued in the peer
+     * and are flushed by mcf_fec_enable_rx.  */
+    return s->rx_enabled;
+}
+
+static ssize_t mcf_fec_receive(NetClientState *nc, const uint8_t *buf,
+                               size_t size)
+{
+    const struct iovec iov = {
+        .iov_base = (uint8_t *)buf,
+        .iov_len = size
+    };
+
+    return mcf_fec_receive_iov(nc, &iov, 1);
+}
+
 static const MemoryRegionOps mcf_fec_ops = {
     .read = mcf_fec_read,
     .write = mcf_fec_write,
@@ -629,7 +892,9 @@ static const MemoryRegionOps mcf_fec_ops = {
 static NetClientInfo net_mcf_fec_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
+    .can_receive = mcf_fec_can_receive,
     .receive = mcf_fec_receive,
+    .receive_iov = mcf_fec_receive_iov,
 };
 
 static void mcf_fec_realize(DeviceState *dev, Error **errp)
@@ -639,6 +904,8 @@ static void mcf_fec_realize(DeviceState *dev, Error **errp)
     s->nic = qemu_new_nic(&net_mcf_fec_info, &s->conf,
                           object_get_typename(OBJECT(dev)), dev->id, s);
     qemu_format_nic_info_str(qemu_get_queue(s->nic), s->conf.macaddr.a);
+    s->rx_coalesce_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                        mcf_fec_rx_coalesce_timer, s);
 }
 
 static void mcf_fec_instance_init(Object *obj)
@@ -656,6 +923,10 @@ static void mcf_fec_instance_init(Object *obj)
 
 static Property mcf_fec_properties[] = {
     DEFINE_NIC_PROPERTIES(mcf_fec_state, conf),
+    DEFINE_PROP_UINT32("rx-coalesce-frames", mcf_fec_state,
+                       rx_coalesce_frames, 0),
+    DEFINE_PROP_UINT32("rx-coalesce-usecs", mcf_fec_state,
+                       rx_coalesce_usecs, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
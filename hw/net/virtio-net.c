@@ -1172,8 +1172,13 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     return 0;
 }
 
-static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size)
+/*
+ * Copy one packet to the guest.  Its used ring entries are written
+ * *@filled entries past the used index, and *@filled is advanced; the
+ * caller then publishes them all with virtqueue_flush().
+ */
+static ssize_t virtio_net_receive_one(NetClientState *nc, const uint8_t *buf,
+                                      size_t size, unsigned *filled)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
@@ -1259,7 +1264,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         }
 
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elem, total, i++);
+        virtqueue_fill(q->rx_vq, elem, total, *filled + i++);
         g_free(elem);
     }
 
@@ -1270,23 +1275,54 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                      &mhdr.num_buffers, sizeof mhdr.num_buffers);
     }
 
-    virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
-
+    *filled += i;
     return size;
 }
 
+static void virtio_net_rx_flush(NetClientState *nc, unsigned filled)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    if (filled) {
+        virtqueue_flush(q->rx_vq, filled);
+        virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+    }
+}
+
 static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
+    unsigned filled = 0;
     ssize_t r;
 
     rcu_read_lock();
-    r = virtio_net_receive_rcu(nc, buf, size);
+    r = virtio_net_receive_one(nc, buf, size, &filled);
+    virtio_net_rx_flush(nc, filled);
     rcu_read_unlock();
     return r;
 }
 
+/* Update the used index and notify the guest once for the whole batch.  */
+static int virtio_net_receive_batch(NetClientState *nc,
+                                    const struct iovec *pkts, int count)
+{
+    unsigned filled = 0;
+    int i;
+
+    rcu_read_lock();
+    for (i = 0; i < count; i++) {
+        if (virtio_net_receive_one(nc, pkts[i].iov_base, pkts[i].iov_len,
+                                   &filled) == 0) {
+            /* Out of buffers, the rest goes to the queue */
+            break;
+        }
+    }
+    virtio_net_rx_flush(nc, filled);
+    rcu_read_unlock();
+    return i;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
@@ -1881,6 +1917,7 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_batch = virtio_net_receive_batch,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
 };
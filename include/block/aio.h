@@ -47,7 +47,18 @@ typedef void QEMUBHFunc(void *opaque);
 typedef bool AioPollFn(void *opaque);
 typedef void IOHandler(void *opaque);
 
+/* Default for aio_context_set_epoll_threshold() */
+#define AIO_EPOLL_THRESHOLD_DEFAULT 64
+
+typedef struct AioPollStats {
+    uint64_t poll_hits;     /* busy polling made progress */
+    uint64_t poll_misses;   /* busy polling timed out, had to block */
+    uint64_t dispatches;    /* fd handler callbacks run */
+    uint64_t batch_rounds;  /* bottom half rounds run right after completions */
+} AioPollStats;
+
 struct Coroutine;
+struct CoroutinePool;
 struct ThreadPool;
 struct LinuxAioState;
 
@@ -112,6 +123,11 @@ struct AioContext {
     QSLIST_HEAD(, Coroutine) scheduled_coroutines;
     QEMUBH *co_schedule_bh;
 
+    /* Terminated coroutines that last ran in this context, for reuse.
+     * Has its own locking.
+     */
+    struct CoroutinePool *coroutine_pool;
+
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
@@ -143,10 +159,14 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    /* Polling statistics, see aio_context_get_poll_stats() */
+    AioPollStats poll_stats;
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
     bool epoll_enabled;
     bool epoll_available;
+    unsigned epoll_threshold; /* fd count to switch to epoll, 0 for never */
 };
 
 /**
@@ -564,4 +584,25 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_epoll_threshold:
+ * @ctx: the aio context
+ * @threshold: number of file descriptors above which epoll(7) is used
+ *
+ * A threshold of 0 keeps the context on ppoll(2).  Once epoll is in use,
+ * lowering the number of file descriptors does not switch back.  This is a
+ * no-op on hosts without epoll.
+ */
+void aio_context_set_epoll_threshold(AioContext *ctx, unsigned threshold);
+
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @stats: filled with the statistics accumulated since the context was
+ *         created
+ *
+ * Can be called from any thread, but the values are only a snapshot.
+ */
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats);
+
 #endif
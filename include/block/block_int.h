@@ -36,6 +36,7 @@
 #include "block/snapshot.h"
 #include "qemu/main-loop.h"
 #include "qemu/throttle.h"
+#include "qemu/rcu.h"
 
 #define BLOCK_FLAG_LAZY_REFCOUNTS   8
 
@@ -567,6 +568,8 @@ extern const BdrvChildRole child_format;
 extern const BdrvChildRole child_backing;
 
 struct BdrvChild {
+    /* Freed after an RCU grace period, see bdrv_query_bds_stats() */
+    struct rcu_head rcu;
     BlockDriverState *bs;
     char *name;
     const BdrvChildRole *role;
@@ -594,6 +597,9 @@ struct BdrvChild {
  * copied as well.
  */
 struct BlockDriverState {
+    /* The BDS is freed after an RCU grace period, see bdrv_next_node() */
+    struct rcu_head rcu;
+
     /* Protected by big QEMU lock or read-only after opening.  No special
      * locking needed during I/O...
      */
@@ -637,7 +643,8 @@ struct BlockDriverState {
 
     /* the following member gives a name to every node on the bs graph. */
     char node_name[32];
-    /* element of the list of named nodes building the graph */
+    /* element of the list of named nodes building the graph; readers
+     * can walk it under rcu_read_lock(), see bdrv_next_node() */
     QTAILQ_ENTRY(BlockDriverState) node_list;
     /* element of the list of all BlockDriverStates (all_bdrv_states) */
     QTAILQ_ENTRY(BlockDriverState) bs_list;
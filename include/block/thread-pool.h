@@ -27,6 +27,24 @@ typedef struct ThreadPool ThreadPool;
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
+/* At most 64, which is the default.  Lowering the limit does not stop
+ * threads that are already running.
+ */
+void thread_pool_set_max_threads(ThreadPool *pool, int max_threads);
+
+/* Restrict worker threads to the host CPUs in @cpus, for example "0-3,8"
+ * for the CPUs of one NUMA node.  An empty list lifts the restriction.
+ * Only threads started afterwards are affected.
+ */
+void thread_pool_set_affinity(ThreadPool *pool, const char *cpus,
+                              Error **errp);
+
+/* Wait for every worker thread to exit, for example before fork().  The
+ * pool must have no requests outstanding; threads are started again on
+ * demand by later requests.
+ */
+void thread_pool_stop_workers(ThreadPool *pool);
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque);
@@ -251,6 +251,7 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
 void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
+void tb_invalidate_phys_addr_range(AddressSpace *as, hwaddr addr, hwaddr len);
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
                  uintptr_t retaddr);
 #else
@@ -301,6 +302,10 @@ static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu,
 static inline void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
 {
 }
+static inline void tb_invalidate_phys_addr_range(AddressSpace *as,
+                                                 hwaddr addr, hwaddr len)
+{
+}
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
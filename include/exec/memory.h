@@ -245,6 +245,7 @@ struct MemoryRegion {
     bool enabled;
     bool warning_printed; /* For reservations */
     uint8_t vga_logging_count;
+    unsigned change_gen;
     MemoryRegion *alias;
     hwaddr alias_offset;
     int32_t priority;
@@ -1691,9 +1692,14 @@ void stq_le_phys(AddressSpace *as, hwaddr addr, uint64_t val);
 void stq_be_phys(AddressSpace *as, hwaddr addr, uint64_t val);
 
 struct MemoryRegionCache {
+    void *ptr;
+    hwaddr addr;
     hwaddr xlat;
     hwaddr len;
+    hwaddr map_len;
     AddressSpace *as;
+    MemoryRegion *mr;
+    bool is_write;
 };
 
 #define MEMORY_REGION_CACHE_INVALID ((MemoryRegionCache) { .as = NULL })
@@ -1707,12 +1713,15 @@ struct MemoryRegionCache {
  * @len: length of buffer
  * @is_write: indicates the transfer direction
  *
- * Will only work with RAM, and may map a subset of the requested range by
- * returning a value that is less than @len.  On failure, return a negative
- * errno value.
+ * The RAM at @addr is translated and mapped once; accesses through the
+ * cache to that part of the range then skip the lookup entirely.  The
+ * rest of the range, as well as MMIO and anything behind an IOMMU, is
+ * still accessed through @as.  The mapping stays valid until the cache
+ * is destroyed, so a long-lived cache must be rebuilt when the memory
+ * topology changes.
  *
- * Because it only works with RAM, this function can be used for
- * read-modify-write operations.  In this case, is_write should be %true.
+ * Returns @len.  If the transfer direction may be a write, is_write should
+ * be %true; read-modify-write operations need that too.
  *
  * Note that addresses passed to the address_space_*_cached functions
  * are relative to @addr.
@@ -1968,7 +1977,12 @@ address_space_read_cached(MemoryRegionCache *cache, hwaddr addr,
                           void *buf, int len)
 {
     assert(addr < cache->len && len <= cache->len - addr);
-    address_space_read(cache->as, cache->xlat + addr, MEMTXATTRS_UNSPECIFIED, buf, len);
+    if (cache->ptr && addr < cache->map_len && len <= cache->map_len - addr) {
+        memcpy(buf, cache->ptr + addr, len);
+    } else {
+        address_space_read(cache->as, cache->addr + addr,
+                           MEMTXATTRS_UNSPECIFIED, buf, len);
+    }
 }
 
 /**
@@ -1984,7 +1998,14 @@ address_space_write_cached(MemoryRegionCache *cache, hwaddr addr,
                            void *buf, int len)
 {
     assert(addr < cache->len && len <= cache->len - addr);
-    address_space_write(cache->as, cache->xlat + addr, MEMTXATTRS_UNSPECIFIED, buf, len);
+    if (cache->ptr && cache->is_write &&
+        addr < cache->map_len && len <= cache->map_len - addr) {
+        memcpy(cache->ptr + addr, buf, len);
+        address_space_cache_invalidate(cache, addr, len);
+    } else {
+        address_space_write(cache->as, cache->addr + addr,
+                            MEMTXATTRS_UNSPECIFIED, buf, len);
+    }
 }
 
 #endif
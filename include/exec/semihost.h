@@ -32,6 +32,11 @@ static inline bool semihosting_enabled(void)
     return true;
 }
 
+static inline bool semihosting_buffered(void)
+{
+    return false;
+}
+
 static inline SemihostingTarget semihosting_get_target(void)
 {
     return SEMIHOSTING_TARGET_AUTO;
@@ -53,6 +58,7 @@ static inline const char *semihosting_get_cmdline(void)
 }
 #else
 bool semihosting_enabled(void);
+bool semihosting_buffered(void);
 SemihostingTarget semihosting_get_target(void);
 const char *semihosting_get_arg(int i);
 int semihosting_get_argc(void);
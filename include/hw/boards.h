@@ -238,6 +238,7 @@ struct MachineState {
     bool suppress_vmdesc;
     bool enforce_config_section;
     bool enable_graphics;
+    char *kernel_cache;
 
     ram_addr_t ram_size;
     ram_addr_t maxram_size;
@@ -0,0 +1,31 @@
+/*
+ * Goldfish programmable interrupt controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_INTC_GOLDFISH_PIC_H
+#define HW_INTC_GOLDFISH_PIC_H
+
+#include "hw/sysbus.h"
+
+#define TYPE_GOLDFISH_PIC "goldfish_pic"
+#define GOLDFISH_PIC(obj) \
+    OBJECT_CHECK(GoldfishPICState, (obj), TYPE_GOLDFISH_PIC)
+
+#define GOLDFISH_PIC_IRQ_NB 32
+
+typedef struct GoldfishPICState {
+    /*< private >*/
+    SysBusDevice parent_obj;
+    /*< public >*/
+
+    MemoryRegion iomem;
+    qemu_irq irq;
+
+    uint32_t pending;
+    uint32_t enabled;
+} GoldfishPICState;
+
+#endif
@@ -17,7 +17,7 @@
 #include "qemu-common.h"
 #include "qapi/qmp/qlist.h"
 
-QObject *json_parser_parse(GQueue *tokens, va_list *ap);
-QObject *json_parser_parse_err(GQueue *tokens, va_list *ap, Error **errp);
+QObject *json_parser_parse(GArray *tokens, va_list *ap);
+QObject *json_parser_parse_err(GArray *tokens, va_list *ap, Error **errp);
 
 #endif
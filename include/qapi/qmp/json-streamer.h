@@ -20,21 +20,28 @@ typedef struct JSONToken {
     int type;
     int x;
     int y;
-    char str[];
+    size_t offset;      /* of the text in JSONMessageParser.text */
+    const char *str;
 } JSONToken;
 
+/*
+ * The tokens of a message are stored in arrays that are reused for the
+ * next message, so the GArray of JSONToken passed to @emit is only valid
+ * until @emit returns.  @emit gets NULL for a malformed message.
+ */
 typedef struct JSONMessageParser
 {
-    void (*emit)(struct JSONMessageParser *parser, GQueue *tokens);
+    void (*emit)(struct JSONMessageParser *parser, GArray *tokens);
     JSONLexer lexer;
     int brace_count;
     int bracket_count;
-    GQueue *tokens;
+    GArray *tokens;
+    GString *text;
     uint64_t token_size;
 } JSONMessageParser;
 
 void json_message_parser_init(JSONMessageParser *parser,
-                              void (*func)(JSONMessageParser *, GQueue *));
+                              void (*func)(JSONMessageParser *, GArray *));
 
 int json_message_parser_feed(JSONMessageParser *parser,
                              const char *buffer, size_t size);
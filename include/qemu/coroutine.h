@@ -117,6 +117,48 @@ bool qemu_in_coroutine(void);
  */
 bool qemu_coroutine_entered(Coroutine *co);
 
+/**
+ * Pool of terminated coroutines kept for reuse
+ *
+ * Each AioContext has one, holding the coroutines that last ran there;
+ * threads without an AioContext share a global pool.
+ */
+typedef struct CoroutinePool CoroutinePool;
+
+#define COROUTINE_POOL_DEFAULT_SIZE 128
+
+typedef struct CoroutinePoolStats {
+    /* Coroutines created without allocating a new one */
+    uint64_t hits;
+    /* Coroutines that had to be allocated */
+    uint64_t misses;
+    /* Terminated coroutines that were freed because the pool was full */
+    uint64_t frees;
+    /* Coroutines currently in the pool */
+    unsigned int size;
+} CoroutinePoolStats;
+
+CoroutinePool *qemu_coroutine_pool_new(void);
+
+/**
+ * Free @pool and the coroutines in it
+ */
+void qemu_coroutine_pool_free(CoroutinePool *pool);
+
+/**
+ * Set the number of terminated coroutines that @pool may hold
+ */
+void qemu_coroutine_pool_set_size(CoroutinePool *pool, unsigned int size);
+
+/**
+ * Get the statistics of @pool, or of the global pool if @pool is %NULL
+ *
+ * The counters are only approximate while other threads create or
+ * terminate coroutines in the same pool.
+ */
+void qemu_coroutine_pool_get_stats(CoroutinePool *pool,
+                                   CoroutinePoolStats *stats);
+
 /**
  * Provides a mutex that can be used to synchronise coroutines
  */
@@ -64,6 +64,23 @@ struct Coroutine {
     QSLIST_ENTRY(Coroutine) co_scheduled_next;
 };
 
+/**
+ * qemu_coroutine_stack_alloc:
+ * @sz: pointer to a size_t holding the requested usable stack size
+ *
+ * Like qemu_alloc_stack(), but stacks of COROUTINE_STACK_SIZE come from
+ * an arena of large mappings, so that allocating and freeing them is
+ * cheap.  The stack must be freed with qemu_coroutine_stack_free().
+ */
+void *qemu_coroutine_stack_alloc(size_t *sz);
+
+/**
+ * qemu_coroutine_stack_free:
+ * @stack: stack to free
+ * @sz: size returned by qemu_coroutine_stack_alloc()
+ */
+void qemu_coroutine_stack_free(void *stack, size_t sz);
+
 Coroutine *qemu_coroutine_new(void);
 void qemu_coroutine_delete(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
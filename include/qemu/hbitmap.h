@@ -248,7 +248,7 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
  * @hb: HBitmap to operate on.
  *
  * Repair HBitmap after calling hbitmap_deserialize_data. Actually, all HBitmap
- * layers are restored here.
+ * layers are restored here, and the count of set bits is recomputed.
  */
 void hbitmap_deserialize_finish(HBitmap *hb);
 
@@ -260,6 +260,15 @@ void hbitmap_deserialize_finish(HBitmap *hb);
  */
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp);
 
+/**
+ * test_hbitmap_next_accel:
+ *
+ * Switch the word array operations to the next slower implementation
+ * that the host supports, for testing.  Returns false, and goes back to
+ * the fastest implementation, after the plain C version was used.
+ */
+bool test_hbitmap_next_accel(void);
+
 /**
  * hbitmap_free:
  * @hb: HBitmap to operate on.
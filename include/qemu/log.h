@@ -5,6 +5,7 @@
 /* Private global variables, don't use */
 extern FILE *qemu_logfile;
 extern int qemu_loglevel;
+extern bool qemu_log_binary;
 
 /* 
  * The new API:
@@ -43,6 +44,7 @@ static inline bool qemu_log_separate(void)
 #define CPU_LOG_PAGE       (1 << 14)
 #define LOG_TRACE          (1 << 15)
 #define CPU_LOG_TB_OP_IND  (1 << 16)
+#define LOG_BINARY         (1 << 17)
 
 /* Returns true if a bit is set in the current loglevel mask
  */
@@ -57,14 +59,25 @@ static inline bool qemu_loglevel_mask(int mask)
  * qemu_loglevel is never set when qemu_logfile is unset.
  */
 
+void qemu_log_binary_group(bool start);
+
 static inline void qemu_log_lock(void)
 {
-    qemu_flockfile(qemu_logfile);
+    if (unlikely(qemu_log_binary)) {
+        /* Logs from other threads go to their own buffers anyway.  */
+        qemu_log_binary_group(true);
+    } else {
+        qemu_flockfile(qemu_logfile);
+    }
 }
 
 static inline void qemu_log_unlock(void)
 {
-    qemu_funlockfile(qemu_logfile);
+    if (unlikely(qemu_log_binary)) {
+        qemu_log_binary_group(false);
+    } else {
+        qemu_funlockfile(qemu_logfile);
+    }
 }
 
 /* Logging functions: */
@@ -73,16 +86,31 @@ static inline void qemu_log_unlock(void)
  */
 int GCC_FMT_ATTR(1, 2) qemu_log(const char *fmt, ...);
 
+int GCC_FMT_ATTR(1, 0) qemu_log_binary_vprintf(const char *fmt, va_list va);
+
 /* vfprintf-like logging function
  */
 static inline void GCC_FMT_ATTR(1, 0)
 qemu_log_vprintf(const char *fmt, va_list va)
 {
-    if (qemu_logfile) {
+    if (unlikely(qemu_log_binary)) {
+        qemu_log_binary_vprintf(fmt, va);
+    } else if (qemu_logfile) {
         vfprintf(qemu_logfile, fmt, va);
     }
 }
 
+/* Log the execution of a translation block, in the format of "-d exec".
+ * With "-d binary" the record is stored without formatting it.
+ * @host_pc: address of the translated code
+ * @cpu_index: index of the executing CPU
+ * @pc: guest address of the block
+ * @pc_bits: width of guest addresses
+ * @symbol: symbol that contains @pc, or ""
+ */
+void qemu_log_exec_tb(const void *host_pc, int cpu_index, uint64_t pc,
+                      int pc_bits, const char *symbol);
+
 /* log only if a bit is set on the current loglevel mask:
  * @mask: bit to check in the mask
  * @fmt: printf-style format string
@@ -237,6 +237,22 @@ AioContext *iohandler_get_aio_context(void);
  * @pid: The pid that QEMU should observe.
  */
 int qemu_add_child_watch(pid_t pid);
+
+typedef void ChildWatchFunc(pid_t pid, int status, void *opaque);
+
+/**
+ * qemu_add_child_watch_full: Register a child process for reaping,
+ * with a callback.
+ *
+ * Like qemu_add_child_watch(), but @cb is called from the main loop
+ * with the status returned by waitpid once the child has been reaped.
+ * @cb may start and watch further children.
+ *
+ * @pid: The pid that QEMU should observe.
+ * @cb: The function to call once the child has exited.
+ * @opaque: The opaque pointer to pass to @cb.
+ */
+int qemu_add_child_watch_full(pid_t pid, ChildWatchFunc *cb, void *opaque);
 #endif
 
 /**
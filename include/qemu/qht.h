@@ -22,6 +22,8 @@ struct qht {
  * @head_buckets: number of head buckets
  * @used_head_buckets: number of non-empty head buckets
  * @entries: total number of entries
+ * @pending_buckets: number of head buckets of the previous map whose entries
+ *                   have not been copied yet, while a resize is in progress
  * @chain: frequency distribution representing the number of buckets in each
  *         chain, excluding empty chains.
  * @occupancy: frequency distribution representing chain occupancy rate.
@@ -30,11 +32,14 @@ struct qht {
  * An entry is a pointer-hash pair.
  * Each bucket can host several entries.
  * Chains are chains of buckets, whose first link is always a head bucket.
+ * While a resize is in progress, @entries, @chain and @occupancy include
+ * the chains of the previous map that have not been copied yet.
  */
 struct qht_stats {
     size_t head_buckets;
     size_t used_head_buckets;
     size_t entries;
+    size_t pending_buckets;
     struct qdist chain;
     struct qdist occupancy;
 };
@@ -146,6 +151,10 @@ bool qht_reset_size(struct qht *ht, size_t n_elems);
  * @ht: QHT to be resized
  * @n_elems: number of entries the resized hash table should be optimized for
  *
+ * Entries are copied to the resized table one head bucket at a time, so
+ * lookups and writers to other buckets are not held off meanwhile.
+ * Returns once all entries have been copied.
+ *
  * Returns true on success.
  * Returns false if the resize was not necessary and therefore not performed.
  * See also: qht_reset_size().
@@ -160,6 +169,8 @@ bool qht_resize(struct qht *ht, size_t n_elems);
  *
  * Each time it is called, user-provided @func is passed a pointer-hash pair,
  * plus @userp.
+ *
+ * A resize in progress is finished before iterating.
  */
 void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp);
 
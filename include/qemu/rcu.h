@@ -27,6 +27,7 @@
 #include "qemu/thread.h"
 #include "qemu/queue.h"
 #include "qemu/atomic.h"
+#include "qemu/sys_membarrier.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +56,8 @@ extern unsigned long rcu_gp_ctr;
 
 extern QemuEvent rcu_gp_event;
 
+struct rcu_head;
+
 struct rcu_reader_data {
     /* Data used by both reader and synchronize_rcu() */
     unsigned long ctr;
@@ -62,6 +65,13 @@ struct rcu_reader_data {
 
     /* Data used by reader only */
     unsigned depth;
+    bool registered;
+
+    /* Callbacks queued by this thread with call_rcu(), newest first.  The
+     * call_rcu thread takes the whole list at once.
+     */
+    struct rcu_head *cb_list;
+    long cb_count;
 
     /* Data used for registry, protected by rcu_registry_lock */
     QLIST_ENTRY(rcu_reader_data) node;
@@ -79,7 +89,10 @@ static inline void rcu_read_lock(void)
     }
 
     ctr = atomic_read(&rcu_gp_ctr);
-    atomic_xchg(&p_rcu_reader->ctr, ctr);
+    atomic_set(&p_rcu_reader->ctr, ctr);
+
+    /* Write p_rcu_reader->ctr before reading RCU-protected pointers.  */
+    smp_mb_placeholder();
 }
 
 static inline void rcu_read_unlock(void)
@@ -91,7 +104,15 @@ static inline void rcu_read_unlock(void)
         return;
     }
 
-    atomic_xchg(&p_rcu_reader->ctr, 0);
+    /* Ensure that the critical section is seen to precede the
+     * store to p_rcu_reader->ctr.  Together with the following
+     * smp_mb_placeholder(), this ensures writes to p_rcu_reader->ctr
+     * are sequentially consistent.
+     */
+    atomic_store_release(&p_rcu_reader->ctr, 0);
+
+    /* Write p_rcu_reader->ctr before reading p_rcu_reader->waiting.  */
+    smp_mb_placeholder();
     if (unlikely(atomic_read(&p_rcu_reader->waiting))) {
         atomic_set(&p_rcu_reader->waiting, false);
         qemu_event_set(&rcu_gp_event);
@@ -100,6 +121,22 @@ static inline void rcu_read_unlock(void)
 
 extern void synchronize_rcu(void);
 
+typedef struct RCUStats {
+    uint64_t grace_periods;     /* synchronize_rcu() calls */
+    uint64_t gp_total_ns;       /* time spent in synchronize_rcu() */
+    uint64_t gp_max_ns;
+    uint64_t batches;           /* callback batches run */
+    uint64_t callbacks;         /* callbacks run */
+    uint64_t max_batch;         /* callbacks in the largest batch */
+    uint64_t backlog;           /* callbacks queued but not run yet */
+} RCUStats;
+
+/*
+ * Statistics since startup.  They are gathered under locks that
+ * synchronize_rcu() takes, so this may block for a grace period.
+ */
+extern void rcu_get_stats(RCUStats *stats);
+
 /*
  * Reader thread registration.
  */
@@ -112,7 +149,6 @@ extern void rcu_unregister_thread(void);
 extern void rcu_enable_atfork(void);
 extern void rcu_disable_atfork(void);
 
-struct rcu_head;
 typedef void RCUCBFunc(struct rcu_head *head);
 
 struct rcu_head {
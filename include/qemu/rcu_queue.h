@@ -128,6 +128,48 @@ extern "C" {
           ((next_var) = atomic_rcu_read(&(var)->field.le_next), 1);  \
            (var) = (next_var))
 
+/*
+ * Tail queue access methods.  Readers can only walk the queue forwards.
+ */
+#define QTAILQ_EMPTY_RCU(head) (atomic_rcu_read(&(head)->tqh_first) == NULL)
+#define QTAILQ_FIRST_RCU(head) (atomic_rcu_read(&(head)->tqh_first))
+#define QTAILQ_NEXT_RCU(elm, field) (atomic_rcu_read(&(elm)->field.tqe_next))
+
+/*
+ * Tail queue functions.
+ */
+
+/* Upon publication of the last element's next value, list readers
+ * will see the new element at the end of the queue.
+ */
+#define QTAILQ_INSERT_TAIL_RCU(head, elm, field) do {                   \
+    (elm)->field.tqe_next = NULL;                                       \
+    (elm)->field.tqe_prev = (head)->tqh_last;                           \
+    atomic_rcu_set((head)->tqh_last, (elm));                            \
+    (head)->tqh_last = &(elm)->field.tqe_next;                          \
+} while (/*CONSTCOND*/0)
+
+/* The removed element keeps its next pointer, so readers that are
+ * looking at it can still move on to the rest of the queue.  It must
+ * not be freed until after the RCU grace period; if it is reinserted
+ * earlier, those readers may miss the elements that followed it.
+ */
+#define QTAILQ_REMOVE_RCU(head, elm, field) do {                        \
+    if (((elm)->field.tqe_next) != NULL) {                              \
+        (elm)->field.tqe_next->field.tqe_prev = (elm)->field.tqe_prev;  \
+    } else {                                                            \
+        (head)->tqh_last = (elm)->field.tqe_prev;                       \
+    }                                                                   \
+    atomic_set((elm)->field.tqe_prev, (elm)->field.tqe_next);           \
+    (elm)->field.tqe_prev = NULL;                                       \
+} while (/*CONSTCOND*/0)
+
+/* Tail queue traversal must occur within an RCU critical section.  */
+#define QTAILQ_FOREACH_RCU(var, head, field)                            \
+    for ((var) = atomic_rcu_read(&(head)->tqh_first);                   \
+         (var);                                                         \
+         (var) = atomic_rcu_read(&(var)->field.tqe_next))
+
 #ifdef __cplusplus
 }
 #endif
@@ -318,6 +318,10 @@ struct qemu_work_item;
  * @ignore_memory_transaction_failures: Cached copy of the MachineState
  *    flag of the same name: allows the board to suppress calling of the
  *    CPU do_transaction_failed hook function.
+ * @explicit_code_coherency: The guest invalidates modified code itself
+ *    through cache maintenance instructions, so pages holding code
+ *    translated by this CPU are not write-protected.  The target must
+ *    flush the TB cache whenever this changes.
  *
  * State of one CPU core or thread.
  */
@@ -407,6 +411,8 @@ struct CPUState {
 
     bool ignore_memory_transaction_failures;
 
+    bool explicit_code_coherency;
+
     /* Note that this is accessed at the start of every TB via a negative
        offset from AREG0.  Leave this field at the end so as to make the
        (absolute value) offset as small as possible.  This reduces code
@@ -0,0 +1,43 @@
+/*
+ * Run test cases in copy-on-write children of a paused VM
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef SYSEMU_FORK_SERVER_H
+#define SYSEMU_FORK_SERVER_H
+
+#include "qemu/notify.h"
+
+/**
+ * ForkServerCaseFunc:
+ * @index: number of the case run by this child, or -1 in the parent once
+ *         all cases have finished
+ * @opaque: data passed to fork_server_checkpoint()
+ *
+ * Called with the VM stopped, just before it resumes.
+ */
+typedef void ForkServerCaseFunc(int64_t index, void *opaque);
+
+/**
+ * fork_server_checkpoint:
+ * @func: called in each child and, at the end, in the parent
+ * @opaque: passed to @func
+ *
+ * Called from a vCPU when the guest reaches its checkpoint.  If
+ * x-fork-server armed the fork server, stop the VM so that it can be
+ * forked once per case and return true.  Otherwise return false.
+ */
+bool fork_server_checkpoint(ForkServerCaseFunc *func, void *opaque);
+
+/**
+ * fork_server_add_prepare_notifier:
+ * @n: notifier called in the parent, from the main loop, before each fork()
+ *
+ * Code that buffers guest output in memory writes it out from @n, so that
+ * the children neither inherit nor write it out again.
+ */
+void fork_server_add_prepare_notifier(Notifier *n);
+
+#endif
@@ -36,6 +36,15 @@ typedef struct {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Terminated coroutines kept for reuse */
+    uint32_t coroutine_pool_size;
+
+    /* Number of file descriptors above which epoll(7) is used */
+    uint32_t epoll_threshold;
+
+    /* Host CPUs for the thread pool workers, see thread_pool_set_affinity() */
+    char *thread_pool_cpus;
 } IOThread;
 
 #define IOTHREAD(obj) \
@@ -24,6 +24,7 @@ static inline bool qtest_enabled(void)
 }
 
 bool qtest_driver(void);
+void qtest_server_detach(void);
 
 void qtest_init(const char *qtest_chrdev, const char *qtest_log, Error **errp);
 
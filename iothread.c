@@ -17,6 +17,7 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qmp-commands.h"
 #include "qemu/error-report.h"
@@ -108,6 +109,8 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->coroutine_pool_size = COROUTINE_POOL_DEFAULT_SIZE;
+    iothread->epoll_threshold = AIO_EPOLL_THRESHOLD_DEFAULT;
 }
 
 static void iothread_instance_finalize(Object *obj)
@@ -121,6 +124,7 @@ static void iothread_instance_finalize(Object *obj)
     }
     qemu_cond_destroy(&iothread->init_done_cond);
     qemu_mutex_destroy(&iothread->init_done_lock);
+    g_free(iothread->thread_pool_cpus);
     if (!iothread->ctx) {
         return;
     }
@@ -152,6 +156,20 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         iothread->ctx = NULL;
         return;
     }
+    qemu_coroutine_pool_set_size(iothread->ctx->coroutine_pool,
+                                 iothread->coroutine_pool_size);
+    aio_context_set_epoll_threshold(iothread->ctx, iothread->epoll_threshold);
+
+    if (iothread->thread_pool_cpus) {
+        thread_pool_set_affinity(aio_get_thread_pool(iothread->ctx),
+                                 iothread->thread_pool_cpus, &local_error);
+        if (local_error) {
+            error_propagate(errp, local_error);
+            aio_context_unref(iothread->ctx);
+            iothread->ctx = NULL;
+            return;
+        }
+    }
 
     qemu_mutex_init(&iothread->init_done_lock);
     qemu_cond_init(&iothread->init_done_cond);
@@ -235,6 +253,86 @@ out:
     error_propagate(errp, local_err);
 }
 
+static void iothread_get_coroutine_pool_size(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_uint32(v, name, &iothread->coroutine_pool_size, errp);
+}
+
+static void iothread_set_coroutine_pool_size(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    iothread->coroutine_pool_size = value;
+    if (iothread->ctx) {
+        qemu_coroutine_pool_set_size(iothread->ctx->coroutine_pool, value);
+    }
+}
+
+static void iothread_get_epoll_threshold(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_uint32(v, name, &iothread->epoll_threshold, errp);
+}
+
+static void iothread_set_epoll_threshold(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    iothread->epoll_threshold = value;
+    if (iothread->ctx) {
+        aio_context_set_epoll_threshold(iothread->ctx, value);
+    }
+}
+
+static char *iothread_get_thread_pool_cpus(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return g_strdup(iothread->thread_pool_cpus ?: "");
+}
+
+static void iothread_set_thread_pool_cpus(Object *obj, const char *value,
+                                          Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+
+    if (iothread->ctx) {
+        thread_pool_set_affinity(aio_get_thread_pool(iothread->ctx), value,
+                                 &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+
+    g_free(iothread->thread_pool_cpus);
+    iothread->thread_pool_cpus = g_strdup(value);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -252,6 +350,18 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add(klass, "coroutine-pool-size", "uint32",
+                              iothread_get_coroutine_pool_size,
+                              iothread_set_coroutine_pool_size,
+                              NULL, NULL, &error_abort);
+    object_class_property_add(klass, "epoll-threshold", "uint32",
+                              iothread_get_epoll_threshold,
+                              iothread_set_epoll_threshold,
+                              NULL, NULL, &error_abort);
+    object_class_property_add_str(klass, "thread-pool-cpus",
+                                  iothread_get_thread_pool_cpus,
+                                  iothread_set_thread_pool_cpus,
+                                  &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -39,6 +39,11 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
+/* Regions whose change_gen matches were modified by the pending update;
+ * update_all forces every FlatView to be rendered again.
+ */
+static unsigned memory_region_change_gen = 1;
+static bool memory_region_update_all;
 static bool global_dirty_log = false;
 
 static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
@@ -49,6 +54,15 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/* Record that @mr or its list of subregions changed in a way that affects
+ * the memory topology.
+ */
+static void memory_region_mark_changed(MemoryRegion *mr)
+{
+    mr->change_gen = memory_region_change_gen;
+    memory_region_update_pending = true;
+}
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -262,6 +276,22 @@ static bool flatrange_equal(FlatRange *a, FlatRange *b)
         && a->readonly == b->readonly;
 }
 
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static FlatView *flatview_new(MemoryRegion *mr_root)
 {
     FlatView *view;
@@ -354,19 +384,35 @@ static void flatview_simplify(FlatView *view)
 {
     unsigned i, j;
 
+    if (!view->nr) {
+        return;
+    }
+
     i = 0;
-    while (i < view->nr) {
-        j = i + 1;
-        while (j < view->nr
-               && can_merge(&view->ranges[j-1], &view->ranges[j])) {
+    for (j = 1; j < view->nr; j++) {
+        if (can_merge(&view->ranges[i], &view->ranges[j])) {
             int128_addto(&view->ranges[i].addr.size, view->ranges[j].addr.size);
-            ++j;
+        } else {
+            view->ranges[++i] = view->ranges[j];
+        }
+    }
+    view->nr = i + 1;
+}
+
+/* Return the index of the first range in @view that ends after @addr.  */
+static unsigned flatview_find_range(FlatView *view, Int128 addr)
+{
+    unsigned lo = 0, hi = view->nr, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (int128_ge(addr, addrrange_end(view->ranges[mid].addr))) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        ++i;
-        memmove(&view->ranges[i], &view->ranges[j],
-                (view->nr - j) * sizeof(view->ranges[j]));
-        view->nr -= j - i;
     }
+    return lo;
 }
 
 static bool memory_region_big_endian(MemoryRegion *mr)
@@ -704,7 +750,8 @@ static void render_memory_region(FlatView *view,
     fr.readonly = readonly;
 
     /* Render the region itself into any gaps left by the current view. */
-    for (i = 0; i < view->nr && int128_nz(remain); ++i) {
+    for (i = flatview_find_range(view, base);
+         i < view->nr && int128_nz(remain); ++i) {
         if (int128_ge(base, addrrange_end(view->ranges[i].addr))) {
             continue;
         }
@@ -777,8 +824,11 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/* Render a memory topology into a list of disjoint absolute ranges.
+ * If the result is the same as @old_view, that view and its dispatch
+ * tree are reused.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr, FlatView *old_view)
 {
     int i;
     FlatView *view;
@@ -791,6 +841,14 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old_view && flatview_equal(view, old_view)) {
+        flatview_unref(view);
+        flatview_ref(old_view);
+        trace_flatview_reuse(old_view, mr);
+        g_hash_table_replace(flat_views, mr, old_view);
+        return old_view;
+    }
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -979,7 +1037,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -988,26 +1046,66 @@ static void flatviews_init(void)
     }
 }
 
+/* Return whether anything under @mr was modified by the pending update.
+ * Disabled subregions are visited too, since enabling one is a change.
+ */
+static bool memory_region_tree_changed(MemoryRegion *mr)
+{
+    MemoryRegion *subregion;
+
+    if (mr->change_gen == memory_region_change_gen) {
+        return true;
+    }
+    if (mr->alias && memory_region_tree_changed(mr->alias)) {
+        return true;
+    }
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        if (memory_region_tree_changed(subregion)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs.  Those whose tree did not change are carried
+     * over; the others are rendered again, and still reuse the old view
+     * if the change turned out to be invisible.
+     */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view = NULL;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        if (old_views) {
+            old_view = g_hash_table_lookup(old_views, physmr);
+        }
+        if (old_view && !memory_region_update_all
+            && !memory_region_tree_changed(physmr)) {
+            flatview_ref(old_view);
+            trace_flatview_reuse(old_view, physmr);
+            g_hash_table_replace(flat_views, physmr, old_view);
+            continue;
+        }
+
+        generate_memory_topology(physmr, old_view);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
+    memory_region_update_all = false;
+    memory_region_change_gen++;
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1061,7 +1159,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -1934,7 +2032,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2014,7 +2114,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2024,7 +2126,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2294,7 +2398,10 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_changed(mr);
+        memory_region_mark_changed(subregion);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2332,8 +2439,10 @@ void memory_region_del_subregion(MemoryRegion *mr,
     assert(subregion->container == mr);
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -2344,7 +2453,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_mark_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2360,7 +2469,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_mark_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2397,7 +2506,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2540,6 +2651,7 @@ void memory_global_dirty_log_start(void)
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_all = true;
     memory_region_transaction_commit();
 }
 
@@ -2550,6 +2662,7 @@ static void memory_global_dirty_log_do_stop(void)
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_all = true;
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -92,6 +92,8 @@ typedef struct BlkMigBlock {
 } BlkMigBlock;
 
 typedef struct BlkMigState {
+    /* Written under both the iothread lock and lock, so that the
+     * statistics for query-migrate can be read with just lock.  */
     QSIMPLEQ_HEAD(bmds_list, BlkMigDevState) bmds_list;
     int64_t total_sector_sum;
     bool zero_blocks;
@@ -189,9 +191,11 @@ uint64_t blk_mig_bytes_total(void)
     BlkMigDevState *bmds;
     uint64_t sum = 0;
 
+    blk_mig_lock();
     QSIMPLEQ_FOREACH(bmds, &block_mig_state.bmds_list, entry) {
         sum += bmds->total_sectors;
     }
+    blk_mig_unlock();
     return sum << BDRV_SECTOR_BITS;
 }
 
@@ -440,7 +444,9 @@ static int init_blk_migration(QEMUFile *f)
             DPRINTF("Start full migration for %s\n", bdrv_get_device_name(bs));
         }
 
+        blk_mig_lock();
         QSIMPLEQ_INSERT_TAIL(&block_mig_state.bmds_list, bmds, entry);
+        blk_mig_unlock();
     }
 
     /* Can only insert new BDSes now because doing so while iterating block
@@ -690,8 +696,17 @@ static void block_migration_cleanup_bmds(void)
 
     unset_dirty_tracking();
 
-    while ((bmds = QSIMPLEQ_FIRST(&block_mig_state.bmds_list)) != NULL) {
-        QSIMPLEQ_REMOVE_HEAD(&block_mig_state.bmds_list, entry);
+    for (;;) {
+        blk_mig_lock();
+        bmds = QSIMPLEQ_FIRST(&block_mig_state.bmds_list);
+        if (bmds) {
+            QSIMPLEQ_REMOVE_HEAD(&block_mig_state.bmds_list, entry);
+        }
+        blk_mig_unlock();
+        if (!bmds) {
+            break;
+        }
+
         bdrv_op_unblock_all(blk_bs(bmds->blk), bmds->blocker);
         error_free(bmds->blocker);
 
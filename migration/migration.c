@@ -591,12 +591,18 @@ static void populate_disk_info(MigrationInfo *info)
     }
 }
 
+/*
+ * This can run out-of-band without the iothread lock, like the migration
+ * thread itself: counters are read as they are, and the RAM and block
+ * migration state is protected by RCU and the block migration lock.
+ */
 MigrationInfo *qmp_query_migrate(Error **errp)
 {
     MigrationInfo *info = g_malloc0(sizeof(*info));
     MigrationState *s = migrate_get_current();
+    int state = atomic_read(&s->state);
 
-    switch (s->state) {
+    switch (state) {
     case MIGRATION_STATUS_NONE:
         /* no migration has happened ever */
         break;
@@ -639,16 +645,18 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
+        qemu_mutex_lock(&s->error_mutex);
         if (s->error) {
             info->has_error_desc = true;
             info->error_desc = g_strdup(error_get_pretty(s->error));
         }
+        qemu_mutex_unlock(&s->error_mutex);
         break;
     case MIGRATION_STATUS_CANCELLED:
         info->has_status = true;
         break;
     }
-    info->status = s->state;
+    info->status = state;
 
     return info;
 }
@@ -1263,8 +1271,10 @@ MigrationState *migrate_init(void)
     s->start_postcopy = false;
     s->postcopy_after_devices = false;
     s->migration_thread_running = false;
+    qemu_mutex_lock(&s->error_mutex);
     error_free(s->error);
     s->error = NULL;
+    qemu_mutex_unlock(&s->error_mutex);
 
     migrate_set_state(&s->state, MIGRATION_STATUS_NONE, MIGRATION_STATUS_SETUP);
 
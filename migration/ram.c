@@ -194,6 +194,8 @@ struct RAMSrcPageRequest {
 
 /* State of RAM for migration */
 struct RAMState {
+    /* Freed after an RCU grace period, see ram_bytes_remaining() */
+    struct rcu_head rcu;
     /* QEMUFile used for this migration */
     QEMUFile *f;
     /* Last block that we have visited searching for dirty pages */
@@ -235,9 +237,19 @@ typedef struct RAMState RAMState;
 
 static RAMState *ram_state;
 
+/* Can be called without the iothread lock, e.g. by query-migrate.  */
 uint64_t ram_bytes_remaining(void)
 {
-    return ram_state->migration_dirty_pages * TARGET_PAGE_SIZE;
+    RAMState *rs;
+    uint64_t remaining = 0;
+
+    rcu_read_lock();
+    rs = atomic_rcu_read(&ram_state);
+    if (rs) {
+        remaining = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
+    }
+    rcu_read_unlock();
+    return remaining;
 }
 
 MigrationStats ram_counters;
@@ -1600,11 +1612,13 @@ static void xbzrle_load_cleanup(void)
 
 static void ram_state_cleanup(RAMState **rsp)
 {
-    migration_page_queue_free(*rsp);
-    qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
-    qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
-    g_free(*rsp);
-    *rsp = NULL;
+    RAMState *rs = *rsp;
+
+    migration_page_queue_free(rs);
+    qemu_mutex_destroy(&rs->bitmap_mutex);
+    qemu_mutex_destroy(&rs->src_page_req_mutex);
+    atomic_rcu_set(rsp, NULL);
+    g_free_rcu(rs, rcu);
 }
 
 static void xbzrle_cleanup(void)
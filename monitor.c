@@ -36,6 +36,7 @@
 #include "net/net.h"
 #include "net/slirp.h"
 #include "chardev/char-fe.h"
+#include "chardev/char-mux.h"
 #include "ui/qemu-spice.h"
 #include "sysemu/numa.h"
 #include "monitor/monitor.h"
@@ -76,6 +77,7 @@
 #include "qmp-introspect.h"
 #include "sysemu/qtest.h"
 #include "sysemu/cpus.h"
+#include "sysemu/iothread.h"
 #include "qemu/cutils.h"
 #include "qapi/qmp/dispatch.h"
 
@@ -158,14 +160,37 @@ struct MonFdset {
     QLIST_ENTRY(MonFdset) next;
 };
 
+/*
+ * An in-band request that a monitor's I/O thread has parsed, waiting for
+ * the main loop to dispatch it.
+ */
+typedef struct QMPRequest {
+    QObject *req;
+    QObject *id;
+} QMPRequest;
+
+/* Stop reading from a monitor while this many requests are queued */
+#define QMP_REQ_QUEUE_LEN_MAX 8
+
 typedef struct {
     JSONMessageParser parser;
     /*
      * When a client connects, we're in capabilities negotiation mode.
      * When command qmp_capabilities succeeds, we go into command
-     * mode.
+     * mode.  The I/O thread reads this with atomic_read().
      */
     QmpCommandList *commands;
+    bool capab_offered[QMP_CAPABILITY__MAX]; /* capabilities offered */
+    bool capab[QMP_CAPABILITY__MAX];         /* capabilities enabled */
+    /*
+     * With -mon x-oob=on, the monitor is read in mon_iothread and only
+     * out-of-band requests are dispatched there; the others go through
+     * @qmp_requests to @dispatch_bh, which runs in the main loop.
+     */
+    bool use_io_thread;
+    QemuMutex qmp_queue_lock;
+    GQueue *qmp_requests;       /* QMPRequest, protected by qmp_queue_lock */
+    QEMUBH *dispatch_bh;
 } MonitorQMP;
 
 /*
@@ -218,6 +243,9 @@ static QLIST_HEAD(mon_list, Monitor) mon_list;
 static QLIST_HEAD(mon_fdsets, MonFdset) mon_fdsets;
 static int mon_refcount;
 
+/* Shared by all the monitors with out-of-band support */
+static IOThread *mon_iothread;
+
 static mon_cmd_t mon_cmds[];
 static mon_cmd_t info_cmds[];
 
@@ -246,6 +274,12 @@ bool monitor_cur_is_qmp(void)
     return cur_mon && monitor_is_qmp(cur_mon);
 }
 
+/* Whether some monitor is read in mon_iothread (-mon x-oob=on) */
+bool monitor_has_io_thread(void)
+{
+    return mon_iothread != NULL;
+}
+
 void monitor_read_command(Monitor *mon, int show_prompt)
 {
     if (!mon->rs)
@@ -575,6 +609,27 @@ static void monitor_data_init(Monitor *mon)
     mon->outbuf = qstring_new();
     /* Use *mon_cmds by default. */
     mon->cmd_table = mon_cmds;
+    qemu_mutex_init(&mon->qmp.qmp_queue_lock);
+    mon->qmp.qmp_requests = g_queue_new();
+}
+
+static void qmp_request_free(QMPRequest *req_obj)
+{
+    qobject_decref(req_obj->id);
+    qobject_decref(req_obj->req);
+    g_free(req_obj);
+}
+
+/* Drop the in-band requests that have not been dispatched yet.  */
+static void monitor_qmp_cleanup_queue(Monitor *mon)
+{
+    QMPRequest *req_obj;
+
+    qemu_mutex_lock(&mon->qmp.qmp_queue_lock);
+    while ((req_obj = g_queue_pop_head(mon->qmp.qmp_requests))) {
+        qmp_request_free(req_obj);
+    }
+    qemu_mutex_unlock(&mon->qmp.qmp_queue_lock);
 }
 
 static void monitor_data_destroy(Monitor *mon)
@@ -587,6 +642,12 @@ static void monitor_data_destroy(Monitor *mon)
     g_free(mon->rs);
     QDECREF(mon->outbuf);
     qemu_mutex_destroy(&mon->out_lock);
+    if (mon->qmp.dispatch_bh) {
+        qemu_bh_delete(mon->qmp.dispatch_bh);
+    }
+    monitor_qmp_cleanup_queue(mon);
+    g_queue_free(mon->qmp.qmp_requests);
+    qemu_mutex_destroy(&mon->qmp.qmp_queue_lock);
 }
 
 char *qmp_human_monitor_command(const char *command_line, bool has_cpu_index,
@@ -1027,8 +1088,11 @@ void monitor_init_qmp_commands(void)
                          qmp_marshal_qmp_capabilities, QCO_NO_OPTIONS);
 }
 
-void qmp_qmp_capabilities(Error **errp)
+void qmp_qmp_capabilities(bool has_enable, QMPCapabilityList *enable,
+                          Error **errp)
 {
+    QMPCapabilityList *cap;
+
     if (cur_mon->qmp.commands == &qmp_commands) {
         error_set(errp, ERROR_CLASS_COMMAND_NOT_FOUND,
                   "Capabilities negotiation is already complete, command "
@@ -1036,7 +1100,19 @@ void qmp_qmp_capabilities(Error **errp)
         return;
     }
 
-    cur_mon->qmp.commands = &qmp_commands;
+    for (cap = enable; cap; cap = cap->next) {
+        if (!cur_mon->qmp.capab_offered[cap->value]) {
+            error_setg(errp, "Capability '%s' is not available",
+                       QMPCapability_str(cap->value));
+            return;
+        }
+    }
+    for (cap = enable; cap; cap = cap->next) {
+        atomic_set(&cur_mon->qmp.capab[cap->value], true);
+    }
+
+    /* Publish the capabilities before leaving negotiation mode */
+    atomic_mb_set(&cur_mon->qmp.commands, &qmp_commands);
 }
 
 /* set the current CPU defined by the user */
@@ -3801,18 +3877,132 @@ cleanup:
     free_cmdline_args(args, nb_args);
 }
 
+static bool monitor_qmp_queue_full(Monitor *mon)
+{
+    bool full;
+
+    qemu_mutex_lock(&mon->qmp.qmp_queue_lock);
+    full = g_queue_get_length(mon->qmp.qmp_requests) >= QMP_REQ_QUEUE_LEN_MAX;
+    qemu_mutex_unlock(&mon->qmp.qmp_queue_lock);
+    return full;
+}
+
 static int monitor_can_read(void *opaque)
 {
     Monitor *mon = opaque;
 
+    if (monitor_is_qmp(mon) && mon->qmp.use_io_thread) {
+        /* Out-of-band requests wait too; clients must not flood us */
+        return monitor_qmp_queue_full(mon) ? 0 : 1;
+    }
     return (mon->suspend_cnt == 0) ? 1 : 0;
 }
 
-static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
+/*
+ * Send the response @rsp, or an error response for @err, tagged with
+ * @id.  Takes ownership of @rsp and @err.
+ */
+static void monitor_qmp_respond(Monitor *mon, QObject *rsp, Error *err,
+                                QObject *id)
 {
-    QObject *req, *rsp = NULL, *id = NULL;
-    QDict *qdict = NULL;
-    Monitor *mon = cur_mon;
+    QDict *qdict;
+
+    if (err) {
+        qdict = qdict_new();
+        qdict_put_obj(qdict, "error", qmp_build_error_object(err));
+        error_free(err);
+        rsp = QOBJECT(qdict);
+    }
+
+    if (rsp) {
+        if (id) {
+            qobject_incref(id);
+            qdict_put_obj(qobject_to_qdict(rsp), "id", id);
+        }
+
+        monitor_json_emitter(mon, rsp);
+    }
+
+    qobject_decref(rsp);
+}
+
+/*
+ * Dispatch @req and respond to it.  Out-of-band requests get here in
+ * mon_iothread, without the BQL; everything else runs in the main loop
+ * with cur_mon set to @mon.
+ */
+static void monitor_qmp_dispatch(Monitor *mon, QObject *req, QObject *id)
+{
+    QObject *rsp;
+    QDict *error;
+
+    rsp = qmp_dispatch(atomic_read(&mon->qmp.commands), req,
+                       atomic_read(&mon->qmp.capab[QMP_CAPABILITY_OOB]));
+
+    if (atomic_read(&mon->qmp.commands) == &qmp_cap_negotiation_commands) {
+        error = qdict_get_qdict(qobject_to_qdict(rsp), "error");
+        if (error
+            && !g_strcmp0(qdict_get_try_str(error, "class"),
+                    QapiErrorClass_str(ERROR_CLASS_COMMAND_NOT_FOUND))) {
+            /* Provide a more useful error message */
+            qdict_del(error, "desc");
+            qdict_put_str(error, "desc", "Expecting capabilities negotiation"
+                          " with 'qmp_capabilities'");
+        }
+    }
+
+    monitor_qmp_respond(mon, rsp, NULL, id);
+}
+
+static void monitor_qmp_dispatch_in_band(Monitor *mon, QObject *req,
+                                         QObject *id)
+{
+    Monitor *old_mon = cur_mon;
+
+    cur_mon = mon;
+    monitor_qmp_dispatch(mon, req, id);
+    cur_mon = old_mon;
+}
+
+/*
+ * Dispatch the oldest request queued by @opaque's I/O thread.  Only one
+ * request is handled per run, so that a client cannot hog the main loop.
+ */
+static void monitor_qmp_bh_dispatcher(void *opaque)
+{
+    Monitor *mon = opaque;
+    QMPRequest *req_obj;
+    bool more, was_full;
+
+    qemu_mutex_lock(&mon->qmp.qmp_queue_lock);
+    was_full = g_queue_get_length(mon->qmp.qmp_requests)
+        >= QMP_REQ_QUEUE_LEN_MAX;
+    req_obj = g_queue_pop_head(mon->qmp.qmp_requests);
+    more = !g_queue_is_empty(mon->qmp.qmp_requests);
+    qemu_mutex_unlock(&mon->qmp.qmp_queue_lock);
+
+    if (!req_obj) {
+        return;
+    }
+    if (more) {
+        qemu_bh_schedule(mon->qmp.dispatch_bh);
+    }
+    if (was_full) {
+        /* Let the I/O thread look at monitor_can_read() again */
+        g_main_context_wakeup(iothread_get_g_main_context(mon_iothread));
+    }
+
+    trace_monitor_qmp_dispatch_queued(mon);
+    monitor_qmp_dispatch_in_band(mon, req_obj->req, req_obj->id);
+    qmp_request_free(req_obj);
+}
+
+static void handle_qmp_command(JSONMessageParser *parser, GArray *tokens)
+{
+    Monitor *mon = container_of(parser, Monitor, qmp.parser);
+    QObject *req, *id = NULL;
+    QDict *qdict;
+    QMPRequest *req_obj;
     Error *err = NULL;
 
     req = json_parser_parse_err(tokens, NULL, &err);
@@ -3821,7 +4011,9 @@ static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
         error_setg(&err, QERR_JSON_PARSING);
     }
     if (err) {
-        goto err_out;
+        monitor_qmp_respond(mon, NULL, err, NULL);
+        qobject_decref(req);
+        return;
     }
 
     qdict = qobject_to_qdict(req);
@@ -3837,51 +4029,32 @@ static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
         QDECREF(req_json);
     }
 
-    rsp = qmp_dispatch(cur_mon->qmp.commands, req);
-
-    if (mon->qmp.commands == &qmp_cap_negotiation_commands) {
-        qdict = qdict_get_qdict(qobject_to_qdict(rsp), "error");
-        if (qdict
-            && !g_strcmp0(qdict_get_try_str(qdict, "class"),
-                    QapiErrorClass_str(ERROR_CLASS_COMMAND_NOT_FOUND))) {
-            /* Provide a more useful error message */
-            qdict_del(qdict, "desc");
-            qdict_put_str(qdict, "desc", "Expecting capabilities negotiation"
-                          " with 'qmp_capabilities'");
-        }
-    }
-
-err_out:
-    if (err) {
-        qdict = qdict_new();
-        qdict_put_obj(qdict, "error", qmp_build_error_object(err));
-        error_free(err);
-        rsp = QOBJECT(qdict);
-    }
-
-    if (rsp) {
-        if (id) {
-            qdict_put_obj(qobject_to_qdict(rsp), "id", id);
-            id = NULL;
-        }
-
-        monitor_json_emitter(mon, rsp);
+    if (atomic_read(&mon->qmp.capab[QMP_CAPABILITY_OOB])
+        && qmp_is_oob(req)) {
+        /* Jumps the queue: run it right here in the I/O thread */
+        monitor_qmp_dispatch(mon, req, id);
+    } else if (mon->qmp.use_io_thread) {
+        req_obj = g_new0(QMPRequest, 1);
+        req_obj->req = req;
+        req_obj->id = id;
+        qemu_mutex_lock(&mon->qmp.qmp_queue_lock);
+        g_queue_push_tail(mon->qmp.qmp_requests, req_obj);
+        qemu_mutex_unlock(&mon->qmp.qmp_queue_lock);
+        qemu_bh_schedule(mon->qmp.dispatch_bh);
+        return;
+    } else {
+        monitor_qmp_dispatch_in_band(mon, req, id);
     }
 
     qobject_decref(id);
-    qobject_decref(rsp);
     qobject_decref(req);
 }
 
 static void monitor_qmp_read(void *opaque, const uint8_t *buf, int size)
 {
-    Monitor *old_mon = cur_mon;
-
-    cur_mon = opaque;
-
-    json_message_parser_feed(&cur_mon->qmp.parser, (const char *) buf, size);
+    Monitor *mon = opaque;
 
-    cur_mon = old_mon;
+    json_message_parser_feed(&mon->qmp.parser, (const char *) buf, size);
 }
 
 static void monitor_read(void *opaque, const uint8_t *buf, int size)
@@ -3930,34 +4103,72 @@ void monitor_resume(Monitor *mon)
         readline_show_prompt(mon->rs);
 }
 
-static QObject *get_qmp_greeting(void)
+static QObject *get_qmp_greeting(Monitor *mon)
 {
+    QList *cap_list = qlist_new();
     QObject *ver = NULL;
+    QMPCapability cap;
 
     qmp_marshal_query_version(NULL, &ver, NULL);
 
-    return qobject_from_jsonf("{'QMP': {'version': %p, 'capabilities': []}}",
-                              ver);
+    for (cap = 0; cap < QMP_CAPABILITY__MAX; cap++) {
+        if (mon->qmp.capab_offered[cap]) {
+            qlist_append_str(cap_list, QMPCapability_str(cap));
+        }
+    }
+
+    return qobject_from_jsonf("{'QMP': {'version': %p, 'capabilities': %p}}",
+                              ver, QOBJECT(cap_list));
+}
+
+static void monitor_refcount_update(void *opaque)
+{
+    int delta = GPOINTER_TO_INT(opaque);
+
+    mon_refcount += delta;
+    if (delta < 0) {
+        monitor_fdsets_cleanup();
+    }
+}
+
+/*
+ * mon_refcount and the fd sets belong to the main loop, but monitors
+ * with an I/O thread get their chardev events there.
+ */
+static void monitor_qmp_refcount_update(int delta)
+{
+    if (qemu_mutex_iothread_locked()) {
+        monitor_refcount_update(GINT_TO_POINTER(delta));
+    } else {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                monitor_refcount_update,
+                                GINT_TO_POINTER(delta));
+    }
 }
 
 static void monitor_qmp_event(void *opaque, int event)
 {
     QObject *data;
     Monitor *mon = opaque;
+    QMPCapability cap;
 
     switch (event) {
     case CHR_EVENT_OPENED:
-        mon->qmp.commands = &qmp_cap_negotiation_commands;
-        data = get_qmp_greeting();
+        for (cap = 0; cap < QMP_CAPABILITY__MAX; cap++) {
+            atomic_set(&mon->qmp.capab[cap], false);
+        }
+        atomic_set(&mon->qmp.commands, &qmp_cap_negotiation_commands);
+        data = get_qmp_greeting(mon);
         monitor_json_emitter(mon, data);
         qobject_decref(data);
-        mon_refcount++;
+        monitor_qmp_refcount_update(1);
         break;
     case CHR_EVENT_CLOSED:
+        /* Nobody is there to read the responses anymore */
+        monitor_qmp_cleanup_queue(mon);
         json_message_parser_destroy(&mon->qmp.parser);
         json_message_parser_init(&mon->qmp.parser, handle_qmp_command);
-        mon_refcount--;
-        monitor_fdsets_cleanup();
+        monitor_qmp_refcount_update(-1);
         break;
     }
 }
@@ -4080,8 +4291,21 @@ static void __attribute__((constructor)) monitor_lock_init(void)
 void monitor_init(Chardev *chr, int flags)
 {
     static int is_first_init = 1;
+    GMainContext *context = NULL;
     Monitor *mon;
 
+    if (flags & MONITOR_USE_OOB) {
+        if (CHARDEV_IS_MUX(chr)) {
+            error_report("Monitor out-of-band is not supported with "
+                         "MUX typed chardev backend");
+            exit(1);
+        }
+        if (!(flags & MONITOR_USE_CONTROL)) {
+            error_report("Monitor out-of-band is only supported by QMP");
+            exit(1);
+        }
+    }
+
     if (is_first_init) {
         monitor_qapi_event_init();
         sortcmdlist();
@@ -4102,10 +4326,21 @@ void monitor_init(Chardev *chr, int flags)
     }
 
     if (monitor_is_qmp(mon)) {
-        qemu_chr_fe_set_handlers(&mon->chr, monitor_can_read, monitor_qmp_read,
-                                 monitor_qmp_event, NULL, mon, NULL, true);
-        qemu_chr_fe_set_echo(&mon->chr, true);
+        if (flags & MONITOR_USE_OOB) {
+            if (!mon_iothread) {
+                mon_iothread = iothread_create("mon_iothread", &error_abort);
+            }
+            context = iothread_get_g_main_context(mon_iothread);
+            mon->qmp.use_io_thread = true;
+            mon->qmp.capab_offered[QMP_CAPABILITY_OOB] = true;
+            mon->qmp.dispatch_bh = aio_bh_new(qemu_get_aio_context(),
+                                              monitor_qmp_bh_dispatcher, mon);
+        }
+        /* The I/O thread may start reading as soon as the handlers are set */
         json_message_parser_init(&mon->qmp.parser, handle_qmp_command);
+        qemu_chr_fe_set_echo(&mon->chr, true);
+        qemu_chr_fe_set_handlers(&mon->chr, monitor_can_read, monitor_qmp_read,
+                                 monitor_qmp_event, NULL, mon, context, true);
     } else {
         qemu_chr_fe_set_handlers(&mon->chr, monitor_can_read, monitor_read,
                                  monitor_event, NULL, mon, NULL, true);
@@ -4120,6 +4355,11 @@ void monitor_cleanup(void)
 {
     Monitor *mon, *next;
 
+    /* Nothing must run in the I/O thread while the monitors go away */
+    if (mon_iothread) {
+        iothread_stop(mon_iothread);
+    }
+
     qemu_mutex_lock(&monitor_lock);
     QLIST_FOREACH_SAFE(mon, &mon_list, entry, next) {
         QLIST_REMOVE(mon, entry);
@@ -4127,6 +4367,11 @@ void monitor_cleanup(void)
         g_free(mon);
     }
     qemu_mutex_unlock(&monitor_lock);
+
+    if (mon_iothread) {
+        iothread_destroy(mon_iothread);
+        mon_iothread = NULL;
+    }
 }
 
 QemuOptsList qemu_mon_opts = {
@@ -4146,6 +4391,9 @@ QemuOptsList qemu_mon_opts = {
         },{
             .name = "pretty",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "x-oob",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
@@ -20,24 +20,50 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 
+/* One's complement addition of a 64-bit word */
+static inline uint64_t net_checksum_add64(uint64_t sum, uint64_t w)
+{
+    sum += w;
+    return sum + (sum < w);
+}
+
+/*
+ * The one's complement sum does not depend on byte order (RFC 1071), so
+ * the data is added eight bytes at a time as host-endian words and only
+ * the folded 16-bit sum is brought into big-endian order.  An odd @seq
+ * means the data starts at an odd offset of the checksummed area, which
+ * swaps the bytes of the result.
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
+    uint64_t sum = 0;
+    uint8_t tail[8];
+    uint16_t res;
     int i;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    for (i = 0; i + 32 <= len; i += 32) {
+        sum = net_checksum_add64(sum, ldq_he_p(buf + i));
+        sum = net_checksum_add64(sum, ldq_he_p(buf + i + 8));
+        sum = net_checksum_add64(sum, ldq_he_p(buf + i + 16));
+        sum = net_checksum_add64(sum, ldq_he_p(buf + i + 24));
+    }
+    for (; i + 8 <= len; i += 8) {
+        sum = net_checksum_add64(sum, ldq_he_p(buf + i));
     }
     if (i < len) {
-        sum1 += (uint32_t)buf[i];
+        /* An odd trailing byte is the high half of a zero-padded word */
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, buf + i, len - i);
+        sum = net_checksum_add64(sum, ldq_he_p(tail));
     }
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
-    }
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    res = be16_to_cpu(sum);
+
+    return seq & 1 ? bswap16(res) : res;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
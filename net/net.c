@@ -681,6 +681,56 @@ ssize_t qemu_send_packet_async(NetClientState *sender,
                                              buf, size, sent_cb);
 }
 
+static int qemu_deliver_packet_batch(NetClientState *sender,
+                                     const struct iovec *pkts, int count,
+                                     void *opaque)
+{
+    NetClientState *nc = opaque;
+
+    if (nc->link_down) {
+        return count;
+    }
+
+    return nc->info->receive_batch(nc, pkts, count);
+}
+
+/*
+ * Send @count packets, each in a single buffer of @pkts.  If the peer
+ * can take them in one go, through its receive_batch callback, it can
+ * for example notify the guest once for all of them.  The packets that
+ * it does not take, or all of them if filters are in the way, are sent
+ * with qemu_send_packet_async().
+ *
+ * Returns false if some packets were queued; @sent_cb is then called for
+ * each of them, and the caller should stop sending until it is.
+ */
+bool qemu_send_packet_batch_async(NetClientState *sender,
+                                  const struct iovec *pkts, int count,
+                                  NetPacketSent *sent_cb)
+{
+    NetClientState *peer = sender->peer;
+    bool all_sent = true;
+    int i = 0;
+
+    if (sender->link_down || !peer) {
+        return true;
+    }
+
+    if (peer->info->receive_batch &&
+        QTAILQ_EMPTY(&sender->filters) && QTAILQ_EMPTY(&peer->filters)) {
+        i = qemu_net_queue_send_batch(peer->incoming_queue, sender,
+                                      pkts, count, qemu_deliver_packet_batch);
+    }
+
+    for (; i < count; i++) {
+        if (qemu_send_packet_async(sender, pkts[i].iov_base, pkts[i].iov_len,
+                                   sent_cb) == 0) {
+            all_sent = false;
+        }
+    }
+    return all_sent;
+}
+
 void qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size)
 {
     qemu_send_packet_async(nc, buf, size, NULL);
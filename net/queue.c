@@ -232,6 +232,33 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+/*
+ * Hand @count packets to @deliver_batch at once, bypassing @queue.  This
+ * only happens while nothing is queued, so that the packets do not
+ * overtake older ones.  Returns the number of packets consumed; the
+ * caller sends the others one by one, and they are queued as usual if
+ * the receiver is full.
+ */
+int qemu_net_queue_send_batch(NetQueue *queue,
+                              NetClientState *sender,
+                              const struct iovec *pkts,
+                              int count,
+                              NetQueueDeliverBatchFunc *deliver_batch)
+{
+    int ret;
+
+    if (queue->delivering || !QTAILQ_EMPTY(&queue->packets) ||
+        !qemu_can_send_packet(sender)) {
+        return 0;
+    }
+
+    queue->delivering = 1;
+    ret = deliver_batch(sender, pkts, count, queue->opaque);
+    queue->delivering = 0;
+
+    return ret;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
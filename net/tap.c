@@ -45,12 +45,22 @@
 
 #include "net/vhost_net.h"
 
+/* Packets read from the tap device before they are passed to the peer */
+#define TAP_BATCH_SIZE 16
+
+/*
+ * When the host keeps receiving more packets while tap_send() is running
+ * we can hog the QEMU global mutex.  Limit the number of packets that are
+ * processed per tap_send() callback to prevent stalling the guest.
+ */
+#define TAP_SEND_BUDGET 50
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
+    uint8_t *batch_buf;         /* TAP_BATCH_SIZE buffers of NET_BUFSIZE */
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -75,16 +85,24 @@ static void tap_update_fd_handler(TAPState *s)
                         s);
 }
 
+/*
+ * The sent callback of every queued packet enables polling again, so
+ * skip the updates that change nothing.
+ */
 static void tap_read_poll(TAPState *s, bool enable)
 {
-    s->read_poll = enable;
-    tap_update_fd_handler(s);
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        tap_update_fd_handler(s);
+    }
 }
 
 static void tap_write_poll(TAPState *s, bool enable)
 {
-    s->write_poll = enable;
-    tap_update_fd_handler(s);
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        tap_update_fd_handler(s);
+    }
 }
 
 static void tap_writable(void *opaque)
@@ -182,38 +200,42 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
-    int size;
+    struct iovec pkts[TAP_BATCH_SIZE];
+    bool drained = false;
     int packets = 0;
+    int n, size;
 
-    while (true) {
-        uint8_t *buf = s->buf;
+    if (!s->batch_buf) {
+        s->batch_buf = g_malloc(TAP_BATCH_SIZE * NET_BUFSIZE);
+    }
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
-            break;
-        }
+    while (!drained && packets < TAP_SEND_BUDGET) {
+        /* The tap device returns one packet per read() */
+        for (n = 0; n < MIN(TAP_BATCH_SIZE, TAP_SEND_BUDGET - packets); n++) {
+            uint8_t *buf = s->batch_buf + n * NET_BUFSIZE;
+
+            size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
+            if (size <= 0) {
+                drained = true;
+                break;
+            }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+            if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+                buf  += s->host_vnet_hdr_len;
+                size -= s->host_vnet_hdr_len;
+            }
+            pkts[n].iov_base = buf;
+            pkts[n].iov_len = size;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
+        if (n == 0) {
             break;
         }
+        packets += n;
 
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the QEMU global mutex.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
-        packets++;
-        if (packets >= 50) {
+        if (!qemu_send_packet_batch_async(&s->nc, pkts, n,
+                                          tap_send_completed)) {
+            tap_read_poll(s, false);
             break;
         }
     }
@@ -325,6 +347,8 @@ static void tap_cleanup(NetClientState *nc)
     tap_write_poll(s, false);
     close(s->fd);
     s->fd = -1;
+    g_free(s->batch_buf);
+    s->batch_buf = NULL;
 }
 
 static void tap_poll(NetClientState *nc, bool enable)
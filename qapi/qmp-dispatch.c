@@ -20,7 +20,8 @@
 #include "qapi-types.h"
 #include "qapi/qmp/qerror.h"
 
-static QDict *qmp_dispatch_check_obj(const QObject *request, Error **errp)
+static QDict *qmp_dispatch_check_obj(const QObject *request, bool allow_oob,
+                                     Error **errp)
 {
     const QDictEntry *ent;
     const char *arg_name;
@@ -39,10 +40,17 @@ static QDict *qmp_dispatch_check_obj(const QObject *request, Error **errp)
         arg_name = qdict_entry_key(ent);
         arg_obj = qdict_entry_value(ent);
 
-        if (!strcmp(arg_name, "execute")) {
+        if (!strcmp(arg_name, "execute")
+            || (!strcmp(arg_name, "exec-oob") && allow_oob)) {
             if (qobject_type(arg_obj) != QTYPE_QSTRING) {
-                error_setg(errp,
-                           "QMP input member 'execute' must be a string");
+                error_setg(errp, "QMP input member '%s' must be a string",
+                           arg_name);
+                return NULL;
+            }
+            if (has_exec_key) {
+                error_setg(errp, "QMP input member '%s' clashes with '%s'",
+                           arg_name,
+                           strcmp(arg_name, "execute") ? "execute" : "exec-oob");
                 return NULL;
             }
             has_exec_key = true;
@@ -68,20 +76,27 @@ static QDict *qmp_dispatch_check_obj(const QObject *request, Error **errp)
 }
 
 static QObject *do_qmp_dispatch(QmpCommandList *cmds, QObject *request,
-                                Error **errp)
+                                bool allow_oob, Error **errp)
 {
     Error *local_err = NULL;
+    bool oob;
     const char *command;
     QDict *args, *dict;
     QmpCommand *cmd;
     QObject *ret = NULL;
 
-    dict = qmp_dispatch_check_obj(request, errp);
+    dict = qmp_dispatch_check_obj(request, allow_oob, errp);
     if (!dict) {
         return NULL;
     }
 
-    command = qdict_get_str(dict, "execute");
+    command = qdict_get_try_str(dict, "execute");
+    oob = false;
+    if (!command) {
+        assert(allow_oob);
+        command = qdict_get_str(dict, "exec-oob");
+        oob = true;
+    }
     cmd = qmp_find_command(cmds, command);
     if (cmd == NULL) {
         error_set(errp, ERROR_CLASS_COMMAND_NOT_FOUND,
@@ -93,6 +108,11 @@ static QObject *do_qmp_dispatch(QmpCommandList *cmds, QObject *request,
                    command);
         return NULL;
     }
+    if (oob && !(cmd->options & QCO_ALLOW_OOB)) {
+        error_setg(errp, "The command %s does not support OOB",
+                   command);
+        return NULL;
+    }
 
     if (!qdict_haskey(dict, "arguments")) {
         args = qdict_new();
@@ -122,13 +142,31 @@ QObject *qmp_build_error_object(Error *err)
                               error_get_pretty(err));
 }
 
-QObject *qmp_dispatch(QmpCommandList *cmds, QObject *request)
+/*
+ * Does @request ask for out-of-band execution?  This says nothing about
+ * whether the request is otherwise valid; qmp_dispatch() checks that.
+ */
+bool qmp_is_oob(const QObject *request)
+{
+    QDict *dict = qobject_to_qdict(request);
+
+    return dict && qdict_haskey(dict, "exec-oob")
+        && !qdict_haskey(dict, "execute");
+}
+
+/*
+ * Execute @request, which uses "execute", or "exec-oob" if @allow_oob,
+ * and return the response.  "exec-oob" only works with commands that
+ * have QCO_ALLOW_OOB; the caller is responsible for running those
+ * where they are expected to run.
+ */
+QObject *qmp_dispatch(QmpCommandList *cmds, QObject *request, bool allow_oob)
 {
     Error *err = NULL;
     QObject *ret;
     QDict *rsp;
 
-    ret = do_qmp_dispatch(cmds, request, &err);
+    ret = do_qmp_dispatch(cmds, request, allow_oob, &err);
 
     rsp = qdict_new();
     if (err) {
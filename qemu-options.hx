@@ -37,6 +37,7 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                kernel-cache=dir caches decompressed kernel images in dir\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
     "                aes-key-wrap=on|off controls support for AES key wrapping (default=on)\n"
     "                dea-key-wrap=on|off controls support for DEA key wrapping (default=on)\n"
@@ -85,6 +86,11 @@ Include guest memory in a core dump. The default is on.
 Enables or disables memory merge support. This feature, when supported by
 the host, de-duplicates identical memory pages among VMs instances
 (enabled by default).
+@item kernel-cache=@var{dir}
+Keep the decompressed payload of gzip compressed U-Boot kernel images in
+@var{dir}, named after a hash of the compressed payload, and use it
+instead of decompressing the image again on later runs.  A cache file that
+is empty or larger than the decompression limit is ignored and rewritten.
 @item aes-key-wrap=on|off
 Enables or disables AES key wrapping support on s390-ccw hosts. This feature
 controls whether AES wrapping keys will be created to allow
@@ -3481,11 +3487,16 @@ Like -qmp but uses pretty JSON formatting.
 ETEXI
 
 DEF("mon", HAS_ARG, QEMU_OPTION_mon, \
-    "-mon [chardev=]name[,mode=readline|control]\n", QEMU_ARCH_ALL)
+    "-mon [chardev=]name[,mode=readline|control][,pretty[=on|off]][,x-oob=on|off]\n", QEMU_ARCH_ALL)
 STEXI
-@item -mon [chardev=]name[,mode=readline|control]
+@item -mon [chardev=]name[,mode=readline|control][,pretty[=on|off]][,x-oob=on|off]
 @findex -mon
-Setup monitor on chardev @var{name}.
+Setup monitor on chardev @var{name}.  @code{pretty} turns on JSON pretty
+printing easing human reading and debugging.  @code{x-oob} serves a
+@code{control} monitor from a separate thread, and lets its clients
+execute some commands out-of-band, without waiting for the commands
+already queued (experimental).  Out-of-band execution is not available
+on multiplexed character devices.
 ETEXI
 
 DEF("debugcon", HAS_ARG, QEMU_OPTION_debugcon, \
@@ -3579,7 +3590,12 @@ DEF("D", HAS_ARG, QEMU_OPTION_D, \
 STEXI
 @item -D @var{logfile}
 @findex -D
-Output log in @var{logfile} instead of to stderr
+Output log in @var{logfile} instead of to stderr.  If @code{binary} is
+among the @option{-d} items, each thread logs to a buffer of its own and
+@var{logfile} holds binary records; @file{scripts/qemu-log-decode.py}
+turns it back into text.  Once a log file holds records, adding or
+removing @code{binary} at run time does not change its format; set a new
+log file to switch.
 ETEXI
 
 DEF("dfilter", HAS_ARG, QEMU_OPTION_DFILTER, \
@@ -4007,12 +4023,13 @@ STEXI
 Enable semihosting mode (ARM, M68K, Xtensa, MIPS only).
 ETEXI
 DEF("semihosting-config", HAS_ARG, QEMU_OPTION_semihosting_config,
-    "-semihosting-config [enable=on|off][,target=native|gdb|auto][,arg=str[,...]]\n" \
+    "-semihosting-config [enable=on|off][,target=native|gdb|auto][,buffered=on|off]\n" \
+    "                    [,arg=str[,...]]\n" \
     "                semihosting configuration\n",
 QEMU_ARCH_ARM | QEMU_ARCH_M68K | QEMU_ARCH_XTENSA | QEMU_ARCH_LM32 |
 QEMU_ARCH_MIPS)
 STEXI
-@item -semihosting-config [enable=on|off][,target=native|gdb|auto][,arg=str[,...]]
+@item -semihosting-config [enable=on|off][,target=native|gdb|auto][,buffered=on|off][,arg=str[,...]]
 @findex -semihosting-config
 Enable and configure semihosting (ARM, M68K, Xtensa, MIPS only).
 @table @option
@@ -4020,6 +4037,14 @@ Enable and configure semihosting (ARM, M68K, Xtensa, MIPS only).
 Defines where the semihosting calls will be addressed, to QEMU (@code{native})
 or to GDB (@code{gdb}). The default is @code{auto}, which means @code{gdb}
 during debug sessions and @code{native} otherwise.
+@item buffered=@code{on|off}
+Buffer semihosted file I/O in QEMU (M68K only, @code{native} target only).
+Small reads are served from a read-ahead buffer and small writes are
+held for at most 50 ms, or until the file is closed, sought or read from;
+output to a terminal is also flushed at each newline.  Held writes are
+lost if QEMU crashes or is killed before they are flushed, and an error
+from a held write is only reported by a later call on the same file,
+typically its close.  The default is @code{off}.
 @item arg=@var{str1},arg=@var{str2},...
 Allows the user to pass input arguments, and can be used multiple times to build
 up a list. The old-style @code{-kernel}/@code{-append} method of passing a
@@ -23,8 +23,9 @@
 typedef struct JSONParserContext
 {
     Error *err;
-    JSONToken *current;
-    GQueue *buf;
+    GArray *buf;
+    guint pos;
+    GString *scratch;   /* for unescaping strings */
 } JSONParserContext;
 
 #define BUG_ON(cond) assert(!(cond))
@@ -122,148 +123,139 @@ static int hex2decimal(char ch)
  *      \t
  *      \u four-hex-digits 
  */
-static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
-                                         JSONToken *token)
+/*
+ * Unescape a string token, appending it with its terminator to
+ * ctxt->scratch.  Return its offset there, or -1 on error.  The scratch
+ * buffer is used as a stack: the caller truncates it back to the offset
+ * when done with the string.
+ */
+static int unescape_str(JSONParserContext *ctxt, JSONToken *token)
 {
     const char *ptr = token->str;
-    QString *str;
-    int double_quote = 1;
+    GString *str = ctxt->scratch;
+    size_t offset = str->len;
+    char quote = *ptr++;
 
-    if (*ptr == '"') {
-        double_quote = 1;
-    } else {
-        double_quote = 0;
-    }
-    ptr++;
+    while (*ptr && *ptr != quote) {
+        const char *start = ptr;
 
-    str = qstring_new();
-    while (*ptr && 
-           ((double_quote && *ptr != '"') || (!double_quote && *ptr != '\''))) {
-        if (*ptr == '\\') {
+        /* Copy runs of plain characters at once.  */
+        while (*ptr && *ptr != quote && *ptr != '\\') {
             ptr++;
+        }
+        g_string_append_len(str, start, ptr - start);
+        if (*ptr != '\\') {
+            break;
+        }
 
-            switch (*ptr) {
-            case '"':
-                qstring_append(str, "\"");
-                ptr++;
-                break;
-            case '\'':
-                qstring_append(str, "'");
-                ptr++;
-                break;
-            case '\\':
-                qstring_append(str, "\\");
-                ptr++;
-                break;
-            case '/':
-                qstring_append(str, "/");
-                ptr++;
-                break;
-            case 'b':
-                qstring_append(str, "\b");
-                ptr++;
-                break;
-            case 'f':
-                qstring_append(str, "\f");
-                ptr++;
-                break;
-            case 'n':
-                qstring_append(str, "\n");
-                ptr++;
-                break;
-            case 'r':
-                qstring_append(str, "\r");
-                ptr++;
-                break;
-            case 't':
-                qstring_append(str, "\t");
-                ptr++;
-                break;
-            case 'u': {
-                uint16_t unicode_char = 0;
-                char utf8_char[4];
-                int i = 0;
+        ptr++;
+        switch (*ptr) {
+        case '"':
+            g_string_append_c(str, '"');
+            ptr++;
+            break;
+        case '\'':
+            g_string_append_c(str, '\'');
+            ptr++;
+            break;
+        case '\\':
+            g_string_append_c(str, '\\');
+            ptr++;
+            break;
+        case '/':
+            g_string_append_c(str, '/');
+            ptr++;
+            break;
+        case 'b':
+            g_string_append_c(str, '\b');
+            ptr++;
+            break;
+        case 'f':
+            g_string_append_c(str, '\f');
+            ptr++;
+            break;
+        case 'n':
+            g_string_append_c(str, '\n');
+            ptr++;
+            break;
+        case 'r':
+            g_string_append_c(str, '\r');
+            ptr++;
+            break;
+        case 't':
+            g_string_append_c(str, '\t');
+            ptr++;
+            break;
+        case 'u': {
+            uint16_t unicode_char = 0;
+            char utf8_char[4];
+            int i = 0;
 
-                ptr++;
+            ptr++;
 
-                for (i = 0; i < 4; i++) {
-                    if (qemu_isxdigit(*ptr)) {
-                        unicode_char |= hex2decimal(*ptr) << ((3 - i) * 4);
-                    } else {
-                        parse_error(ctxt, token,
-                                    "invalid hex escape sequence in string");
-                        goto out;
-                    }
-                    ptr++;
+            for (i = 0; i < 4; i++) {
+                if (qemu_isxdigit(*ptr)) {
+                    unicode_char |= hex2decimal(*ptr) << ((3 - i) * 4);
+                } else {
+                    parse_error(ctxt, token,
+                                "invalid hex escape sequence in string");
+                    goto out;
                 }
-
-                wchar_to_utf8(unicode_char, utf8_char, sizeof(utf8_char));
-                qstring_append(str, utf8_char);
-            }   break;
-            default:
-                parse_error(ctxt, token, "invalid escape sequence in string");
-                goto out;
+                ptr++;
             }
-        } else {
-            char dummy[2];
-
-            dummy[0] = *ptr++;
-            dummy[1] = 0;
 
-            qstring_append(str, dummy);
+            wchar_to_utf8(unicode_char, utf8_char, sizeof(utf8_char));
+            g_string_append(str, utf8_char);
+        }   break;
+        default:
+            parse_error(ctxt, token, "invalid escape sequence in string");
+            goto out;
         }
     }
 
-    return str;
+    g_string_append_c(str, 0);
+    return offset;
 
 out:
-    QDECREF(str);
-    return NULL;
+    g_string_truncate(str, offset);
+    return -1;
 }
 
-/* Note: the token object returned by parser_context_peek_token or
- * parser_context_pop_token is deleted as soon as parser_context_pop_token
- * is called again.
- */
-static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
+static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
+                                         JSONToken *token)
 {
-    g_free(ctxt->current);
-    assert(!g_queue_is_empty(ctxt->buf));
-    ctxt->current = g_queue_pop_head(ctxt->buf);
-    return ctxt->current;
-}
+    QString *str;
+    int offset;
 
-static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
-{
-    assert(!g_queue_is_empty(ctxt->buf));
-    return g_queue_peek_head(ctxt->buf);
+    offset = unescape_str(ctxt, token);
+    if (offset < 0) {
+        return NULL;
+    }
+    /* Copy up to, not including, the terminator */
+    str = qstring_from_substr(ctxt->scratch->str, offset,
+                              ctxt->scratch->len - 2);
+    g_string_truncate(ctxt->scratch, offset);
+    return str;
 }
 
-static JSONParserContext *parser_context_new(GQueue *tokens)
+/* Note: the tokens returned by parser_context_peek_token or
+ * parser_context_pop_token are owned by the JSONMessageParser and stay
+ * valid until the message is parsed.
+ */
+static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
 {
-    JSONParserContext *ctxt;
-
-    if (!tokens) {
+    if (ctxt->pos == ctxt->buf->len) {
         return NULL;
     }
-
-    ctxt = g_malloc0(sizeof(JSONParserContext));
-    ctxt->buf = tokens;
-
-    return ctxt;
+    return &g_array_index(ctxt->buf, JSONToken, ctxt->pos++);
 }
 
-/* to support error propagation, ctxt->err must be freed separately */
-static void parser_context_free(JSONParserContext *ctxt)
+static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
 {
-    if (ctxt) {
-        while (!g_queue_is_empty(ctxt->buf)) {
-            parser_context_pop_token(ctxt);
-        }
-        g_free(ctxt->current);
-        g_queue_free(ctxt->buf);
-        g_free(ctxt);
+    if (ctxt->pos == ctxt->buf->len) {
+        return NULL;
     }
+    return &g_array_index(ctxt->buf, JSONToken, ctxt->pos);
 }
 
 /**
@@ -273,6 +265,7 @@ static int parse_pair(JSONParserContext *ctxt, QDict *dict, va_list *ap)
 {
     QObject *key = NULL, *value;
     JSONToken *peek, *token;
+    int key_offset = -1;
 
     peek = parser_context_peek_token(ctxt);
     if (peek == NULL) {
@@ -280,10 +273,20 @@ static int parse_pair(JSONParserContext *ctxt, QDict *dict, va_list *ap)
         goto out;
     }
 
-    key = parse_value(ctxt, ap);
-    if (!key || qobject_type(key) != QTYPE_QSTRING) {
-        parse_error(ctxt, peek, "key is not a string in object");
-        goto out;
+    if (peek->type == JSON_STRING) {
+        /* The QDict copies the key, no need for a QString */
+        parser_context_pop_token(ctxt);
+        key_offset = unescape_str(ctxt, peek);
+        if (key_offset < 0) {
+            parse_error(ctxt, peek, "key is not a string in object");
+            goto out;
+        }
+    } else {
+        key = parse_value(ctxt, ap);
+        if (!key || qobject_type(key) != QTYPE_QSTRING) {
+            parse_error(ctxt, peek, "key is not a string in object");
+            goto out;
+        }
     }
 
     token = parser_context_pop_token(ctxt);
@@ -303,13 +306,20 @@ static int parse_pair(JSONParserContext *ctxt, QDict *dict, va_list *ap)
         goto out;
     }
 
-    qdict_put_obj(dict, qstring_get_str(qobject_to_qstring(key)), value);
-
-    qobject_decref(key);
+    if (key) {
+        qdict_put_obj(dict, qstring_get_str(qobject_to_qstring(key)), value);
+        qobject_decref(key);
+    } else {
+        qdict_put_obj(dict, ctxt->scratch->str + key_offset, value);
+        g_string_truncate(ctxt->scratch, key_offset);
+    }
 
     return 0;
 
 out:
+    if (key_offset >= 0) {
+        g_string_truncate(ctxt->scratch, key_offset);
+    }
     qobject_decref(key);
 
     return -1;
@@ -569,25 +579,25 @@ static QObject *parse_value(JSONParserContext *ctxt, va_list *ap)
     }
 }
 
-QObject *json_parser_parse(GQueue *tokens, va_list *ap)
+QObject *json_parser_parse(GArray *tokens, va_list *ap)
 {
     return json_parser_parse_err(tokens, ap, NULL);
 }
 
-QObject *json_parser_parse_err(GQueue *tokens, va_list *ap, Error **errp)
+QObject *json_parser_parse_err(GArray *tokens, va_list *ap, Error **errp)
 {
-    JSONParserContext *ctxt = parser_context_new(tokens);
+    JSONParserContext ctxt = { .buf = tokens };
     QObject *result;
 
-    if (!ctxt) {
+    if (!tokens) {
         return NULL;
     }
 
-    result = parse_value(ctxt, ap);
-
-    error_propagate(errp, ctxt->err);
+    ctxt.scratch = g_string_new(NULL);
+    result = parse_value(&ctxt, ap);
+    g_string_free(ctxt.scratch, true);
 
-    parser_context_free(ctxt);
+    error_propagate(errp, ctxt.err);
 
     return result;
 }
@@ -20,26 +20,33 @@
 #define MAX_TOKEN_COUNT (2ULL << 20)
 #define MAX_NESTING (1ULL << 10)
 
-static void json_message_free_token(void *token, void *opaque)
-{
-    g_free(token);
-}
+/* Buffers bigger than this are not kept around after a message.  */
+#define MAX_CACHED_TOKENS 1024
+#define MAX_CACHED_TEXT (64 * 1024)
 
-static void json_message_free_tokens(JSONMessageParser *parser)
+static void json_message_reset_tokens(JSONMessageParser *parser)
 {
-    if (parser->tokens) {
-        g_queue_foreach(parser->tokens, json_message_free_token, NULL);
-        g_queue_free(parser->tokens);
-        parser->tokens = NULL;
+    if (parser->tokens->len > MAX_CACHED_TOKENS) {
+        g_array_free(parser->tokens, true);
+        parser->tokens = g_array_new(false, false, sizeof(JSONToken));
+    } else {
+        g_array_set_size(parser->tokens, 0);
     }
+    if (parser->text->allocated_len > MAX_CACHED_TEXT) {
+        g_string_free(parser->text, true);
+        parser->text = g_string_new(NULL);
+    } else {
+        g_string_truncate(parser->text, 0);
+    }
+    parser->token_size = 0;
 }
 
 static void json_message_process_token(JSONLexer *lexer, GString *input,
                                        JSONTokenType type, int x, int y)
 {
     JSONMessageParser *parser = container_of(lexer, JSONMessageParser, lexer);
-    JSONToken *token;
-    GQueue *tokens;
+    JSONToken token;
+    guint i;
 
     switch (type) {
     case JSON_LCURLY:
@@ -58,17 +65,20 @@ static void json_message_process_token(JSONLexer *lexer, GString *input,
         break;
     }
 
-    token = g_malloc(sizeof(JSONToken) + input->len + 1);
-    token->type = type;
-    memcpy(token->str, input->str, input->len);
-    token->str[input->len] = 0;
-    token->x = x;
-    token->y = y;
+    /* Token texts are packed, with their terminators, in parser->text;
+     * token.str is only set once the message is complete, because
+     * parser->text can move while it grows.
+     */
+    token.type = type;
+    token.x = x;
+    token.y = y;
+    token.offset = parser->text->len;
+    token.str = NULL;
+    g_string_append_len(parser->text, input->str, input->len + 1);
+    g_array_append_val(parser->tokens, token);
 
     parser->token_size += input->len;
 
-    g_queue_push_tail(parser->tokens, token);
-
     if (type == JSON_ERROR) {
         goto out_emit_bad;
     } else if (parser->brace_count < 0 ||
@@ -77,7 +87,7 @@ static void json_message_process_token(JSONLexer *lexer, GString *input,
          parser->bracket_count == 0)) {
         goto out_emit;
     } else if (parser->token_size > MAX_TOKEN_SIZE ||
-               g_queue_get_length(parser->tokens) > MAX_TOKEN_COUNT ||
+               parser->tokens->len > MAX_TOKEN_COUNT ||
                parser->bracket_count + parser->brace_count > MAX_NESTING) {
         /* Security consideration, we limit total memory allocated per object
          * and the maximum recursion depth that a message can force.
@@ -92,27 +102,33 @@ out_emit_bad:
      * Clear out token list and tell the parser to emit an error
      * indication by passing it a NULL list
      */
-    json_message_free_tokens(parser);
+    parser->brace_count = 0;
+    parser->bracket_count = 0;
+    json_message_reset_tokens(parser);
+    parser->emit(parser, NULL);
+    return;
+
 out_emit:
     /* send current list of tokens to parser and reset tokenizer */
     parser->brace_count = 0;
     parser->bracket_count = 0;
-    /* parser->emit takes ownership of parser->tokens.  Remove our own
-     * reference to parser->tokens before handing it out to parser->emit.
-     */
-    tokens = parser->tokens;
-    parser->tokens = g_queue_new();
-    parser->emit(parser, tokens);
-    parser->token_size = 0;
+    for (i = 0; i < parser->tokens->len; i++) {
+        JSONToken *t = &g_array_index(parser->tokens, JSONToken, i);
+
+        t->str = parser->text->str + t->offset;
+    }
+    parser->emit(parser, parser->tokens);
+    json_message_reset_tokens(parser);
 }
 
 void json_message_parser_init(JSONMessageParser *parser,
-                              void (*func)(JSONMessageParser *, GQueue *))
+                              void (*func)(JSONMessageParser *, GArray *))
 {
     parser->emit = func;
     parser->brace_count = 0;
     parser->bracket_count = 0;
-    parser->tokens = g_queue_new();
+    parser->tokens = g_array_new(false, false, sizeof(JSONToken));
+    parser->text = g_string_new(NULL);
     parser->token_size = 0;
 
     json_lexer_init(&parser->lexer, json_message_process_token);
@@ -132,5 +148,6 @@ int json_message_parser_flush(JSONMessageParser *parser)
 void json_message_parser_destroy(JSONMessageParser *parser)
 {
     json_lexer_destroy(&parser->lexer);
-    json_message_free_tokens(parser);
+    g_array_free(parser->tokens, true);
+    g_string_free(parser->text, true);
 }
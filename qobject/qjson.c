@@ -28,7 +28,7 @@ typedef struct JSONParsingState
     Error *err;
 } JSONParsingState;
 
-static void parse_json(JSONMessageParser *parser, GQueue *tokens)
+static void parse_json(JSONMessageParser *parser, GArray *tokens)
 {
     JSONParsingState *s = container_of(parser, JSONParsingState, parser);
 
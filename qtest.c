@@ -731,6 +731,13 @@ void qtest_init(const char *qtest_chrdev, const char *qtest_log, Error **errp)
     inbuf = g_string_new("");
 }
 
+/* Stop serving the qtest protocol without closing the connection, e.g. in a
+ * child process that shares it with its parent.  */
+void qtest_server_detach(void)
+{
+    qemu_chr_fe_deinit(&qtest_chr, false);
+}
+
 bool qtest_driver(void)
 {
     return qtest_chr.chr != NULL;
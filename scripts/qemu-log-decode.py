@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+#
+# Decode a log file written with "-d binary" back to the text of
+# the usual "-d" output
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: qemu-log-decode.py [--threads] <log-file>
+#
+# Each thread writes its own records, so the file is made of chunks of
+# records from different threads.  Records are merged by timestamp; lines
+# that a thread logged under qemu_log_lock(), or a line built with several
+# qemu_log() calls, are kept together.
+
+import struct
+import sys
+import heapq
+
+file_magic = b'QEMULOG\0'
+file_version = 1
+
+REC_TEXT = 1
+REC_EXEC = 2
+REC_F_CONT = 1
+
+file_header_fmt = '8sII'
+rec_header_fmt = 'HHIIIQ'
+exec_fmt = 'QQiI'
+
+
+class LogDecodeError(Exception):
+    pass
+
+
+def read_header(f):
+    '''Check the file header, return the byte order of the records'''
+    hlen = struct.calcsize('=' + file_header_fmt)
+    data = f.read(hlen)
+    if len(data) != hlen:
+        raise LogDecodeError('file too short')
+    for order in '<>':
+        magic, version, _ = struct.unpack(order + file_header_fmt, data)
+        if magic != file_magic:
+            raise LogDecodeError('not a binary QEMU log')
+        if version == file_version:
+            return order
+    raise LogDecodeError('unsupported log version')
+
+
+def format_exec(payload, order):
+    elen = struct.calcsize(order + exec_fmt)
+    host_pc, pc, cpu_index, pc_bits = \
+        struct.unpack(order + exec_fmt, payload[:elen])
+    return ('Trace 0x%x [%d: %0*x] ' % (host_pc, cpu_index, pc_bits // 4, pc)
+            ).encode() + payload[elen:] + b'\n'
+
+
+def read_records(f, order):
+    '''Yield (thread, timestamp, flags, text) for each record'''
+    hdr_fmt = order + rec_header_fmt
+    hlen = struct.calcsize(hdr_fmt)
+    while True:
+        data = f.read(hlen)
+        if not data:
+            return
+        if len(data) != hlen:
+            raise LogDecodeError('truncated record header')
+        rtype, flags, length, thread, _, timestamp = \
+            struct.unpack(hdr_fmt, data)
+        payload = f.read(length)
+        if len(payload) != length:
+            raise LogDecodeError('truncated record')
+        if rtype == REC_TEXT:
+            text = payload
+        elif rtype == REC_EXEC:
+            text = format_exec(payload, order)
+        else:
+            raise LogDecodeError('unknown record type %d' % rtype)
+        yield thread, timestamp, flags, text
+
+
+def group_records(records):
+    '''Return, for each thread, a list of (timestamp, index, text) groups'''
+    threads = {}
+    index = 0
+    for thread, timestamp, flags, text in records:
+        groups = threads.setdefault(thread, [])
+        if groups and (flags & REC_F_CONT or not groups[-1][2].endswith(b'\n')):
+            ts, i, prev = groups[-1]
+            groups[-1] = (ts, i, prev + text)
+        else:
+            groups.append((timestamp, index, text))
+            index += 1
+    return threads
+
+
+def main(args):
+    show_threads = False
+    if args and args[0] == '--threads':
+        show_threads = True
+        args = args[1:]
+    if len(args) != 1:
+        sys.stderr.write('usage: %s [--threads] <log-file>\n' % sys.argv[0])
+        return 1
+
+    out = getattr(sys.stdout, 'buffer', sys.stdout)
+    try:
+        with open(args[0], 'rb') as f:
+            order = read_header(f)
+            threads = group_records(read_records(f, order))
+    except (IOError, LogDecodeError) as e:
+        sys.stderr.write('%s: %s\n' % (args[0], e))
+        return 1
+
+    streams = [[(ts, i, thread, text) for ts, i, text in groups]
+               for thread, groups in threads.items()]
+    for ts, i, thread, text in heapq.merge(*streams):
+        if show_threads:
+            out.write(('[%d] ' % thread).encode())
+        out.write(text)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
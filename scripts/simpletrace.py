@@ -12,6 +12,8 @@
 import struct
 import re
 import inspect
+import gzip
+import heapq
 from tracetool import read_events, Event
 from tracetool.backend.simple import is_string
 
@@ -22,6 +24,11 @@ dropped_event_id = 0xfffffffffffffffe
 record_type_mapping = 0
 record_type_event = 1
 
+# Each thread traces to its own buffer.  QEMU merges the buffers by
+# timestamp as it writes them out, but a record that was still being
+# written can land after newer records from other threads.
+reorder_window = 65536
+
 log_header_fmt = '=QQQ'
 rec_header_fmt = '=QQII'
 
@@ -122,6 +129,29 @@ def read_trace_records(edict, idtoname, fobj):
 
             yield rec
 
+def sort_trace_records(records, window=reorder_window):
+    """Yield trace records in timestamp order, provided no record is more
+    than `window` records away from its place."""
+    heap = []
+    seq = 0
+    for rec in records:
+        heapq.heappush(heap, (rec[1], seq, rec))
+        seq += 1
+        if len(heap) > window:
+            yield heapq.heappop(heap)[2]
+    while heap:
+        yield heapq.heappop(heap)[2]
+
+def open_trace_file(filename):
+    """Open a trace file, compressed or not."""
+    fobj = open(filename, 'rb')
+    magic = fobj.read(2)
+    fobj.seek(0)
+    if magic == b'\x1f\x8b':
+        fobj.close()
+        fobj = gzip.open(filename, 'rb')
+    return fobj
+
 class Analyzer(object):
     """A trace file analyzer which processes trace records.
 
@@ -170,7 +200,7 @@ def process(events, log, analyzer, read_header=True):
     if isinstance(events, str):
         events = read_events(open(events, 'r'))
     if isinstance(log, str):
-        log = open(log, 'rb')
+        log = open_trace_file(log)
 
     if read_header:
         read_trace_header(log)
@@ -209,7 +239,7 @@ def process(events, log, analyzer, read_header=True):
 
     analyzer.begin()
     fn_cache = {}
-    for rec in read_trace_records(edict, idtoname, log):
+    for rec in sort_trace_records(read_trace_records(edict, idtoname, log)):
         event_num = rec[0]
         event = edict[event_num]
         if event_num not in fn_cache:
@@ -18,19 +18,52 @@
 #include "qemu/osdep.h"
 #include "slirp.h"
 
-#define MBUF_THRESH 30
-
 /*
  * Find a nice value for msize
  */
 #define SLIRP_MSIZE\
     (offsetof(struct mbuf, m_dat) + IF_MAXLINKHDR + TCPIPHDR_DELTA + IF_MTU)
 
+/*
+ * mbufs are carved out of slabs of MBUF_SLAB_SIZE, which are only freed
+ * by m_cleanup(); a TCP window worth of segments in flight then costs no
+ * allocation per packet.  Past MBUF_THRESH mbufs, single mbufs are
+ * allocated with M_DOFREE so that a burst does not pin memory forever.
+ */
+#define MBUF_SLAB_SIZE 64
+#define MBUF_THRESH (8 * MBUF_SLAB_SIZE)
+#define MBUF_STRIDE ROUND_UP(SLIRP_MSIZE, sizeof(uint64_t))
+
+struct mbuf_slab {
+    struct mbuf_slab *next;
+    uint64_t data[];
+};
+
+static void m_slab_new(Slirp *slirp)
+{
+    struct mbuf_slab *slab;
+    struct mbuf *m;
+    int i;
+
+    slab = g_malloc(sizeof(*slab) + MBUF_SLAB_SIZE * MBUF_STRIDE);
+    slab->next = slirp->mbuf_slabs;
+    slirp->mbuf_slabs = slab;
+
+    for (i = 0; i < MBUF_SLAB_SIZE; i++) {
+        m = (struct mbuf *)((char *)slab->data + i * MBUF_STRIDE);
+        m->slirp = slirp;
+        m->m_flags = M_FREELIST;
+        insque(m, &slirp->m_freelist);
+    }
+    slirp->mbuf_alloced += MBUF_SLAB_SIZE;
+}
+
 void
 m_init(Slirp *slirp)
 {
     slirp->m_freelist.qh_link = slirp->m_freelist.qh_rlink = &slirp->m_freelist;
     slirp->m_usedlist.qh_link = slirp->m_usedlist.qh_rlink = &slirp->m_usedlist;
+    m_slab_new(slirp);
 }
 
 void m_cleanup(Slirp *slirp)
@@ -43,24 +76,28 @@ void m_cleanup(Slirp *slirp)
         if (m->m_flags & M_EXT) {
             g_free(m->m_ext);
         }
-        g_free(m);
+        if (m->m_flags & M_DOFREE) {
+            g_free(m);
+        }
         m = next;
     }
-    m = (struct mbuf *) slirp->m_freelist.qh_link;
-    while ((struct quehead *) m != &slirp->m_freelist) {
-        next = m->m_next;
-        g_free(m);
-        m = next;
+
+    /* Only slab mbufs are on the free list */
+    while (slirp->mbuf_slabs) {
+        struct mbuf_slab *slab = slirp->mbuf_slabs;
+
+        slirp->mbuf_slabs = slab->next;
+        g_free(slab);
     }
 }
 
 /*
  * Get an mbuf from the free list, if there are none
- * allocate one
+ * allocate a new slab of them
  *
  * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually g_free() it
+ * free old mbufs, mbufs above MBUF_THRESH are allocated one by
+ * one and marked M_DOFREE, which tells m_free to actually g_free() it
  */
 struct mbuf *
 m_get(Slirp *slirp)
@@ -70,11 +107,14 @@ m_get(Slirp *slirp)
 
 	DEBUG_CALL("m_get");
 
+	if (slirp->m_freelist.qh_link == &slirp->m_freelist &&
+	    slirp->mbuf_alloced < MBUF_THRESH) {
+		m_slab_new(slirp);
+	}
 	if (slirp->m_freelist.qh_link == &slirp->m_freelist) {
                 m = g_malloc(SLIRP_MSIZE);
 		slirp->mbuf_alloced++;
-		if (slirp->mbuf_alloced > MBUF_THRESH)
-			flags = M_DOFREE;
+		flags = M_DOFREE;
 		m->slirp = slirp;
 	} else {
 		m = (struct mbuf *) slirp->m_freelist.qh_link;
@@ -178,6 +178,7 @@ struct Slirp {
     /* mbuf states */
     struct quehead m_freelist;
     struct quehead m_usedlist;
+    struct mbuf_slab *mbuf_slabs;
     int mbuf_alloced;
 
     /* if states */
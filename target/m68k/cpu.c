@@ -24,6 +24,7 @@
 #include "qemu-common.h"
 #include "migration/vmstate.h"
 #include "exec/exec-all.h"
+#include "hw/qdev-properties.h"
 
 
 static void m68k_cpu_set_pc(CPUState *cs, vaddr value)
@@ -68,6 +69,7 @@ static void m68k_cpu_reset(CPUState *s)
     cpu_m68k_set_ccr(env, 0);
     /* TODO: We should set PC from the interrupt vector.  */
     env->pc = 0;
+    m68k_update_code_coherency(env);
 }
 
 static void m68k_cpu_disas_set_info(CPUState *s, disassemble_info *info)
@@ -136,7 +138,15 @@ static void m68020_cpu_initfn(Object *obj)
     m68k_set_feature(env, M68K_FEATURE_RTD);
 }
 #define m68030_cpu_initfn m68020_cpu_initfn
-#define m68040_cpu_initfn m68020_cpu_initfn
+
+static void m68040_cpu_initfn(Object *obj)
+{
+    M68kCPU *cpu = M68K_CPU(obj);
+    CPUM68KState *env = &cpu->env;
+
+    m68020_cpu_initfn(obj);
+    m68k_set_feature(env, M68K_FEATURE_M68040);
+}
 
 static void m68060_cpu_initfn(Object *obj)
 {
@@ -156,6 +166,7 @@ static void m68060_cpu_initfn(Object *obj)
     m68k_set_feature(env, M68K_FEATURE_CAS);
     m68k_set_feature(env, M68K_FEATURE_BKPT);
     m68k_set_feature(env, M68K_FEATURE_RTD);
+    m68k_set_feature(env, M68K_FEATURE_M68040);
 }
 
 static void m5208_cpu_initfn(Object *obj)
@@ -209,6 +220,14 @@ static void m68k_cpu_realizefn(DeviceState *dev, Error **errp)
     M68kCPUClass *mcc = M68K_CPU_GET_CLASS(dev);
     Error *local_err = NULL;
 
+    if (cpu->explicit_icache_sync &&
+        !m68k_feature(&cpu->env, M68K_FEATURE_CF_ISA_A) &&
+        !m68k_feature(&cpu->env, M68K_FEATURE_M68040)) {
+        error_setg(errp, "x-explicit-icache-sync needs a CPU with cache "
+                   "maintenance instructions (68040, 68060 or ColdFire)");
+        return;
+    }
+
     register_m68k_insns(&cpu->env);
 
     cpu_exec_realizefn(cs, &local_err);
@@ -239,6 +258,12 @@ static const VMStateDescription vmstate_m68k_cpu = {
     .unmigratable = 1,
 };
 
+static Property m68k_cpu_properties[] = {
+    DEFINE_PROP_BOOL("x-explicit-icache-sync", M68kCPU, explicit_icache_sync,
+                     false),
+    DEFINE_PROP_END_OF_LIST()
+};
+
 static void m68k_cpu_class_init(ObjectClass *c, void *data)
 {
     M68kCPUClass *mcc = M68K_CPU_CLASS(c);
@@ -247,6 +272,7 @@ static void m68k_cpu_class_init(ObjectClass *c, void *data)
 
     mcc->parent_realize = dc->realize;
     dc->realize = m68k_cpu_realizefn;
+    dc->props = m68k_cpu_properties;
 
     mcc->parent_reset = cc->reset;
     cc->reset = m68k_cpu_reset;
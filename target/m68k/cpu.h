@@ -69,6 +69,11 @@
 #define EXCP_HALT_INSN      0x101
 
 #define NB_MMU_MODES 2
+
+/* Sequential runs of TLB misses tracked, and pages refilled per miss
+   once a run is detected.  See m68k_cpu_handle_mmu_fault.  */
+#define M68K_TLB_FILL_STREAMS 4
+#define M68K_TLB_FILL_PAGES   32
 #define TARGET_INSN_START_EXTRA_WORDS 1
 
 typedef CPU_LDoubleU FPReg;
@@ -108,6 +113,14 @@ typedef struct CPUM68KState {
     /* MMU status.  */
     struct {
         uint32_t ar;
+        uint32_t tcr;
+        uint32_t urp;
+        uint32_t srp;
+        uint32_t mmusr;
+        uint32_t ttr[4];
+        /* Page following each recent sequential run of TLB refills.  */
+        uint32_t fill_next[M68K_TLB_FILL_STREAMS];
+        unsigned int fill_victim;
     } mmu;
 
     /* Control registers.  */
@@ -115,6 +128,11 @@ typedef struct CPUM68KState {
     uint32_t mbar;
     uint32_t rambar0;
     uint32_t cacr;
+    uint32_t sfc;
+    uint32_t dfc;
+    uint32_t msp;
+    uint32_t buscr;
+    uint32_t pcr;
 
     int pending_vector;
     int pending_level;
@@ -142,6 +160,10 @@ struct M68kCPU {
     /*< public >*/
 
     CPUM68KState env;
+
+    /* Honour the guest's instruction cache maintenance instead of
+     * write-protecting translated code while its icache is enabled.  */
+    bool explicit_icache_sync;
 };
 
 static inline M68kCPU *m68k_env_get_cpu(CPUM68KState *env)
@@ -276,6 +298,36 @@ typedef enum {
 /* CACR fields are implementation defined, but some bits are common.  */
 #define M68K_CACR_EUSP  0x10
 
+/* 68040 CACR.  */
+#define M68K_CACR_IE    0x00008000 /* Instruction cache enable.  */
+
+/* ColdFire CACR.  */
+#define CF_CACR_CENB    0x80000000 /* Cache enable.  */
+#define CF_CACR_CINV    0x01000000 /* Cache invalidate.  */
+#define CF_CACR_DISI    0x00800000 /* Disable instruction caching.  */
+
+/* 68040/68060 MOVEC control registers.  */
+#define M68K_CR_SFC     0x000
+#define M68K_CR_DFC     0x001
+#define M68K_CR_CACR    0x002
+#define M68K_CR_TC      0x003
+#define M68K_CR_ITT0    0x004
+#define M68K_CR_ITT1    0x005
+#define M68K_CR_DTT0    0x006
+#define M68K_CR_DTT1    0x007
+#define M68K_CR_BUSCR   0x008   /* 68060 */
+#define M68K_CR_USP     0x800
+#define M68K_CR_VBR     0x801
+#define M68K_CR_MSP     0x803   /* 68040 */
+#define M68K_CR_ISP     0x804   /* 68040 */
+#define M68K_CR_MMUSR   0x805   /* 68040 */
+#define M68K_CR_URP     0x806
+#define M68K_CR_SRP     0x807
+#define M68K_CR_PCR     0x808   /* 68060 */
+
+/* 68040/68060 TCR.  */
+#define M68K_TCR_PAGE_8K 0x4000    /* 8K pages rather than 4K.  */
+
 #define MACSR_PAV0  0x100
 #define MACSR_OMC   0x080
 #define MACSR_SU    0x040
@@ -288,6 +340,8 @@ typedef enum {
 
 void m68k_set_irq_level(M68kCPU *cpu, int level, uint8_t vector);
 void m68k_switch_sp(CPUM68KState *env);
+void m68k_update_code_coherency(CPUM68KState *env);
+bool m68k_movec_valid(int reg);
 
 void do_m68k_semihosting(CPUM68KState *env, int nr);
 
@@ -317,6 +371,7 @@ enum m68k_features {
     M68K_FEATURE_CAS,
     M68K_FEATURE_BKPT,
     M68K_FEATURE_RTD,
+    M68K_FEATURE_M68040, /* 68040/68060 CINV, CPUSH, MOVEC and TCR.  */
 };
 
 static inline int m68k_feature(CPUM68KState *env, int feature)
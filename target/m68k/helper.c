@@ -179,6 +179,12 @@ void HELPER(movec)(CPUM68KState *env, uint32_t reg, uint32_t val)
     case 0x02: /* CACR */
         env->cacr = val;
         m68k_switch_sp(env);
+        m68k_update_code_coherency(env);
+        if (m68k_feature(env, M68K_FEATURE_CF_ISA_A)
+            && (val & CF_CACR_CINV)
+            && CPU(cpu)->explicit_code_coherency) {
+            tb_flush(CPU(cpu));
+        }
         break;
     case 0x04: case 0x05: case 0x06: case 0x07: /* ACR[0-3] */
         /* TODO: Implement Access Control Registers.  */
@@ -193,6 +199,111 @@ void HELPER(movec)(CPUM68KState *env, uint32_t reg, uint32_t val)
     }
 }
 
+/* 68040/68060 MOVEC.  The translator has already rejected the registers
+ * that m68k_movec_valid() does not know about.  Address translation is not
+ * implemented, so the MMU registers are only stored, except for the page
+ * size in TC.
+ */
+bool m68k_movec_valid(int reg)
+{
+    switch (reg) {
+    case M68K_CR_SFC: case M68K_CR_DFC: case M68K_CR_CACR: case M68K_CR_TC:
+    case M68K_CR_ITT0: case M68K_CR_ITT1: case M68K_CR_DTT0: case M68K_CR_DTT1:
+    case M68K_CR_BUSCR: case M68K_CR_USP: case M68K_CR_VBR: case M68K_CR_MSP:
+    case M68K_CR_ISP: case M68K_CR_MMUSR: case M68K_CR_URP: case M68K_CR_SRP:
+    case M68K_CR_PCR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void HELPER(m68k_movec_to)(CPUM68KState *env, uint32_t reg, uint32_t val)
+{
+    switch (reg) {
+    case M68K_CR_SFC:
+        env->sfc = val & 7;
+        break;
+    case M68K_CR_DFC:
+        env->dfc = val & 7;
+        break;
+    case M68K_CR_CACR:
+        env->cacr = val;
+        m68k_update_code_coherency(env);
+        break;
+    case M68K_CR_TC:
+        env->mmu.tcr = val;
+        break;
+    case M68K_CR_ITT0: case M68K_CR_ITT1: case M68K_CR_DTT0: case M68K_CR_DTT1:
+        env->mmu.ttr[reg - M68K_CR_ITT0] = val;
+        break;
+    case M68K_CR_BUSCR:
+        env->buscr = val;
+        break;
+    case M68K_CR_USP:
+        /* MOVEC is privileged, so the USP is never the active A7.  */
+        env->sp[M68K_USP] = val;
+        break;
+    case M68K_CR_VBR:
+        env->vbr = val;
+        break;
+    case M68K_CR_MSP:
+        /* SR.M is not implemented: the master stack is never active.  */
+        env->msp = val;
+        break;
+    case M68K_CR_ISP:
+        env->aregs[7] = val;
+        break;
+    case M68K_CR_MMUSR:
+        env->mmu.mmusr = val;
+        break;
+    case M68K_CR_URP:
+        env->mmu.urp = val;
+        break;
+    case M68K_CR_SRP:
+        env->mmu.srp = val;
+        break;
+    case M68K_CR_PCR:
+        env->pcr = val;
+        break;
+    }
+}
+
+uint32_t HELPER(m68k_movec_from)(CPUM68KState *env, uint32_t reg)
+{
+    switch (reg) {
+    case M68K_CR_SFC:
+        return env->sfc;
+    case M68K_CR_DFC:
+        return env->dfc;
+    case M68K_CR_CACR:
+        return env->cacr;
+    case M68K_CR_TC:
+        return env->mmu.tcr;
+    case M68K_CR_ITT0: case M68K_CR_ITT1: case M68K_CR_DTT0: case M68K_CR_DTT1:
+        return env->mmu.ttr[reg - M68K_CR_ITT0];
+    case M68K_CR_BUSCR:
+        return env->buscr;
+    case M68K_CR_USP:
+        return env->sp[M68K_USP];
+    case M68K_CR_VBR:
+        return env->vbr;
+    case M68K_CR_MSP:
+        return env->msp;
+    case M68K_CR_ISP:
+        return env->aregs[7];
+    case M68K_CR_MMUSR:
+        return env->mmu.mmusr;
+    case M68K_CR_URP:
+        return env->mmu.urp;
+    case M68K_CR_SRP:
+        return env->mmu.srp;
+    case M68K_CR_PCR:
+        return env->pcr;
+    }
+    return 0;
+}
+
 void HELPER(set_macsr)(CPUM68KState *env, uint32_t val)
 {
     uint32_t acc;
@@ -227,13 +338,70 @@ void HELPER(set_macsr)(CPUM68KState *env, uint32_t val)
     env->macsr = val;
 }
 
+static bool m68k_icache_enabled(CPUM68KState *env)
+{
+    if (m68k_feature(env, M68K_FEATURE_CF_ISA_A)) {
+        return (env->cacr & (CF_CACR_CENB | CF_CACR_DISI)) == CF_CACR_CENB;
+    }
+    return env->cacr & M68K_CACR_IE;
+}
+
+/* Stop write-protecting translated code while the guest has asked for
+ * explicit instruction cache maintenance and has its icache enabled; from
+ * then on, stale TBs are only dropped by CINV/CPUSH and CACR invalidates.
+ */
+void m68k_update_code_coherency(CPUM68KState *env)
+{
+    M68kCPU *cpu = m68k_env_get_cpu(env);
+    CPUState *cs = CPU(cpu);
+    bool enable = cpu->explicit_icache_sync && m68k_icache_enabled(env);
+
+    if (cs->explicit_code_coherency != enable) {
+        cs->explicit_code_coherency = enable;
+        /* Pages holding existing TBs may or may not be protected.  */
+        tb_flush(cs);
+    }
+}
+
+/* CINV, CPUSH and CPUSHL on the instruction cache.  @scope is 1 for a line,
+ * 2 for a page and 3 for the whole cache; @addr is physical.  A page is the
+ * MMU page selected by TCR, not TARGET_PAGE_SIZE.
+ */
+void HELPER(cinv)(CPUM68KState *env, uint32_t addr, uint32_t scope)
+{
+    CPUState *cs = CPU(m68k_env_get_cpu(env));
+    uint32_t page_size = env->mmu.tcr & M68K_TCR_PAGE_8K ? 8192 : 4096;
+
+    /* Otherwise code writes have already invalidated the TBs.  */
+    if (!cs->explicit_code_coherency) {
+        return;
+    }
+    switch (scope) {
+    case 1:
+        tb_invalidate_phys_addr_range(cs->as, addr & ~15, 16);
+        break;
+    case 2:
+        tb_invalidate_phys_addr_range(cs->as, addr & ~(page_size - 1),
+                                      page_size);
+        break;
+    case 3:
+        tb_flush(cs);
+        break;
+    }
+}
+
 void m68k_switch_sp(CPUM68KState *env)
 {
     int new_sp;
 
     env->sp[env->current_sp] = env->aregs[7];
-    new_sp = (env->sr & SR_S && env->cacr & M68K_CACR_EUSP)
-             ? M68K_SSP : M68K_USP;
+    if (m68k_feature(env, M68K_FEATURE_M68000)) {
+        /* 680x0 supervisor mode always has its own stack.  */
+        new_sp = env->sr & SR_S ? M68K_SSP : M68K_USP;
+    } else {
+        new_sp = (env->sr & SR_S && env->cacr & M68K_CACR_EUSP)
+                 ? M68K_SSP : M68K_USP;
+    }
     env->aregs[7] = env->sp[new_sp];
     env->current_sp = new_sp;
 }
@@ -260,14 +428,42 @@ hwaddr m68k_cpu_get_phys_page_debug(CPUState *cs, vaddr addr)
     return addr;
 }
 
+/* Without an MMU every page maps to itself, but the TLB still holds
+   one 1K page per entry, so a guest streaming through a buffer takes a
+   refill per page.  When a miss continues a run that an earlier refill
+   ended, install the next M68K_TLB_FILL_PAGES pages at once.  A few runs
+   are tracked so that a copy's source and destination both qualify.  */
 int m68k_cpu_handle_mmu_fault(CPUState *cs, vaddr address, int rw,
                               int mmu_idx)
 {
-    int prot;
+    CPUM68KState *env = &M68K_CPU(cs)->env;
+    int prot, pages, i;
 
     address &= TARGET_PAGE_MASK;
     prot = PAGE_READ | PAGE_WRITE | PAGE_EXEC;
-    tlb_set_page(cs, address, address, prot, mmu_idx, TARGET_PAGE_SIZE);
+
+    for (i = 0; i < M68K_TLB_FILL_STREAMS; i++) {
+        if (env->mmu.fill_next[i] == address) {
+            break;
+        }
+    }
+    if (i < M68K_TLB_FILL_STREAMS) {
+        pages = MIN(M68K_TLB_FILL_PAGES,
+                    ((1ULL << TARGET_VIRT_ADDR_SPACE_BITS) - address)
+                    >> TARGET_PAGE_BITS);
+    } else {
+        i = env->mmu.fill_victim++ % M68K_TLB_FILL_STREAMS;
+        pages = 1;
+    }
+    env->mmu.fill_next[i] = address + pages * TARGET_PAGE_SIZE;
+
+    /* The pages land in distinct TLB slots, so the faulting entry
+       stays in place.  */
+    QEMU_BUILD_BUG_ON(M68K_TLB_FILL_PAGES > CPU_TLB_SIZE);
+    while (pages--) {
+        tlb_set_page(cs, address, address, prot, mmu_idx, TARGET_PAGE_SIZE);
+        address += TARGET_PAGE_SIZE;
+    }
     return 0;
 }
 
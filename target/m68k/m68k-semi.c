@@ -27,6 +27,10 @@
 #include "qemu-common.h"
 #include "exec/gdbstub.h"
 #include "exec/softmmu-semi.h"
+#include "exec/semihost.h"
+#include "exec/address-spaces.h"
+#include "qemu/timer.h"
+#include "sysemu/fork-server.h"
 #endif
 #include "qemu/log.h"
 #include "sysemu/sysemu.h"
@@ -45,6 +49,8 @@
 #define HOSTED_GETTIMEOFDAY 11
 #define HOSTED_ISATTY 12
 #define HOSTED_SYSTEM 13
+/* QEMU extension: fork test cases from here, see x-fork-server.  */
+#define HOSTED_FORK_CHECKPOINT 0x100
 
 typedef uint32_t gdb_mode_t;
 typedef uint32_t gdb_time_t;
@@ -154,6 +160,333 @@ static void m68k_semi_return_u64(CPUM68KState *env, uint64_t ret, uint32_t err)
 
 static int m68k_semi_is_fseek;
 
+#if !defined(CONFIG_USER_ONLY)
+/*
+ * Host-side streams for semihosted file descriptors.  A guest that prints
+ * one character per call, or reads a file in small pieces, would otherwise
+ * pay for a trap and a host system call every time.  Buffered writes reach
+ * the host when the buffer fills, when the descriptor is read, sought,
+ * stat'ed or closed, when the guest exits, and at most
+ * M68K_SEMI_FLUSH_MS later; terminals are also flushed at each newline.
+ * Write errors found while flushing are reported by the next call.
+ */
+#define M68K_SEMI_BUF_SIZE  (64 * 1024)
+#define M68K_SEMI_FLUSH_MS  50
+
+typedef struct M68kSemiStream {
+    int fd;
+    bool tty;
+    bool writing;           /* buf holds pending output, else read-ahead */
+    int error;              /* errno of a failed deferred write */
+    uint32_t pos;
+    uint32_t len;
+    uint8_t buf[M68K_SEMI_BUF_SIZE];
+} M68kSemiStream;
+
+static GHashTable *m68k_semi_streams;
+static QEMUTimer *m68k_semi_flush_timer;
+
+static void m68k_semi_flush(M68kSemiStream *s)
+{
+    uint32_t done = 0;
+    ssize_t ret;
+
+    while (s->writing && done < s->len) {
+        ret = write(s->fd, s->buf + done, s->len - done);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            s->error = errno;
+            break;
+        }
+        done += ret;
+    }
+    s->pos = s->len = 0;
+}
+
+/* Give back read-ahead so that the host file offset matches the guest's.  */
+static void m68k_semi_unread(M68kSemiStream *s)
+{
+    if (!s->writing && s->pos < s->len) {
+        lseek(s->fd, (off_t)s->pos - s->len, SEEK_CUR);
+    }
+    s->pos = s->len = 0;
+}
+
+static void m68k_semi_sync(M68kSemiStream *s)
+{
+    if (s->writing) {
+        m68k_semi_flush(s);
+    } else {
+        m68k_semi_unread(s);
+    }
+}
+
+static void m68k_semi_flush_one(gpointer key, gpointer value, gpointer opaque)
+{
+    m68k_semi_flush(value);
+}
+
+static void m68k_semi_flush_all(void)
+{
+    if (m68k_semi_streams) {
+        g_hash_table_foreach(m68k_semi_streams, m68k_semi_flush_one, NULL);
+    }
+}
+
+static void m68k_semi_flush_timer_cb(void *opaque)
+{
+    m68k_semi_flush_all();
+}
+
+static void m68k_semi_flush_atexit(void)
+{
+    m68k_semi_flush_all();
+}
+
+static void m68k_semi_flush_before_fork(Notifier *n, void *unused)
+{
+    m68k_semi_flush_all();
+}
+
+static Notifier m68k_semi_fork_notifier = {
+    .notify = m68k_semi_flush_before_fork,
+};
+
+static M68kSemiStream *m68k_semi_stream(int fd)
+{
+    M68kSemiStream *s;
+
+    if (!semihosting_buffered() || fd < 0) {
+        return NULL;
+    }
+    if (!m68k_semi_streams) {
+        m68k_semi_streams = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+        m68k_semi_flush_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                             m68k_semi_flush_timer_cb, NULL);
+        atexit(m68k_semi_flush_atexit);
+        fork_server_add_prepare_notifier(&m68k_semi_fork_notifier);
+    }
+    s = g_hash_table_lookup(m68k_semi_streams, GINT_TO_POINTER(fd));
+    if (!s) {
+        s = g_new0(M68kSemiStream, 1);
+        s->fd = fd;
+        s->tty = isatty(fd);
+        g_hash_table_insert(m68k_semi_streams, GINT_TO_POINTER(fd), s);
+    }
+    return s;
+}
+
+/* Flush and forget the stream of @fd; returns a pending write error.  */
+static int m68k_semi_release(int fd)
+{
+    M68kSemiStream *s;
+    int err;
+
+    if (!m68k_semi_streams) {
+        return 0;
+    }
+    s = g_hash_table_lookup(m68k_semi_streams, GINT_TO_POINTER(fd));
+    if (!s) {
+        return 0;
+    }
+    m68k_semi_sync(s);
+    err = s->error;
+    g_hash_table_remove(m68k_semi_streams, GINT_TO_POINTER(fd));
+    return err;
+}
+
+/* Report, and clear, an error left behind by a deferred write.  */
+static bool m68k_semi_error(M68kSemiStream *s)
+{
+    if (s->error) {
+        errno = s->error;
+        s->error = 0;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Map a guest buffer that is contiguous in guest RAM so the host can
+ * read or write it in place.  Returns NULL if it is not.
+ */
+static void *m68k_semi_map(CPUM68KState *env, target_ulong addr,
+                           uint32_t len, bool is_write)
+{
+    CPUState *cs = CPU(m68k_env_get_cpu(env));
+    hwaddr phys, plen = len;
+    target_ulong page;
+    void *p;
+
+    phys = cpu_get_phys_page_debug(cs, addr & TARGET_PAGE_MASK);
+    if (phys == -1) {
+        return NULL;
+    }
+    phys += addr & ~TARGET_PAGE_MASK;
+    for (page = (addr & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+         page - addr < len; page += TARGET_PAGE_SIZE) {
+        if (cpu_get_phys_page_debug(cs, page) != phys + (page - addr)) {
+            return NULL;
+        }
+    }
+    p = address_space_map(cs->as, phys, &plen, is_write);
+    if (p && plen < len) {
+        address_space_unmap(cs->as, p, plen, is_write, 0);
+        return NULL;
+    }
+    return p;
+}
+
+static void m68k_semi_unmap(CPUM68KState *env, void *p, uint32_t len,
+                            bool is_write, uint32_t done)
+{
+    CPUState *cs = CPU(m68k_env_get_cpu(env));
+
+    address_space_unmap(cs->as, p, len, is_write, done);
+}
+
+static uint32_t m68k_semi_read(CPUM68KState *env, M68kSemiStream *s,
+                               target_ulong addr, uint32_t len)
+{
+    CPUState *cs = CPU(m68k_env_get_cpu(env));
+    ssize_t ret;
+    void *p;
+
+    if (s->writing) {
+        m68k_semi_flush(s);
+        s->writing = false;
+    }
+    if (m68k_semi_error(s)) {
+        return -1;
+    }
+    /* Make prompts visible before waiting for input.  */
+    if (s->tty || s->fd == STDIN_FILENO) {
+        m68k_semi_flush_all();
+    }
+
+    if (s->pos == s->len && len >= M68K_SEMI_BUF_SIZE) {
+        p = m68k_semi_map(env, addr, len, true);
+        if (p) {
+            ret = read(s->fd, p, len);
+            m68k_semi_unmap(env, p, len, true, ret > 0 ? ret : 0);
+            return ret;
+        }
+    }
+
+    if (s->pos == s->len) {
+        /* Never read ahead of what an interactive guest asked for.  */
+        ret = read(s->fd, s->buf,
+                   s->tty ? MIN(len, M68K_SEMI_BUF_SIZE) : M68K_SEMI_BUF_SIZE);
+        if (ret <= 0) {
+            return ret;
+        }
+        s->pos = 0;
+        s->len = ret;
+    }
+    len = MIN(len, s->len - s->pos);
+    if (cpu_memory_rw_debug(cs, addr, s->buf + s->pos, len, 1)) {
+        /* The data stays buffered for the next read.  */
+        errno = EFAULT;
+        return -1;
+    }
+    s->pos += len;
+    return len;
+}
+
+static uint32_t m68k_semi_write(CPUM68KState *env, M68kSemiStream *s,
+                                target_ulong addr, uint32_t len)
+{
+    CPUState *cs = CPU(m68k_env_get_cpu(env));
+    ssize_t ret;
+    void *p;
+
+    if (!s->writing) {
+        m68k_semi_unread(s);
+        s->writing = true;
+    }
+    if (m68k_semi_error(s)) {
+        return -1;
+    }
+
+    if (s->len + len > M68K_SEMI_BUF_SIZE) {
+        m68k_semi_flush(s);
+        if (m68k_semi_error(s)) {
+            return -1;
+        }
+    }
+
+    if (len >= M68K_SEMI_BUF_SIZE) {
+        p = m68k_semi_map(env, addr, len, false);
+        if (p) {
+            ret = write(s->fd, p, len);
+            m68k_semi_unmap(env, p, len, false, len);
+        } else {
+            p = g_malloc(len);
+            if (cpu_memory_rw_debug(cs, addr, p, len, 0)) {
+                errno = EFAULT;
+                ret = -1;
+            } else {
+                ret = write(s->fd, p, len);
+            }
+            g_free(p);
+        }
+        return ret;
+    }
+
+    if (cpu_memory_rw_debug(cs, addr, s->buf + s->len, len, 0)) {
+        errno = EFAULT;
+        return -1;
+    }
+    s->len += len;
+    if (s->tty && memchr(s->buf + s->len - len, '\n', len)) {
+        m68k_semi_flush(s);
+    } else if (!timer_pending(m68k_semi_flush_timer)) {
+        timer_mod(m68k_semi_flush_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + M68K_SEMI_FLUSH_MS);
+    }
+    return len;
+}
+#else
+typedef struct M68kSemiStream M68kSemiStream;
+
+static inline M68kSemiStream *m68k_semi_stream(int fd)
+{
+    return NULL;
+}
+
+static inline int m68k_semi_release(int fd)
+{
+    return 0;
+}
+
+static inline void m68k_semi_flush_all(void)
+{
+}
+
+static inline void m68k_semi_sync(M68kSemiStream *s)
+{
+}
+
+static inline bool m68k_semi_error(M68kSemiStream *s)
+{
+    return false;
+}
+
+static inline uint32_t m68k_semi_read(CPUM68KState *env, M68kSemiStream *s,
+                                      target_ulong addr, uint32_t len)
+{
+    g_assert_not_reached();
+}
+
+static inline uint32_t m68k_semi_write(CPUM68KState *env, M68kSemiStream *s,
+                                       target_ulong addr, uint32_t len)
+{
+    g_assert_not_reached();
+}
+#endif
+
 static void m68k_semi_cb(CPUState *cs, target_ulong ret, target_ulong err)
 {
     M68kCPU *cpu = M68K_CPU(cs);
@@ -169,6 +502,14 @@ static void m68k_semi_cb(CPUState *cs, target_ulong ret, target_ulong err)
     }
 }
 
+#if !defined(CONFIG_USER_ONLY)
+/* Hand each forked child its case number, and the parent -1.  */
+static void m68k_semi_fork_case(int64_t index, void *opaque)
+{
+    m68k_semi_return_u32(opaque, index, 0);
+}
+#endif
+
 /* Read the input value from the argument block; fail the semihosting
  * call if the memory read fails.
  */
@@ -188,10 +529,12 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
     void *q;
     uint32_t len;
     uint32_t result;
+    M68kSemiStream *s;
 
     args = env->dregs[1];
     switch (nr) {
     case HOSTED_EXIT:
+        m68k_semi_flush_all();
         gdb_exit(env, env->dregs[0]);
         exit(env->dregs[0]);
     case HOSTED_OPEN:
@@ -224,10 +567,22 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
                     gdb_do_syscall(m68k_semi_cb, "close,%x", arg0);
                     return;
                 } else {
+                    int err = m68k_semi_release(fd);
                     result = close(fd);
+                    if (err) {
+                        result = -1;
+                        errno = err;
+                    }
                 }
             } else {
+                s = m68k_semi_stream(fd);
+                if (s) {
+                    m68k_semi_sync(s);
+                }
                 result = 0;
+                if (s && m68k_semi_error(s)) {
+                    result = -1;
+                }
             }
             break;
         }
@@ -240,6 +595,8 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
             gdb_do_syscall(m68k_semi_cb, "read,%x,%x,%x",
                            arg0, arg1, len);
             return;
+        } else if ((s = m68k_semi_stream(arg0)) != NULL) {
+            result = m68k_semi_read(env, s, arg1, len);
         } else {
             p = lock_user(VERIFY_WRITE, arg1, len, 0);
             if (!p) {
@@ -260,6 +617,8 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
             gdb_do_syscall(m68k_semi_cb, "write,%x,%x,%x",
                            arg0, arg1, len);
             return;
+        } else if ((s = m68k_semi_stream(arg0)) != NULL) {
+            result = m68k_semi_write(env, s, arg1, len);
         } else {
             p = lock_user(VERIFY_READ, arg1, len, 1);
             if (!p) {
@@ -284,6 +643,10 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
                 gdb_do_syscall(m68k_semi_cb, "fseek,%x,%lx,%x",
                                arg0, off, arg3);
             } else {
+                s = m68k_semi_stream(arg0);
+                if (s) {
+                    m68k_semi_sync(s);
+                }
                 off = lseek(arg0, off, arg3);
                 m68k_semi_return_u64(env, off, errno);
             }
@@ -360,10 +723,14 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
                            arg0, arg1);
             return;
         } else {
-            struct stat s;
-            result = fstat(arg0, &s);
+            struct stat st;
+            s = m68k_semi_stream(arg0);
+            if (s) {
+                m68k_semi_sync(s);
+            }
+            result = fstat(arg0, &st);
             if (result == 0) {
-                translate_stat(env, arg1, &s);
+                translate_stat(env, arg1, &st);
             }
         }
         break;
@@ -408,6 +775,7 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
                            arg0, (int)arg1);
             return;
         } else {
+            m68k_semi_flush_all();
             p = lock_user_string(arg0);
             if (!p) {
                 /* FIXME - check error code? */
@@ -453,6 +821,16 @@ void do_m68k_semihosting(CPUM68KState *env, int nr)
         env->aregs[7] = ram_size;
 #endif
         return;
+    case HOSTED_FORK_CHECKPOINT:
+#if !defined(CONFIG_USER_ONLY)
+        /* Pending output is flushed before each fork().  */
+        if (fork_server_checkpoint(m68k_semi_fork_case, env)) {
+            return;
+        }
+#endif
+        result = -1;
+        errno = ENOSYS;
+        break;
     default:
         cpu_abort(CPU(m68k_env_get_cpu(env)), "Unsupported semihosting syscall %d\n", nr);
         result = 0;
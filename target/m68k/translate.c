@@ -4338,6 +4338,38 @@ DISAS_INSN(movec)
     gen_lookup_tb(s);
 }
 
+/* MOVEC to (4e7b) and from (4e7a) a 68040/68060 control register.  */
+DISAS_INSN(m68k_movec)
+{
+    uint16_t ext;
+    TCGv reg;
+    int creg;
+
+    if (IS_USER(s)) {
+        gen_exception(s, s->insn_pc, EXCP_PRIVILEGE);
+        return;
+    }
+
+    ext = read_im16(env, s);
+    creg = ext & 0xfff;
+    if (!m68k_movec_valid(creg)) {
+        gen_exception(s, s->insn_pc, EXCP_ILLEGAL);
+        return;
+    }
+
+    if (ext & 0x8000) {
+        reg = AREG(ext, 12);
+    } else {
+        reg = DREG(ext, 12);
+    }
+    if (insn & 1) {
+        gen_helper_m68k_movec_to(cpu_env, tcg_const_i32(creg), reg);
+    } else {
+        gen_helper_m68k_movec_from(reg, cpu_env, tcg_const_i32(creg));
+    }
+    gen_lookup_tb(s);
+}
+
 DISAS_INSN(intouch)
 {
     if (IS_USER(s)) {
@@ -4353,7 +4385,28 @@ DISAS_INSN(cpushl)
         gen_exception(s, s->pc - 2, EXCP_PRIVILEGE);
         return;
     }
-    /* Cache push/invalidate.  Implement as no-op.  */
+    /* An selects a cache set and way rather than an address, so pushing
+       any instruction cache line has to drop all translated code.  */
+    if (insn & 0x80) {
+        gen_helper_cinv(cpu_env, tcg_const_i32(0), tcg_const_i32(3));
+        gen_lookup_tb(s);
+    }
+}
+
+DISAS_INSN(cinv)
+{
+    int scope = (insn >> 3) & 3;
+
+    if (IS_USER(s)) {
+        gen_exception(s, s->pc - 2, EXCP_PRIVILEGE);
+        return;
+    }
+    /* Data cache operations need nothing: memory is always coherent.  */
+    if ((insn & 0x80) && scope != 0) {
+        gen_helper_cinv(cpu_env, scope == 3 ? tcg_const_i32(0) : AREG(insn, 0),
+                        tcg_const_i32(scope));
+        gen_lookup_tb(s);
+    }
 }
 
 DISAS_INSN(wddata)
@@ -5475,6 +5528,7 @@ void register_m68k_insns (CPUM68KState *env)
     INSN(rtd,       4e74, ffff, RTD);
     BASE(rts,       4e75, ffff);
     INSN(movec,     4e7b, ffff, CF_ISA_A);
+    INSN(m68k_movec, 4e7a, fffe, M68040);
     BASE(jump,      4e80, ffc0);
     BASE(jump,      4ec0, ffc0);
     INSN(addsubq,   5000, f080, M68000);
@@ -5587,6 +5641,7 @@ void register_m68k_insns (CPUM68KState *env)
     INSN(fsave,     f300, ffc0, FPU);
     INSN(intouch,   f340, ffc0, CF_ISA_A);
     INSN(cpushl,    f428, ff38, CF_ISA_A);
+    INSN(cinv,      f400, ff00, M68040);
     INSN(wddata,    fb00, ff00, CF_ISA_A);
     INSN(wdebug,    fbc0, ffc0, CF_ISA_A);
 #undef INSN
@@ -544,6 +544,16 @@ void tcg_register_thread(void)
     g_assert(!err);
     qemu_mutex_unlock(&region.lock);
 }
+
+/*
+ * Take over context @n, registered by a thread that no longer exists.
+ * This is the case for vCPU threads in a child process after fork().
+ */
+void tcg_adopt_thread_context(unsigned int n)
+{
+    g_assert(n < atomic_read(&n_tcg_ctxs));
+    tcg_ctx = atomic_read(&tcg_ctxs[n]);
+}
 #endif /* !CONFIG_USER_ONLY */
 
 /*
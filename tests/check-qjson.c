@@ -17,6 +17,8 @@
 #include "qapi/qmp/types.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlit.h"
+#include "qapi/qmp/json-parser.h"
+#include "qapi/qmp/json-streamer.h"
 #include "qemu-common.h"
 
 static void escaped_string(void)
@@ -1413,6 +1415,126 @@ static void limits_nesting(void)
     g_assert(obj == NULL);
 }
 
+/* Escaped keys and values at several levels share the unescape buffer */
+static void escaped_keys(void)
+{
+    QLitObject decoded = QLIT_QDICT(((QLitDictEntry[]){
+        { "aA", QLIT_QDICT(((QLitDictEntry[]){
+            { "b", QLIT_QSTR("x\ny") },
+            { "c\"", QLIT_QLIST(((QLitObject[]){
+                QLIT_QSTR("d"),
+                QLIT_QDICT(((QLitDictEntry[]){
+                    { "e/", QLIT_QSTR("") },
+                    { }
+                })),
+                { }
+            })) },
+            { }
+        })) },
+        { "g", QLIT_QSTR("h\t") },
+        { }
+    }));
+    QObject *obj;
+
+    obj = qobject_from_json("{'a\\u0041': {'b': 'x\\ny',"
+                            " 'c\\\"': ['d', {'e\\/': ''}]},"
+                            " 'g': 'h\\t'}", &error_abort);
+    g_assert(qlit_equal_qobject(&decoded, obj));
+    qobject_decref(obj);
+}
+
+typedef struct StreamState {
+    JSONMessageParser parser;
+    GPtrArray *objs;
+} StreamState;
+
+static void stream_emit(JSONMessageParser *parser, GArray *tokens)
+{
+    StreamState *s = container_of(parser, StreamState, parser);
+
+    g_ptr_array_add(s->objs, json_parser_parse(tokens, NULL));
+}
+
+/* Messages split over several feeds, and several messages in one feed */
+static void streamer_split(void)
+{
+    static const char input[] =
+        "{'execute': 'query-status'}{'execute': 'cont', 'id': [1, 'two']}"
+        " [\"x\"] 42 {'a': {'b': 'c'}} ";
+    StreamState s;
+    QObject *obj;
+    int chunk;
+
+    for (chunk = 1; chunk <= sizeof(input); chunk++) {
+        size_t i;
+
+        s.objs = g_ptr_array_new_with_free_func(
+            (GDestroyNotify)qobject_decref);
+        json_message_parser_init(&s.parser, stream_emit);
+        for (i = 0; i < sizeof(input) - 1; i += chunk) {
+            json_message_parser_feed(&s.parser, input + i,
+                                     MIN(chunk, sizeof(input) - 1 - i));
+        }
+        json_message_parser_flush(&s.parser);
+        json_message_parser_destroy(&s.parser);
+
+        g_assert_cmpint(s.objs->len, ==, 5);
+        obj = g_ptr_array_index(s.objs, 0);
+        g_assert_cmpstr(qdict_get_str(qobject_to_qdict(obj), "execute"), ==,
+                        "query-status");
+        obj = g_ptr_array_index(s.objs, 1);
+        g_assert_cmpstr(qdict_get_str(qobject_to_qdict(obj), "execute"), ==,
+                        "cont");
+        g_assert_cmpint(qlist_size(qdict_get_qlist(qobject_to_qdict(obj),
+                                                   "id")), ==, 2);
+        obj = g_ptr_array_index(s.objs, 2);
+        g_assert_cmpint(qlist_size(qobject_to_qlist(obj)), ==, 1);
+        obj = g_ptr_array_index(s.objs, 3);
+        g_assert_cmpint(qnum_get_int(qobject_to_qnum(obj)), ==, 42);
+        obj = g_ptr_array_index(s.objs, 4);
+        g_assert_cmpstr(qdict_get_str(qdict_get_qdict(qobject_to_qdict(obj),
+                                                      "a"), "b"), ==, "c");
+        g_ptr_array_free(s.objs, true);
+    }
+}
+
+/* Parse throughput, for a small command and a large blockdev-add.  */
+static void perf_parse(void)
+{
+    GString *big = g_string_new("{'execute': 'blockdev-add', 'arguments': "
+                                "{'driver': 'qcow2', 'node-name': 'disk0', "
+                                "'file': {'driver': 'file', "
+                                "'filename': '/var/lib/images/disk0.qcow2'}, "
+                                "'cache': {'direct': true, 'no-flush': false}, "
+                                "'x-props': [");
+    const char *small = "{'execute': 'query-status', 'id': 12345}";
+    const char *msgs[2];
+    double secs;
+    int i, j, count;
+
+    for (i = 0; i < 200; i++) {
+        g_string_append_printf(big, "%s{'name': 'prop-%d', 'value': %d, "
+                               "'desc': 'escaped \\\"text\\\" %d'}",
+                               i ? ", " : "", i, i * 1000, i);
+    }
+    g_string_append(big, "]}}");
+
+    msgs[0] = small;
+    msgs[1] = big->str;
+    for (i = 0; i < ARRAY_SIZE(msgs); i++) {
+        count = i ? 2000 : 200000;
+        g_test_timer_start();
+        for (j = 0; j < count; j++) {
+            qobject_decref(qobject_from_json(msgs[i], &error_abort));
+        }
+        secs = g_test_timer_elapsed();
+        g_test_message("%zu byte message: %.0f msgs/s, %.1f MB/s",
+                       strlen(msgs[i]), count / secs,
+                       count * strlen(msgs[i]) / secs / 1e6);
+    }
+    g_string_free(big, true);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1432,6 +1554,7 @@ int main(int argc, char **argv)
 
     g_test_add_func("/dicts/simple_dict", simple_dict);
     g_test_add_func("/dicts/large_dict", large_dict);
+    g_test_add_func("/dicts/escaped_keys", escaped_keys);
     g_test_add_func("/lists/simple_list", simple_list);
 
     g_test_add_func("/whitespace/simple_whitespace", simple_whitespace);
@@ -1451,5 +1574,10 @@ int main(int argc, char **argv)
     g_test_add_func("/errors/unterminated/literal", unterminated_literal);
     g_test_add_func("/errors/limits/nesting", limits_nesting);
 
+    g_test_add_func("/streamer/split", streamer_split);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/parse", perf_parse);
+    }
+
     return g_test_run();
 }
@@ -0,0 +1,213 @@
+/*
+ * QTest testcase for x-fork-server
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qapi/qmp/qdict.h"
+
+#define RAM_BASE        0x40000000
+#define ARGS            (RAM_BASE + 0x100)
+#define HANG_CASE       (RAM_BASE + 0x104)
+
+/*
+ *      lea     ARGS,%a0
+ *      move.l  %a0,%d1
+ *      move.l  #0x100,%d0              | HOSTED_FORK_CHECKPOINT
+ *      nop
+ *      nop
+ *      halt
+ *      .long   0x4e7bf000
+ *      move.l  (%a0),%d2               | case number, -1 in the parent
+ *      bmi.s   1f
+ *      cmp.l   HANG_CASE,%d2
+ *      beq.s   1f
+ *      moveq   #0,%d0                  | HOSTED_EXIT
+ *      nop
+ *      nop
+ *      halt
+ *      .long   0x4e7bf000
+ * 1:   stop    #0x2700
+ *      bra.s   1b
+ */
+static const uint8_t guest[] = {
+    0x41, 0xf9, 0x40, 0x00, 0x01, 0x00,
+    0x22, 0x08,
+    0x20, 0x3c, 0x00, 0x00, 0x01, 0x00,
+    0x4e, 0x71,
+    0x4e, 0x71,
+    0x4a, 0xc8,
+    0x4e, 0x7b, 0xf0, 0x00,
+    0x24, 0x10,
+    0x6b, 0x14,
+    0xb4, 0xb9, 0x40, 0x00, 0x01, 0x04,
+    0x67, 0x0c,
+    0x70, 0x00,
+    0x4e, 0x71,
+    0x4e, 0x71,
+    0x4a, 0xc8,
+    0x4e, 0x7b, 0xf0, 0x00,
+    0x4e, 0x72, 0x27, 0x00,
+    0x60, 0xfa,
+};
+
+static char *kernel;
+
+/* Boot to the checkpoint and run @count cases; returns the event data.  */
+static QDict *run_cases(int count, int jobs, uint32_t hang_case,
+                        const char *output_dir)
+{
+    QDict *rsp, *data;
+
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg "
+                                "-semihosting -S -kernel %s", kernel);
+    writel(HANG_CASE, hang_case);
+
+    if (output_dir) {
+        rsp = qmp("{ 'execute': 'x-fork-server', 'arguments': {"
+                  " 'count': %d, 'jobs': %d, 'timeout': 1,"
+                  " 'output-dir': %s, 'checkpoint': true } }",
+                  count, jobs, output_dir);
+    } else {
+        rsp = qmp("{ 'execute': 'x-fork-server', 'arguments': {"
+                  " 'count': %d, 'jobs': %d, 'checkpoint': true } }",
+                  count, jobs);
+    }
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    qmp_async("{ 'execute': 'cont' }");
+    if (output_dir) {
+        /* Case runs are reaped from the main loop, so the monitor keeps
+         * answering while they are in progress.  */
+        qmp_eventwait("STOP");
+        qmp_async("{ 'execute': 'query-status' }");
+        for (;;) {
+            rsp = qmp_receive();
+            g_assert(!qdict_haskey(rsp, "event") ||
+                     strcmp(qdict_get_str(rsp, "event"), "FORK_SERVER_DONE"));
+            if (qdict_haskey(rsp, "return")) {
+                QDECREF(rsp);
+                break;
+            }
+            QDECREF(rsp);
+        }
+    }
+    rsp = qmp_eventwait_ref("FORK_SERVER_DONE");
+    data = qdict_get_qdict(rsp, "data");
+    QINCREF(data);
+    QDECREF(rsp);
+
+    qtest_quit(global_qtest);
+    return data;
+}
+
+static void test_checkpoint(void)
+{
+    char *dir = g_dir_make_tmp("qtest-fork-server-XXXXXX", NULL);
+    QDict *data;
+    int i;
+
+    /* Case 2 never exits and is killed after the one second timeout.  */
+    data = run_cases(4, 2, 2, dir);
+    g_assert_cmpint(qdict_get_int(data, "cases"), ==, 4);
+    g_assert_cmpint(qdict_get_int(data, "failed"), ==, 1);
+    QDECREF(data);
+
+    for (i = 0; i < 4; i++) {
+        char *path = g_strdup_printf("%s/stderr.%d", dir, i);
+
+        g_assert(g_file_test(path, G_FILE_TEST_EXISTS));
+        unlink(path);
+        g_free(path);
+    }
+    rmdir(dir);
+    g_free(dir);
+}
+
+/* Threads that would be missing in the children, but whose locks and
+ * state they would inherit.  */
+static void test_refused(gconstpointer opaque)
+{
+    const char *args = opaque;
+    QDict *rsp;
+
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg "
+                                "-semihosting -S -kernel %s %s",
+                                kernel, args);
+
+    rsp = qmp("{ 'execute': 'x-fork-server', 'arguments': {"
+              " 'count': 1, 'checkpoint': true } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+
+    /* The VM is left alone and keeps working.  */
+    rsp = qmp("{ 'execute': 'query-status' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    qtest_quit(global_qtest);
+}
+
+/*
+ * Compare a fresh boot per case with cases forked from one boot, serially
+ * and four at a time.
+ */
+static void test_throughput(void)
+{
+    const int boots = 20, cases = 500;
+    double secs;
+    QDict *data;
+    int i, jobs;
+
+    g_test_timer_start();
+    for (i = 0; i < boots; i++) {
+        data = run_cases(1, 1, -1, NULL);
+        QDECREF(data);
+    }
+    secs = g_test_timer_elapsed();
+    g_test_message("fresh boot per case: %.1f cases/sec", boots / secs);
+
+    for (jobs = 1; jobs <= 4; jobs *= 4) {
+        data = run_cases(cases, jobs, -1, NULL);
+        g_assert_cmpint(qdict_get_int(data, "failed"), ==, 0);
+        g_test_message("fork server, %d job(s): %.1f cases/sec", jobs,
+                       cases * 1e9 / qdict_get_int(data, "elapsed"));
+        QDECREF(data);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char tmpname[] = "/tmp/qtest-fork-server-kernel-XXXXXX";
+    int fd, ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    fd = mkstemp(tmpname);
+    g_assert(fd != -1);
+    g_assert_cmpint(write(fd, guest, sizeof(guest)), ==, sizeof(guest));
+    close(fd);
+    kernel = tmpname;
+
+    qtest_add_func("/fork-server/checkpoint", test_checkpoint);
+    qtest_add_data_func("/fork-server/oob-monitor",
+                        "-chardev null,id=oob0 "
+                        "-mon chardev=oob0,mode=control,x-oob=on",
+                        test_refused);
+    qtest_add_data_func("/fork-server/iothread",
+                        "-object iothread,id=iothread0", test_refused);
+    qtest_add_data_func("/fork-server/binary-log",
+                        "-d binary -D /dev/null", test_refused);
+    if (g_test_perf()) {
+        qtest_add_func("/fork-server/throughput", test_throughput);
+    }
+
+    ret = g_test_run();
+    unlink(tmpname);
+    return ret;
+}
@@ -0,0 +1,205 @@
+/*
+ * QTest testcase for the MCF5208 programmable interrupt timers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qemu/timer.h"
+
+#define PIT_BASE        0xfc080000
+#define PIT_PCSR        (PIT_BASE + 0x0)
+#define PIT_PMR         (PIT_BASE + 0x2)
+#define PIT_PCNTR       (PIT_BASE + 0x4)
+
+#define PCSR_EN         0x0001
+#define PCSR_RLD        0x0002
+#define PCSR_PIF        0x0004
+#define PCSR_PIE        0x0008
+#define PCSR_OVW        0x0010
+
+/* Prescaler 1: the PIT counts at half the 166.67 MHz system clock.  */
+#define PIT_FREQ        (166666666 / 2)
+#define PIT_LIMIT       10000
+
+#define IDLE_US         (2 * 1000 * 1000)
+
+static int64_t ticks_ns(int64_t ticks)
+{
+    return ticks * NANOSECONDS_PER_SECOND / PIT_FREQ;
+}
+
+static void assert_count(int expected)
+{
+    int count = readw(PIT_PCNTR);
+
+    g_assert_cmpint(count, >=, expected - 2);
+    g_assert_cmpint(count, <=, expected + 2);
+}
+
+/* Load the counter with PIT_LIMIT before enabling, so it does not fire
+ * straight away.  */
+static void pit_start(uint16_t pcsr)
+{
+    writew(PIT_PCSR, PCSR_RLD | PCSR_OVW);
+    writew(PIT_PMR, PIT_LIMIT);
+    writew(PIT_PCSR, pcsr);
+}
+
+static void test_masked(void)
+{
+    global_qtest = qtest_start("-machine mcf5208evb");
+
+    pit_start(PCSR_EN | PCSR_RLD | PCSR_OVW);
+
+    clock_step(ticks_ns(2500));
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, 0);
+    assert_count(PIT_LIMIT - 2500);
+
+    /* Several wraps later the counter still has the right phase.  */
+    clock_step(ticks_ns(3 * PIT_LIMIT));
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, PCSR_PIF);
+    assert_count(PIT_LIMIT - 2500);
+
+    writew(PIT_PCSR, PCSR_EN | PCSR_RLD | PCSR_OVW | PCSR_PIF);
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, 0);
+    clock_step(ticks_ns(PIT_LIMIT - 2000));
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, PCSR_PIF);
+    assert_count(PIT_LIMIT - 500);
+
+    qtest_quit(global_qtest);
+}
+
+static void test_pending(void)
+{
+    const uint16_t pcsr = PCSR_EN | PCSR_RLD | PCSR_OVW | PCSR_PIE;
+
+    global_qtest = qtest_start("-machine mcf5208evb");
+
+    pit_start(pcsr);
+
+    clock_step(ticks_ns(PIT_LIMIT + 1000));
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, PCSR_PIF);
+    assert_count(PIT_LIMIT - 1000);
+
+    /* Leave the interrupt pending across many periods, then acknowledge.  */
+    clock_step(ticks_ns(10 * PIT_LIMIT + 500));
+    assert_count(PIT_LIMIT - 1500);
+    writew(PIT_PCSR, pcsr | PCSR_PIF);
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, 0);
+
+    clock_step(ticks_ns(PIT_LIMIT - 2000));
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, 0);
+    clock_step(ticks_ns(1000));
+    g_assert_cmphex(readw(PIT_PCSR) & PCSR_PIF, ==, PCSR_PIF);
+
+    qtest_quit(global_qtest);
+}
+
+/*
+ *      lea     0xfc080000,%a0
+ *      move.w  #40,2(%a0)              | PMR: ~1 kHz with a 2048 prescaler
+ *      move.w  #0x0b13,(%a0)           | PCSR: PRE=11, OVW, RLD, EN; PIE clear
+ * 1:   stop    #0x2700
+ *      bra.s   1b
+ */
+static const uint8_t idle_loop[] = {
+    0x41, 0xf9, 0xfc, 0x08, 0x00, 0x00,
+    0x31, 0x7c, 0x00, 0x28, 0x00, 0x02,
+    0x30, 0xbc, 0x0b, 0x13,
+    0x4e, 0x72, 0x27, 0x00,
+    0x60, 0xfa,
+};
+
+static long context_switches(pid_t pid)
+{
+    char *path = g_strdup_printf("/proc/%d/status", pid);
+    char *contents, **lines;
+    long total = 0;
+    int i;
+
+    g_assert(g_file_get_contents(path, &contents, NULL, NULL));
+    lines = g_strsplit(contents, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        long n;
+
+        if (sscanf(lines[i], "voluntary_ctxt_switches: %ld", &n) == 1 ||
+            sscanf(lines[i], "nonvoluntary_ctxt_switches: %ld", &n) == 1) {
+            total += n;
+        }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    g_free(path);
+    return total;
+}
+
+/*
+ * Boot a guest that programs the PIT with its interrupt masked and then
+ * sits in STOP, and count how often the main loop thread is scheduled.
+ */
+static void test_idle_wakeups(void)
+{
+    char kernel[] = "/tmp/qtest-m5208-timer-kernel-XXXXXX";
+    char pidfile[] = "/tmp/qtest-m5208-timer-pid-XXXXXX";
+    char *contents;
+    long before, after;
+    double secs;
+    pid_t pid;
+    int fd;
+
+    if (!g_file_test("/proc/self/status", G_FILE_TEST_EXISTS)) {
+        g_test_message("no /proc, skipping");
+        return;
+    }
+
+    fd = mkstemp(kernel);
+    g_assert(fd != -1);
+    g_assert_cmpint(write(fd, idle_loop, sizeof(idle_loop)), ==,
+                    sizeof(idle_loop));
+    close(fd);
+    fd = mkstemp(pidfile);
+    g_assert(fd != -1);
+    close(fd);
+
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg "
+                                "-kernel %s -pidfile %s",
+                                kernel, pidfile);
+    unlink(kernel);
+
+    g_assert(g_file_get_contents(pidfile, &contents, NULL, NULL));
+    pid = atoi(contents);
+    g_free(contents);
+    unlink(pidfile);
+    g_assert_cmpint(pid, >, 0);
+
+    /* Let the guest reach STOP before sampling.  */
+    g_usleep(200 * 1000);
+
+    before = context_switches(pid);
+    g_test_timer_start();
+    g_usleep(IDLE_US);
+    after = context_switches(pid);
+    secs = g_test_timer_elapsed();
+
+    qtest_quit(global_qtest);
+
+    g_test_message("idle guest, PIT at %d Hz: %.1f host wakeups/sec",
+                   166666666 / 2 / 2048 / 40, (after - before) / secs);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/m5208-timer/masked", test_masked);
+    qtest_add_func("/m5208-timer/pending", test_pending);
+    if (g_test_perf()) {
+        qtest_add_func("/m5208-timer/idle-wakeups", test_idle_wakeups);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,245 @@
+/*
+ * QTest testcase for m68k kernel loading: ELF segments and the
+ * decompressed uImage cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qemu/bswap.h"
+
+#define RAM_BASE        0x40000000
+#define PATCH           (RAM_BASE + 0x800)
+#define FLAG            (RAM_BASE + 0x800000)
+
+#define SEG_OFFSET      0x1000
+#define SEG_SIZE        (0x100000 + 0x123)
+#define BSS_SIZE        0x1000
+#define UIMAGE_SIZE     0x2000
+
+#define TIMEOUT_US      (30 * 1000 * 1000)
+
+/*
+ *      move.l  FLAG,%d0
+ *      bne.s   1f
+ *      move.l  #0xdeadbeef,%d1         | first boot only
+ *      move.l  %d1,PATCH
+ * 1:   addq.l  #1,%d0
+ *      move.l  %d0,FLAG
+ * 2:   stop    #0x2700
+ *      bra.s   2b
+ */
+static const uint8_t guest[] = {
+    0x20, 0x39, 0x40, 0x80, 0x00, 0x00,
+    0x66, 0x0c,
+    0x22, 0x3c, 0xde, 0xad, 0xbe, 0xef,
+    0x23, 0xc1, 0x40, 0x00, 0x08, 0x00,
+    0x52, 0x80,
+    0x23, 0xc0, 0x40, 0x80, 0x00, 0x00,
+    0x4e, 0x72, 0x27, 0x00,
+    0x60, 0xfa,
+};
+
+static uint8_t pattern(size_t i)
+{
+    return i < sizeof(guest) ? guest[i] : i * 7 + 3;
+}
+
+static uint8_t *make_payload(size_t size)
+{
+    uint8_t *buf = g_malloc(size);
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        buf[i] = pattern(i);
+    }
+    return buf;
+}
+
+static void write_file(const char *path, const void *buf, size_t len)
+{
+    g_assert(g_file_set_contents(path, buf, len, NULL));
+}
+
+/* A big-endian EM_68K executable with one segment at RAM_BASE.  */
+static void make_elf(const char *path, size_t seg_size)
+{
+    size_t len = SEG_OFFSET + seg_size;
+    uint8_t *buf = g_malloc0(len);
+    uint8_t *payload = make_payload(seg_size);
+
+    memcpy(buf, "\x7f" "ELF\x01\x02\x01", 7);
+    stw_be_p(buf + 16, 2);                      /* ET_EXEC */
+    stw_be_p(buf + 18, 4);                      /* EM_68K */
+    stl_be_p(buf + 20, 1);
+    stl_be_p(buf + 24, RAM_BASE);               /* e_entry */
+    stl_be_p(buf + 28, 52);                     /* e_phoff */
+    stw_be_p(buf + 40, 52);                     /* e_ehsize */
+    stw_be_p(buf + 42, 32);                     /* e_phentsize */
+    stw_be_p(buf + 44, 1);                      /* e_phnum */
+
+    stl_be_p(buf + 52, 1);                      /* PT_LOAD */
+    stl_be_p(buf + 56, SEG_OFFSET);
+    stl_be_p(buf + 60, RAM_BASE);
+    stl_be_p(buf + 64, RAM_BASE);
+    stl_be_p(buf + 68, seg_size);
+    stl_be_p(buf + 72, seg_size + BSS_SIZE);
+    stl_be_p(buf + 76, 7);                      /* PF_R | PF_W | PF_X */
+    stl_be_p(buf + 80, 0x1000);
+
+    memcpy(buf + SEG_OFFSET, payload, seg_size);
+    write_file(path, buf, len);
+    g_free(payload);
+    g_free(buf);
+}
+
+/* A gzip compressed U-Boot kernel image, using a stored deflate block.  */
+static void make_uimage(const char *path)
+{
+    static const uint8_t gz_header[] = {
+        0x1f, 0x8b, 0x08, 0x00, 0, 0, 0, 0, 0x00, 0x03
+    };
+    size_t gz_len = sizeof(gz_header) + 5 + UIMAGE_SIZE + 8;
+    uint8_t *buf = g_malloc0(64 + gz_len);
+    uint8_t *payload = make_payload(UIMAGE_SIZE);
+    uint8_t *gz = buf + 64;
+
+    stl_be_p(buf, 0x27051956);                  /* ih_magic */
+    stl_be_p(buf + 12, gz_len);                 /* ih_size */
+    stl_be_p(buf + 16, RAM_BASE);               /* ih_load */
+    stl_be_p(buf + 20, RAM_BASE);               /* ih_ep */
+    buf[28] = 5;                                /* IH_OS_LINUX */
+    buf[29] = 12;                               /* IH_ARCH_M68K */
+    buf[30] = 2;                                /* IH_TYPE_KERNEL */
+    buf[31] = 1;                                /* IH_COMP_GZIP */
+
+    memcpy(gz, gz_header, sizeof(gz_header));
+    gz += sizeof(gz_header);
+    gz[0] = 1;                                  /* BFINAL, stored */
+    stw_le_p(gz + 1, UIMAGE_SIZE);
+    stw_le_p(gz + 3, ~UIMAGE_SIZE);
+    memcpy(gz + 5, payload, UIMAGE_SIZE);
+
+    write_file(path, buf, 64 + gz_len);
+    g_free(payload);
+    g_free(buf);
+}
+
+static void wait_flag(uint32_t value)
+{
+    int64_t deadline = g_get_monotonic_time() + TIMEOUT_US;
+
+    while (readl(FLAG) != value) {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(100);
+    }
+}
+
+static void boot(const char *kernel, const char *machine_opts)
+{
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg%s "
+                                "-kernel %s", machine_opts, kernel);
+    wait_flag(1);
+}
+
+static uint32_t pattern_l(size_t i)
+{
+    return (uint32_t)pattern(i) << 24 | pattern(i + 1) << 16 |
+           pattern(i + 2) << 8 | pattern(i + 3);
+}
+
+/* The guest patches its image on the first boot only; a reset must
+ * restore the original contents.  */
+static void test_elf(void)
+{
+    char *dir = g_dir_make_tmp("qtest-m68k-boot-XXXXXX", NULL);
+    char *path = g_strdup_printf("%s/kernel.elf", dir);
+
+    make_elf(path, SEG_SIZE);
+    boot(path, "");
+
+    g_assert_cmphex(readl(PATCH), ==, 0xdeadbeef);
+    g_assert_cmphex(readl(RAM_BASE + 0x100), ==, pattern_l(0x100));
+    g_assert_cmphex(readl(RAM_BASE + 0x54320), ==, pattern_l(0x54320));
+    g_assert_cmphex(readb(RAM_BASE + SEG_SIZE - 1), ==,
+                    pattern(SEG_SIZE - 1));
+    g_assert_cmphex(readb(RAM_BASE + SEG_SIZE), ==, 0);
+
+    qmp_discard_response("{ 'execute': 'system_reset' }");
+    wait_flag(2);
+    g_assert_cmphex(readl(PATCH), ==, pattern_l(0x800));
+
+    qtest_quit(global_qtest);
+    unlink(path);
+    rmdir(dir);
+    g_free(path);
+    g_free(dir);
+}
+
+static void test_uimage_cache(void)
+{
+    char *dir = g_dir_make_tmp("qtest-m68k-boot-XXXXXX", NULL);
+    char *path = g_strdup_printf("%s/uImage", dir);
+    char *opts = g_strdup_printf(",kernel-cache=%s", dir);
+    char *cached = NULL;
+    const gchar *name;
+    GDir *gdir;
+    gchar *contents;
+    gsize len;
+
+    make_uimage(path);
+    boot(path, opts);
+    g_assert_cmphex(readl(RAM_BASE + 0x100), ==, pattern_l(0x100));
+    qtest_quit(global_qtest);
+
+    gdir = g_dir_open(dir, 0, NULL);
+    while ((name = g_dir_read_name(gdir))) {
+        if (g_str_has_prefix(name, "uimage-")) {
+            g_assert(!cached);
+            cached = g_strdup_printf("%s/%s", dir, name);
+        }
+    }
+    g_dir_close(gdir);
+    g_assert(cached);
+    g_assert(g_file_get_contents(cached, &contents, &len, NULL));
+    g_assert_cmpint(len, ==, UIMAGE_SIZE);
+
+    /* Prove that the second boot loads the cached copy.  */
+    contents[0x100] = 0x5a;
+    write_file(cached, contents, len);
+    g_free(contents);
+
+    boot(path, opts);
+    g_assert_cmphex(readb(RAM_BASE + 0x100), ==, 0x5a);
+    qtest_quit(global_qtest);
+
+    /* An empty cache file is ignored and replaced.  */
+    write_file(cached, "", 0);
+    boot(path, opts);
+    g_assert_cmphex(readl(RAM_BASE + 0x100), ==, pattern_l(0x100));
+    qtest_quit(global_qtest);
+    g_assert(g_file_get_contents(cached, &contents, &len, NULL));
+    g_assert_cmpint(len, ==, UIMAGE_SIZE);
+    g_free(contents);
+
+    unlink(cached);
+    unlink(path);
+    rmdir(dir);
+    g_free(cached);
+    g_free(opts);
+    g_free(path);
+    g_free(dir);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/m68k-boot/elf", test_elf);
+    qtest_add_func("/m68k-boot/uimage-cache", test_uimage_cache);
+
+    return g_test_run();
+}
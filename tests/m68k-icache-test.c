@@ -0,0 +1,298 @@
+/*
+ * QTest testcase for m68k instruction cache maintenance
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+
+#define RAM_BASE        0x40000000
+#define RESULTS         (RAM_BASE + 0x100)
+
+#define TIMEOUT_US      (30 * 1000 * 1000)
+
+/*
+ *      lea     0x40001000,%sp
+ *      move.l  #0x80000000,%d1         | CACR: CENB
+ *      movec   %d1,%cacr
+ *      lea     ram_base + 0x100,%a1    | results
+ *      jsr     func
+ *      move.l  %d0,(%a1)+
+ *      move.w  #0x7002,%d2             | patch func to "moveq #2,%d0"
+ *      move.w  %d2,func
+ *      jsr     func
+ *      move.l  %d0,(%a1)+
+ *      move.l  #0x81000000,%d1         | CACR: CENB | CINV
+ *      movec   %d1,%cacr
+ *      jsr     func
+ *      move.l  %d0,(%a1)+
+ * 1:   stop    #0x2700
+ *      bra.s   1b
+ *      .balign 0x20
+ * func:
+ *      moveq   #1,%d0
+ *      rts
+ */
+static const uint8_t guest[] = {
+    0x4f, 0xf9, 0x40, 0x00, 0x10, 0x00,
+    0x22, 0x3c, 0x80, 0x00, 0x00, 0x00,
+    0x4e, 0x7b, 0x10, 0x02,
+    0x43, 0xf9, 0x40, 0x00, 0x01, 0x00,
+    0x4e, 0xb9, 0x40, 0x00, 0x00, 0x60,
+    0x22, 0xc0,
+    0x34, 0x3c, 0x70, 0x02,
+    0x33, 0xc2, 0x40, 0x00, 0x00, 0x60,
+    0x4e, 0xb9, 0x40, 0x00, 0x00, 0x60,
+    0x22, 0xc0,
+    0x22, 0x3c, 0x81, 0x00, 0x00, 0x00,
+    0x4e, 0x7b, 0x10, 0x02,
+    0x4e, 0xb9, 0x40, 0x00, 0x00, 0x60,
+    0x22, 0xc0,
+    0x4e, 0x72, 0x27, 0x00,
+    0x60, 0xfa,
+    0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x71,
+    0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x71,
+    0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x71,
+    0x70, 0x01,
+    0x4e, 0x75,
+};
+
+static char *kernel;
+
+/* Run the guest and fetch the three values it recorded.  */
+static void run_guest(bool explicit_sync, uint32_t *results)
+{
+    int64_t deadline;
+    int i;
+
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg "
+                                "-cpu m5208,x-explicit-icache-sync=%s "
+                                "-kernel %s",
+                                explicit_sync ? "on" : "off", kernel);
+
+    deadline = g_get_monotonic_time() + TIMEOUT_US;
+    while (readl(RESULTS + 8) == 0) {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(1000);
+    }
+    for (i = 0; i < 3; i++) {
+        results[i] = readl(RESULTS + i * 4);
+    }
+
+    qtest_quit(global_qtest);
+}
+
+/* By default a store to code takes effect at once.  */
+static void test_coherent(void)
+{
+    uint32_t results[3];
+
+    run_guest(false, results);
+    g_assert_cmpint(results[0], ==, 1);
+    g_assert_cmpint(results[1], ==, 2);
+    g_assert_cmpint(results[2], ==, 2);
+}
+
+/*
+ * With explicit maintenance, a store to code may leave the old code
+ * running until the cache is invalidated, but no longer.
+ */
+static void test_explicit(void)
+{
+    uint32_t results[3];
+
+    run_guest(true, results);
+    g_assert_cmpint(results[0], ==, 1);
+    g_assert(results[1] == 1 || results[1] == 2);
+    g_assert_cmpint(results[2], ==, 2);
+}
+
+/*
+ * Explicit maintenance by instruction: call a function, patch it, issue
+ * one cache operation and call it again.  The second call must see the
+ * patch.  The function sits 0x800 into a 4K page, so a page operation on
+ * the start of the page only works when it covers the full MMU page.
+ */
+typedef struct {
+    const char *name;
+    const char *machine;
+    const char *cpu;
+    uint32_t ram_base;
+    uint32_t cacr;
+    bool set_tcr;
+    uint32_t tcr;
+    uint16_t op;                /* operates on (%a2) */
+    uint32_t a2;                /* offset from ram_base */
+} CacheOpTest;
+
+#define FUNC_OFFSET     0x3800
+
+static const CacheOpTest cache_op_tests[] = {
+    /* 68040 CINV and CPUSH, instruction cache.  */
+    { "68040/cinvl", "virt", "m68040", 0, 0x8000, true, 0,
+      0xf48a, FUNC_OFFSET },
+    { "68040/cinvp-4k", "virt", "m68040", 0, 0x8000, true, 0,
+      0xf492, 0x3000 },
+    { "68040/cinvp-8k", "virt", "m68040", 0, 0x8000, true, 0x4000,
+      0xf492, 0x2000 },
+    { "68040/cinva", "virt", "m68040", 0, 0x8000, true, 0,
+      0xf49a, 0 },
+    { "68040/cpushl", "virt", "m68040", 0, 0x8000, true, 0,
+      0xf4aa, FUNC_OFFSET },
+    { "68040/cpushp", "virt", "m68040", 0, 0x8000, true, 0,
+      0xf4b2, 0x3000 },
+    { "68040/cpusha", "virt", "m68040", 0, 0x8000, true, 0,
+      0xf4ba, 0 },
+    /* Both caches.  */
+    { "68040/cpushp-bc", "virt", "m68040", 0, 0x8000, true, 0x4000,
+      0xf4f2, 0x2000 },
+    /* ColdFire CPUSHL; %a2 is a set/way index.  */
+    { "cf/cpushl", "mcf5208evb", "m5208", RAM_BASE, 0x80000000, false, 0,
+      0xf4aa, 0 },
+};
+
+static size_t put16(uint8_t *p, size_t n, uint16_t v)
+{
+    p[n] = v >> 8;
+    p[n + 1] = v;
+    return n + 2;
+}
+
+static size_t put32(uint8_t *p, size_t n, uint32_t v)
+{
+    n = put16(p, n, v >> 16);
+    return put16(p, n, v);
+}
+
+/*
+ *      lea     ram_base + 0x1000,%sp
+ *      move.l  #cacr,%d1
+ *      movec   %d1,%cacr
+ *      move.l  #tcr,%d1                | 68040 only
+ *      movec   %d1,%tc
+ *      lea     ram_base + 0x100,%a1    | results
+ *      lea     func,%a0
+ *      jsr     (%a0)
+ *      move.l  %d0,(%a1)+
+ *      move.w  #0x7002,(%a0)           | patch func to "moveq #2,%d0"
+ *      lea     ram_base + a2,%a2
+ *      op      (%a2)
+ *      jsr     (%a0)
+ *      move.l  %d0,(%a1)+
+ * 1:   stop    #0x2700
+ *      bra.s   1b
+ *
+ *      .org    ram_base + FUNC_OFFSET
+ * func:
+ *      moveq   #1,%d0
+ *      rts
+ */
+static size_t build_cache_op_guest(const CacheOpTest *t, uint8_t *p)
+{
+    uint32_t base = t->ram_base;
+    size_t n = 0;
+
+    n = put16(p, n, 0x4ff9);
+    n = put32(p, n, base + 0x1000);
+    n = put16(p, n, 0x223c);
+    n = put32(p, n, t->cacr);
+    n = put32(p, n, 0x4e7b1002);
+    if (t->set_tcr) {
+        n = put16(p, n, 0x223c);
+        n = put32(p, n, t->tcr);
+        n = put32(p, n, 0x4e7b1003);
+    }
+    n = put16(p, n, 0x43f9);
+    n = put32(p, n, base + 0x100);
+    n = put16(p, n, 0x41f9);
+    n = put32(p, n, base + FUNC_OFFSET);
+    n = put16(p, n, 0x4e90);
+    n = put16(p, n, 0x22c0);
+    n = put32(p, n, 0x30bc7002);
+    n = put16(p, n, 0x45f9);
+    n = put32(p, n, base + t->a2);
+    n = put16(p, n, t->op);
+    n = put16(p, n, 0x4e90);
+    n = put16(p, n, 0x22c0);
+    n = put32(p, n, 0x4e722700);
+    n = put16(p, n, 0x60fa);
+    g_assert(n <= 0x100);
+
+    memset(p + n, 0, FUNC_OFFSET - n);
+    n = put32(p, FUNC_OFFSET, 0x70014e75);
+    return n;
+}
+
+static void test_cache_op(const void *data)
+{
+    const CacheOpTest *t = data;
+    uint8_t guest_image[FUNC_OFFSET + 4];
+    char tmpname[] = "/tmp/qtest-m68k-icache-op-XXXXXX";
+    uint32_t results = t->ram_base + 0x100;
+    size_t size;
+    int64_t deadline;
+    int fd;
+
+    size = build_cache_op_guest(t, guest_image);
+
+    if (t->ram_base) {
+        /* mcf5208evb starts a raw -kernel image at the base of RAM.  */
+        fd = mkstemp(tmpname);
+        g_assert(fd != -1);
+        g_assert_cmpint(write(fd, guest_image, size), ==, size);
+        close(fd);
+        global_qtest = qtest_startf("-machine %s,accel=tcg "
+                                    "-cpu %s,x-explicit-icache-sync=on "
+                                    "-kernel %s",
+                                    t->machine, t->cpu, tmpname);
+        unlink(tmpname);
+    } else {
+        /* virt without a kernel starts at address 0.  */
+        global_qtest = qtest_startf("-machine %s,accel=tcg "
+                                    "-cpu %s,x-explicit-icache-sync=on -S",
+                                    t->machine, t->cpu);
+        memwrite(0, guest_image, size);
+        qmp_discard_response("{ 'execute': 'cont' }");
+    }
+
+    deadline = g_get_monotonic_time() + TIMEOUT_US;
+    while (readl(results + 4) == 0) {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(1000);
+    }
+    g_assert_cmpint(readl(results), ==, 1);
+    g_assert_cmpint(readl(results + 4), ==, 2);
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    char tmpname[] = "/tmp/qtest-m68k-icache-kernel-XXXXXX";
+    int fd, ret;
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    fd = mkstemp(tmpname);
+    g_assert(fd != -1);
+    g_assert_cmpint(write(fd, guest, sizeof(guest)), ==, sizeof(guest));
+    close(fd);
+    kernel = tmpname;
+
+    qtest_add_func("/m68k-icache/coherent", test_coherent);
+    qtest_add_func("/m68k-icache/explicit", test_explicit);
+    for (i = 0; i < ARRAY_SIZE(cache_op_tests); i++) {
+        char *name = g_strdup_printf("/m68k-icache/op/%s",
+                                     cache_op_tests[i].name);
+        qtest_add_data_func(name, &cache_op_tests[i], test_cache_op);
+        g_free(name);
+    }
+
+    ret = g_test_run();
+    unlink(tmpname);
+    return ret;
+}
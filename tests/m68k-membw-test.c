@@ -0,0 +1,179 @@
+/*
+ * QTest testcase for m68k guest memory bandwidth
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qemu/bswap.h"
+
+#define RAM_BASE        0x40000000
+#define ITERS           (RAM_BASE + 0x100)
+#define FLAG            (RAM_BASE + 0x104)
+#define SUM             (RAM_BASE + 0x108)
+#define SRC             (RAM_BASE + 0x100000)
+#define DST             (RAM_BASE + 0x200000)
+#define BUF_SIZE        0x100000
+
+#define TIMEOUT_US      (60 * 1000 * 1000)
+
+/*
+ *      moveq   #0,%d1
+ *      move.l  ITERS,%d2
+ *      move.l  %d2,%d3
+ * 1:   lea     SRC,%a0                 | read pass
+ *      move.l  #BUF_SIZE/4,%d0
+ * 2:   add.l   (%a0)+,%d1
+ *      subq.l  #1,%d0
+ *      bne.s   2b
+ *      subq.l  #1,%d2
+ *      bne.s   1b
+ *      move.l  %d1,SUM
+ *      moveq   #1,%d4
+ *      move.l  %d4,FLAG
+ * 3:   lea     SRC,%a0                 | copy pass
+ *      lea     DST,%a1
+ *      move.l  #BUF_SIZE/4,%d0
+ * 4:   move.l  (%a0)+,(%a1)+
+ *      subq.l  #1,%d0
+ *      bne.s   4b
+ *      subq.l  #1,%d3
+ *      bne.s   3b
+ *      moveq   #2,%d4
+ *      move.l  %d4,FLAG
+ * 5:   stop    #0x2700
+ *      bra.s   5b
+ */
+static const uint8_t guest[] = {
+    0x72, 0x00,
+    0x24, 0x39, 0x40, 0x00, 0x01, 0x00,
+    0x26, 0x02,
+    0x41, 0xf9, 0x40, 0x10, 0x00, 0x00,
+    0x20, 0x3c, 0x00, 0x04, 0x00, 0x00,
+    0xd2, 0x98,
+    0x53, 0x80,
+    0x66, 0xfa,
+    0x53, 0x82,
+    0x66, 0xea,
+    0x23, 0xc1, 0x40, 0x00, 0x01, 0x08,
+    0x78, 0x01,
+    0x23, 0xc4, 0x40, 0x00, 0x01, 0x04,
+    0x41, 0xf9, 0x40, 0x10, 0x00, 0x00,
+    0x43, 0xf9, 0x40, 0x20, 0x00, 0x00,
+    0x20, 0x3c, 0x00, 0x04, 0x00, 0x00,
+    0x22, 0xd8,
+    0x53, 0x80,
+    0x66, 0xfa,
+    0x53, 0x83,
+    0x66, 0xe4,
+    0x78, 0x02,
+    0x23, 0xc4, 0x40, 0x00, 0x01, 0x04,
+    0x4e, 0x72, 0x27, 0x00,
+    0x60, 0xfa,
+};
+
+static char *kernel;
+
+static void wait_flag(uint32_t value)
+{
+    int64_t deadline = g_get_monotonic_time() + TIMEOUT_US;
+
+    while (readl(FLAG) != value) {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(100);
+    }
+}
+
+/*
+ * Let the guest sum SRC and then copy it to DST, @iters times each;
+ * returns the seconds taken by each pass.
+ */
+static void run_guest(const uint8_t *src, uint32_t iters, double *secs)
+{
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg "
+                                "-S -kernel %s", kernel);
+    bufwrite(SRC, src, BUF_SIZE);
+    writel(ITERS, iters);
+
+    g_test_timer_start();
+    qmp_discard_response("{ 'execute': 'cont' }");
+    wait_flag(1);
+    secs[0] = g_test_timer_elapsed();
+    g_test_timer_start();
+    wait_flag(2);
+    secs[1] = g_test_timer_elapsed();
+}
+
+static uint8_t *make_src(void)
+{
+    uint8_t *src = g_malloc(BUF_SIZE);
+    size_t i;
+
+    for (i = 0; i < BUF_SIZE; i++) {
+        src[i] = i * 7 + (i >> 10);
+    }
+    return src;
+}
+
+static void test_copy(void)
+{
+    uint8_t *src = make_src();
+    uint8_t *dst = g_malloc(BUF_SIZE);
+    uint32_t sum = 0;
+    double secs[2];
+    size_t i;
+
+    for (i = 0; i < BUF_SIZE; i += 4) {
+        sum += ldl_be_p(src + i);
+    }
+
+    run_guest(src, 2, secs);
+    g_assert_cmphex(readl(SUM), ==, sum * 2);
+    bufread(DST, dst, BUF_SIZE);
+    g_assert(memcmp(src, dst, BUF_SIZE) == 0);
+    qtest_quit(global_qtest);
+
+    g_free(dst);
+    g_free(src);
+}
+
+static void test_bandwidth(void)
+{
+    const uint32_t iters = 64;
+    uint8_t *src = make_src();
+    double secs[2];
+
+    run_guest(src, iters, secs);
+    qtest_quit(global_qtest);
+
+    g_test_message("read: %.1f MB/s, copy: %.1f MB/s",
+                   iters * (BUF_SIZE / 1e6) / secs[0],
+                   iters * (BUF_SIZE / 1e6) / secs[1]);
+    g_free(src);
+}
+
+int main(int argc, char **argv)
+{
+    char tmpname[] = "/tmp/qtest-m68k-membw-kernel-XXXXXX";
+    int fd, ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    fd = mkstemp(tmpname);
+    g_assert(fd != -1);
+    g_assert_cmpint(write(fd, guest, sizeof(guest)), ==, sizeof(guest));
+    close(fd);
+    kernel = tmpname;
+
+    qtest_add_func("/m68k-membw/copy", test_copy);
+    if (g_test_perf()) {
+        qtest_add_func("/m68k-membw/bandwidth", test_bandwidth);
+    }
+
+    ret = g_test_run();
+    unlink(tmpname);
+    return ret;
+}
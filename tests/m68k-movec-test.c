@@ -0,0 +1,149 @@
+/*
+ * QTest testcase for 68040 MOVEC
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+
+#define RESULTS         0x400
+#define HANDLER         0x800
+#define VBR             0x1000
+#define ISP             0x2000
+#define STACK           0x3000
+
+#define ILLEGAL_MARK    0xdead
+#define BAD_CREG        0x009
+
+#define TIMEOUT_US      (30 * 1000 * 1000)
+
+typedef struct {
+    uint16_t creg;
+    uint32_t val;
+} ControlReg;
+
+/* Every 68040 control register, in the order the guest writes them.  */
+static const ControlReg regs[] = {
+    { 0x000, 5 },               /* SFC */
+    { 0x001, 6 },               /* DFC */
+    { 0x002, 0x00008000 },      /* CACR: IE */
+    { 0x003, 0x00004000 },      /* TC: 8K pages, translation off */
+    { 0x004, 0x12340004 },      /* ITT0 */
+    { 0x005, 0x12340005 },      /* ITT1 */
+    { 0x006, 0x12340006 },      /* DTT0 */
+    { 0x007, 0x12340007 },      /* DTT1 */
+    { 0x800, 0x12340800 },      /* USP */
+    { 0x801, VBR },             /* VBR */
+    { 0x803, 0x12340803 },      /* MSP */
+    { 0x804, ISP },             /* ISP */
+    { 0x805, 0x12340805 },      /* MMUSR */
+    { 0x806, 0x12340806 },      /* URP */
+    { 0x807, 0x12340807 },      /* SRP */
+};
+
+static size_t put16(uint8_t *p, size_t n, uint16_t v)
+{
+    p[n] = v >> 8;
+    p[n + 1] = v;
+    return n + 2;
+}
+
+static size_t put32(uint8_t *p, size_t n, uint32_t v)
+{
+    n = put16(p, n, v >> 16);
+    return put16(p, n, v);
+}
+
+/*
+ *      lea     STACK,%sp
+ *      lea     RESULTS,%a1
+ *      .rept   ARRAY_SIZE(regs)
+ *      move.l  #val,%d1
+ *      movec   %d1,creg
+ *      movec   creg,%d2
+ *      move.l  %d2,(%a1)+
+ *      .endr
+ *      movec   %d1,BAD_CREG            | illegal instruction, vector 4
+ * 1:   stop    #0x2700
+ *      bra.s   1b
+ *
+ *      .org    HANDLER
+ *      move.l  #ILLEGAL_MARK,(%a1)+
+ * 1:   stop    #0x2700
+ *      bra.s   1b
+ *
+ *      .org    VBR + 4 * 4
+ *      .long   HANDLER
+ */
+static size_t build_guest(uint8_t *p)
+{
+    size_t n = 0;
+    int i;
+
+    n = put16(p, n, 0x4ff9);
+    n = put32(p, n, STACK);
+    n = put16(p, n, 0x43f9);
+    n = put32(p, n, RESULTS);
+    for (i = 0; i < ARRAY_SIZE(regs); i++) {
+        n = put16(p, n, 0x223c);
+        n = put32(p, n, regs[i].val);
+        n = put16(p, n, 0x4e7b);
+        n = put16(p, n, 0x1000 | regs[i].creg);
+        n = put16(p, n, 0x4e7a);
+        n = put16(p, n, 0x2000 | regs[i].creg);
+        n = put16(p, n, 0x22c2);
+    }
+    n = put16(p, n, 0x4e7b);
+    n = put16(p, n, 0x1000 | BAD_CREG);
+    n = put32(p, n, 0x4e722700);
+    n = put16(p, n, 0x60fa);
+    g_assert(n <= RESULTS);
+
+    memset(p + n, 0, VBR + 0x20 - n);
+    n = put16(p, HANDLER, 0x22fc);
+    n = put32(p, n, ILLEGAL_MARK);
+    n = put32(p, n, 0x4e722700);
+    n = put16(p, n, 0x60fa);
+    put32(p, VBR + 4 * 4, HANDLER);
+    return VBR + 0x20;
+}
+
+/* Write each control register, read it back, then try a bad one.  */
+static void test_movec(void)
+{
+    uint8_t guest[VBR + 0x20];
+    uint32_t mark = RESULTS + 4 * ARRAY_SIZE(regs);
+    int64_t deadline;
+    size_t size;
+    int i;
+
+    size = build_guest(guest);
+    global_qtest = qtest_start("-machine virt,accel=tcg -cpu m68040 -S");
+    memwrite(0, guest, size);
+    qmp_discard_response("{ 'execute': 'cont' }");
+
+    deadline = g_get_monotonic_time() + TIMEOUT_US;
+    while (readl(mark) == 0) {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(1000);
+    }
+    for (i = 0; i < ARRAY_SIZE(regs); i++) {
+        g_assert_cmphex(readl(RESULTS + 4 * i), ==, regs[i].val);
+    }
+    /* An unknown register raises an exception rather than killing QEMU.  */
+    g_assert_cmphex(readl(mark), ==, ILLEGAL_MARK);
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/m68k-movec/68040", test_movec);
+
+    return g_test_run();
+}
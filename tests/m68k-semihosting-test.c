@@ -0,0 +1,188 @@
+/*
+ * QTest testcase for m68k semihosted file I/O
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+
+#define RAM_BASE        0x40000000
+#define ARGS            (RAM_BASE + 0x100)
+#define PATH            (RAM_BASE + 0x200)
+#define DATA            (RAM_BASE + 0x300)
+
+#define GDB_O_WRONLY    0x001
+#define GDB_O_CREAT     0x200
+#define GDB_O_TRUNC     0x400
+
+#define WRITES          65536
+#define TIMEOUT_US      (60 * 1000 * 1000)
+
+/*
+ *      lea     ARGS,%a0
+ *      move.l  %a0,%d1
+ *      moveq   #2,%d0                  | HOSTED_OPEN, arguments from qtest
+ *      nop
+ *      nop
+ *      halt
+ *      .long   0x4e7bf000
+ *      move.l  (%a0),%d4               | fd
+ *      move.l  #WRITES,%d3
+ * 1:   move.l  %d4,(%a0)
+ *      move.l  #DATA,4(%a0)
+ *      moveq   #1,%d2
+ *      move.l  %d2,8(%a0)
+ *      moveq   #5,%d0                  | HOSTED_WRITE, one byte
+ *      nop
+ *      nop
+ *      halt
+ *      .long   0x4e7bf000
+ *      subq.l  #1,%d3
+ *      bne.s   1b
+ *      move.l  %d4,(%a0)
+ *      moveq   #3,%d0                  | HOSTED_CLOSE
+ *      nop
+ *      halt
+ *      .long   0x4e7bf000
+ * 2:   stop    #0x2700
+ *      bra.s   2b
+ */
+static const uint8_t guest[] = {
+    0x41, 0xf9, 0x40, 0x00, 0x01, 0x00,
+    0x22, 0x08,
+    0x70, 0x02,
+    0x4e, 0x71,
+    0x4e, 0x71,
+    0x4a, 0xc8,
+    0x4e, 0x7b, 0xf0, 0x00,
+    0x28, 0x10,
+    0x26, 0x3c, 0x00, 0x01, 0x00, 0x00,
+    0x20, 0x84,
+    0x21, 0x7c, 0x40, 0x00, 0x03, 0x00, 0x00, 0x04,
+    0x74, 0x01,
+    0x21, 0x42, 0x00, 0x08,
+    0x70, 0x05,
+    0x4e, 0x71,
+    0x4e, 0x71,
+    0x4a, 0xc8,
+    0x4e, 0x7b, 0xf0, 0x00,
+    0x53, 0x83,
+    0x66, 0xe0,
+    0x20, 0x84,
+    0x70, 0x03,
+    0x4e, 0x71,
+    0x4a, 0xc8,
+    0x4e, 0x7b, 0xf0, 0x00,
+    0x4e, 0x72, 0x27, 0x00,
+    0x60, 0xfa,
+};
+
+static char *kernel;
+
+/*
+ * Let the guest write WRITES single bytes to @path and return how long
+ * that took, in seconds.
+ */
+static double run_writes(const char *path, bool buffered)
+{
+    struct stat st;
+    int64_t deadline;
+    double secs;
+
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg "
+                                "-semihosting-config enable=on,buffered=%s "
+                                "-S -kernel %s",
+                                buffered ? "on" : "off", kernel);
+
+    memwrite(PATH, path, strlen(path) + 1);
+    writel(ARGS, PATH);
+    writel(ARGS + 4, strlen(path) + 1);
+    writel(ARGS + 8, GDB_O_WRONLY | GDB_O_CREAT | GDB_O_TRUNC);
+    writel(ARGS + 12, 0644);
+    writeb(DATA, 'x');
+
+    g_test_timer_start();
+    qmp_discard_response("{ 'execute': 'cont' }");
+
+    deadline = g_get_monotonic_time() + TIMEOUT_US;
+    for (;;) {
+        if (stat(path, &st) == 0 && st.st_size == WRITES) {
+            break;
+        }
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(1000);
+    }
+    secs = g_test_timer_elapsed();
+
+    qtest_quit(global_qtest);
+    return secs;
+}
+
+static void test_buffered_write(void)
+{
+    char *dir = g_dir_make_tmp("qtest-m68k-semihosting-XXXXXX", NULL);
+    char *path = g_strdup_printf("%s/out", dir);
+    gchar *contents;
+    gsize len, i;
+
+    run_writes(path, true);
+
+    g_assert(g_file_get_contents(path, &contents, &len, NULL));
+    g_assert_cmpint(len, ==, WRITES);
+    for (i = 0; i < len; i++) {
+        g_assert_cmpint(contents[i], ==, 'x');
+    }
+    g_free(contents);
+
+    unlink(path);
+    rmdir(dir);
+    g_free(path);
+    g_free(dir);
+}
+
+/* Compare one host write per semihosting call with buffered writes.  */
+static void test_write_throughput(void)
+{
+    char *dir = g_dir_make_tmp("qtest-m68k-semihosting-XXXXXX", NULL);
+    char *path = g_strdup_printf("%s/out", dir);
+    double secs;
+    int buffered;
+
+    for (buffered = 0; buffered <= 1; buffered++) {
+        secs = run_writes(path, buffered);
+        g_test_message("1-byte writes, buffered=%s: %.0f calls/sec",
+                       buffered ? "on" : "off", WRITES / secs);
+        unlink(path);
+    }
+
+    rmdir(dir);
+    g_free(path);
+    g_free(dir);
+}
+
+int main(int argc, char **argv)
+{
+    char tmpname[] = "/tmp/qtest-m68k-semihosting-kernel-XXXXXX";
+    int fd, ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    fd = mkstemp(tmpname);
+    g_assert(fd != -1);
+    g_assert_cmpint(write(fd, guest, sizeof(guest)), ==, sizeof(guest));
+    close(fd);
+    kernel = tmpname;
+
+    qtest_add_func("/m68k-semihosting/buffered-write", test_buffered_write);
+    if (g_test_perf()) {
+        qtest_add_func("/m68k-semihosting/write-throughput",
+                       test_write_throughput);
+    }
+
+    ret = g_test_run();
+    unlink(tmpname);
+    return ret;
+}
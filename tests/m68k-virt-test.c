@@ -0,0 +1,263 @@
+/*
+ * QTest testcase for the m68k virt machine and its goldfish devices
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-mmio.h"
+#include "libqos/malloc-generic.h"
+#include "qemu-common.h"
+#include "qemu/bswap.h"
+#include "qemu/timer.h"
+#include "standard-headers/linux/virtio_ids.h"
+#include "standard-headers/linux/virtio_ring.h"
+#include "standard-headers/linux/virtio_blk.h"
+
+/* PIC #6 gets the RTC interrupts, the first RTC is on its IRQ #1.  */
+#define PIC6_BASE           (0xff000000 + 5 * 0x1000)
+#define PIC_STATUS          0x00
+#define PIC_IRQ_PENDING     0x04
+#define PIC_IRQ_DISABLE_ALL 0x08
+#define PIC_DISABLE         0x0c
+#define PIC_ENABLE          0x10
+#define PIC_RTC_BIT         0x1
+
+#define RTC_BASE            0xff006000
+#define RTC_TIME_LOW        0x00
+#define RTC_TIME_HIGH       0x04
+#define RTC_ALARM_LOW       0x08
+#define RTC_ALARM_HIGH      0x0c
+#define RTC_IRQ_ENABLED     0x10
+#define RTC_ALARM_STATUS    0x18
+#define RTC_CLEAR_INTERRUPT 0x1c
+
+/* Transports 0-31 are on PIC #2, 32-63 on PIC #3, and so on.  */
+#define VIRTIO_MMIO_BASE    0xff010000
+#define VIRTIO_MMIO_SIZE    0x200
+#define VIRTIO_MMIO_NB      128
+#define VIRTIO_PIC_BASE(n)  (0xff000000 + (1 + (n) / 32) * 0x1000)
+#define VIRTIO_PIC_BIT(n)   (1u << ((n) % 32))
+
+#define VIRTIO_PAGE_SIZE    4096
+#define VIRTIO_RAM_ADDR     0x00100000
+#define VIRTIO_RAM_SIZE     0x00100000
+#define VIRTIO_TIMEOUT_US   (30 * 1000 * 1000)
+
+static uint64_t rtc_time(void)
+{
+    uint64_t low = readl(RTC_BASE + RTC_TIME_LOW);
+
+    return ((uint64_t)readl(RTC_BASE + RTC_TIME_HIGH) << 32) | low;
+}
+
+static void test_rtc_time(void)
+{
+    int64_t host = (int64_t)time(NULL) * NANOSECONDS_PER_SECOND;
+    uint64_t t0, t1;
+
+    global_qtest = qtest_start("-machine virt -rtc clock=vm");
+
+    /* The RTC starts at the host wall clock time.  */
+    t0 = rtc_time();
+    g_assert_cmpint(llabs((int64_t)t0 - host), <=,
+                    60 * NANOSECONDS_PER_SECOND);
+
+    /* With clock=vm, it only advances with the virtual clock.  */
+    clock_step(NANOSECONDS_PER_SECOND);
+    t1 = rtc_time();
+    g_assert_cmpint(t1 - t0, ==, NANOSECONDS_PER_SECOND);
+
+    qtest_end();
+}
+
+static void test_rtc_alarm(void)
+{
+    uint64_t alarm;
+
+    global_qtest = qtest_start("-machine virt -rtc clock=vm");
+
+    writel(PIC6_BASE + PIC_ENABLE, PIC_RTC_BIT);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, 0);
+
+    alarm = rtc_time() + 1000 * SCALE_US;
+    writel(RTC_BASE + RTC_IRQ_ENABLED, 1);
+    writel(RTC_BASE + RTC_ALARM_HIGH, alarm >> 32);
+    writel(RTC_BASE + RTC_ALARM_LOW, alarm & 0xffffffff);
+    g_assert_cmpint(readl(RTC_BASE + RTC_ALARM_STATUS), ==, 1);
+
+    clock_step(500 * SCALE_US);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, 0);
+
+    clock_step(1000 * SCALE_US);
+    g_assert_cmpint(readl(RTC_BASE + RTC_ALARM_STATUS), ==, 0);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, PIC_RTC_BIT);
+    g_assert_cmpint(readl(PIC6_BASE + PIC_STATUS), ==, 1);
+
+    writel(RTC_BASE + RTC_CLEAR_INTERRUPT, 1);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, 0);
+    g_assert_cmpint(readl(PIC6_BASE + PIC_STATUS), ==, 0);
+
+    qtest_end();
+}
+
+/* Only enabled sources are reported, and masking does not lose them.  */
+static void test_pic_mask(void)
+{
+    uint64_t alarm;
+
+    global_qtest = qtest_start("-machine virt -rtc clock=vm");
+
+    alarm = rtc_time();
+    writel(RTC_BASE + RTC_IRQ_ENABLED, 1);
+    writel(RTC_BASE + RTC_ALARM_HIGH, alarm >> 32);
+    writel(RTC_BASE + RTC_ALARM_LOW, alarm & 0xffffffff);
+
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, 0);
+    writel(PIC6_BASE + PIC_ENABLE, PIC_RTC_BIT);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, PIC_RTC_BIT);
+
+    writel(PIC6_BASE + PIC_DISABLE, PIC_RTC_BIT);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, 0);
+    g_assert_cmpint(readl(PIC6_BASE + PIC_STATUS), ==, 0);
+    writel(PIC6_BASE + PIC_ENABLE, PIC_RTC_BIT);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, PIC_RTC_BIT);
+
+    writel(PIC6_BASE + PIC_IRQ_DISABLE_ALL, 0);
+    g_assert_cmphex(readl(PIC6_BASE + PIC_IRQ_PENDING), ==, 0);
+
+    qtest_end();
+}
+
+/* Return the index of the transport with a device of type @id, or -1.  */
+static int virtio_mmio_find(uint32_t id)
+{
+    uint64_t addr;
+    int i, found = -1;
+
+    for (i = 0; i < VIRTIO_MMIO_NB; i++) {
+        addr = VIRTIO_MMIO_BASE + i * VIRTIO_MMIO_SIZE;
+        g_assert_cmphex(readl(addr + QVIRTIO_MMIO_MAGIC_VALUE), ==,
+                        'v' | 'i' << 8 | 'r' << 16 | 't' << 24);
+        g_assert_cmpint(readl(addr + QVIRTIO_MMIO_VERSION), ==, 1);
+        if (readl(addr + QVIRTIO_MMIO_DEVICE_ID) == id) {
+            g_assert_cmpint(found, ==, -1);
+            found = i;
+        }
+    }
+    return found;
+}
+
+/* Every transport answers the probe, but only plugged ones have an ID.  */
+static void test_virtio_probe(void)
+{
+    global_qtest = qtest_start("-machine virt");
+    g_assert_cmpint(virtio_mmio_find(VIRTIO_ID_BLOCK), ==, -1);
+    qtest_end();
+
+    global_qtest = qtest_start("-machine virt "
+                               "-drive if=none,id=drv0,file=null-co://,"
+                               "format=raw "
+                               "-device virtio-blk-device,drive=drv0");
+    g_assert_cmpint(virtio_mmio_find(VIRTIO_ID_BLOCK), >=, 0);
+    qtest_end();
+}
+
+/* Read a sector through a virtqueue and check the completion interrupt.  */
+static void test_virtio_blk_read(void)
+{
+    struct virtio_blk_outhdr hdr;
+    QVirtioMMIODevice *dev;
+    QGuestAllocator *alloc;
+    QVirtQueue *vq;
+    uint64_t req, pic;
+    uint32_t features, free_head, bit;
+    uint8_t buf[512];
+    int64_t deadline;
+    int n, i;
+
+    global_qtest = qtest_start("-machine virt "
+                               "-drive if=none,id=drv0,format=raw,"
+                               "file.driver=null-co,file.read-zeroes=on "
+                               "-device virtio-blk-device,drive=drv0");
+
+    n = virtio_mmio_find(VIRTIO_ID_BLOCK);
+    g_assert_cmpint(n, >=, 0);
+    pic = VIRTIO_PIC_BASE(n);
+    bit = VIRTIO_PIC_BIT(n);
+    writel(pic + PIC_ENABLE, bit);
+
+    dev = qvirtio_mmio_init_device(VIRTIO_MMIO_BASE + n * VIRTIO_MMIO_SIZE,
+                                   VIRTIO_PAGE_SIZE);
+    g_assert_cmphex(dev->vdev.device_type, ==, VIRTIO_ID_BLOCK);
+    qvirtio_reset(&dev->vdev);
+    qvirtio_set_acknowledge(&dev->vdev);
+    qvirtio_set_driver(&dev->vdev);
+
+    alloc = generic_alloc_init(VIRTIO_RAM_ADDR, VIRTIO_RAM_SIZE,
+                               VIRTIO_PAGE_SIZE);
+    vq = qvirtqueue_setup(&dev->vdev, alloc, 0);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1u << VIRTIO_RING_F_EVENT_IDX) |
+                  (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    /* The legacy header is in guest (big-endian) byte order.  */
+    hdr.type = cpu_to_be32(VIRTIO_BLK_T_IN);
+    hdr.ioprio = 0;
+    hdr.sector = cpu_to_be64(0);
+    memset(buf, 0xaa, sizeof(buf));
+
+    req = guest_alloc(alloc, sizeof(hdr) + sizeof(buf) + 1);
+    memwrite(req, &hdr, sizeof(hdr));
+    memwrite(req + sizeof(hdr), buf, sizeof(buf));
+    writeb(req + sizeof(hdr) + sizeof(buf), 0xff);
+
+    free_head = qvirtqueue_add(vq, req, sizeof(hdr), false, true);
+    qvirtqueue_add(vq, req + sizeof(hdr), sizeof(buf), true, true);
+    qvirtqueue_add(vq, req + sizeof(hdr) + sizeof(buf), 1, true, false);
+    g_assert_cmphex(readl(pic + PIC_IRQ_PENDING) & bit, ==, 0);
+    qvirtqueue_kick(&dev->vdev, vq, free_head);
+
+    /* The completion reaches the PIC before the driver acknowledges it.  */
+    deadline = g_get_monotonic_time() + VIRTIO_TIMEOUT_US;
+    while (!(readl(pic + PIC_IRQ_PENDING) & bit)) {
+        g_assert(g_get_monotonic_time() < deadline);
+        clock_step(100);
+    }
+    qvirtio_wait_used_elem(&dev->vdev, vq, free_head, VIRTIO_TIMEOUT_US);
+    g_assert_cmphex(readl(pic + PIC_IRQ_PENDING) & bit, ==, 0);
+
+    g_assert_cmpint(readb(req + sizeof(hdr) + sizeof(buf)), ==,
+                    VIRTIO_BLK_S_OK);
+    memread(req + sizeof(hdr), buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, 0);
+    }
+
+    guest_free(alloc, req);
+    qvirtqueue_cleanup(dev->vdev.bus, vq, alloc);
+    g_free(dev);
+    generic_alloc_uninit(alloc);
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/m68k-virt/rtc/time", test_rtc_time);
+    qtest_add_func("/m68k-virt/rtc/alarm", test_rtc_alarm);
+    qtest_add_func("/m68k-virt/pic/mask", test_pic_mask);
+    qtest_add_func("/m68k-virt/virtio/probe", test_virtio_probe);
+    qtest_add_func("/m68k-virt/virtio/blk-read", test_virtio_blk_read);
+
+    return g_test_run();
+}
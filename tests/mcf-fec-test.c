@@ -0,0 +1,420 @@
+/*
+ * QTest testcase for the ColdFire Fast Ethernet Controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qemu/iov.h"
+#include "qemu/sockets.h"
+#include "qemu/bswap.h"
+
+#define FEC_BASE        0xfc030000
+#define FEC_EIR         (FEC_BASE + 0x004)
+#define FEC_EIMR        (FEC_BASE + 0x008)
+#define FEC_RDAR        (FEC_BASE + 0x010)
+#define FEC_TDAR        (FEC_BASE + 0x014)
+#define FEC_ECR         (FEC_BASE + 0x024)
+#define FEC_ERDSR       (FEC_BASE + 0x180)
+#define FEC_ETDSR       (FEC_BASE + 0x184)
+#define FEC_EMRBR       (FEC_BASE + 0x188)
+
+#define FEC_EN          2
+#define FEC_INT_TXF     0x08000000
+#define FEC_INT_RXF     0x02000000
+
+#define FEC_BD_R        0x8000
+#define FEC_BD_E        0x8000
+#define FEC_BD_W        0x2000
+#define FEC_BD_L        0x0800
+
+/* The FEC RXF interrupt is INTC source 40, bit 8 of IPRH.  */
+#define INTC_IPRH       0xfc048000
+#define INTC_FEC_RXF    (1 << 8)
+
+#define RAM_BASE        0x40000000
+#define TX_RING         (RAM_BASE + 0x1000)
+#define RX_RING         (RAM_BASE + 0x2000)
+#define TX_BUFS         (RAM_BASE + 0x10000)
+#define RX_BUFS         (RAM_BASE + 0x80000)
+
+#define RING_SIZE       32
+#define BUF_SIZE        0x600
+#define FRAME_SIZE      1514
+#define SMALL_FRAME     60
+#define FRAGS           4
+
+#define TIMEOUT_US      (30 * 1000 * 1000)
+
+typedef struct {
+    uint16_t flags;
+    uint16_t length;
+    uint32_t data;
+} QEMU_PACKED FECBufDesc;
+
+static int sock[2];
+
+static void fec_start_args(const char *extra_args)
+{
+    int ret;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sock);
+    g_assert_cmpint(ret, !=, -1);
+
+    global_qtest = qtest_startf("-machine mcf5208evb "
+                                "-netdev socket,fd=%d,id=hs0 "
+                                "-net nic,model=mcf-fec,netdev=hs0 %s",
+                                sock[1], extra_args);
+
+    writel(FEC_ECR, FEC_EN);
+    writel(FEC_ETDSR, TX_RING);
+    writel(FEC_ERDSR, RX_RING);
+    writel(FEC_EMRBR, BUF_SIZE);
+}
+
+static void fec_start(void)
+{
+    fec_start_args("");
+}
+
+static void fec_stop(void)
+{
+    qtest_quit(global_qtest);
+    close(sock[0]);
+}
+
+/* Hand @n descriptors of @ring to the controller, all in one go.  */
+static void fec_fill_ring(uint64_t ring, uint64_t bufs, int n,
+                          uint16_t flags, uint16_t len)
+{
+    FECBufDesc bd[RING_SIZE];
+    int i;
+
+    g_assert(n <= RING_SIZE);
+    for (i = 0; i < n; i++) {
+        bd[i].flags = cpu_to_be16(flags | (i == n - 1 ? FEC_BD_W : 0));
+        bd[i].length = cpu_to_be16(len);
+        bd[i].data = cpu_to_be32(bufs + i * BUF_SIZE);
+    }
+    memwrite(ring, bd, n * sizeof(bd[0]));
+}
+
+static void fec_wait_bd_done(uint64_t addr, uint16_t busy)
+{
+    int64_t end = g_get_monotonic_time() + TIMEOUT_US;
+
+    while (readw(addr) & busy) {
+        g_assert_cmpint(g_get_monotonic_time(), <, end);
+    }
+}
+
+static void sock_send_frame(const void *buf, uint32_t len)
+{
+    uint32_t hdr = htonl(len);
+    struct iovec iov[] = {
+        {
+            .iov_base = &hdr,
+            .iov_len = sizeof(hdr),
+        }, {
+            .iov_base = (void *)buf,
+            .iov_len = len,
+        },
+    };
+    ssize_t ret;
+
+    ret = iov_send(sock[0], iov, 2, 0, sizeof(hdr) + len);
+    g_assert_cmpint(ret, ==, sizeof(hdr) + len);
+}
+
+static uint32_t sock_recv_frame(void *buf, uint32_t max)
+{
+    uint32_t len;
+    ssize_t ret;
+
+    ret = qemu_recv(sock[0], &len, sizeof(len), MSG_WAITALL);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    len = ntohl(len);
+    g_assert_cmpint(len, <=, max);
+    ret = qemu_recv(sock[0], buf, len, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, len);
+    return len;
+}
+
+static void test_tx(void)
+{
+    static const char hdr[] = "FRAME-HEADER:";
+    static const char payload[] = "fragmented payload";
+    FECBufDesc bd[2];
+    char buf[256];
+    uint32_t len;
+
+    fec_start();
+
+    /* One frame split over two descriptors.  */
+    memwrite(TX_BUFS, hdr, sizeof(hdr) - 1);
+    memwrite(TX_BUFS + BUF_SIZE, payload, sizeof(payload));
+    bd[0].flags = cpu_to_be16(FEC_BD_R);
+    bd[0].length = cpu_to_be16(sizeof(hdr) - 1);
+    bd[0].data = cpu_to_be32(TX_BUFS);
+    bd[1].flags = cpu_to_be16(FEC_BD_R | FEC_BD_L | FEC_BD_W);
+    bd[1].length = cpu_to_be16(sizeof(payload));
+    bd[1].data = cpu_to_be32(TX_BUFS + BUF_SIZE);
+    memwrite(TX_RING, bd, sizeof(bd));
+    writel(FEC_TDAR, 0);
+
+    len = sock_recv_frame(buf, sizeof(buf));
+    g_assert_cmpint(len, ==, sizeof(hdr) - 1 + sizeof(payload));
+    g_assert(memcmp(buf, hdr, sizeof(hdr) - 1) == 0);
+    g_assert_cmpstr(buf + sizeof(hdr) - 1, ==, payload);
+
+    g_assert_cmphex(readw(TX_RING) & FEC_BD_R, ==, 0);
+    g_assert_cmphex(readw(TX_RING + 8) & FEC_BD_R, ==, 0);
+    g_assert_cmphex(readl(FEC_EIR) & FEC_INT_TXF, ==, FEC_INT_TXF);
+
+    fec_stop();
+}
+
+static void test_rx(void)
+{
+    static const char test[] = "TEST FRAME";
+    char buf[64];
+    int i;
+
+    fec_start();
+
+    fec_fill_ring(RX_RING, RX_BUFS, 2, FEC_BD_E, 0);
+    writel(FEC_RDAR, 0);
+
+    for (i = 0; i < 2; i++) {
+        sock_send_frame(test, sizeof(test));
+        fec_wait_bd_done(RX_RING + i * 8, FEC_BD_E);
+        g_assert_cmphex(readw(RX_RING + i * 8) & FEC_BD_L, ==, FEC_BD_L);
+        /* Frame plus 4 bytes of CRC.  */
+        g_assert_cmpint(readw(RX_RING + i * 8 + 2), ==, sizeof(test) + 4);
+        memread(RX_BUFS + i * BUF_SIZE, buf, sizeof(test));
+        g_assert_cmpstr(buf, ==, test);
+    }
+    g_assert_cmphex(readl(FEC_EIR) & FEC_INT_RXF, ==, FEC_INT_RXF);
+
+    /* The ring is full now; the next frame waits until it is refilled.  */
+    sock_send_frame(test, sizeof(test));
+    qmp_discard_response("{ 'execute' : 'query-status'}");
+    fec_fill_ring(RX_RING, RX_BUFS, 2, FEC_BD_E, 0);
+    writel(FEC_RDAR, 0);
+    fec_wait_bd_done(RX_RING, FEC_BD_E);
+
+    fec_stop();
+}
+
+static bool fec_rx_irq(void)
+{
+    return readl(INTC_IPRH) & INTC_FEC_RXF;
+}
+
+/* Receive one small frame into descriptor @i of the RX ring.  */
+static void fec_rx_one(int i)
+{
+    static const char test[] = "COALESCED FRAME";
+
+    sock_send_frame(test, sizeof(test));
+    fec_wait_bd_done(RX_RING + i * 8, FEC_BD_E);
+}
+
+static void test_rx_coalesce_usecs(void)
+{
+    fec_start_args("-global mcf-fec.rx-coalesce-usecs=1000");
+
+    writel(FEC_EIMR, FEC_INT_RXF);
+    fec_fill_ring(RX_RING, RX_BUFS, 4, FEC_BD_E, 0);
+    writel(FEC_RDAR, 0);
+
+    /* Two frames inside the window share one interrupt...  */
+    fec_rx_one(0);
+    g_assert_cmphex(readl(FEC_EIR) & FEC_INT_RXF, ==, FEC_INT_RXF);
+    g_assert(!fec_rx_irq());
+    clock_step(500 * 1000);
+    fec_rx_one(1);
+    g_assert(!fec_rx_irq());
+
+    /* ...which fires 1 ms after the first of them.  */
+    clock_step(499 * 1000);
+    g_assert(!fec_rx_irq());
+    clock_step(1000);
+    g_assert(fec_rx_irq());
+
+    /* Acknowledging it starts a new window.  */
+    writel(FEC_EIR, FEC_INT_RXF);
+    g_assert(!fec_rx_irq());
+    fec_rx_one(2);
+    g_assert(!fec_rx_irq());
+    clock_step(1000 * 1000);
+    g_assert(fec_rx_irq());
+
+    fec_stop();
+}
+
+static void test_rx_coalesce_frames(void)
+{
+    int i;
+
+    fec_start_args("-global mcf-fec.rx-coalesce-frames=4");
+
+    writel(FEC_EIMR, FEC_INT_RXF);
+    fec_fill_ring(RX_RING, RX_BUFS, 8, FEC_BD_E, 0);
+    writel(FEC_RDAR, 0);
+
+    /* A full batch is signalled as soon as its last frame lands.  */
+    for (i = 0; i < 3; i++) {
+        fec_rx_one(i);
+        g_assert(!fec_rx_irq());
+    }
+    fec_rx_one(3);
+    g_assert(fec_rx_irq());
+    writel(FEC_EIR, FEC_INT_RXF);
+
+    /*
+     * A partial batch, such as a lone ping reply, still gets its
+     * interrupt once the default timeout expires.
+     */
+    fec_rx_one(4);
+    g_assert(!fec_rx_irq());
+    clock_step(1000 * 1000);
+    g_assert(fec_rx_irq());
+
+    fec_stop();
+}
+
+/*
+ * iperf-style throughput: keep a full ring of maximum size frames moving
+ * between the controller and the socket backend for a couple of seconds.
+ */
+static void test_tx_throughput(void)
+{
+    uint8_t frame[FRAME_SIZE];
+    uint64_t bytes = 0;
+    double elapsed;
+    int i;
+
+    fec_start();
+
+    memset(frame, 0x5a, sizeof(frame));
+    for (i = 0; i < RING_SIZE; i++) {
+        memwrite(TX_BUFS + i * BUF_SIZE, frame, sizeof(frame));
+    }
+
+    g_test_timer_start();
+    do {
+        fec_fill_ring(TX_RING, TX_BUFS, RING_SIZE, FEC_BD_R | FEC_BD_L,
+                      FRAME_SIZE);
+        writel(FEC_TDAR, 0);
+        for (i = 0; i < RING_SIZE; i++) {
+            bytes += sock_recv_frame(frame, sizeof(frame));
+        }
+        fec_wait_bd_done(TX_RING + (RING_SIZE - 1) * 8, FEC_BD_R);
+    } while (g_test_timer_elapsed() < 2.0);
+    elapsed = g_test_timer_last();
+
+    g_test_message("TX: %" PRIu64 " bytes in %.2f s, %.1f Mbit/s",
+                   bytes, elapsed, bytes * 8 / elapsed / 1e6);
+
+    fec_stop();
+}
+
+/*
+ * Minimum size frames scattered over FRAGS descriptors each, so the time
+ * goes into descriptor accesses rather than copying payload.
+ */
+static void test_tx_small_frames(void)
+{
+    FECBufDesc bd[RING_SIZE];
+    uint8_t frame[SMALL_FRAME];
+    uint64_t frames = 0;
+    double elapsed;
+    int i;
+
+    fec_start();
+
+    memset(frame, 0x3c, sizeof(frame));
+    memwrite(TX_BUFS, frame, sizeof(frame));
+    for (i = 0; i < RING_SIZE; i++) {
+        uint16_t flags = FEC_BD_R;
+
+        if (i % FRAGS == FRAGS - 1) {
+            flags |= FEC_BD_L;
+        }
+        if (i == RING_SIZE - 1) {
+            flags |= FEC_BD_W;
+        }
+        bd[i].flags = cpu_to_be16(flags);
+        bd[i].length = cpu_to_be16(SMALL_FRAME / FRAGS);
+        bd[i].data = cpu_to_be32(TX_BUFS + (i % FRAGS) * SMALL_FRAME / FRAGS);
+    }
+
+    g_test_timer_start();
+    do {
+        memwrite(TX_RING, bd, sizeof(bd));
+        writel(FEC_TDAR, 0);
+        for (i = 0; i < RING_SIZE / FRAGS; i++) {
+            g_assert_cmpint(sock_recv_frame(frame, sizeof(frame)), ==,
+                            SMALL_FRAME);
+        }
+        frames += RING_SIZE / FRAGS;
+        fec_wait_bd_done(TX_RING + (RING_SIZE - 1) * 8, FEC_BD_R);
+    } while (g_test_timer_elapsed() < 2.0);
+    elapsed = g_test_timer_last();
+
+    g_test_message("TX: %" PRIu64 " frames of %d bytes in %.2f s, "
+                   "%.0f frames/s", frames, SMALL_FRAME, elapsed,
+                   frames / elapsed);
+
+    fec_stop();
+}
+
+static void test_rx_throughput(void)
+{
+    uint8_t frame[FRAME_SIZE];
+    uint64_t bytes = 0;
+    double elapsed;
+    int i;
+
+    fec_start();
+
+    memset(frame, 0xa5, sizeof(frame));
+
+    g_test_timer_start();
+    do {
+        fec_fill_ring(RX_RING, RX_BUFS, RING_SIZE, FEC_BD_E, 0);
+        writel(FEC_RDAR, 0);
+        for (i = 0; i < RING_SIZE; i++) {
+            sock_send_frame(frame, sizeof(frame));
+        }
+        fec_wait_bd_done(RX_RING + (RING_SIZE - 1) * 8, FEC_BD_E);
+        bytes += RING_SIZE * sizeof(frame);
+    } while (g_test_timer_elapsed() < 2.0);
+    elapsed = g_test_timer_last();
+
+    g_test_message("RX: %" PRIu64 " bytes in %.2f s, %.1f Mbit/s",
+                   bytes, elapsed, bytes * 8 / elapsed / 1e6);
+
+    fec_stop();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("mcf-fec/tx", test_tx);
+    qtest_add_func("mcf-fec/rx", test_rx);
+    qtest_add_func("mcf-fec/rx-coalesce-usecs", test_rx_coalesce_usecs);
+    qtest_add_func("mcf-fec/rx-coalesce-frames", test_rx_coalesce_frames);
+    if (g_test_perf()) {
+        qtest_add_func("mcf-fec/tx-throughput", test_tx_throughput);
+        qtest_add_func("mcf-fec/rx-throughput", test_rx_throughput);
+        qtest_add_func("mcf-fec/tx-small-frames", test_tx_small_frames);
+    }
+
+    return g_test_run();
+}
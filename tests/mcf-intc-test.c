@@ -0,0 +1,109 @@
+/*
+ * QTest testcase for the ColdFire interrupt controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu-common.h"
+
+#define INTC_BASE       0xfc048000
+#define INTC_IMRH       (INTC_BASE + 0x08)
+#define INTC_IMRL       (INTC_BASE + 0x0c)
+#define INTC_ICR(n)     (INTC_BASE + 0x40 + (n))
+#define INTC_SWIACK     (INTC_BASE + 0xe0)
+
+#define PIT_BASE(n)     (0xfc080000 + 0x4000 * (n))
+#define PIT_PCSR(n)     (PIT_BASE(n) + 0x0)
+#define PIT_PMR(n)      (PIT_BASE(n) + 0x2)
+
+#define PCSR_EN         0x0001
+#define PCSR_RLD        0x0002
+#define PCSR_PIF        0x0004
+#define PCSR_PIE        0x0008
+#define PCSR_OVW        0x0010
+
+/* PIT n raises INTC source 4 + n.  */
+#define PIT_SOURCE(n)   (4 + (n))
+#define PIT_VECTOR(n)   (64 + PIT_SOURCE(n))
+#define NO_VECTOR       24
+
+#define PIT_LIMIT       100
+
+static void pit_fire(int n)
+{
+    writew(PIT_PCSR(n), PCSR_RLD | PCSR_OVW);
+    writew(PIT_PMR(n), PIT_LIMIT);
+    writew(PIT_PCSR(n), PCSR_EN | PCSR_RLD | PCSR_OVW | PCSR_PIE);
+    clock_step(1000 * 1000);
+    g_assert_cmphex(readw(PIT_PCSR(n)) & PCSR_PIF, ==, PCSR_PIF);
+}
+
+static void pit_ack(int n)
+{
+    writew(PIT_PCSR(n), PCSR_RLD | PCSR_OVW | PCSR_PIF);
+}
+
+static void test_mask(void)
+{
+    global_qtest = qtest_start("-machine mcf5208evb");
+
+    pit_fire(0);
+    /* Out of reset the source is masked and its ICR is zero.  */
+    g_assert_cmpint(readb(INTC_SWIACK), ==, NO_VECTOR);
+
+    writel(INTC_IMRL, ~(1u << PIT_SOURCE(0)));
+    g_assert_cmpint(readb(INTC_SWIACK), ==, NO_VECTOR);
+
+    writeb(INTC_ICR(PIT_SOURCE(0)), 3);
+    g_assert_cmpint(readb(INTC_SWIACK), ==, PIT_VECTOR(0));
+
+    writel(INTC_IMRL, ~0u);
+    g_assert_cmpint(readb(INTC_SWIACK), ==, NO_VECTOR);
+    writel(INTC_IMRL, ~(1u << PIT_SOURCE(0)));
+    g_assert_cmpint(readb(INTC_SWIACK), ==, PIT_VECTOR(0));
+
+    pit_ack(0);
+    g_assert_cmpint(readb(INTC_SWIACK), ==, NO_VECTOR);
+
+    qtest_quit(global_qtest);
+}
+
+static void test_priority(void)
+{
+    global_qtest = qtest_start("-machine mcf5208evb");
+
+    writel(INTC_IMRL, ~((1u << PIT_SOURCE(0)) | (1u << PIT_SOURCE(1))));
+    writeb(INTC_ICR(PIT_SOURCE(0)), 5);
+    writeb(INTC_ICR(PIT_SOURCE(1)), 2);
+    pit_fire(0);
+    pit_fire(1);
+
+    /* The higher level wins.  */
+    g_assert_cmpint(readb(INTC_SWIACK), ==, PIT_VECTOR(0));
+    writeb(INTC_ICR(PIT_SOURCE(1)), 6);
+    g_assert_cmpint(readb(INTC_SWIACK), ==, PIT_VECTOR(1));
+
+    /* On equal levels, so does the higher numbered source.  */
+    writeb(INTC_ICR(PIT_SOURCE(0)), 6);
+    g_assert_cmpint(readb(INTC_SWIACK), ==, PIT_VECTOR(1));
+
+    pit_ack(1);
+    g_assert_cmpint(readb(INTC_SWIACK), ==, PIT_VECTOR(0));
+    writeb(INTC_ICR(PIT_SOURCE(0)), 0);
+    g_assert_cmpint(readb(INTC_SWIACK), ==, NO_VECTOR);
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/mcf-intc/mask", test_mask);
+    qtest_add_func("/mcf-intc/priority", test_priority);
+
+    return g_test_run();
+}
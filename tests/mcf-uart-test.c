@@ -0,0 +1,205 @@
+/*
+ * QTest testcase for the ColdFire UART
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/un.h>
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qemu/cutils.h"
+
+#define UART_BASE       0xfc060000
+#define UART_UMR        (UART_BASE + 0x00)
+#define UART_USR        (UART_BASE + 0x04)
+#define UART_UCR        (UART_BASE + 0x08)
+#define UART_UBUF       (UART_BASE + 0x0c)
+
+#define USR_RxRDY       0x01
+#define USR_FFULL       0x02
+#define USR_TxRDY       0x04
+#define USR_TxEMP       0x08
+
+#define UCR_RX_ENABLE   0x01
+#define UCR_TX_ENABLE   0x04
+
+#define RX_FIFO_SIZE    64
+
+#define TIMEOUT_US      (30 * 1000 * 1000)
+#define THROUGHPUT_US   (2 * 1000 * 1000)
+
+/*
+ *      lea     0xfc060000,%a0
+ *      move.b  #4,8(%a0)               | enable the transmitter
+ *      moveq   #'T',%d0
+ * 1:   btst    #2,4(%a0)               | wait for TxRDY
+ *      beq.s   1b
+ *      move.b  %d0,12(%a0)
+ *      bra.s   1b
+ */
+static const uint8_t tx_loop[] = {
+    0x41, 0xf9, 0xfc, 0x06, 0x00, 0x00,
+    0x11, 0x7c, 0x00, 0x04, 0x00, 0x08,
+    0x70, 0x54,
+    0x08, 0x28, 0x00, 0x02, 0x00, 0x04,
+    0x67, 0xf8,
+    0x11, 0x40, 0x00, 0x0c,
+    0x60, 0xf2,
+};
+
+static void test_tx(void)
+{
+    char tmpname[] = "/tmp/qtest-mcf-uart-XXXXXX";
+    const char *msg = "Hello, ColdFire!";
+    char buf[32];
+    int fd, i, len = strlen(msg);
+
+    fd = mkstemp(tmpname);
+    g_assert(fd != -1);
+
+    global_qtest = qtest_startf("-machine mcf5208evb "
+                                "-chardev file,id=serial0,path=%s "
+                                "-serial chardev:serial0", tmpname);
+    unlink(tmpname);
+
+    /* Out of reset the transmitter is idle but not ready.  */
+    g_assert_cmphex(readb(UART_USR) & (USR_TxRDY | USR_TxEMP), ==, USR_TxEMP);
+
+    writeb(UART_UCR, UCR_TX_ENABLE);
+    g_assert_cmphex(readb(UART_USR) & USR_TxRDY, ==, USR_TxRDY);
+
+    for (i = 0; i < len; i++) {
+        writeb(UART_UBUF, msg[i]);
+    }
+    g_assert_cmphex(readb(UART_USR) & (USR_TxRDY | USR_TxEMP), ==,
+                    USR_TxRDY | USR_TxEMP);
+
+    qtest_quit(global_qtest);
+
+    g_assert_cmpint(read(fd, buf, sizeof(buf)), ==, len);
+    g_assert(memcmp(buf, msg, len) == 0);
+    close(fd);
+}
+
+static int connect_unix(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd, ret;
+
+    fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    g_assert_cmpint(fd, !=, -1);
+    pstrcpy(addr.sun_path, sizeof(addr.sun_path), path);
+    ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    g_assert_cmpint(ret, ==, 0);
+    return fd;
+}
+
+static void test_rx_fifo(void)
+{
+    char *tmpdir = g_dir_make_tmp("qtest-mcf-uart-XXXXXX", NULL);
+    char *path = g_strdup_printf("%s/sock", tmpdir);
+    uint8_t data[RX_FIFO_SIZE];
+    int64_t deadline;
+    int fd, i;
+
+    global_qtest = qtest_startf("-machine mcf5208evb "
+                                "-global mcf-uart.rx-fifo-size=%d "
+                                "-chardev socket,id=serial0,path=%s,"
+                                "server,nowait "
+                                "-serial chardev:serial0",
+                                RX_FIFO_SIZE, path);
+    fd = connect_unix(path);
+
+    for (i = 0; i < RX_FIFO_SIZE; i++) {
+        data[i] = i * 7;
+    }
+    g_assert_cmpint(write(fd, data, sizeof(data)), ==, sizeof(data));
+
+    writeb(UART_UCR, UCR_RX_ENABLE);
+
+    /* The whole burst fits in the FIFO before the guest reads anything.  */
+    deadline = g_get_monotonic_time() + TIMEOUT_US;
+    while (!(readb(UART_USR) & USR_FFULL)) {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(1000);
+    }
+
+    for (i = 0; i < RX_FIFO_SIZE; i++) {
+        g_assert_cmphex(readb(UART_USR) & USR_RxRDY, ==, USR_RxRDY);
+        g_assert_cmphex(readb(UART_UBUF), ==, data[i]);
+    }
+    g_assert_cmphex(readb(UART_USR) & (USR_RxRDY | USR_FFULL), ==, 0);
+
+    qtest_quit(global_qtest);
+    close(fd);
+    unlink(path);
+    rmdir(tmpdir);
+    g_free(path);
+    g_free(tmpdir);
+}
+
+/*
+ * Let a guest spin on TxRDY and measure how many bytes per second reach
+ * a file chardev.
+ */
+static void test_tx_throughput(void)
+{
+    char kernel[] = "/tmp/qtest-mcf-uart-kernel-XXXXXX";
+    char tmpname[] = "/tmp/qtest-mcf-uart-XXXXXX";
+    struct stat st;
+    off_t start;
+    int64_t deadline;
+    double secs;
+    int fd, kfd;
+
+    kfd = mkstemp(kernel);
+    g_assert(kfd != -1);
+    g_assert_cmpint(write(kfd, tx_loop, sizeof(tx_loop)), ==, sizeof(tx_loop));
+    close(kfd);
+
+    fd = mkstemp(tmpname);
+    g_assert(fd != -1);
+
+    global_qtest = qtest_startf("-machine mcf5208evb,accel=tcg "
+                                "-kernel %s "
+                                "-chardev file,id=serial0,path=%s "
+                                "-serial chardev:serial0", kernel, tmpname);
+    unlink(tmpname);
+    unlink(kernel);
+
+    /* Wait for the first byte so that boot time is not counted.  */
+    deadline = g_get_monotonic_time() + TIMEOUT_US;
+    do {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(1000);
+        g_assert(fstat(fd, &st) == 0);
+    } while (st.st_size == 0);
+    start = st.st_size;
+
+    g_test_timer_start();
+    g_usleep(THROUGHPUT_US);
+    g_assert(fstat(fd, &st) == 0);
+    secs = g_test_timer_elapsed();
+
+    qtest_quit(global_qtest);
+    close(fd);
+
+    g_assert_cmpint(st.st_size, >, start);
+    g_test_message("console throughput: %.0f bytes/sec",
+                   (st.st_size - start) / secs);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/mcf-uart/tx", test_tx);
+    qtest_add_func("/mcf-uart/rx-fifo", test_rx_fifo);
+    if (g_test_perf()) {
+        qtest_add_func("/mcf-uart/tx-throughput", test_tx_throughput);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,156 @@
+/*
+ * QTest testcase for memory topology updates
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+#include "qemu-common.h"
+
+#define TESTDEV_VENDOR  0x1b36
+#define TESTDEV_DEVICE  0x0005
+#define TESTDEV_SLOT    3
+#define MAX_DEVS        28
+
+/* Selecting test 0 ("mmio-no-eventfd") exposes its name here.  */
+#define NAME_OFFSET     16
+
+typedef struct DevList {
+    QPCIDevice *devs[MAX_DEVS];
+    QPCIBar bars[MAX_DEVS];
+    int nr;
+} DevList;
+
+static void add_dev(QPCIDevice *dev, int devfn, void *data)
+{
+    DevList *list = data;
+
+    g_assert_cmpint(list->nr, <, MAX_DEVS);
+    list->devs[list->nr++] = dev;
+}
+
+/* Start a PC with @nr_devs pci-testdevs, all with BAR 0 mapped.  */
+static QPCIBus *start(int nr_devs, DevList *list)
+{
+    GString *cmd = g_string_new("-machine pc");
+    QPCIBus *bus;
+    int i;
+
+    for (i = 0; i < nr_devs; i++) {
+        g_string_append_printf(cmd, " -device pci-testdev,addr=%d",
+                               TESTDEV_SLOT + i);
+    }
+    global_qtest = qtest_start(cmd->str);
+    g_string_free(cmd, true);
+
+    bus = qpci_init_pc(NULL);
+    list->nr = 0;
+    qpci_device_foreach(bus, TESTDEV_VENDOR, TESTDEV_DEVICE, add_dev, list);
+    g_assert_cmpint(list->nr, ==, nr_devs);
+
+    for (i = 0; i < list->nr; i++) {
+        list->bars[i] = qpci_iomap(list->devs[i], 0, NULL);
+        qpci_device_enable(list->devs[i]);
+        qpci_io_writeb(list->devs[i], list->bars[i], 0, 0);
+    }
+    return bus;
+}
+
+static void stop(QPCIBus *bus, DevList *list)
+{
+    int i;
+
+    for (i = 0; i < list->nr; i++) {
+        g_free(list->devs[i]);
+    }
+    qpci_free_pc(bus);
+    qtest_end();
+}
+
+static void test_remap(void)
+{
+    DevList list;
+    QPCIBus *bus = start(2, &list);
+    QPCIDevice *dev = list.devs[0];
+    uint64_t addr, moved;
+    uint16_t cmd;
+
+    g_assert_cmpint(qpci_io_readb(dev, list.bars[0], NAME_OFFSET), ==, 'm');
+
+    /* Move BAR 0; only the new address decodes.  */
+    addr = qpci_config_readl(dev, PCI_BASE_ADDRESS_0)
+           & PCI_BASE_ADDRESS_MEM_MASK;
+    moved = addr + 0x100000;
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, moved);
+    g_assert_cmpint(readb(moved + NAME_OFFSET), ==, 'm');
+    g_assert_cmpint(readb(addr + NAME_OFFSET), !=, 'm');
+
+    /* Toggle memory decoding.  */
+    cmd = qpci_config_readw(dev, PCI_COMMAND);
+    qpci_config_writew(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+    g_assert_cmpint(readb(moved + NAME_OFFSET), !=, 'm');
+    qpci_config_writew(dev, PCI_COMMAND, cmd);
+    g_assert_cmpint(readb(moved + NAME_OFFSET), ==, 'm');
+
+    /* The other device was not disturbed.  */
+    g_assert_cmpint(qpci_io_readb(list.devs[1], list.bars[1], NAME_OFFSET),
+                    ==, 'm');
+
+    stop(bus, &list);
+}
+
+/*
+ * Time toggling one BAR with an increasing number of mapped devices.  A
+ * config write that leaves the topology alone gives the qtest overhead.
+ */
+static void test_commit_latency(void)
+{
+    static const int nr_devs[] = { 1, 8, MAX_DEVS };
+    const int count = 500;
+    double base, secs;
+    DevList list;
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    uint16_t cmd;
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(nr_devs); i++) {
+        bus = start(nr_devs[i], &list);
+        dev = list.devs[0];
+        cmd = qpci_config_readw(dev, PCI_COMMAND);
+
+        g_test_timer_start();
+        for (j = 0; j < count; j++) {
+            qpci_config_writeb(dev, PCI_LATENCY_TIMER, 0);
+            qpci_config_writeb(dev, PCI_LATENCY_TIMER, 0);
+        }
+        base = g_test_timer_elapsed();
+
+        g_test_timer_start();
+        for (j = 0; j < count; j++) {
+            qpci_config_writew(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+            qpci_config_writew(dev, PCI_COMMAND, cmd);
+        }
+        secs = g_test_timer_elapsed();
+
+        g_test_message("%d devices: %.1f us per commit",
+                       nr_devs[i], (secs - base) * 1e6 / (2 * count));
+        stop(bus, &list);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/memory-commit/remap", test_remap);
+    if (g_test_perf()) {
+        qtest_add_func("/memory-commit/latency", test_commit_latency);
+    }
+
+    return g_test_run();
+}
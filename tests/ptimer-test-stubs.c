@@ -48,33 +48,35 @@ void timer_init_tl(QEMUTimer *ts,
 void timer_mod(QEMUTimer *ts, int64_t expire_time)
 {
     QEMUTimerList *timer_list = ts->timer_list;
-    QEMUTimer *t = &timer_list->active_timers;
+    int i, free = -1;
 
-    while (t->next != NULL) {
-        if (t->next == ts) {
+    for (i = 0; i < PTIMER_TEST_MAX_TIMERS; i++) {
+        if (timer_list->active_timers[i] == ts) {
             break;
         }
-
-        t = t->next;
+        if (timer_list->active_timers[i] == NULL && free == -1) {
+            free = i;
+        }
+    }
+    if (i == PTIMER_TEST_MAX_TIMERS) {
+        g_assert(free != -1);
+        i = free;
     }
 
     ts->expire_time = MAX(expire_time * ts->scale, 0);
-    ts->next = NULL;
-    t->next = ts;
+    timer_list->active_timers[i] = ts;
 }
 
 void timer_del(QEMUTimer *ts)
 {
     QEMUTimerList *timer_list = ts->timer_list;
-    QEMUTimer *t = &timer_list->active_timers;
+    int i;
 
-    while (t->next != NULL) {
-        if (t->next == ts) {
-            t->next = ts->next;
+    for (i = 0; i < PTIMER_TEST_MAX_TIMERS; i++) {
+        if (timer_list->active_timers[i] == ts) {
+            timer_list->active_timers[i] = NULL;
             return;
         }
-
-        t = t->next;
     }
 }
 
@@ -86,17 +88,20 @@ int64_t qemu_clock_get_ns(QEMUClockType type)
 int64_t qemu_clock_deadline_ns_all(QEMUClockType type)
 {
     QEMUTimerList *timer_list = main_loop_tlg.tl[type];
-    QEMUTimer *t = timer_list->active_timers.next;
     int64_t deadline = -1;
+    int i;
 
-    while (t != NULL) {
+    for (i = 0; i < PTIMER_TEST_MAX_TIMERS; i++) {
+        QEMUTimer *t = timer_list->active_timers[i];
+
+        if (t == NULL) {
+            continue;
+        }
         if (deadline == -1) {
             deadline = t->expire_time;
         } else {
             deadline = MIN(deadline, t->expire_time);
         }
-
-        t = t->next;
     }
 
     return deadline;
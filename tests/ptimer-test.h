@@ -15,8 +15,10 @@ extern bool qtest_allowed;
 
 extern int64_t ptimer_test_time_ns;
 
+#define PTIMER_TEST_MAX_TIMERS 8
+
 struct QEMUTimerList {
-    QEMUTimer active_timers;
+    QEMUTimer *active_timers[PTIMER_TEST_MAX_TIMERS];
 };
 
 #endif
@@ -9,6 +9,7 @@
 #include "qemu/atomic.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/tb-hash-xx.h"
 
 struct thread_stats {
@@ -20,6 +21,10 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    size_t stable_miss;
+    size_t lat_samples;
+    uint64_t lat_total_ns;
+    uint64_t lat_max_ns;
 };
 
 struct thread_info {
@@ -54,6 +59,14 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 
+/*
+ * In the concurrent resize scenario, keys at or above update_range are never
+ * removed, so lookups for them must always succeed.
+ */
+static bool concurrent_resize;
+/* in that scenario, time one in LAT_SAMPLE_MASK + 1 lookups */
+#define LAT_SAMPLE_MASK 0xff
+
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
 static uint64_t resize_threshold;
@@ -84,7 +97,12 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -c = concurrent resize scenario: populate all of -K, keep updates to\n"
+    "      its lower half, resize continuously unless -S is given, and\n"
+    "      check that keys in the upper half are always found. Also\n"
+    "      reports lookup latency.";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -146,15 +164,29 @@ static void do_rw(struct thread_info *info)
     long *p;
 
     if (info->r >= update_threshold) {
+        unsigned long idx = info->r & (lookup_range - 1);
+        int64_t t = 0;
         bool read;
 
-        p = &keys[info->r & (lookup_range - 1)];
+        p = &keys[idx];
         hash = h(*p);
+        if (concurrent_resize && (info->r & LAT_SAMPLE_MASK) == 0) {
+            t = get_clock();
+        }
         read = qht_lookup(&ht, is_equal, p, hash);
+        if (t) {
+            t = get_clock() - t;
+            stats->lat_samples++;
+            stats->lat_total_ns += t;
+            stats->lat_max_ns = MAX(stats->lat_max_ns, t);
+        }
         if (read) {
             stats->rd++;
         } else {
             stats->not_rd++;
+            if (concurrent_resize && idx >= update_range) {
+                stats->stable_miss++;
+            }
         }
     } else {
         p = &keys[info->r & (update_range - 1)];
@@ -258,6 +290,9 @@ static void pr_params(void)
     printf(" initial size hint: %zu\n", qht_n_elems);
     printf(" auto-resize:       %s\n",
            qht_mode & QHT_MODE_AUTO_RESIZE ? "on" : "off");
+    if (concurrent_resize) {
+        printf(" scenario:          concurrent resize\n");
+    }
     if (resize_rate) {
         printf(" resize_rate:       %f%%\n", resize_rate * 100.0);
         printf(" resize range:      %zu-%zu\n", resize_min, resize_max);
@@ -349,10 +384,15 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->stable_miss += stats->stable_miss;
+        s->lat_samples += stats->lat_samples;
+        s->lat_total_ns += stats->lat_total_ns;
+        s->lat_max_ns = MAX(s->lat_max_ns, stats->lat_max_ns);
     }
 }
 
-static void pr_stats(void)
+static size_t pr_stats(void)
 {
     struct thread_stats s = {};
     double tx;
@@ -383,6 +423,14 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+
+    if (concurrent_resize) {
+        printf(" Lookup latency:    avg %.1f ns, max %.1f us\n",
+               s.lat_samples ? (double)s.lat_total_ns / s.lat_samples : 0,
+               s.lat_max_ns / 1e3);
+        printf(" Stable key misses: %zu\n", s.stable_miss);
+    }
+    return s.stable_miss;
 }
 
 static void run_test(void)
@@ -409,14 +457,18 @@ static void run_test(void)
 
 static void parse_args(int argc, char *argv[])
 {
+    bool resize_given = false;
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:r:Rs:S:u:");
+        c = getopt(argc, argv, "cd:D:g:k:K:l:hn:N:o:r:Rs:S:u:");
         if (c < 0) {
             break;
         }
         switch (c) {
+        case 'c':
+            concurrent_resize = true;
+            break;
         case 'd':
             duration = atoi(optarg);
             break;
@@ -461,6 +513,7 @@ static void parse_args(int argc, char *argv[])
             qht_n_elems = atol(optarg);
             break;
         case 'S':
+            resize_given = true;
             resize_rate = atof(optarg) / 100.0;
             if (resize_rate > 1.0) {
                 resize_rate = 1.0;
@@ -474,6 +527,18 @@ static void parse_args(int argc, char *argv[])
             break;
         }
     }
+
+    if (concurrent_resize) {
+        if (init_range < 2) {
+            init_range = 2;
+        }
+        init_size = init_range;
+        lookup_range = init_range;
+        update_range = init_range / 2;
+        if (!resize_given) {
+            resize_rate = 1.0;
+        }
+    }
 }
 
 int main(int argc, char *argv[])
@@ -482,6 +547,5 @@ int main(int argc, char *argv[])
     htable_init();
     create_threads();
     run_test();
-    pr_stats();
-    return 0;
+    return pr_stats() ? 1 : 0;
 }
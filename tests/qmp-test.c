@@ -14,6 +14,7 @@
 #include "libqtest.h"
 #include "qapi-visit.h"
 #include "qapi/error.h"
+#include "qapi/qmp/qstring.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/util.h"
 #include "qapi/visitor.h"
@@ -76,7 +77,7 @@ static void test_qmp_protocol(void)
     QDict *resp, *q, *ret;
     QList *capabilities;
 
-    global_qtest = qtest_init_without_qmp_handshake(common_args);
+    global_qtest = qtest_init_without_qmp_handshake(false, common_args);
 
     /* Test greeting */
     resp = qmp_receive();
@@ -95,6 +96,12 @@ static void test_qmp_protocol(void)
     /* Test malformed commands before handshake */
     test_malformed();
 
+    /* Test handshake with a capability that is not offered */
+    resp = qmp("{ 'execute': 'qmp_capabilities',"
+               " 'arguments': { 'enable': [ 'oob' ] } }");
+    g_assert_cmpstr(get_error_class(resp), ==, "GenericError");
+    QDECREF(resp);
+
     /* Test handshake */
     resp = qmp("{ 'execute': 'qmp_capabilities' }");
     ret = qdict_get_qdict(resp, "return");
@@ -114,6 +121,11 @@ static void test_qmp_protocol(void)
     /* Test malformed commands */
     test_malformed();
 
+    /* Test out-of-band command without the capability */
+    resp = qmp("{ 'exec-oob': 'query-status' }");
+    g_assert_cmpstr(get_error_class(resp), ==, "GenericError");
+    QDECREF(resp);
+
     /* Test 'id' */
     resp = qmp("{ 'execute': 'query-name', 'id': 'cookie#1' }");
     ret = qdict_get_qdict(resp, "return");
@@ -130,6 +142,74 @@ static void test_qmp_protocol(void)
     qtest_end();
 }
 
+static bool qlist_has_str(QList *list, const char *str)
+{
+    const QListEntry *entry;
+
+    QLIST_FOREACH_ENTRY(list, entry) {
+        QString *qstr = qobject_to_qstring(qlist_entry_obj(entry));
+
+        if (qstr && !strcmp(qstring_get_str(qstr), str)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_qmp_oob(void)
+{
+    QDict *resp, *q, *ret;
+    QList *capabilities;
+
+    global_qtest = qtest_init_without_qmp_handshake(true, common_args);
+
+    /* Test greeting */
+    resp = qmp_receive();
+    q = qdict_get_qdict(resp, "QMP");
+    g_assert(q);
+    capabilities = qdict_get_qlist(q, "capabilities");
+    g_assert(capabilities && qlist_has_str(capabilities, "oob"));
+    QDECREF(resp);
+
+    /* Test handshake with an unknown capability */
+    resp = qmp("{ 'execute': 'qmp_capabilities',"
+               " 'arguments': { 'enable': [ 'no-such-cap' ] } }");
+    g_assert_cmpstr(get_error_class(resp), ==, "GenericError");
+    QDECREF(resp);
+
+    /* Test handshake */
+    resp = qmp("{ 'execute': 'qmp_capabilities',"
+               " 'arguments': { 'enable': [ 'oob' ] } }");
+    ret = qdict_get_qdict(resp, "return");
+    g_assert(ret && !qdict_size(ret));
+    QDECREF(resp);
+
+    /* Test out-of-band command */
+    resp = qmp("{ 'exec-oob': 'query-status', 'id': 'oob#1' }");
+    ret = qdict_get_qdict(resp, "return");
+    g_assert(ret && qdict_haskey(ret, "running"));
+    g_assert_cmpstr(qdict_get_try_str(resp, "id"), ==, "oob#1");
+    QDECREF(resp);
+
+    /* Test in-band command */
+    resp = qmp("{ 'execute': 'query-status' }");
+    g_assert(qdict_haskey(resp, "return"));
+    QDECREF(resp);
+
+    /* Test out-of-band command that doesn't support it */
+    resp = qmp("{ 'exec-oob': 'query-name', 'id': 2 }");
+    g_assert_cmpstr(get_error_class(resp), ==, "GenericError");
+    g_assert_cmpint(qdict_get_int(resp, "id"), ==, 2);
+    QDECREF(resp);
+
+    /* Test 'execute' and 'exec-oob' together */
+    resp = qmp("{ 'execute': 'query-status', 'exec-oob': 'query-status' }");
+    g_assert_cmpstr(get_error_class(resp), ==, "GenericError");
+    QDECREF(resp);
+
+    qtest_end();
+}
+
 static int query_error_class(const char *cmd)
 {
     static struct {
@@ -190,6 +270,126 @@ static void test_query(const void *data)
     qtest_end();
 }
 
+static void throughput_send(bool large)
+{
+    if (large) {
+        qmp_async("{ 'execute': 'qom-list',"
+                  " 'arguments': { 'path': '/machine' } }");
+    } else {
+        qmp_async("{ 'execute': 'query-status' }");
+    }
+}
+
+/*
+ * Command throughput: keep a window of commands in flight, so that the
+ * round trip latency does not dominate.  libqtest reads the responses a
+ * byte at a time, so this is a lower bound for QEMU's own throughput.
+ */
+static void test_throughput(void)
+{
+    const int count = 20000, window = 32;
+    double secs;
+    QDict *resp;
+    int large, j;
+
+    qtest_start(common_args);
+    for (large = 0; large <= 1; large++) {
+        g_test_timer_start();
+        for (j = 0; j < count + window; j++) {
+            if (j < count) {
+                throughput_send(large);
+            }
+            if (j >= window) {
+                resp = qmp_receive();
+                g_assert(qdict_haskey(resp, "return"));
+                QDECREF(resp);
+            }
+        }
+        secs = g_test_timer_elapsed();
+        g_test_message("%s: %.0f commands/s",
+                       large ? "qom-list" : "query-status", count / secs);
+    }
+    qtest_end();
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+
+    return da < db ? -1 : da > db;
+}
+
+/*
+ * Send query-status, in-band or out-of-band, and wait for its response
+ * while keeping the in-band commands that are already in flight coming.
+ * Returns the latency in microseconds.
+ */
+static double oob_latency_one(bool oob, int seq)
+{
+    QDict *resp;
+
+    g_test_timer_start();
+    if (oob) {
+        qmp_async("{ 'exec-oob': 'query-status', 'id': %d }", seq);
+    } else {
+        qmp_async("{ 'execute': 'query-status', 'id': %d }", seq);
+    }
+    for (;;) {
+        resp = qmp_receive();
+        g_assert(qdict_haskey(resp, "return"));
+        if (qdict_haskey(resp, "id")) {
+            g_assert_cmpint(qdict_get_int(resp, "id"), ==, seq);
+            QDECREF(resp);
+            break;
+        }
+        /* Keep the backlog up until the probe is answered */
+        qmp_async("{ 'execute': 'query-qmp-schema' }");
+        QDECREF(resp);
+    }
+    return g_test_timer_elapsed() * 1e6;
+}
+
+/*
+ * Latency of query-status behind a pipelined backlog of expensive
+ * in-band commands: out-of-band requests should not have to wait for
+ * the main loop.  The backlog stays below the size of the monitor's
+ * request queue, so that the I/O thread keeps reading.
+ */
+static void test_oob_latency(void)
+{
+    const int backlog = 4;
+    double lat[200];
+    const int count = ARRAY_SIZE(lat);
+    QDict *resp;
+    int oob, i, j;
+
+    global_qtest = qtest_init_without_qmp_handshake(true, common_args);
+    qmp_discard_response("");
+    qmp_discard_response("{ 'execute': 'qmp_capabilities',"
+                         " 'arguments': { 'enable': [ 'oob' ] } }");
+
+    for (oob = 0; oob <= 1; oob++) {
+        for (i = 0; i < count; i++) {
+            for (j = 0; j < backlog; j++) {
+                qmp_async("{ 'execute': 'query-qmp-schema' }");
+            }
+            lat[i] = oob_latency_one(oob, i);
+            /* Drain what is left of the backlog */
+            for (j = 0; j < backlog; j++) {
+                resp = qmp_receive();
+                g_assert(!qdict_haskey(resp, "id"));
+                QDECREF(resp);
+            }
+        }
+        qsort(lat, count, sizeof(lat[0]), compare_double);
+        g_test_message("%s query-status: p50 %.0f us, p90 %.0f us, "
+                       "p99 %.0f us", oob ? "out-of-band" : "in-band",
+                       lat[count / 2], lat[count * 9 / 10],
+                       lat[count * 99 / 100]);
+    }
+    qtest_end();
+}
+
 static bool query_is_blacklisted(const char *cmd)
 {
     const char *blacklist[] = {
@@ -308,6 +508,11 @@ int main(int argc, char *argv[])
     g_test_init(&argc, &argv, NULL);
 
     qtest_add_func("qmp/protocol", test_qmp_protocol);
+    qtest_add_func("qmp/oob", test_qmp_oob);
+    if (g_test_perf()) {
+        qtest_add_func("qmp/throughput", test_throughput);
+        qtest_add_func("qmp/oob-latency", test_oob_latency);
+    }
     qmp_schema_init(&schema);
     add_query_tests(&schema);
 
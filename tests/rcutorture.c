@@ -11,6 +11,9 @@
  *     ./rcu <nreaders> perf [ <seconds> ]
  *         Run a combined read/update performance test with the specified
  *         number of readers and one updater and specified duration.
+ *     ./rcu <nupdaters> cperf [ <seconds> ]
+ *         Run a reclamation throughput test with the specified number of
+ *         threads queueing call_rcu() callbacks, plus one reader.
  *
  * The above tests produce output as follows:
  *
@@ -23,6 +26,13 @@
  * lists the average duration of each type of operation in nanoseconds,
  * or "nan" if the corresponding type of operation was not performed.
  *
+ * The cperf test instead prints the number of callbacks that were queued
+ * and run, and the grace period and batch statistics from rcu_get_stats():
+ *
+ * n_calls: 18263040  n_freed: 18263040  nupdaters: 4  duration: 1
+ * ns/call: 219.018  grace periods: 37  avg gp: 41.2 us  max gp: 95.7 us
+ * max batch: 712704  backlog: 0
+ *
  *     ./rcu <nreaders> stress [ <seconds> ]
  *         Run a stress test with the specified number of readers and
  *         one updater.
@@ -216,6 +226,86 @@ static void uperftest(int nupdaters, int duration)
     perftestrun(i, duration, 0, nupdaters);
 }
 
+/*
+ * Reclamation throughput test.
+ */
+
+struct rcu_call_perf {
+    struct rcu_head rcu;
+    int payload;
+};
+
+static long long n_freed;
+
+static void rcu_call_perf_free(struct rcu_call_perf *p)
+{
+    atomic_inc(&n_freed);
+    g_free(p);
+}
+
+static void *rcu_call_perf_test(void *arg)
+{
+    long long n_updates_local = 0;
+    struct rcu_call_perf *p;
+
+    rcu_register_thread();
+
+    *(struct rcu_reader_data **)arg = &rcu_reader;
+    atomic_inc(&nthreadsrunning);
+    while (goflag == GOFLAG_INIT) {
+        g_usleep(1000);
+    }
+    while (goflag == GOFLAG_RUN) {
+        p = g_new(struct rcu_call_perf, 1);
+        p->payload = n_updates_local;
+        call_rcu(p, rcu_call_perf_free, rcu);
+        n_updates_local++;
+    }
+    qemu_mutex_lock(&counts_mutex);
+    n_updates += n_updates_local;
+    qemu_mutex_unlock(&counts_mutex);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void cperftest(int nupdaters, int duration)
+{
+    RCUStats stats;
+    int i;
+
+    perftestinit();
+    for (i = 0; i < nupdaters; i++) {
+        create_thread(rcu_call_perf_test);
+    }
+    create_thread(rcu_read_perf_test);
+    while (atomic_read(&nthreadsrunning) < i + 1) {
+        g_usleep(1000);
+    }
+    goflag = GOFLAG_RUN;
+    g_usleep(duration * G_USEC_PER_SEC);
+    goflag = GOFLAG_STOP;
+    wait_all_threads();
+
+    /* Let the call_rcu thread catch up.  */
+    while (atomic_read(&n_freed) < n_updates) {
+        g_usleep(1000);
+    }
+
+    rcu_get_stats(&stats);
+    printf("n_calls: %ld  n_freed: %lld  nupdaters: %d  duration: %d\n",
+           n_updates, n_freed, nupdaters, duration);
+    printf("ns/call: %g  grace periods: %" PRIu64 "  avg gp: %.1f us  "
+           "max gp: %.1f us\n",
+           duration * 1000 * 1000 * 1000. * nupdaters / n_updates,
+           stats.grace_periods,
+           stats.gp_total_ns / 1000. / MAX(stats.grace_periods, 1),
+           stats.gp_max_ns / 1000.);
+    printf("max batch: %" PRIu64 "  backlog: %" PRIu64 "\n",
+           stats.max_batch, stats.backlog);
+    exit(0);
+}
+
 /*
  * Stress test.
  */
@@ -417,7 +507,8 @@ static void gtest_stress_10_5(void)
 
 static void usage(int argc, char *argv[])
 {
-    fprintf(stderr, "Usage: %s [nreaders [ perf | stress ] ]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [nreaders [ perf | stress | cperf ] ]\n",
+            argv[0]);
     exit(-1);
 }
 
@@ -453,6 +544,8 @@ int main(int argc, char *argv[])
         uperftest(nreaders, duration);
     } else if (strcmp(argv[2], "perf") == 0) {
         perftest(nreaders, duration);
+    } else if (strcmp(argv[2], "cperf") == 0) {
+        cperftest(nreaders, duration);
     }
     usage(argc, argv);
     return 0;
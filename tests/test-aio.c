@@ -405,6 +405,46 @@ static void test_aio_external_client(void)
     }
 }
 
+typedef struct {
+    EventNotifier e;
+    BHTestData bh;
+} BatchTestData;
+
+static void batch_event_cb(EventNotifier *e)
+{
+    BatchTestData *data = container_of(e, BatchTestData, e);
+
+    g_assert(event_notifier_test_and_clear(e));
+    qemu_bh_schedule(data->bh.bh);
+}
+
+/* A bottom half scheduled by a completion runs in the same aio_poll().  */
+static void test_event_batch_bh(void)
+{
+    BatchTestData data = { .bh = { .n = 0 } };
+    AioPollStats before, after;
+
+    data.bh.bh = aio_bh_new(ctx, bh_test_cb, &data.bh);
+    event_notifier_init(&data.e, false);
+    set_event_notifier(ctx, &data.e, batch_event_cb);
+    while (aio_poll(ctx, false));
+    aio_context_get_poll_stats(ctx, &before);
+
+    event_notifier_set(&data.e);
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(data.bh.n, ==, 1);
+    g_assert(!aio_poll(ctx, false));
+    g_assert_cmpint(data.bh.n, ==, 1);
+
+    aio_context_get_poll_stats(ctx, &after);
+    g_assert_cmpint(after.dispatches - before.dispatches, ==, 1);
+    g_assert_cmpint(after.batch_rounds - before.batch_rounds, ==, 1);
+
+    set_event_notifier(ctx, &data.e, NULL);
+    event_notifier_cleanup(&data.e);
+    qemu_bh_delete(data.bh.bh);
+}
+
 static void test_wait_event_notifier_noflush(void)
 {
     EventNotifierTestData data = { .n = 0 };
@@ -862,6 +902,7 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
+    g_test_add_func("/aio/event/batch-bh",          test_event_batch_bh);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
 
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
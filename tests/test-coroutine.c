@@ -277,6 +277,80 @@ static void test_order(void)
         g_assert_cmpint(records[i].state, ==, expected_pos[i].state);
     }
 }
+
+/*
+ * Check that terminated coroutines are reused and counted as pool hits
+ */
+
+static void coroutine_fn yield_once(void *opaque)
+{
+    qemu_coroutine_yield();
+}
+
+static void test_pool_stats(void)
+{
+    CoroutinePoolStats before, after;
+    Coroutine *coroutines[100];
+    Coroutine *coroutine;
+    bool done;
+    int i;
+
+    /* Fill the pool with more than one batch of coroutines */
+    for (i = 0; i < ARRAY_SIZE(coroutines); i++) {
+        coroutines[i] = qemu_coroutine_create(yield_once, NULL);
+        qemu_coroutine_enter(coroutines[i]);
+    }
+    for (i = 0; i < ARRAY_SIZE(coroutines); i++) {
+        qemu_coroutine_enter(coroutines[i]);
+    }
+
+    qemu_coroutine_pool_get_stats(NULL, &before);
+    for (i = 0; i < 10; i++) {
+        coroutine = qemu_coroutine_create(set_and_exit, &done);
+        qemu_coroutine_enter(coroutine);
+    }
+    qemu_coroutine_pool_get_stats(NULL, &after);
+
+    g_assert_cmpint(after.hits - before.hits, ==, 10);
+    g_assert_cmpint(after.misses, ==, before.misses);
+}
+
+#ifdef CONFIG_POSIX
+/*
+ * Check that stacks from the arena are distinct and usable, also across
+ * more than one chunk
+ */
+
+#define NR_STACKS 200
+
+static void test_stack_arena(void)
+{
+    void *stacks[NR_STACKS];
+    size_t sizes[NR_STACKS];
+    size_t pagesz = getpagesize();
+    int i, j;
+
+    for (j = 0; j < 2; j++) {
+        for (i = 0; i < NR_STACKS; i++) {
+            sizes[i] = COROUTINE_STACK_SIZE;
+            stacks[i] = qemu_coroutine_stack_alloc(&sizes[i]);
+            g_assert_cmpint(sizes[i], >=, COROUTINE_STACK_SIZE + pagesz);
+
+            /* Everything above the guard page is ours */
+            memset(stacks[i] + pagesz, i, sizes[i] - pagesz);
+        }
+        for (i = 0; i < NR_STACKS; i++) {
+            g_assert_cmpint(*(uint8_t *)(stacks[i] + pagesz), ==, i & 0xff);
+            g_assert_cmpint(*(uint8_t *)(stacks[i] + sizes[i] - 1), ==,
+                            i & 0xff);
+        }
+        for (i = 0; i < NR_STACKS; i++) {
+            qemu_coroutine_stack_free(stacks[i], sizes[i]);
+        }
+    }
+}
+#endif
+
 /*
  * Lifecycle benchmark
  */
@@ -304,6 +378,41 @@ static void perf_lifecycle(void)
     g_test_message("Lifecycle %u iterations: %f s\n", max, duration);
 }
 
+/*
+ * Create, enter and terminate coroutines in bursts bigger than the pool,
+ * as a deep queue of block requests does
+ */
+
+#define BURST 1000
+
+static void perf_lifecycle_burst(void)
+{
+    const unsigned int burst = BURST, rounds = 200;
+    Coroutine *coroutines[BURST];
+    CoroutinePoolStats before, after;
+    unsigned int i, j;
+    double duration;
+
+    qemu_coroutine_pool_get_stats(NULL, &before);
+    g_test_timer_start();
+    for (i = 0; i < rounds; i++) {
+        for (j = 0; j < burst; j++) {
+            coroutines[j] = qemu_coroutine_create(yield_once, NULL);
+            qemu_coroutine_enter(coroutines[j]);
+        }
+        for (j = 0; j < burst; j++) {
+            qemu_coroutine_enter(coroutines[j]);
+        }
+    }
+    duration = g_test_timer_elapsed();
+    qemu_coroutine_pool_get_stats(NULL, &after);
+
+    g_test_message("Lifecycle %u bursts of %u: %f s, %.0f coroutines/s, "
+                   "pool hits %" PRIu64 " misses %" PRIu64 "\n",
+                   rounds, burst, duration, rounds * burst / duration,
+                   after.hits - before.hits, after.misses - before.misses);
+}
+
 static void perf_nesting(void)
 {
     unsigned int i, maxcycles, maxnesting;
@@ -424,7 +533,11 @@ int main(int argc, char **argv)
      */
     if (CONFIG_COROUTINE_POOL) {
         g_test_add_func("/basic/co_queue", test_co_queue);
+        g_test_add_func("/basic/pool-stats", test_pool_stats);
     }
+#ifdef CONFIG_POSIX
+    g_test_add_func("/basic/stack-arena", test_stack_arena);
+#endif
 
     g_test_add_func("/basic/lifecycle", test_lifecycle);
     g_test_add_func("/basic/yield", test_yield);
@@ -435,6 +548,7 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/order", test_order);
     if (g_test_perf()) {
         g_test_add_func("/perf/lifecycle", perf_lifecycle);
+        g_test_add_func("/perf/lifecycle-burst", perf_lifecycle_burst);
         g_test_add_func("/perf/nesting", perf_nesting);
         g_test_add_func("/perf/yield", perf_yield);
         g_test_add_func("/perf/function-call", perf_baseline);
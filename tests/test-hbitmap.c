@@ -902,6 +902,58 @@ static void test_hbitmap_serialize_zeroes(TestHBitmapData *data,
     }
 }
 
+/* Exercise every implementation of the word array operations, with
+ * ranges that cover partial and whole words on each level.
+ */
+static void test_hbitmap_accel(TestHBitmapData *data, const void *unused)
+{
+    static const struct {
+        uint64_t first, count;
+    } sets[] = {
+        { 1, L2 - 2 },
+        { L1 + 3, L1 * 5 },
+        { L2 - 7, L1 * 3 + 9 },
+        { L2 * 5 + 1, L2 * 3 },
+    }, resets[] = {
+        { L1 * 2 + 1, L2 },
+        { L2 * 6, L1 * 17 + 3 },
+    };
+    HBitmap *other;
+    uint8_t *buf;
+    size_t buf_size;
+    uint64_t i;
+    int j;
+
+    do {
+        hbitmap_test_init(data, L2 * 10, 0);
+        for (j = 0; j < ARRAY_SIZE(sets); j++) {
+            hbitmap_test_set(data, sets[j].first, sets[j].count);
+        }
+        for (j = 0; j < ARRAY_SIZE(resets); j++) {
+            hbitmap_test_reset(data, resets[j].first, resets[j].count);
+        }
+
+        other = hbitmap_alloc(data->size, 0);
+        hbitmap_set(other, L2 * 3 - 5, L1 * 7 + 1);
+        g_assert(hbitmap_merge(data->hb, other));
+        for (i = L2 * 3 - 5; i < L2 * 3 - 5 + L1 * 7 + 1; i++) {
+            set_bit(i, data->bits);
+        }
+        hbitmap_test_check(data, 0);
+        hbitmap_free(other);
+
+        buf_size = hbitmap_serialization_size(data->hb, 0, data->size);
+        buf = g_malloc0(buf_size);
+        hbitmap_serialize_part(data->hb, buf, 0, data->size);
+        hbitmap_reset_all(data->hb);
+        hbitmap_deserialize_part(data->hb, buf, 0, data->size, true);
+        hbitmap_test_check(data, 0);
+        g_free(buf);
+
+        hbitmap_test_teardown(data, NULL);
+    } while (test_hbitmap_next_accel());
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -925,6 +977,92 @@ static void test_hbitmap_iter_and_reset(TestHBitmapData *data,
     hbitmap_iter_next(&hbi);
 }
 
+/*
+ * Dirty bitmap of a 1 TiB disk with 64 KiB granularity, with @len bytes
+ * dirty every @stride bytes; time the operations of a backup or mirror
+ * job on it, with each implementation of the word array operations.
+ */
+static void hbitmap_perf_run(const char *name, uint64_t stride, uint64_t len)
+{
+    const uint64_t size = 1ULL << 40;
+    const int granularity = 16;
+    HBitmap *a, *b;
+    HBitmapIter hbi;
+    uint8_t *buf;
+    size_t buf_size;
+    uint64_t off, items;
+    double set, count, merge, iter, ser, reset;
+    int accel = 0;
+
+    do {
+        a = hbitmap_alloc(size, granularity);
+        b = hbitmap_alloc(size, granularity);
+
+        g_test_timer_start();
+        for (off = 0; off < size; off += stride) {
+            hbitmap_set(a, off, len);
+        }
+        set = g_test_timer_elapsed();
+
+        /* Setting an already dirty range only counts its bits.  */
+        g_test_timer_start();
+        for (off = 0; off < size; off += stride) {
+            hbitmap_set(a, off, len);
+        }
+        count = g_test_timer_elapsed();
+
+        hbitmap_set(b, stride / 2, size - stride);
+        g_test_timer_start();
+        hbitmap_merge(b, a);
+        merge = g_test_timer_elapsed();
+
+        g_test_timer_start();
+        hbitmap_iter_init(&hbi, a, 0);
+        for (items = 0; hbitmap_iter_next(&hbi) >= 0; items++) {
+            /* nothing */
+        }
+        iter = g_test_timer_elapsed();
+        g_assert_cmpint(items << granularity, ==, hbitmap_count(a));
+
+        buf_size = hbitmap_serialization_size(a, 0, size);
+        buf = g_malloc(buf_size);
+        g_test_timer_start();
+        hbitmap_serialize_part(a, buf, 0, size);
+        hbitmap_deserialize_part(b, buf, 0, size, true);
+        ser = g_test_timer_elapsed();
+        g_assert_cmpint(hbitmap_count(a), ==, hbitmap_count(b));
+        g_free(buf);
+
+        g_test_timer_start();
+        for (off = 0; off < size; off += stride) {
+            hbitmap_reset(a, off, len);
+        }
+        reset = g_test_timer_elapsed();
+        g_assert(hbitmap_empty(a));
+
+        g_test_message("%s, implementation %d: set %.2f ms, count %.2f ms, "
+                       "merge %.2f ms, iterate %.2f ms, serialize %.2f ms, "
+                       "reset %.2f ms", name, accel++, set * 1000,
+                       count * 1000, merge * 1000, iter * 1000, ser * 1000,
+                       reset * 1000);
+
+        hbitmap_free(a);
+        hbitmap_free(b);
+    } while (test_hbitmap_next_accel());
+}
+
+static void test_hbitmap_perf_sparse(void)
+{
+    /* One cluster every 64 MiB */
+    hbitmap_perf_run("sparse", 64 << 20, 64 << 10);
+}
+
+static void test_hbitmap_perf_dense(void)
+{
+    /* Three quarters of every GiB */
+    hbitmap_perf_run("dense", 1 << 30, 768 << 20);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -985,6 +1123,12 @@ int main(int argc, char **argv)
 
     hbitmap_test_add("/hbitmap/iter/iter_and_reset",
                      test_hbitmap_iter_and_reset);
+    hbitmap_test_add("/hbitmap/accel", test_hbitmap_accel);
+
+    if (g_test_perf()) {
+        g_test_add_func("/hbitmap/perf/sparse", test_hbitmap_perf_sparse);
+        g_test_add_func("/hbitmap/perf/dense", test_hbitmap_perf_dense);
+    }
     g_test_run();
 
     return 0;
@@ -30,6 +30,7 @@
 #include "qemu-common.h"
 #include "qapi/error.h"
 #include "qemu/log.h"
+#include "qemu/thread.h"
 
 static void test_parse_range(void)
 {
@@ -108,6 +109,261 @@ static void test_parse_path(gconstpointer data)
     error_free_or_abort(&err);
 }
 
+#ifdef CONFIG_FOPENCOOKIE
+#define NR_THREADS 4
+
+/* Binary log format, keep in sync with util/log.c.  */
+enum {
+    LOG_REC_TEXT = 1,
+    LOG_REC_EXEC = 2,
+};
+
+#define LOG_REC_F_CONT 1
+
+typedef struct LogRecord {
+    uint16_t type;
+    uint16_t flags;
+    uint32_t len;
+    uint32_t thread;
+    uint32_t reserved;
+    uint64_t timestamp;
+} LogRecord;
+
+typedef struct LogExecRecord {
+    uint64_t host_pc;
+    uint64_t pc;
+    int32_t cpu_index;
+    uint32_t pc_bits;
+} LogExecRecord;
+
+static int nr_lines;
+
+static gchar *open_log(const char *tmp_path, int mask)
+{
+    gchar *file_path = g_build_filename(tmp_path, "binary.log", NULL);
+
+    qemu_set_log_filename(file_path, &error_abort);
+    qemu_set_log(mask);
+    g_assert(qemu_log_binary == !!(mask & LOG_BINARY));
+    return file_path;
+}
+
+static void *log_thread(void *opaque)
+{
+    int id = (uintptr_t)opaque;
+    int i;
+
+    for (i = 0; i < nr_lines; i++) {
+        qemu_log_mask(LOG_GUEST_ERROR, "thread %d line %d\n", id, i);
+        if (i % 100 == 0) {
+            qemu_log_lock();
+            qemu_log("group %d", id);
+            fprintf(qemu_logfile, " %d\n", i);
+            qemu_log_unlock();
+            qemu_log_exec_tb((void *)(uintptr_t)i, id, 0x1000 + i, 32, "sym");
+        }
+    }
+    return NULL;
+}
+
+static void run_threads(void)
+{
+    QemuThread threads[NR_THREADS];
+    int i;
+
+    for (i = 0; i < NR_THREADS; i++) {
+        qemu_thread_create(&threads[i], "log", log_thread,
+                           (void *)(uintptr_t)i, QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+}
+
+/* Check that every thread's records made it to the file, in order.  */
+static void test_binary_threads(gconstpointer data)
+{
+    int line[NR_THREADS] = { 0 };
+    int thread_of[NR_THREADS * 2];
+    bool in_group[NR_THREADS] = { false };
+    gchar *file_path, *contents, *p, *end;
+    gsize len;
+    int i, id, n;
+
+    nr_lines = 20000;
+    file_path = open_log(data, LOG_BINARY | LOG_GUEST_ERROR);
+    run_threads();
+    qemu_set_log(0);
+
+    memset(thread_of, -1, sizeof(thread_of));
+    g_assert(g_file_get_contents(file_path, &contents, &len, NULL));
+    g_assert(len > 16);
+    g_assert(memcmp(contents, "QEMULOG", 8) == 0);
+
+    for (p = contents + 16, end = contents + len; p < end; ) {
+        LogRecord rec;
+        const char *payload;
+
+        g_assert(p + sizeof(rec) <= end);
+        memcpy(&rec, p, sizeof(rec));
+        payload = p + sizeof(rec);
+        p += sizeof(rec) + rec.len;
+        g_assert(p <= end);
+        g_assert_cmpint(rec.thread, <, ARRAY_SIZE(thread_of));
+
+        if (rec.type == LOG_REC_EXEC) {
+            LogExecRecord exec;
+
+            memcpy(&exec, payload, sizeof(exec));
+            id = exec.cpu_index;
+            g_assert_cmpint(thread_of[rec.thread], ==, id);
+            g_assert_cmpint(exec.pc, ==, 0x1000 + line[id] - 1);
+            g_assert_cmpint(exec.pc_bits, ==, 32);
+            g_assert_cmpint(rec.len - sizeof(exec), ==, 3);
+            g_assert(memcmp(payload + sizeof(exec), "sym", 3) == 0);
+            continue;
+        }
+
+        g_assert_cmpint(rec.type, ==, LOG_REC_TEXT);
+        if (sscanf(payload, "thread %d line %d\n", &id, &n) == 2) {
+            g_assert_cmpint(rec.flags, ==, 0);
+            g_assert_cmpint(n, ==, line[id]++);
+            if (thread_of[rec.thread] == -1) {
+                thread_of[rec.thread] = id;
+            }
+        } else if (sscanf(payload, "group %d", &id) == 1) {
+            g_assert_cmpint(rec.flags, ==, 0);
+            in_group[id] = true;
+        } else {
+            /* The second half of a group is flagged as a continuation.  */
+            g_assert_cmpint(rec.flags, ==, LOG_REC_F_CONT);
+            id = thread_of[rec.thread];
+            g_assert(in_group[id]);
+            g_assert_cmpint(atoi(payload), ==, line[id] - 1);
+            in_group[id] = false;
+        }
+        g_assert_cmpint(thread_of[rec.thread], ==, id);
+    }
+
+    for (i = 0; i < NR_THREADS; i++) {
+        g_assert_cmpint(line[i], ==, nr_lines);
+    }
+    g_free(contents);
+    g_remove(file_path);
+    g_free(file_path);
+}
+
+/* Appending never mixes text lines and binary records in one file.  */
+static void test_binary_append(gconstpointer data)
+{
+    LogRecord rec;
+    gchar *file_path, *contents, *p;
+    gsize len;
+
+    file_path = open_log(data, LOG_GUEST_ERROR);
+    qemu_log("text\n");
+    qemu_set_log(LOG_BINARY | LOG_GUEST_ERROR);
+    g_assert(!qemu_log_binary);
+    qemu_log("more text\n");
+    qemu_set_log(0);
+
+    g_assert(g_file_get_contents(file_path, &contents, &len, NULL));
+    g_assert_cmpstr(contents, ==, "text\nmore text\n");
+    g_free(contents);
+    g_remove(file_path);
+    g_free(file_path);
+
+    file_path = open_log(data, LOG_BINARY | LOG_GUEST_ERROR);
+    qemu_log("binary\n");
+    qemu_set_log(LOG_GUEST_ERROR);
+    g_assert(qemu_log_binary);
+    qemu_log("more binary\n");
+    qemu_set_log(0);
+
+    /* One header, then both records.  */
+    g_assert(g_file_get_contents(file_path, &contents, &len, NULL));
+    g_assert(memcmp(contents, "QEMULOG", 8) == 0);
+    p = contents + 16;
+    memcpy(&rec, p, sizeof(rec));
+    g_assert_cmpint(rec.len, ==, 7);
+    g_assert(memcmp(p + sizeof(rec), "binary\n", 7) == 0);
+    p += sizeof(rec) + rec.len;
+    memcpy(&rec, p, sizeof(rec));
+    g_assert_cmpint(rec.len, ==, 12);
+    g_assert(memcmp(p + sizeof(rec), "more binary\n", 12) == 0);
+    p += sizeof(rec) + rec.len;
+    g_assert(p == contents + len);
+
+    g_free(contents);
+    g_remove(file_path);
+    g_free(file_path);
+}
+
+static bool flood_stop;
+
+static void *flood_thread(void *opaque)
+{
+    int i = 0;
+
+    while (!atomic_read(&flood_stop)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "line %d\n", i++);
+    }
+    return NULL;
+}
+
+/* Closing the log while threads fill their rings must not leave them
+ * waiting for the writer forever.
+ */
+static void test_binary_close(gconstpointer data)
+{
+    QemuThread threads[NR_THREADS];
+    gchar *file_path;
+    int i, round;
+
+    for (round = 0; round < 10; round++) {
+        file_path = open_log(data, LOG_BINARY | LOG_GUEST_ERROR);
+        atomic_set(&flood_stop, false);
+        for (i = 0; i < NR_THREADS; i++) {
+            qemu_thread_create(&threads[i], "flood", flood_thread,
+                               NULL, QEMU_THREAD_JOINABLE);
+        }
+        g_usleep(20000);
+        qemu_set_log(0);
+
+        atomic_set(&flood_stop, true);
+        for (i = 0; i < NR_THREADS; i++) {
+            qemu_thread_join(&threads[i]);
+        }
+        g_remove(file_path);
+        g_free(file_path);
+    }
+}
+
+/* Compare the time to log from several threads through stdio and through
+ * the per-thread buffers.
+ */
+static void test_binary_perf(gconstpointer data)
+{
+    gchar *file_path;
+    int binary;
+    double secs;
+
+    nr_lines = 500000;
+    for (binary = 0; binary <= 1; binary++) {
+        file_path = open_log(data, (binary ? LOG_BINARY : 0) | LOG_GUEST_ERROR);
+        g_test_timer_start();
+        run_threads();
+        secs = g_test_timer_elapsed();
+        qemu_set_log(0);
+
+        g_test_message("%s: %.1f ns per line", binary ? "binary" : "text",
+                       secs * 1e9 / (NR_THREADS * nr_lines));
+        g_remove(file_path);
+        g_free(file_path);
+    }
+}
+#endif
+
 /* Remove a directory and all its entries (non-recursive). */
 static void rmdir_full(gchar const *root)
 {
@@ -134,6 +390,18 @@ int main(int argc, char **argv)
 
     g_test_add_func("/logging/parse_range", test_parse_range);
     g_test_add_data_func("/logging/parse_path", tmp_path, test_parse_path);
+#ifdef CONFIG_FOPENCOOKIE
+    g_test_add_data_func("/logging/binary/threads", tmp_path,
+                         test_binary_threads);
+    g_test_add_data_func("/logging/binary/append", tmp_path,
+                         test_binary_append);
+    g_test_add_data_func("/logging/binary/close", tmp_path,
+                         test_binary_close);
+    if (g_test_perf()) {
+        g_test_add_data_func("/logging/binary/perf", tmp_path,
+                             test_binary_perf);
+    }
+#endif
 
     rc = g_test_run();
 
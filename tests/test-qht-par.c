@@ -7,19 +7,26 @@
 #include "qemu/osdep.h"
 
 #define TEST_QHT_STRING "tests/qht-bench 1>/dev/null 2>&1 -R -S0.1 -D10000 -N1 "
+#define TEST_QHT_RESIZE_STRING "tests/qht-bench 1>/dev/null 2>&1 -c -D100 "
 
-static void test_qht(int n_threads, int update_rate, int duration)
+static void test_qht_cmd(const char *cmd, int n_threads, int update_rate,
+                         int duration)
 {
     char *str;
     int rc;
 
-    str = g_strdup_printf(TEST_QHT_STRING "-n %d -u %d -d %d",
-                          n_threads, update_rate, duration);
+    str = g_strdup_printf("%s-n %d -u %d -d %d",
+                          cmd, n_threads, update_rate, duration);
     rc = system(str);
     g_free(str);
     g_assert_cmpint(rc, ==, 0);
 }
 
+static void test_qht(int n_threads, int update_rate, int duration)
+{
+    test_qht_cmd(TEST_QHT_STRING, n_threads, update_rate, duration);
+}
+
 static void test_2th0u1s(void)
 {
     test_qht(2, 0, 1);
@@ -40,6 +47,11 @@ static void test_2th20u5s(void)
     test_qht(2, 20, 5);
 }
 
+static void test_2th20u1s_resize(void)
+{
+    test_qht_cmd(TEST_QHT_RESIZE_STRING, 2, 20, 1);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -51,5 +63,7 @@ int main(int argc, char *argv[])
         g_test_add_func("/qht/parallel/2threads-0%updates-5s", test_2th0u5s);
         g_test_add_func("/qht/parallel/2threads-20%updates-5s", test_2th20u5s);
     }
+    g_test_add_func("/qht/parallel/2threads-20%updates-1s-resize",
+                    test_2th20u1s_resize);
     return g_test_run();
 }
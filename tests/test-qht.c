@@ -127,6 +127,17 @@ static void qht_do_test(unsigned int mode, size_t init_entries)
     insert(10, 150);
     check_n(N);
 
+    qht_resize(&ht, N * 4);
+    check(0, N, true);
+    check_n(N);
+    iter_check(N);
+    rm(10, 200);
+    qht_resize(&ht, N / 4);
+    check(10, 200, false);
+    check_n(N - 190);
+    insert(10, 200);
+    iter_check(N);
+
     rm(1, 2);
     check_n(N - 1);
     qht_reset_size(&ht, 0);
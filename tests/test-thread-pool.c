@@ -135,6 +135,33 @@ static void test_submit_many(void)
     }
 }
 
+/* Workers stopped while the pool is idle are started again on demand.  */
+static void test_stop_workers(void)
+{
+    WorkerTestData data[10];
+    int i, round;
+
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < 10; i++) {
+            data[i].n = 0;
+            data[i].ret = -EINPROGRESS;
+            thread_pool_submit_aio(pool, worker_cb, &data[i],
+                                   done_cb, &data[i]);
+        }
+
+        active = 10;
+        while (active > 0) {
+            aio_poll(ctx, true);
+        }
+        for (i = 0; i < 10; i++) {
+            g_assert_cmpint(data[i].n, ==, 1);
+            g_assert_cmpint(data[i].ret, ==, 0);
+        }
+
+        thread_pool_stop_workers(pool);
+    }
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -222,6 +249,53 @@ static void test_cancel_async(void)
     do_test_cancel(false);
 }
 
+static int perf_done;
+
+static int noop_cb(void *opaque)
+{
+    return 0;
+}
+
+static void perf_done_cb(void *opaque, int ret)
+{
+    perf_done++;
+}
+
+/* Submit/complete throughput of empty work items, with up to 1024 in
+ * flight, for a growing number of worker threads.
+ */
+static void test_perf_throughput(void)
+{
+    static const int nr_threads[] = { 1, 2, 4, 8, 16 };
+    const int count = 200000;
+    const int in_flight = 1024;
+    ThreadPool *perf_pool;
+    double secs;
+    int i, submitted;
+
+    for (i = 0; i < ARRAY_SIZE(nr_threads); i++) {
+        perf_pool = thread_pool_new(ctx);
+        thread_pool_set_max_threads(perf_pool, nr_threads[i]);
+        perf_done = 0;
+        submitted = 0;
+
+        g_test_timer_start();
+        while (perf_done < count) {
+            while (submitted < count && submitted - perf_done < in_flight) {
+                thread_pool_submit_aio(perf_pool, noop_cb, NULL,
+                                       perf_done_cb, NULL);
+                submitted++;
+            }
+            aio_poll(ctx, true);
+        }
+        secs = g_test_timer_elapsed();
+
+        g_test_message("%2d threads: %.0f requests/s",
+                       nr_threads[i], count / secs);
+        thread_pool_free(perf_pool);
+    }
+}
+
 int main(int argc, char **argv)
 {
     int ret;
@@ -235,8 +309,12 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/stop-workers", test_stop_workers);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
+    if (g_test_perf()) {
+        g_test_add_func("/thread-pool/perf/throughput", test_perf_throughput);
+    }
 
     ret = g_test_run();
 
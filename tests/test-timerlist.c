@@ -0,0 +1,216 @@
+/*
+ * QEMUTimerList tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#define NR_TIMERS 1000
+
+typedef struct TestTimer {
+    QEMUTimer timer;
+    int id;
+    bool armed;
+    int64_t expire;
+    unsigned seq;
+} TestTimer;
+
+static QEMUTimerList *tl;
+static TestTimer timers[NR_TIMERS];
+static unsigned seq;
+static int fired[NR_TIMERS];
+static int nr_fired;
+
+static void notify_cb(void *opaque, QEMUClockType type)
+{
+}
+
+static void timer_cb(void *opaque)
+{
+    TestTimer *t = opaque;
+
+    g_assert_cmpint(nr_fired, <, NR_TIMERS);
+    fired[nr_fired++] = t->id;
+}
+
+static void setup(void)
+{
+    int i;
+
+    tl = timerlist_new(QEMU_CLOCK_REALTIME, notify_cb, NULL);
+    for (i = 0; i < NR_TIMERS; i++) {
+        timer_init_tl(&timers[i].timer, tl, SCALE_NS, timer_cb, &timers[i]);
+        timers[i].id = i;
+        timers[i].armed = false;
+    }
+    nr_fired = 0;
+}
+
+static void teardown(void)
+{
+    int i;
+
+    for (i = 0; i < NR_TIMERS; i++) {
+        timer_del(&timers[i].timer);
+        timer_deinit(&timers[i].timer);
+    }
+    g_assert(!timerlist_has_timers(tl));
+    timerlist_free(tl);
+}
+
+static void arm(TestTimer *t, int64_t expire)
+{
+    timer_mod_ns(&t->timer, expire);
+    t->armed = true;
+    t->expire = expire;
+    t->seq = seq++;
+}
+
+static void disarm(TestTimer *t)
+{
+    timer_del(&t->timer);
+    t->armed = false;
+}
+
+static int compare_timers(const void *a, const void *b)
+{
+    const TestTimer *ta = &timers[*(const int *)a];
+    const TestTimer *tb = &timers[*(const int *)b];
+
+    if (ta->expire != tb->expire) {
+        return ta->expire < tb->expire ? -1 : 1;
+    }
+    return ta->seq < tb->seq ? -1 : ta->seq > tb->seq;
+}
+
+/*
+ * Timers must fire in expiration order, and in the order they were armed
+ * when they expire at the same time.
+ */
+static void test_order(void)
+{
+    int64_t base = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - SCALE_MS;
+    int expected[NR_TIMERS];
+    int i, n;
+
+    setup();
+    for (i = 0; i < NR_TIMERS; i++) {
+        arm(&timers[i], base + g_test_rand_int_range(0, 100));
+    }
+    for (i = 0; i < NR_TIMERS; i += 3) {
+        disarm(&timers[i]);
+    }
+    for (i = 0; i < NR_TIMERS; i += 5) {
+        arm(&timers[i], base + g_test_rand_int_range(0, 100));
+    }
+    /* timer_mod_anticipate only moves timers earlier */
+    for (i = 1; i < NR_TIMERS; i += 7) {
+        int64_t old = timers[i].expire;
+        int64_t expire = base + g_test_rand_int_range(0, 100);
+
+        timer_mod_anticipate_ns(&timers[i].timer, expire);
+        if (!timers[i].armed || expire < old) {
+            timers[i].armed = true;
+            timers[i].expire = expire;
+            timers[i].seq = seq++;
+        }
+    }
+
+    n = 0;
+    for (i = 0; i < NR_TIMERS; i++) {
+        g_assert(timer_pending(&timers[i].timer) == timers[i].armed);
+        if (timers[i].armed) {
+            g_assert_cmpint(timer_expire_time_ns(&timers[i].timer), ==,
+                            timers[i].expire);
+            expected[n++] = i;
+        }
+    }
+    qsort(expected, n, sizeof(expected[0]), compare_timers);
+
+    g_assert(timerlist_expired(tl));
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 0);
+    g_assert(timerlist_run_timers(tl));
+    g_assert_cmpint(nr_fired, ==, n);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpint(fired[i], ==, expected[i]);
+    }
+    g_assert(!timerlist_has_timers(tl));
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, -1);
+    teardown();
+}
+
+static void test_deadline(void)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t deadline;
+    int i;
+
+    setup();
+    for (i = 0; i < NR_TIMERS; i++) {
+        arm(&timers[i], now + 10 * NANOSECONDS_PER_SECOND + i * SCALE_MS);
+    }
+    disarm(&timers[0]);
+    deadline = timerlist_deadline_ns(tl);
+    g_assert_cmpint(deadline, <=, timers[1].expire - now);
+    g_assert_cmpint(deadline, >,
+                    timers[1].expire - now - NANOSECONDS_PER_SECOND);
+
+    arm(&timers[NR_TIMERS - 1], now + NANOSECONDS_PER_SECOND);
+    g_assert_cmpint(timerlist_deadline_ns(tl), <=, NANOSECONDS_PER_SECOND);
+    g_assert(!timerlist_expired(tl));
+    g_assert(!timerlist_run_timers(tl));
+    g_assert_cmpint(nr_fired, ==, 0);
+    teardown();
+}
+
+/* Re-arm and cancel random timers out of a large armed set.  */
+static void test_perf_mod_del(void)
+{
+    static const int sizes[] = { 16, 256, NR_TIMERS };
+    const int ops = 1000000;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    double secs;
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        setup();
+        for (j = 0; j < sizes[i]; j++) {
+            arm(&timers[j], now + 60 * NANOSECONDS_PER_SECOND +
+                g_test_rand_int_range(0, 1000000));
+        }
+
+        g_test_timer_start();
+        for (j = 0; j < ops; j++) {
+            TestTimer *t = &timers[g_test_rand_int_range(0, sizes[i])];
+
+            if (j & 1) {
+                timer_del(&t->timer);
+            } else {
+                timer_mod_ns(&t->timer, now + 60 * NANOSECONDS_PER_SECOND +
+                             g_test_rand_int_range(0, 1000000));
+            }
+        }
+        secs = g_test_timer_elapsed();
+
+        g_test_message("%d timers: %.1f ns per timer_mod/timer_del",
+                       sizes[i], secs * 1e9 / ops);
+        teardown();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    init_clocks(NULL);
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/timerlist/order", test_order);
+    g_test_add_func("/timerlist/deadline", test_deadline);
+    if (g_test_perf()) {
+        g_test_add_func("/timerlist/perf/mod-del", test_perf_mod_del);
+    }
+
+    return g_test_run();
+}
@@ -34,6 +34,9 @@
 #define MMIO_RAM_ADDR           0x40000000
 #define MMIO_RAM_SIZE           0x20000000
 
+#define PERF_REQ_SIZE           4096
+#define PERF_QUEUE_DEPTH        32
+
 typedef struct QVirtioBlkReq {
     uint32_t type;
     uint32_t ioprio;
@@ -277,6 +280,130 @@ static void test_basic(QVirtioDevice *dev, QGuestAllocator *alloc,
     }
 }
 
+/* Boot with the device on null-co, optionally in an IOThread, and set up
+ * PERF_QUEUE_DEPTH read requests.
+ */
+static QOSState *perf_start(bool iothread, QVirtioPCIDevice **pdev,
+                            QVirtQueuePCI **pvqpci, uint64_t *req_addrs)
+{
+    QOSState *qs;
+    QVirtioPCIDevice *dev;
+    QVirtQueuePCI *vqpci;
+    QVirtioBlkReq req;
+    uint32_t features;
+    int i;
+
+    qs = qtest_pc_boot("-drive if=none,id=drive0,file=null-co://,format=raw "
+                       "%s -device virtio-blk-pci,id=drv0,drive=drive0,"
+                       "addr=%x.%x%s",
+                       iothread ? "-object iothread,id=iothread0" : "",
+                       PCI_SLOT, PCI_FN,
+                       iothread ? ",iothread=iothread0" : "");
+    dev = virtio_blk_pci_init(qs->pcibus, PCI_SLOT);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev, qs->alloc, 0);
+    g_assert_cmpint(vqpci->vq.size, >=, 2 * PERF_QUEUE_DEPTH);
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    for (i = 0; i < PERF_QUEUE_DEPTH; i++) {
+        req.type = VIRTIO_BLK_T_IN;
+        req.ioprio = 1;
+        req.sector = i * (PERF_REQ_SIZE / 512);
+        req.data = g_malloc0(PERF_REQ_SIZE);
+        req_addrs[i] = virtio_blk_request(qs->alloc, &dev->vdev, &req,
+                                          PERF_REQ_SIZE);
+        g_free(req.data);
+    }
+
+    *pdev = dev;
+    *pvqpci = vqpci;
+    return qs;
+}
+
+static void perf_submit(QVirtioDevice *d, QVirtQueue *vq, uint64_t req_addr)
+{
+    uint32_t free_head;
+
+    free_head = qvirtqueue_add(vq, req_addr, 16, false, true);
+    qvirtqueue_add(vq, req_addr + 16, PERF_REQ_SIZE + 1, true, false);
+    qvirtqueue_kick(d, vq, free_head);
+}
+
+/* Wait for @n completions, in whatever order they come.  */
+static void perf_wait(QVirtQueue *vq, int n)
+{
+    gint64 start_time = g_get_monotonic_time();
+
+    while (n) {
+        if (qvirtqueue_get_buf(vq, NULL)) {
+            n--;
+        } else {
+            g_assert(g_get_monotonic_time() - start_time <=
+                     QVIRTIO_BLK_TIMEOUT_US);
+        }
+    }
+
+    /* Nothing is in flight, so reuse the descriptors from the start */
+    vq->free_head = 0;
+    vq->num_free = vq->size;
+}
+
+/*
+ * 4 KiB reads from null-co, one at a time and PERF_QUEUE_DEPTH at a time.
+ * Every guest access is a qtest round trip, so the numbers are only good
+ * for comparing QEMU builds on the same host.
+ */
+static void pci_perf(void)
+{
+    const int count = 2048;
+    uint64_t req_addrs[PERF_QUEUE_DEPTH];
+    QVirtioPCIDevice *dev;
+    QVirtQueuePCI *vqpci;
+    QOSState *qs;
+    double lat, tput;
+    int iothread, i, j;
+
+    for (iothread = 0; iothread <= 1; iothread++) {
+        qs = perf_start(iothread, &dev, &vqpci, req_addrs);
+
+        g_test_timer_start();
+        for (i = 0; i < count; i++) {
+            perf_submit(&dev->vdev, &vqpci->vq, req_addrs[0]);
+            perf_wait(&vqpci->vq, 1);
+        }
+        lat = g_test_timer_elapsed();
+
+        g_test_timer_start();
+        for (i = 0; i < count; i += PERF_QUEUE_DEPTH) {
+            for (j = 0; j < PERF_QUEUE_DEPTH; j++) {
+                perf_submit(&dev->vdev, &vqpci->vq, req_addrs[j]);
+            }
+            perf_wait(&vqpci->vq, PERF_QUEUE_DEPTH);
+        }
+        tput = g_test_timer_elapsed();
+
+        g_test_message("%s: %.1f us per request at depth 1, "
+                       "%.0f requests/s at depth %d",
+                       iothread ? "iothread" : "main loop",
+                       lat * 1e6 / count, count / tput, PERF_QUEUE_DEPTH);
+
+        for (i = 0; i < PERF_QUEUE_DEPTH; i++) {
+            guest_free(qs->alloc, req_addrs[i]);
+        }
+        qvirtqueue_cleanup(dev->vdev.bus, &vqpci->vq, qs->alloc);
+        qvirtio_pci_device_disable(dev);
+        qvirtio_pci_device_free(dev);
+        qtest_shutdown(qs);
+    }
+}
+
 static void pci_basic(void)
 {
     QVirtioPCIDevice *dev;
@@ -727,6 +854,9 @@ int main(int argc, char **argv)
         if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
             qtest_add_func("/virtio/blk/pci/msix", pci_msix);
             qtest_add_func("/virtio/blk/pci/idx", pci_idx);
+            if (g_test_perf()) {
+                qtest_add_func("/virtio/blk/pci/perf", pci_perf);
+            }
         }
         qtest_add_func("/virtio/blk/pci/hotplug", pci_hotplug);
     } else if (strcmp(arch, "arm") == 0) {
@@ -51,17 +51,17 @@ static QVirtioPCIDevice *virtio_net_pci_init(QPCIBus *bus, int slot)
     return dev;
 }
 
-static QOSState *pci_test_start(int socket)
+static QOSState *pci_test_start(const char *netdev, int socket)
 {
     const char *arch = qtest_get_arch();
-    const char *cmd = "-netdev socket,fd=%d,id=hs0 -device "
+    const char *cmd = "-netdev %s,fd=%d,id=hs0 -device "
                       "virtio-net-pci,netdev=hs0";
 
     if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
-        return qtest_pc_boot(cmd, socket);
+        return qtest_pc_boot(cmd, netdev, socket);
     }
     if (strcmp(arch, "ppc64") == 0) {
-        return qtest_spapr_boot(cmd, socket);
+        return qtest_spapr_boot(cmd, netdev, socket);
     }
     g_printerr("virtio-net tests are only available on x86 or ppc64\n");
     exit(EXIT_FAILURE);
@@ -204,22 +204,201 @@ static void stop_cont_test(QVirtioDevice *dev,
     rx_stop_cont_test(dev, alloc, rvq, socket);
 }
 
-static void pci_basic(gconstpointer data)
+#define PERF_BATCH      128
+#define PERF_ROUNDS     200
+#define PERF_FRAME_LEN  60
+
+/*
+ * Add @n buffers of @len bytes at @addr to the avail ring, but leave it
+ * to ring_kick() to publish them.  Returns the new avail index.
+ */
+static uint16_t ring_post(QVirtQueue *vq, uint64_t addr, uint32_t len,
+                          bool write, int n)
+{
+    /* vq->avail->idx */
+    uint16_t idx = readw(vq->avail + 2);
+    uint32_t head;
+    int i;
+
+    /* The previous buffers have all been used, recycle the descriptors */
+    vq->free_head = 0;
+    vq->num_free = vq->size;
+
+    for (i = 0; i < n; i++) {
+        head = qvirtqueue_add(vq, addr + i * len, len, write, false);
+        /* vq->avail->ring[idx % vq->size] */
+        writew(vq->avail + 4 + 2 * ((idx + i) % vq->size), head);
+    }
+    return idx + n;
+}
+
+static void ring_kick(QVirtioDevice *dev, QVirtQueue *vq, uint16_t idx)
+{
+    writew(vq->avail + 2, idx);
+    dev->bus->virtqueue_kick(dev, vq);
+}
+
+static void ring_wait_used(QVirtQueue *vq, uint16_t idx)
+{
+    gint64 start_time = g_get_monotonic_time();
+
+    /* vq->used->idx */
+    while (readw(vq->used + 2) != idx) {
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_NET_TIMEOUT_US);
+    }
+    vq->last_used_idx = idx;
+}
+
+#define BATCH_RX_CHUNK  5
+#define BATCH_RX_TOTAL  60
+#define BATCH_FRAME_LEN 60
+#define BATCH_SEQ_OFS   14
+
+static void batch_rx_send(int socket, uint32_t seq)
+{
+    uint8_t frame[BATCH_FRAME_LEN];
+    int ret;
+
+    memset(frame, 0xff, sizeof(frame));
+    stl_be_p(frame + BATCH_SEQ_OFS, seq);
+    ret = send(socket, frame, sizeof(frame), 0);
+    g_assert_cmpint(ret, ==, sizeof(frame));
+}
+
+static uint32_t batch_rx_seq(uint64_t addr)
+{
+    uint8_t seq[4];
+
+    memread(addr + VNET_HDR_SIZE + BATCH_SEQ_OFS, seq, sizeof(seq));
+    return ldl_be_p(seq);
+}
+
+/*
+ * Send more frames than the rx ring has room for, so that tap batches
+ * are only partly taken by the NIC and the rest is queued, then hand
+ * out buffers a few at a time.  Every frame must arrive once, in order.
+ */
+static void batch_rx_test(QVirtioDevice *dev,
+                          QGuestAllocator *alloc, QVirtQueue *rvq,
+                          QVirtQueue *tvq, int socket)
+{
+    const uint32_t len = 128;
+    uint64_t addr = guest_alloc(alloc, BATCH_RX_CHUNK * len);
+    uint32_t next = 0;
+    uint16_t idx;
+    int i;
+
+    idx = ring_post(rvq, addr, len, true, BATCH_RX_CHUNK);
+    ring_kick(dev, rvq, idx);
+
+    for (i = 0; i < BATCH_RX_TOTAL; i++) {
+        batch_rx_send(socket, i);
+    }
+
+    for (;;) {
+        ring_wait_used(rvq, idx);
+        for (i = 0; i < BATCH_RX_CHUNK; i++) {
+            g_assert_cmpint(batch_rx_seq(addr + i * len), ==, next);
+            next++;
+        }
+        if (next == BATCH_RX_TOTAL) {
+            break;
+        }
+        idx = ring_post(rvq, addr, len, true, BATCH_RX_CHUNK);
+        ring_kick(dev, rvq, idx);
+    }
+
+    /* Nothing is left over or repeated: the next buffer gets a new frame */
+    idx = ring_post(rvq, addr, len, true, BATCH_RX_CHUNK);
+    ring_kick(dev, rvq, idx);
+    batch_rx_send(socket, BATCH_RX_TOTAL);
+    ring_wait_used(rvq, idx - BATCH_RX_CHUNK + 1);
+    g_assert_cmpint(batch_rx_seq(addr), ==, BATCH_RX_TOTAL);
+
+    guest_free(alloc, addr);
+}
+
+static void perf_rx(QVirtioDevice *dev, QGuestAllocator *alloc,
+                    QVirtQueue *vq, int socket)
+{
+    const uint32_t len = 128;
+    uint64_t addr = guest_alloc(alloc, PERF_BATCH * len);
+    uint8_t frame[PERF_FRAME_LEN];
+    double secs = 0;
+    uint16_t idx;
+    int i, j, ret;
+
+    memset(frame, 0xff, sizeof(frame));
+    for (i = 0; i < PERF_ROUNDS; i++) {
+        idx = ring_post(vq, addr, len, true, PERF_BATCH);
+        ring_kick(dev, vq, idx);
+
+        g_test_timer_start();
+        for (j = 0; j < PERF_BATCH; j++) {
+            ret = send(socket, frame, sizeof(frame), 0);
+            g_assert_cmpint(ret, ==, sizeof(frame));
+        }
+        ring_wait_used(vq, idx);
+        secs += g_test_timer_elapsed();
+    }
+    g_test_message("rx: %.0f packets/s", PERF_ROUNDS * PERF_BATCH / secs);
+
+    guest_free(alloc, addr);
+}
+
+static void perf_tx(QVirtioDevice *dev, QGuestAllocator *alloc,
+                    QVirtQueue *vq, int socket)
+{
+    const uint32_t len = VNET_HDR_SIZE + PERF_FRAME_LEN;
+    uint64_t addr = guest_alloc(alloc, PERF_BATCH * len);
+    uint8_t frame[PERF_FRAME_LEN + 1];
+    double secs = 0;
+    uint16_t idx;
+    int i, j, ret;
+
+    qmemset(addr, 0, PERF_BATCH * len);
+    for (i = 0; i < PERF_ROUNDS; i++) {
+        idx = ring_post(vq, addr, len, false, PERF_BATCH);
+
+        g_test_timer_start();
+        ring_kick(dev, vq, idx);
+        for (j = 0; j < PERF_BATCH; j++) {
+            ret = recv(socket, frame, sizeof(frame), 0);
+            g_assert_cmpint(ret, ==, PERF_FRAME_LEN);
+        }
+        ring_wait_used(vq, idx);
+        secs += g_test_timer_elapsed();
+    }
+    g_test_message("tx: %.0f packets/s", PERF_ROUNDS * PERF_BATCH / secs);
+
+    guest_free(alloc, addr);
+}
+
+static void perf_test(QVirtioDevice *dev,
+                      QGuestAllocator *alloc, QVirtQueue *rvq,
+                      QVirtQueue *tvq, int socket)
+{
+    perf_rx(dev, alloc, rvq, socket);
+    perf_tx(dev, alloc, tvq, socket);
+}
+
+static void pci_run(void (*func)(QVirtioDevice *dev,
+                                 QGuestAllocator *alloc,
+                                 QVirtQueue *rvq,
+                                 QVirtQueue *tvq,
+                                 int socket),
+                    const char *netdev, int type)
 {
     QVirtioPCIDevice *dev;
     QOSState *qs;
     QVirtQueuePCI *tx, *rx;
-    void (*func) (QVirtioDevice *dev,
-                  QGuestAllocator *alloc,
-                  QVirtQueue *rvq,
-                  QVirtQueue *tvq,
-                  int socket) = data;
     int sv[2], ret;
 
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sv);
+    ret = socketpair(PF_UNIX, type, 0, sv);
     g_assert_cmpint(ret, !=, -1);
 
-    qs = pci_test_start(sv[1]);
+    qs = pci_test_start(netdev, sv[1]);
     dev = virtio_net_pci_init(qs->pcibus, PCI_SLOT);
 
     rx = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev, qs->alloc, 0);
@@ -237,6 +416,20 @@ static void pci_basic(gconstpointer data)
     g_free(dev);
     qtest_shutdown(qs);
 }
+
+static void pci_basic(gconstpointer data)
+{
+    pci_run(data, "socket", SOCK_STREAM);
+}
+
+/*
+ * tap only read()s and write()s whole packets, so a datagram socket can
+ * stand in for the tap device.
+ */
+static void pci_tap(gconstpointer data)
+{
+    pci_run(data, "tap", SOCK_DGRAM);
+}
 #endif
 
 static void hotplug(void)
@@ -261,6 +454,11 @@ int main(int argc, char **argv)
     qtest_add_data_func("/virtio/net/pci/basic", send_recv_test, pci_basic);
     qtest_add_data_func("/virtio/net/pci/rx_stop_cont",
                         stop_cont_test, pci_basic);
+    qtest_add_data_func("/virtio/net/pci/tap/rx_batch",
+                        batch_rx_test, pci_tap);
+    if (g_test_perf()) {
+        qtest_add_data_func("/virtio/net/pci/perf/tap", perf_test, pci_tap);
+    }
 #endif
     qtest_add_func("/virtio/net/pci/hotplug", hotplug);
 
@@ -12,7 +12,11 @@
 #ifndef _WIN32
 #include <pthread.h>
 #endif
+#include <zlib.h>
 #include "qemu/timer.h"
+#include "qemu/thread.h"
+#include "qemu/notify.h"
+#include "qemu/atomic.h"
 #include "trace/control.h"
 #include "trace/simple.h"
 #include "qemu/error-report.h"
@@ -35,6 +39,12 @@
 /*
  * Trace records are written out by a dedicated thread.  The thread waits for
  * records to become available, writes them out, and then waits again.
+ *
+ * Each thread traces to a ring buffer of its own, so that vCPUs do not
+ * contend on a shared index and a busy thread cannot fill the buffer of
+ * the others.  A ring has a single producer, its owner, and a single
+ * consumer, the writeout thread; neither takes a lock.  The writeout
+ * thread merges the records of all rings by timestamp.
  */
 static CompatGMutex trace_lock;
 static CompatGCond trace_available_cond;
@@ -46,15 +56,31 @@ static bool trace_writeout_enabled;
 enum {
     TRACE_BUF_LEN = 4096 * 64,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
+    TRACE_FILE_BUF_LEN = 1024 * 1024,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
+typedef struct TraceThreadBuffer {
+    uint8_t buf[TRACE_BUF_LEN];
+    unsigned int head;          /* only written by the owner thread */
+    unsigned int tail;          /* only written by the writeout thread */
+    bool busy;                  /* the owner is between start and finish */
+    bool exited;
+    gint dropped_events;
+    Notifier exit_notifier;
+    struct TraceThreadBuffer *next;
+} TraceThreadBuffer;
+
+/* Protected by trace_lock */
+static TraceThreadBuffer *trace_buffers;
+static __thread TraceThreadBuffer *trace_thread_buf;
+
 static volatile gint dropped_events;
 static uint32_t trace_pid;
 static FILE *trace_fp;
+static gzFile trace_gz;
 static char *trace_file_name;
+static uint64_t trace_events_written;
+static uint64_t trace_events_dropped;
 
 #define TRACE_RECORD_TYPE_MAPPING 0
 #define TRACE_RECORD_TYPE_EVENT   1
@@ -74,54 +100,26 @@ typedef struct {
     uint64_t header_version;  /* HEADER_VERSION  */
 } TraceLogHeader;
 
+/* In the ring buffers, each record is preceded by its record type, so that
+ * the bytes can go to the trace file as they are.
+ */
+typedef struct {
+    uint64_t type;      /* TRACE_RECORD_TYPE_EVENT */
+    TraceRecord rec;
+} TraceBufferEntry;
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
-{
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
-}
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
- */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
-{
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+static void read_from_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                                    const void *dataptr, size_t size);
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+static int st_write(const void *data, size_t size)
+{
+    if (trace_gz) {
+        return gzwrite(trace_gz, data, size) == size ? 0 : -1;
     }
-
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    return fwrite(data, size, 1, trace_fp) == 1 ? 0 : -1;
 }
 
 /**
@@ -153,128 +151,251 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
-static gpointer writeout_thread(gpointer opaque)
+static void trace_thread_exit(Notifier *n, void *unused)
+{
+    TraceThreadBuffer *tb = container_of(n, TraceThreadBuffer, exit_notifier);
+
+    /* The writeout thread frees the buffer after draining it.  */
+    trace_thread_buf = NULL;
+    atomic_store_release(&tb->exited, true);
+}
+
+static TraceThreadBuffer *get_trace_thread_buffer(void)
+{
+    TraceThreadBuffer *tb = trace_thread_buf;
+
+    if (likely(tb)) {
+        return tb;
+    }
+
+    /* don't use g_malloc, can deadlock when traced */
+    tb = calloc(1, sizeof(*tb));
+    if (!tb) {
+        return NULL;
+    }
+    tb->exit_notifier.notify = trace_thread_exit;
+    qemu_thread_atexit_add(&tb->exit_notifier);
+
+    g_mutex_lock(&trace_lock);
+    tb->next = trace_buffers;
+    trace_buffers = tb;
+    g_mutex_unlock(&trace_lock);
+
+    trace_thread_buf = tb;
+    return tb;
+}
+
+static void write_dropped_record(uint32_t count)
 {
-    TraceRecord *recordptr;
     union {
-        TraceRecord rec;
-        uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
+        TraceBufferEntry entry;
+        uint8_t bytes[sizeof(TraceBufferEntry) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
-    size_t unused __attribute__ ((unused));
-    uint64_t type = TRACE_RECORD_TYPE_EVENT;
 
-    for (;;) {
-        wait_for_trace_records_available();
+    dropped.entry.type = TRACE_RECORD_TYPE_EVENT;
+    dropped.entry.rec.event = DROPPED_EVENT_ID;
+    dropped.entry.rec.timestamp_ns = get_clock();
+    dropped.entry.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
+    dropped.entry.rec.pid = trace_pid;
+    dropped.entry.rec.arguments[0] = count;
+    st_write(&dropped, sizeof(dropped));
+    trace_events_dropped += count;
+}
+
+/* Write out the first record of @tb, which must have one.  */
+static void write_buffer_record(TraceThreadBuffer *tb)
+{
+    TraceBufferEntry entry;
+    unsigned int idx = tb->tail % TRACE_BUF_LEN;
+    size_t len, first;
+
+    read_from_buffer(tb, tb->tail, &entry, sizeof(entry));
+    len = sizeof(entry.type) + entry.rec.length;
+    first = MIN(len, TRACE_BUF_LEN - idx);
+
+    st_write(&tb->buf[idx], first);
+    if (first < len) {
+        st_write(&tb->buf[0], len - first);
+    }
+    atomic_store_release(&tb->tail, tb->tail + len);
+    trace_events_written++;
+}
+
+static uint64_t buffer_next_timestamp(TraceThreadBuffer *tb)
+{
+    uint64_t timestamp_ns;
+
+    read_from_buffer(tb, tb->tail + offsetof(TraceBufferEntry,
+                                             rec.timestamp_ns),
+                     &timestamp_ns, sizeof(timestamp_ns));
+    return timestamp_ns;
+}
+
+/*
+ * Write out everything the threads have published so far, oldest record
+ * first.  Rings are ordered by timestamp already, so this is a merge.  A
+ * record that is published after the snapshot below can be older than
+ * the last one written; simpletrace.py reorders within a window.
+ */
+static void write_buffers(void)
+{
+    TraceThreadBuffer **ptb, *tb, *next, *oldest;
+    unsigned int heads[64];
+    TraceThreadBuffer *bufs[ARRAY_SIZE(heads)];
+    uint32_t dropped_count = 0;
+    int i, n = 0;
+
+    g_mutex_lock(&trace_lock);
+    tb = trace_buffers;
+    g_mutex_unlock(&trace_lock);
 
-        if (g_atomic_int_get(&dropped_events)) {
-            dropped.rec.event = DROPPED_EVENT_ID,
-            dropped.rec.timestamp_ns = get_clock();
-            dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t),
-            dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
-            dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+    /* Buffers are only added at the head of the list, and only this
+     * thread removes them, so the rest of the list can be walked
+     * without the lock.  With many threads, merge them in batches.
+     */
+    while (tb) {
+        for (n = 0; tb && n < ARRAY_SIZE(bufs); tb = tb->next) {
+            dropped_count += atomic_xchg(&tb->dropped_events, 0);
+            heads[n] = atomic_load_acquire(&tb->head);
+            if (heads[n] != tb->tail) {
+                bufs[n++] = tb;
+            }
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+        for (;;) {
+            oldest = NULL;
+            for (i = 0; i < n; i++) {
+                if (bufs[i]->tail != heads[i] &&
+                    (!oldest || buffer_next_timestamp(bufs[i]) <
+                                buffer_next_timestamp(oldest))) {
+                    oldest = bufs[i];
+                }
+            }
+            if (!oldest) {
+                break;
+            }
+            write_buffer_record(oldest);
         }
+    }
+
+    dropped_count += atomic_xchg(&dropped_events, 0);
+    if (dropped_count) {
+        write_dropped_record(dropped_count);
+    }
 
-        fflush(trace_fp);
+    /* Free the buffers of threads that are gone.  */
+    g_mutex_lock(&trace_lock);
+    for (ptb = &trace_buffers; (tb = *ptb) != NULL; ) {
+        next = tb->next;
+        if (atomic_load_acquire(&tb->exited) &&
+            atomic_load_acquire(&tb->head) == tb->tail) {
+            *ptb = next;
+            free(tb); /* don't use g_free, can deadlock when traced */
+        } else {
+            ptb = &tb->next;
+        }
+    }
+    g_mutex_unlock(&trace_lock);
+}
+
+static gpointer writeout_thread(gpointer opaque)
+{
+    for (;;) {
+        wait_for_trace_records_available();
+        write_buffers();
+        if (trace_gz) {
+            gzflush(trace_gz, Z_SYNC_FLUSH);
+        } else {
+            fflush(trace_fp);
+        }
     }
     return NULL;
 }
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuffer *tb = get_trace_thread_buffer();
+    TraceBufferEntry entry;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    unsigned int len = sizeof(entry.type) + rec_len;
 
-    idx = old_idx % TRACE_BUF_LEN;
+    if (!tb) {
+        g_atomic_int_inc(&dropped_events);
+        return -ENOSPC;
+    }
+    /* An event traced from a signal handler while the thread is in the
+     * middle of a record would corrupt the ring.
+     */
+    if (tb->busy ||
+        tb->head + len - atomic_load_acquire(&tb->tail) > TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        g_atomic_int_inc(&tb->dropped_events);
+        return -ENOSPC;
+    }
+    tb->busy = true;
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    entry.type = TRACE_RECORD_TYPE_EVENT;
+    entry.rec.event = event;
+    entry.rec.timestamp_ns = get_clock();
+    entry.rec.length = rec_len;
+    entry.rec.pid = trace_pid;
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->tbuf = tb;
+    rec->tbuf_idx = tb->head;
+    rec->rec_off = write_to_buffer(tb, tb->head, &entry, sizeof(entry));
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                             void *dataptr, size_t size)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
+    size_t off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(dataptr, &tb->buf[off], first);
+    memcpy(dataptr + first, &tb->buf[0], size - first);
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                                    const void *dataptr, size_t size)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
+    size_t off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(&tb->buf[off], dataptr, first);
+    memcpy(&tb->buf[0], dataptr + first, size - first);
+    return idx + size; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    TraceThreadBuffer *tb = rec->tbuf;
+    unsigned int used;
+
+    atomic_store_release(&tb->head, rec->rec_off);
+    tb->busy = false;
+
+    /* Kick the writeout thread when crossing the threshold, not for each
+     * record above it.
+     */
+    used = rec->rec_off - atomic_read(&tb->tail);
+    if (used > TRACE_BUF_FLUSH_THRESHOLD &&
+        used - (rec->rec_off - rec->tbuf_idx) <= TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
 }
@@ -290,10 +411,10 @@ static int st_write_event_mapping(void)
         uint64_t id = trace_event_get_id(ev);
         const char *name = trace_event_get_name(ev);
         uint32_t len = strlen(name);
-        if (fwrite(&type, sizeof(type), 1, trace_fp) != 1 ||
-            fwrite(&id, sizeof(id), 1, trace_fp) != 1 ||
-            fwrite(&len, sizeof(len), 1, trace_fp) != 1 ||
-            fwrite(name, len, 1, trace_fp) != 1) {
+        if (st_write(&type, sizeof(type)) < 0 ||
+            st_write(&id, sizeof(id)) < 0 ||
+            st_write(&len, sizeof(len)) < 0 ||
+            st_write(name, len) < 0) {
             return -1;
         }
     }
@@ -301,6 +422,16 @@ static int st_write_event_mapping(void)
     return 0;
 }
 
+static void st_close_trace_file(void)
+{
+    if (trace_gz) {
+        gzclose(trace_gz);
+        trace_gz = NULL;
+    }
+    fclose(trace_fp);
+    trace_fp = NULL;
+}
+
 void st_set_trace_file_enabled(bool enable)
 {
     if (enable == !!trace_fp) {
@@ -324,20 +455,38 @@ void st_set_trace_file_enabled(bool enable)
         if (!trace_fp) {
             return;
         }
+        setvbuf(trace_fp, NULL, _IOFBF, TRACE_FILE_BUF_LEN);
+
+        /* Compress on the fly if the name asks for it.  Favour speed, the
+         * writeout thread must keep up with the vCPUs.
+         */
+        if (g_str_has_suffix(trace_file_name, ".gz")) {
+            int fd = dup(fileno(trace_fp));
+
+            trace_gz = fd >= 0 ? gzdopen(fd, "wb1") : NULL;
+            if (!trace_gz) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                fclose(trace_fp);
+                trace_fp = NULL;
+                return;
+            }
+        }
 
-        if (fwrite(&header, sizeof header, 1, trace_fp) != 1 ||
+        if (st_write(&header, sizeof header) < 0 ||
             st_write_event_mapping() < 0) {
-            fclose(trace_fp);
-            trace_fp = NULL;
+            st_close_trace_file();
             return;
         }
+        trace_events_written = 0;
+        trace_events_dropped = 0;
 
         /* Resume trace writeout */
         trace_writeout_enabled = true;
         flush_trace_file(false);
     } else {
-        fclose(trace_fp);
-        trace_fp = NULL;
+        st_close_trace_file();
     }
 }
 
@@ -367,6 +516,8 @@ void st_print_trace_file_status(FILE *stream, int (*stream_printf)(FILE *stream,
 {
     stream_printf(stream, "Trace file \"%s\" %s.\n",
                   trace_file_name, trace_fp ? "on" : "off");
+    stream_printf(stream, "%" PRIu64 " events written, %" PRIu64
+                  " dropped.\n", trace_events_written, trace_events_dropped);
 }
 
 void st_flush_trace_buffer(void)
@@ -36,13 +36,15 @@ struct AioHandler
     void *opaque;
     bool is_external;
     QLIST_ENTRY(AioHandler) node;
+
+    /* Statistics, reported by the aio_handler_stats trace event */
+    uint64_t poll_calls;        /* io_poll() calls */
+    uint64_t poll_progress;     /* io_poll() calls that made progress */
+    uint64_t dispatches;        /* io_read()/io_write() calls */
 };
 
 #ifdef CONFIG_EPOLL_CREATE1
 
-/* The fd number threashold to switch to epoll */
-#define EPOLL_ENABLE_THRESHOLD 64
-
 static void aio_epoll_disable(AioContext *ctx)
 {
     ctx->epoll_available = false;
@@ -146,13 +148,16 @@ static bool aio_epoll_enabled(AioContext *ctx)
 static bool aio_epoll_check_poll(AioContext *ctx, GPollFD *pfds,
                                  unsigned npfd, int64_t timeout)
 {
+    unsigned threshold;
+
     if (!ctx->epoll_available) {
         return false;
     }
     if (aio_epoll_enabled(ctx)) {
         return true;
     }
-    if (npfd >= EPOLL_ENABLE_THRESHOLD) {
+    threshold = atomic_read(&ctx->epoll_threshold);
+    if (threshold && npfd >= threshold) {
         if (aio_epoll_try_enable(ctx)) {
             return true;
         } else {
@@ -248,6 +253,9 @@ void aio_set_fd_handler(AioContext *ctx,
         if (!node->io_poll) {
             ctx->poll_disable_cnt--;
         }
+
+        trace_aio_handler_stats(ctx, fd, node->poll_calls,
+                                node->poll_progress, node->dispatches);
     } else {
         if (node == NULL) {
             /* Alloc and insert if it's not already there */
@@ -407,6 +415,8 @@ static bool aio_dispatch_handlers(AioContext *ctx)
 
             /* aio_notify() does not count as progress */
             if (node->opaque != &ctx->notifier) {
+                node->dispatches++;
+                ctx->poll_stats.dispatches++;
                 progress = true;
             }
         }
@@ -415,6 +425,8 @@ static bool aio_dispatch_handlers(AioContext *ctx)
             aio_node_check(ctx, node->is_external) &&
             node->io_write) {
             node->io_write(node->opaque);
+            node->dispatches++;
+            ctx->poll_stats.dispatches++;
             progress = true;
         }
 
@@ -493,9 +505,12 @@ static bool run_poll_handlers_once(AioContext *ctx)
 
     QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
         if (!node->deleted && node->io_poll &&
-            aio_node_check(ctx, node->is_external) &&
-            node->io_poll(node->opaque)) {
-            progress = true;
+            aio_node_check(ctx, node->is_external)) {
+            node->poll_calls++;
+            if (node->io_poll(node->opaque)) {
+                node->poll_progress++;
+                progress = true;
+            }
         }
 
         /* Caller handles freeing deleted nodes.  Don't do it here. */
@@ -534,6 +549,11 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
         progress = run_poll_handlers_once(ctx);
     } while (!progress && qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < end_time);
 
+    if (progress) {
+        ctx->poll_stats.poll_hits++;
+    } else {
+        ctx->poll_stats.poll_misses++;
+    }
     trace_run_poll_handlers_end(ctx, progress);
 
     return progress;
@@ -573,6 +593,41 @@ static bool try_poll_mode(AioContext *ctx, bool blocking)
     return run_poll_handlers_once(ctx);
 }
 
+/* Bound on the extra bottom half rounds run by aio_poll() after
+ * completions, so that a busy device cannot starve timers.
+ */
+#define AIO_POLL_BATCH_ROUNDS 4
+
+/* aio_poll_batch:
+ * @ctx: the AioContext
+ *
+ * Completion callbacks usually schedule a bottom half, for example to
+ * reenter a coroutine, and that coroutine often submits the next request.
+ * Run those now rather than in the next aio_poll() iteration, and give
+ * the poll handlers another chance to pick up what was submitted.
+ *
+ * This is only called after fd handlers made progress, so that on an
+ * otherwise idle context a bottom half that reschedules itself still runs
+ * once per aio_poll().
+ *
+ * Note that the caller must have incremented ctx->list_lock.
+ */
+static void aio_poll_batch(AioContext *ctx)
+{
+    int i;
+
+    for (i = 0; i < AIO_POLL_BATCH_ROUNDS; i++) {
+        if (!aio_bh_poll(ctx)) {
+            break;
+        }
+        ctx->poll_stats.batch_rounds++;
+
+        if (!ctx->poll_started || !run_poll_handlers_once(ctx)) {
+            break;
+        }
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
@@ -688,8 +743,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     progress |= aio_bh_poll(ctx);
 
-    if (ret > 0) {
-        progress |= aio_dispatch_handlers(ctx);
+    if (ret > 0 && aio_dispatch_handlers(ctx)) {
+        progress = true;
+        aio_poll_batch(ctx);
     }
 
     qemu_lockcnt_dec(&ctx->list_lock);
@@ -711,6 +767,7 @@ void aio_context_setup(AioContext *ctx)
         ctx->epoll_available = true;
     }
 #endif
+    ctx->epoll_threshold = AIO_EPOLL_THRESHOLD_DEFAULT;
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
@@ -726,3 +783,9 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 
     aio_notify(ctx);
 }
+
+void aio_context_set_epoll_threshold(AioContext *ctx, unsigned threshold)
+{
+    /* Only read by aio_poll(), so a racing update is harmless.  */
+    atomic_set(&ctx->epoll_threshold, threshold);
+}
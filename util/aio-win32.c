@@ -412,3 +412,7 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 {
     error_setg(errp, "AioContext polling is not implemented on Windows");
 }
+
+void aio_context_set_epoll_threshold(AioContext *ctx, unsigned threshold)
+{
+}
@@ -279,6 +279,7 @@ aio_ctx_finalize(GSource     *source)
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
     qemu_bh_delete(ctx->co_schedule_bh);
+    qemu_coroutine_pool_free(ctx->coroutine_pool);
 
     qemu_lockcnt_lock(&ctx->list_lock);
     assert(!qemu_lockcnt_count(&ctx->list_lock));
@@ -414,6 +415,7 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->co_schedule_bh = aio_bh_new(ctx, co_schedule_bh_cb, ctx);
     QSLIST_INIT(&ctx->scheduled_coroutines);
+    ctx->coroutine_pool = qemu_coroutine_pool_new();
 
     aio_set_event_notifier(ctx, &ctx->notifier,
                            false,
@@ -506,3 +508,8 @@ void aio_context_release(AioContext *ctx)
 {
     qemu_rec_mutex_unlock(&ctx->lock);
 }
+
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats)
+{
+    *stats = ctx->poll_stats;
+}
@@ -96,6 +96,409 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Word array kernels behind the range operations.  Each is only a loop
+ * over unsigned longs; they are chosen at startup among a plain C version
+ * and, on x86, SSE2 and AVX2 versions.
+ */
+typedef struct HBitmapAccel {
+    /* Set @n words to all ones, and return the AND of their old values */
+    unsigned long (*fill_ones)(unsigned long *p, size_t n);
+    /* Set @n words to zero, and return the OR of their old values */
+    unsigned long (*fill_zeroes)(unsigned long *p, size_t n);
+    /* Return the number of set bits in @n words */
+    uint64_t (*count)(const unsigned long *p, size_t n);
+    /* OR @n words of @src into @dst */
+    void (*merge)(unsigned long *dst, const unsigned long *src, size_t n);
+    /* Return a word whose bit i is set iff p[i] is nonzero; n <= BITS_PER_LONG */
+    unsigned long (*nonzero)(const unsigned long *p, size_t n);
+} HBitmapAccel;
+
+static unsigned long hb_fill_ones_int(unsigned long *p, size_t n)
+{
+    unsigned long old = ~0UL;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        old &= p[i];
+        p[i] = ~0UL;
+    }
+    return old;
+}
+
+static unsigned long hb_fill_zeroes_int(unsigned long *p, size_t n)
+{
+    unsigned long old = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        old |= p[i];
+        p[i] = 0;
+    }
+    return old;
+}
+
+static uint64_t hb_count_int(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+static void hb_merge_int(unsigned long *dst, const unsigned long *src,
+                         size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] |= src[i];
+    }
+}
+
+static unsigned long hb_nonzero_int(const unsigned long *p, size_t n)
+{
+    unsigned long mask = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        mask |= (unsigned long)(p[i] != 0) << i;
+    }
+    return mask;
+}
+
+static const HBitmapAccel hb_accel_int = {
+    .fill_ones = hb_fill_ones_int,
+    .fill_zeroes = hb_fill_zeroes_int,
+    .count = hb_count_int,
+    .merge = hb_merge_int,
+    .nonzero = hb_nonzero_int,
+};
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+#define SSE2_LONGS (sizeof(__m128i) / sizeof(unsigned long))
+
+static unsigned long hb_fill_ones_sse2(unsigned long *p, size_t n)
+{
+    __m128i ones = _mm_set1_epi32(-1);
+    __m128i acc = ones;
+    unsigned long old[SSE2_LONGS];
+    size_t i;
+
+    for (i = 0; i + SSE2_LONGS <= n; i += SSE2_LONGS) {
+        acc = _mm_and_si128(acc, _mm_loadu_si128((__m128i *)&p[i]));
+        _mm_storeu_si128((__m128i *)&p[i], ones);
+    }
+    memcpy(old, &acc, sizeof(acc));
+    return hb_fill_ones_int(old, SSE2_LONGS) & hb_fill_ones_int(p + i, n - i);
+}
+
+static unsigned long hb_fill_zeroes_sse2(unsigned long *p, size_t n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    unsigned long old[SSE2_LONGS];
+    size_t i;
+
+    for (i = 0; i + SSE2_LONGS <= n; i += SSE2_LONGS) {
+        acc = _mm_or_si128(acc, _mm_loadu_si128((__m128i *)&p[i]));
+        _mm_storeu_si128((__m128i *)&p[i], zero);
+    }
+    memcpy(old, &acc, sizeof(acc));
+    return hb_fill_zeroes_int(old, SSE2_LONGS) |
+           hb_fill_zeroes_int(p + i, n - i);
+}
+
+/* SSE2 has no byte shuffle, so count bits within each byte arithmetically
+ * and let psadbw add up the bytes.
+ */
+static uint64_t hb_count_sse2(const unsigned long *p, size_t n)
+{
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    uint64_t sum[2];
+    size_t i;
+
+    for (i = 0; i + SSE2_LONGS <= n; i += SSE2_LONGS) {
+        __m128i x = _mm_loadu_si128((__m128i *)&p[i]);
+
+        x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi16(x, 1), m1));
+        x = _mm_add_epi8(_mm_and_si128(x, m2),
+                         _mm_and_si128(_mm_srli_epi16(x, 2), m2));
+        x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)), m4);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(x, zero));
+    }
+    memcpy(sum, &acc, sizeof(acc));
+    return sum[0] + sum[1] + hb_count_int(p + i, n - i);
+}
+
+static void hb_merge_sse2(unsigned long *dst, const unsigned long *src,
+                          size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + SSE2_LONGS <= n; i += SSE2_LONGS) {
+        __m128i x = _mm_loadu_si128((__m128i *)&dst[i]);
+        __m128i y = _mm_loadu_si128((__m128i *)&src[i]);
+
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_or_si128(x, y));
+    }
+    hb_merge_int(dst + i, src + i, n - i);
+}
+
+static unsigned long hb_nonzero_sse2(const unsigned long *p, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned long mask = 0;
+    size_t i;
+
+    for (i = 0; i + SSE2_LONGS <= n; i += SSE2_LONGS) {
+        __m128i x = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)&p[i]), zero);
+        unsigned long is_zero;
+
+#if HOST_LONG_BITS == 64
+        /* A long is zero iff both of its halves are.  */
+        x = _mm_and_si128(x, _mm_shuffle_epi32(x, 0xb1));
+        is_zero = _mm_movemask_pd(_mm_castsi128_pd(x));
+#else
+        is_zero = _mm_movemask_ps(_mm_castsi128_ps(x));
+#endif
+        mask |= (~is_zero & ((1UL << SSE2_LONGS) - 1)) << i;
+    }
+    if (i < n) {
+        mask |= hb_nonzero_int(p + i, n - i) << i;
+    }
+    return mask;
+}
+
+static const HBitmapAccel hb_accel_sse2 = {
+    .fill_ones = hb_fill_ones_sse2,
+    .fill_zeroes = hb_fill_zeroes_sse2,
+    .count = hb_count_sse2,
+    .merge = hb_merge_sse2,
+    .nonzero = hb_nonzero_sse2,
+};
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+#define AVX2_LONGS (sizeof(__m256i) / sizeof(unsigned long))
+
+static unsigned long hb_fill_ones_avx2(unsigned long *p, size_t n)
+{
+    __m256i ones = _mm256_set1_epi32(-1);
+    __m256i acc = ones;
+    unsigned long old[AVX2_LONGS];
+    size_t i;
+
+    for (i = 0; i + AVX2_LONGS <= n; i += AVX2_LONGS) {
+        acc = _mm256_and_si256(acc, _mm256_loadu_si256((__m256i *)&p[i]));
+        _mm256_storeu_si256((__m256i *)&p[i], ones);
+    }
+    memcpy(old, &acc, sizeof(acc));
+    return hb_fill_ones_int(old, AVX2_LONGS) & hb_fill_ones_int(p + i, n - i);
+}
+
+static unsigned long hb_fill_zeroes_avx2(unsigned long *p, size_t n)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    unsigned long old[AVX2_LONGS];
+    size_t i;
+
+    for (i = 0; i + AVX2_LONGS <= n; i += AVX2_LONGS) {
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((__m256i *)&p[i]));
+        _mm256_storeu_si256((__m256i *)&p[i], zero);
+    }
+    memcpy(old, &acc, sizeof(acc));
+    return hb_fill_zeroes_int(old, AVX2_LONGS) |
+           hb_fill_zeroes_int(p + i, n - i);
+}
+
+/* Look up the bit count of each nibble, then add up the bytes.  */
+static uint64_t hb_count_avx2(const unsigned long *p, size_t n)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i m4 = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    uint64_t sum[4];
+    size_t i;
+
+    for (i = 0; i + AVX2_LONGS <= n; i += AVX2_LONGS) {
+        __m256i x = _mm256_loadu_si256((__m256i *)&p[i]);
+        __m256i lo = _mm256_and_si256(x, m4);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), m4);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                                      _mm256_shuffle_epi8(lut, hi));
+
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, zero));
+    }
+    memcpy(sum, &acc, sizeof(acc));
+    return sum[0] + sum[1] + sum[2] + sum[3] + hb_count_int(p + i, n - i);
+}
+
+static void hb_merge_avx2(unsigned long *dst, const unsigned long *src,
+                          size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + AVX2_LONGS <= n; i += AVX2_LONGS) {
+        __m256i x = _mm256_loadu_si256((__m256i *)&dst[i]);
+        __m256i y = _mm256_loadu_si256((__m256i *)&src[i]);
+
+        _mm256_storeu_si256((__m256i *)&dst[i], _mm256_or_si256(x, y));
+    }
+    hb_merge_int(dst + i, src + i, n - i);
+}
+
+static unsigned long hb_nonzero_avx2(const unsigned long *p, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned long mask = 0;
+    size_t i;
+
+    for (i = 0; i + AVX2_LONGS <= n; i += AVX2_LONGS) {
+        __m256i x = _mm256_loadu_si256((__m256i *)&p[i]);
+        unsigned long is_zero;
+
+#if HOST_LONG_BITS == 64
+        x = _mm256_cmpeq_epi64(x, zero);
+        is_zero = _mm256_movemask_pd(_mm256_castsi256_pd(x));
+#else
+        x = _mm256_cmpeq_epi32(x, zero);
+        is_zero = _mm256_movemask_ps(_mm256_castsi256_ps(x));
+#endif
+        mask |= (~is_zero & ((1UL << AVX2_LONGS) - 1)) << i;
+    }
+    if (i < n) {
+        mask |= hb_nonzero_int(p + i, n - i) << i;
+    }
+    return mask;
+}
+
+static const HBitmapAccel hb_accel_avx2 = {
+    .fill_ones = hb_fill_ones_avx2,
+    .fill_zeroes = hb_fill_zeroes_avx2,
+    .count = hb_count_avx2,
+    .merge = hb_merge_avx2,
+    .nonzero = hb_nonzero_avx2,
+};
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+/* Note that for test_hbitmap_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+/* Make sure that these variables are appropriately initialized when
+ * SSE2 is enabled on the compiler command-line, but the compiler is
+ * too old to support CONFIG_AVX2_OPT.
+ */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL (&hb_accel_int)
+#else
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL (&hb_accel_sse2)
+#endif
+
+static unsigned hb_cpuid_cache = INIT_CACHE;
+static unsigned hb_cpuid_best = INIT_CACHE;
+static const HBitmapAccel *hb_accel = INIT_ACCEL;
+
+static void hb_init_accel(unsigned cache)
+{
+    const HBitmapAccel *accel = &hb_accel_int;
+
+    if (cache & CACHE_SSE2) {
+        accel = &hb_accel_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        accel = &hb_accel_avx2;
+    }
+#endif
+    hb_accel = accel;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) hb_init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    hb_cpuid_cache = hb_cpuid_best = cache;
+    hb_init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_hbitmap_next_accel(void)
+{
+    /* If no bits set, we just tested the C version, and there are no
+       more acceleration options to test.  Go back to the fastest one.  */
+    if (hb_cpuid_cache == 0) {
+        hb_cpuid_cache = hb_cpuid_best;
+        hb_init_accel(hb_cpuid_cache);
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    hb_cpuid_cache &= hb_cpuid_cache - 1;
+    hb_init_accel(hb_cpuid_cache);
+    return true;
+}
+#else
+static const HBitmapAccel *hb_accel = &hb_accel_int;
+
+bool test_hbitmap_next_accel(void)
+{
+    return false;
+}
+#endif
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -203,34 +606,44 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
+/* Count the set bits in words [pos, end) of the last level, skipping
+ * blocks of words that the level above says are all zero.
  */
-static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
+static uint64_t hb_count_words(HBitmap *hb, size_t pos, size_t end)
 {
-    HBitmapIter hbi;
+    const unsigned long *bottom = hb->levels[HBITMAP_LEVELS - 1];
+    const unsigned long *upper = hb->levels[HBITMAP_LEVELS - 2];
     uint64_t count = 0;
-    uint64_t end = last + 1;
-    unsigned long cur;
-    size_t pos;
+    size_t next;
 
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
+    while (pos < end) {
+        next = MIN((pos | (BITS_PER_LONG - 1)) + 1, end);
+        if (upper[pos >> BITS_PER_LEVEL]) {
+            count += hb_accel->count(bottom + pos, next - pos);
         }
-        count += ctpopl(cur);
+        pos = next;
     }
+    return count;
+}
 
-    if (pos == (end >> BITS_PER_LEVEL)) {
-        /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
-        count += ctpopl(cur);
-    }
+/* Count the number of set bits between start and last, not accounting for
+ * the granularity.
+ */
+static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
+{
+    const unsigned long *bottom = hb->levels[HBITMAP_LEVELS - 1];
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t lastpos = last >> BITS_PER_LEVEL;
+    unsigned long first_mask = ~0UL << (start & (BITS_PER_LONG - 1));
+    unsigned long last_mask =
+        ~0UL >> (BITS_PER_LONG - 1 - (last & (BITS_PER_LONG - 1)));
 
-    return count;
+    if (pos == lastpos) {
+        return ctpopl(bottom[pos] & first_mask & last_mask);
+    }
+    return ctpopl(bottom[pos] & first_mask) +
+           hb_count_words(hb, pos + 1, lastpos) +
+           ctpopl(bottom[lastpos] & last_mask);
 }
 
 /* Setting starts at the last layer and propagates up if an element
@@ -265,15 +678,10 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
         changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
-        }
+        changed |= hb_accel->fill_ones(&hb->levels[level][i + 1],
+                                       lastpos - i - 1) != ~0UL;
+        i = lastpos;
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
     changed |= hb_set_elem(&hb->levels[level][i], start, last);
 
@@ -350,15 +758,10 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
             pos++;
         }
 
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
-        }
+        changed |= hb_accel->fill_zeroes(&hb->levels[level][i + 1],
+                                         lastpos - i - 1) != 0;
+        i = lastpos;
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
 
     /* Same as above, this time for lastpos.  */
@@ -580,17 +983,17 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     for (lev = HBITMAP_LEVELS - 1; lev-- > 0; ) {
         prev_size = size;
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
-        memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
-        for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
-                bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
-                    1UL << (i & (BITS_PER_LONG - 1));
-            }
+        for (i = 0; i < prev_size; i += BITS_PER_LONG) {
+            bitmap->levels[lev][i >> BITS_PER_LEVEL] =
+                hb_accel->nonzero(&bitmap->levels[lev + 1][i],
+                                  MIN(prev_size - i, BITS_PER_LONG));
         }
     }
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
+    bitmap->count = bitmap->size ? hb_count_between(bitmap, 0, bitmap->size - 1)
+                                 : 0;
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -690,7 +1093,6 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
 bool hbitmap_merge(HBitmap *a, const HBitmap *b)
 {
     int i;
-    uint64_t j;
 
     if ((a->size != b->size) || (a->granularity != b->granularity)) {
         return false;
@@ -705,10 +1107,9 @@ bool hbitmap_merge(HBitmap *a, const HBitmap *b)
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
      */
     for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            a->levels[i][j] |= b->levels[i][j];
-        }
+        hb_accel->merge(a->levels[i], b->levels[i], a->sizes[i]);
     }
+    a->count = a->size ? hb_count_between(a, 0, a->size - 1) : 0;
 
     return true;
 }
@@ -24,19 +24,457 @@
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/notify.h"
+#include "qemu/atomic.h"
 #include "trace/control.h"
 
 static char *logfilename;
 FILE *qemu_logfile;
 int qemu_loglevel;
+bool qemu_log_binary;
 static int log_append = 0;
 static GArray *debug_regions;
 
+/*
+ * Binary logging
+ *
+ * With "-d binary" and a log file, qemu_log() and friends do not go
+ * through stdio.  Each thread appends records to its own ring buffer,
+ * without taking any lock, and a writer thread copies the rings to the
+ * log file.  "-d exec" records are stored unformatted.  The file holds
+ * the records of each thread in order, but the threads are interleaved
+ * in chunks; scripts/qemu-log-decode.py merges them by timestamp and
+ * prints the usual text.
+ *
+ * Callers that need a FILE * (cpu_dump_state, disas) get a stream whose
+ * writes become text records of the calling thread.
+ */
+
+#define LOG_BINARY_MAGIC        "QEMULOG"
+#define LOG_BINARY_VERSION      1
+
+/* Per-thread ring size; a record never exceeds a quarter of it.  */
+#define LOG_BUFFER_SIZE         (1 << 20)
+#define LOG_RECORD_MAX          (LOG_BUFFER_SIZE / 4)
+#define LOG_WRITER_PERIOD_MS    10
+
+enum {
+    LOG_REC_TEXT = 1,
+    LOG_REC_EXEC = 2,
+};
+
+/* The record continues the previous one from the same thread.  */
+#define LOG_REC_F_CONT          1
+
+/* All fields are in host byte order; the file header tells which.  */
+typedef struct LogFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} LogFileHeader;
+
+typedef struct LogRecord {
+    uint16_t type;
+    uint16_t flags;
+    uint32_t len;               /* of the payload that follows */
+    uint32_t thread;
+    uint32_t reserved;
+    uint64_t timestamp;         /* host monotonic clock, ns */
+} LogRecord;
+
+/* Followed by the symbol name, without a terminator.  */
+typedef struct LogExecRecord {
+    uint64_t host_pc;
+    uint64_t pc;
+    int32_t cpu_index;
+    uint32_t pc_bits;
+} LogExecRecord;
+
+typedef struct LogBuffer {
+    char *data;
+    size_t head;                /* only written by the owner */
+    size_t tail;                /* only written under log_writer_lock */
+    uint32_t id;
+    int group;                  /* qemu_log_lock() nesting */
+    bool group_started;
+    bool waiting;               /* the owner waits for room */
+    bool exited;
+    QemuEvent space;
+    Notifier exit_notifier;
+    QLIST_ENTRY(LogBuffer) next;
+} LogBuffer;
+
+static __thread LogBuffer *log_buffer;
+static uint32_t log_buffer_next_id;
+
+/* Protects log_buffers, log_fd and the ring tails.  */
+static QemuMutex log_writer_lock;
+static QLIST_HEAD(, LogBuffer) log_buffers;
+static int log_fd = -1;
+static QemuThread log_writer;
+static QemuSemaphore log_writer_sem;
+static bool log_writer_stop;
+
+static void __attribute__((__constructor__)) log_binary_init(void)
+{
+    qemu_mutex_init(&log_writer_lock);
+    qemu_sem_init(&log_writer_sem, 0);
+}
+
+static void log_write_fd(const void *buf, size_t len)
+{
+    while (len) {
+        ssize_t ret = write(log_fd, buf, len);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* Nowhere to report it; drop the data like fwrite would.  */
+            return;
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+/* Copy all committed records to the log file.  Called with
+ * log_writer_lock held.
+ */
+static void log_drain_locked(void)
+{
+    LogBuffer *b, *next;
+
+    QLIST_FOREACH_SAFE(b, &log_buffers, next, next) {
+        bool exited = atomic_load_acquire(&b->exited);
+        size_t head = atomic_load_acquire(&b->head);
+        size_t tail = b->tail;
+
+        while (tail != head) {
+            size_t off = tail & (LOG_BUFFER_SIZE - 1);
+            size_t len = MIN(head - tail, LOG_BUFFER_SIZE - off);
+
+            if (log_fd != -1) {
+                log_write_fd(b->data + off, len);
+            }
+            tail += len;
+        }
+        atomic_store_release(&b->tail, tail);
+
+        /* Pairs with the barrier in log_buffer_reserve.  */
+        smp_mb();
+        if (atomic_read(&b->waiting)) {
+            qemu_event_set(&b->space);
+        }
+
+        if (exited) {
+            QLIST_REMOVE(b, next);
+            qemu_event_destroy(&b->space);
+            g_free(b->data);
+            g_free(b);
+        }
+    }
+}
+
+static void *log_writer_thread(void *opaque)
+{
+    while (!atomic_read(&log_writer_stop)) {
+        qemu_sem_timedwait(&log_writer_sem, LOG_WRITER_PERIOD_MS);
+        qemu_mutex_lock(&log_writer_lock);
+        log_drain_locked();
+        qemu_mutex_unlock(&log_writer_lock);
+    }
+    return NULL;
+}
+
+static void log_buffer_exit(Notifier *n, void *unused)
+{
+    LogBuffer *b = container_of(n, LogBuffer, exit_notifier);
+
+    /* The writer frees the buffer once it is drained.  */
+    log_buffer = NULL;
+    atomic_store_release(&b->exited, true);
+}
+
+static LogBuffer *log_buffer_get(void)
+{
+    LogBuffer *b = log_buffer;
+
+    if (likely(b)) {
+        return b;
+    }
+
+    b = g_new0(LogBuffer, 1);
+    b->data = g_malloc(LOG_BUFFER_SIZE);
+    b->id = atomic_fetch_inc(&log_buffer_next_id);
+    qemu_event_init(&b->space, false);
+    b->exit_notifier.notify = log_buffer_exit;
+    qemu_thread_atexit_add(&b->exit_notifier);
+
+    qemu_mutex_lock(&log_writer_lock);
+    QLIST_INSERT_HEAD(&log_buffers, b, next);
+    qemu_mutex_unlock(&log_writer_lock);
+
+    log_buffer = b;
+    return b;
+}
+
+/* Wait until @len bytes fit in the ring.  Logging must not lose data, so
+ * a thread that outruns the writer blocks like a write to a full pipe.
+ * Returns false if the log is being closed, and the record must be
+ * dropped: nobody would ever make room for it.
+ */
+static bool log_buffer_reserve(LogBuffer *b, size_t len)
+{
+    bool ret = true;
+
+    while (b->head + len - atomic_load_acquire(&b->tail) > LOG_BUFFER_SIZE) {
+        qemu_event_reset(&b->space);
+        atomic_set(&b->waiting, true);
+        /* Pairs with the barriers in log_binary_close and log_drain_locked:
+         * either the final drain sees waiting, or we see the writer stop.
+         */
+        smp_mb();
+        if (b->head + len - atomic_read(&b->tail) <= LOG_BUFFER_SIZE) {
+            break;
+        }
+        if (atomic_read(&log_writer_stop)) {
+            ret = false;
+            break;
+        }
+        qemu_sem_post(&log_writer_sem);
+        qemu_event_wait(&b->space);
+    }
+    atomic_set(&b->waiting, false);
+    return ret;
+}
+
+static void log_buffer_copy(LogBuffer *b, size_t pos, const void *src,
+                            size_t len)
+{
+    size_t off = pos & (LOG_BUFFER_SIZE - 1);
+    size_t first = MIN(len, LOG_BUFFER_SIZE - off);
+
+    memcpy(b->data + off, src, first);
+    memcpy(b->data, src + first, len - first);
+}
+
+/* Append a record made of @hdr_len bytes at @hdr followed by @len bytes
+ * at @buf to the calling thread's ring.
+ */
+static void log_binary_put(int type, const void *hdr, size_t hdr_len,
+                           const void *buf, size_t len)
+{
+    LogBuffer *b = log_buffer_get();
+    LogRecord rec;
+    size_t head, total, used;
+
+    len = MIN(len, LOG_RECORD_MAX - sizeof(rec) - hdr_len);
+    total = sizeof(rec) + hdr_len + len;
+
+    rec.type = type;
+    rec.flags = b->group_started ? LOG_REC_F_CONT : 0;
+    rec.len = hdr_len + len;
+    rec.thread = b->id;
+    rec.reserved = 0;
+    rec.timestamp = get_clock();
+    b->group_started = b->group > 0;
+
+    if (!log_buffer_reserve(b, total)) {
+        return;
+    }
+    head = b->head;
+    log_buffer_copy(b, head, &rec, sizeof(rec));
+    log_buffer_copy(b, head + sizeof(rec), hdr, hdr_len);
+    log_buffer_copy(b, head + sizeof(rec) + hdr_len, buf, len);
+    atomic_store_release(&b->head, head + total);
+
+    /* Kick the writer once per half ring, not on every record.  */
+    used = head + total - atomic_read(&b->tail);
+    if (used >= LOG_BUFFER_SIZE / 2 && used - total < LOG_BUFFER_SIZE / 2) {
+        qemu_sem_post(&log_writer_sem);
+    }
+}
+
+void qemu_log_binary_group(bool start)
+{
+    LogBuffer *b = log_buffer_get();
+
+    if (start) {
+        b->group++;
+    } else if (--b->group == 0) {
+        b->group_started = false;
+    }
+}
+
+int qemu_log_binary_vprintf(const char *fmt, va_list va)
+{
+    char buf[256];
+    va_list va2;
+    int ret;
+
+    va_copy(va2, va);
+    ret = vsnprintf(buf, sizeof(buf), fmt, va2);
+    va_end(va2);
+    if (ret < 0) {
+        return 0;
+    }
+    if (ret < sizeof(buf)) {
+        log_binary_put(LOG_REC_TEXT, NULL, 0, buf, ret);
+    } else {
+        char *str = g_strdup_vprintf(fmt, va);
+
+        log_binary_put(LOG_REC_TEXT, NULL, 0, str, ret);
+        g_free(str);
+    }
+    return ret;
+}
+
+void qemu_log_exec_tb(const void *host_pc, int cpu_index, uint64_t pc,
+                      int pc_bits, const char *symbol)
+{
+    LogExecRecord rec;
+
+    if (!qemu_log_binary) {
+        qemu_log("Trace %p [%d: %0*" PRIx64 "] %s\n",
+                 host_pc, cpu_index, pc_bits / 4, pc, symbol);
+        return;
+    }
+
+    rec.host_pc = (uintptr_t)host_pc;
+    rec.pc = pc;
+    rec.cpu_index = cpu_index;
+    rec.pc_bits = pc_bits;
+    log_binary_put(LOG_REC_EXEC, &rec, sizeof(rec), symbol, strlen(symbol));
+}
+
+static void log_binary_flush(void)
+{
+    qemu_mutex_lock(&log_writer_lock);
+    log_drain_locked();
+    qemu_mutex_unlock(&log_writer_lock);
+}
+
+#ifdef CONFIG_FOPENCOOKIE
+static ssize_t log_cookie_write(void *cookie, const char *buf, size_t size)
+{
+    log_binary_put(LOG_REC_TEXT, NULL, 0, buf, size);
+    return size;
+}
+
+static FILE *log_binary_open(const char *filename, bool append)
+{
+    static const cookie_io_functions_t funcs = {
+        .write = log_cookie_write,
+    };
+    static bool atexit_done;
+    LogFileHeader hdr = {
+        .magic = LOG_BINARY_MAGIC,
+        .version = LOG_BINARY_VERSION,
+    };
+    FILE *f;
+    int fd;
+
+    fd = qemu_open(filename, O_WRONLY | O_CREAT |
+                   (append ? O_APPEND : O_TRUNC), 0666);
+    if (fd < 0) {
+        return NULL;
+    }
+    f = fopencookie(NULL, "w", funcs);
+    if (!f) {
+        qemu_close(fd);
+        return NULL;
+    }
+    /* Every fprintf becomes one record.  */
+    setvbuf(f, NULL, _IONBF, 0);
+
+    qemu_mutex_lock(&log_writer_lock);
+    /* Discard what was logged while the log was closed.  */
+    log_drain_locked();
+    log_fd = fd;
+    if (lseek(fd, 0, SEEK_END) == 0) {
+        log_write_fd(&hdr, sizeof(hdr));
+    }
+    qemu_mutex_unlock(&log_writer_lock);
+
+    atomic_set(&log_writer_stop, false);
+    qemu_thread_create(&log_writer, "log-writer", log_writer_thread,
+                       NULL, QEMU_THREAD_JOINABLE);
+    if (!atexit_done) {
+        atexit(log_binary_flush);
+        atexit_done = true;
+    }
+    return f;
+}
+
+/* A log file that already holds records keeps their format: text lines
+ * after binary records, or binary records without the file header, could
+ * not be decoded.  Return whether @filename must be opened as binary.
+ */
+static bool log_file_keep_format(const char *filename, bool binary)
+{
+    char magic[sizeof(LOG_BINARY_MAGIC)];
+    bool is_binary;
+    ssize_t len;
+    int fd;
+
+    fd = qemu_open(filename, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        return binary;
+    }
+    len = read(fd, magic, sizeof(magic));
+    qemu_close(fd);
+    if (len <= 0) {
+        return binary;
+    }
+
+    is_binary = len == sizeof(magic) &&
+                memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) == 0;
+    if (is_binary != binary) {
+        warn_report("log file '%s' already holds a %s log, "
+                    "not switching to %s records", filename,
+                    is_binary ? "binary" : "text",
+                    binary ? "binary" : "text");
+    }
+    return is_binary;
+}
+#else
+static FILE *log_binary_open(const char *filename, bool append)
+{
+    errno = ENOTSUP;
+    return NULL;
+}
+#endif
+
+static void log_binary_close(void)
+{
+    /* From here on, producers that find their ring full drop the record
+     * instead of waiting for a writer that is going away.
+     */
+    atomic_mb_set(&log_writer_stop, true);
+    qemu_sem_post(&log_writer_sem);
+    qemu_thread_join(&log_writer);
+
+    qemu_mutex_lock(&log_writer_lock);
+    log_drain_locked();
+    qemu_close(log_fd);
+    log_fd = -1;
+    qemu_mutex_unlock(&log_writer_lock);
+}
+
 /* Return the number of characters emitted.  */
 int qemu_log(const char *fmt, ...)
 {
     int ret = 0;
-    if (qemu_logfile) {
+    if (unlikely(qemu_log_binary)) {
+        va_list ap;
+        va_start(ap, fmt);
+        ret = qemu_log_binary_vprintf(fmt, ap);
+        va_end(ap);
+    } else if (qemu_logfile) {
         va_list ap;
         va_start(ap, fmt);
         ret = vfprintf(qemu_logfile, fmt, ap);
@@ -55,13 +493,37 @@ static bool log_uses_own_buffers;
 /* enable or disable low levels log */
 void qemu_set_log(int log_flags)
 {
+    bool binary;
+
     qemu_loglevel = log_flags;
 #ifdef CONFIG_TRACE_LOG
     qemu_loglevel |= LOG_TRACE;
 #endif
+    /* Binary records only make sense in a file of their own.  */
+    binary = (qemu_loglevel & LOG_BINARY) && logfilename && !is_daemonized();
+#ifndef CONFIG_FOPENCOOKIE
+    /* No way to hand out a FILE * that writes to the buffers.  */
+    binary = false;
+#endif
+    if (qemu_logfile && qemu_log_binary != binary) {
+        qemu_log_close();
+    }
     if (!qemu_logfile &&
         (is_daemonized() ? logfilename != NULL : qemu_loglevel)) {
-        if (logfilename) {
+#ifdef CONFIG_FOPENCOOKIE
+        if (logfilename && log_append && !is_daemonized()) {
+            binary = log_file_keep_format(logfilename, binary);
+        }
+#endif
+        if (binary) {
+            qemu_logfile = log_binary_open(logfilename, log_append);
+            if (!qemu_logfile) {
+                perror(logfilename);
+                _exit(1);
+            }
+            qemu_log_binary = true;
+            log_append = 1;
+        } else if (logfilename) {
             qemu_logfile = fopen(logfilename, log_append ? "a" : "w");
             if (!qemu_logfile) {
                 perror(logfilename);
@@ -80,7 +542,9 @@ void qemu_set_log(int log_flags)
             qemu_logfile = stderr;
         }
         /* must avoid mmap() usage of glibc by setting a buffer "by hand" */
-        if (log_uses_own_buffers) {
+        if (qemu_log_binary) {
+            /* log_binary_open() already set up the stream */
+        } else if (log_uses_own_buffers) {
             static char logfile_buf[4096];
 
             setvbuf(qemu_logfile, logfile_buf, _IOLBF, sizeof(logfile_buf));
@@ -225,7 +689,11 @@ out:
 /* fflush() the log file */
 void qemu_log_flush(void)
 {
-    fflush(qemu_logfile);
+    if (qemu_log_binary) {
+        log_binary_flush();
+    } else {
+        fflush(qemu_logfile);
+    }
 }
 
 /* Close the log file */
@@ -235,6 +703,10 @@ void qemu_log_close(void)
         if (qemu_logfile != stderr) {
             fclose(qemu_logfile);
         }
+        if (qemu_log_binary) {
+            atomic_mb_set(&qemu_log_binary, false);
+            log_binary_close();
+        }
         qemu_logfile = NULL;
     }
 }
@@ -272,6 +744,9 @@ const QEMULogItem qemu_log_items[] = {
     { CPU_LOG_TB_NOCHAIN, "nochain",
       "do not chain compiled TBs so that \"exec\" and \"cpu\" show\n"
       "complete traces" },
+    { LOG_BINARY, "binary",
+      "with -D, log to per-thread buffers in a binary format;\n"
+      "decode the file with scripts/qemu-log-decode.py" },
     { 0, NULL, NULL },
 };
 
@@ -285,8 +760,11 @@ int qemu_str_to_log_mask(const char *str)
 
     for (tmp = parts; tmp && *tmp; tmp++) {
         if (g_str_equal(*tmp, "all")) {
+            /* "binary" changes the output format, it is not a category */
             for (item = qemu_log_items; item->mask != 0; item++) {
-                mask |= item->mask;
+                if (item->mask != LOG_BINARY) {
+                    mask |= item->mask;
+                }
             }
 #ifdef CONFIG_TRACE_LOG
         } else if (g_str_has_prefix(*tmp, "trace:") && (*tmp)[6] != '\0') {
@@ -0,0 +1,195 @@
+/*
+ * Coroutine stack arena
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ * Coroutine stacks are carved out of large mappings, so that a coroutine
+ * that misses the pool does not cost an mmap() plus an mprotect(), and
+ * freeing one does not cost an munmap().  The guard page below a stack is
+ * only set up the first time its slot is handed out, and is kept when the
+ * slot is recycled.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/coroutine_int.h"
+
+/* The arena relies on stacks growing down and on the plain stack size, so
+ * leave the unusual hosts and stack usage debugging to qemu_alloc_stack().
+ */
+#if defined(CONFIG_DEBUG_STACK_USAGE) || defined(HOST_IA64) || \
+    defined(HOST_HPPA)
+#define STACK_ARENA 0
+#else
+#define STACK_ARENA 1
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/* Address space is plentiful on 64-bit hosts only.  */
+#if HOST_LONG_BITS == 64
+#define CHUNK_STACKS 64
+#else
+#define CHUNK_STACKS 8
+#endif
+
+typedef struct StackChunk {
+    void *base;
+    unsigned int nr_used;
+    unsigned long used[BITS_TO_LONGS(CHUNK_STACKS)];
+    unsigned long guarded[BITS_TO_LONGS(CHUNK_STACKS)];
+    QLIST_ENTRY(StackChunk) next;
+} StackChunk;
+
+static QemuMutex arena_lock;
+static QLIST_HEAD(, StackChunk) arena_chunks;
+static size_t arena_pagesz;
+/* Size of a slot, including its guard page */
+static size_t arena_slot_size;
+
+static void __attribute__((__constructor__)) stack_arena_init(void)
+{
+    size_t sz = COROUTINE_STACK_SIZE;
+#ifdef _SC_THREAD_STACK_MIN
+    long min_stack_sz = sysconf(_SC_THREAD_STACK_MIN);
+    sz = MAX(MAX(min_stack_sz, 0), sz);
+#endif
+
+    qemu_mutex_init(&arena_lock);
+    arena_pagesz = getpagesize();
+    arena_slot_size = ROUND_UP(sz, arena_pagesz) + arena_pagesz;
+}
+
+static StackChunk *stack_chunk_new(void)
+{
+    StackChunk *chunk;
+    void *base;
+
+    base = mmap(NULL, CHUNK_STACKS * arena_slot_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    chunk = g_new0(StackChunk, 1);
+    chunk->base = base;
+    QLIST_INSERT_HEAD(&arena_chunks, chunk, next);
+    return chunk;
+}
+
+static StackChunk *stack_chunk_find(void *stack)
+{
+    StackChunk *chunk;
+
+    QLIST_FOREACH(chunk, &arena_chunks, next) {
+        if (stack >= chunk->base &&
+            stack < chunk->base + CHUNK_STACKS * arena_slot_size) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+/* Whether a chunk other than @chunk has free slots.  */
+static bool stack_arena_has_room(StackChunk *chunk)
+{
+    StackChunk *other;
+
+    QLIST_FOREACH(other, &arena_chunks, next) {
+        if (other != chunk && other->nr_used < CHUNK_STACKS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void *qemu_coroutine_stack_alloc(size_t *sz)
+{
+    StackChunk *chunk;
+    unsigned long slot;
+    void *stack = NULL;
+
+    if (!STACK_ARENA || *sz != COROUTINE_STACK_SIZE) {
+        return qemu_alloc_stack(sz);
+    }
+
+    qemu_mutex_lock(&arena_lock);
+    QLIST_FOREACH(chunk, &arena_chunks, next) {
+        if (chunk->nr_used < CHUNK_STACKS) {
+            break;
+        }
+    }
+    if (!chunk) {
+        chunk = stack_chunk_new();
+    }
+    if (chunk) {
+        slot = find_first_zero_bit(chunk->used, CHUNK_STACKS);
+        assert(slot < CHUNK_STACKS);
+        set_bit(slot, chunk->used);
+        chunk->nr_used++;
+        stack = chunk->base + slot * arena_slot_size;
+
+        if (!test_bit(slot, chunk->guarded)) {
+            if (mprotect(stack, arena_pagesz, PROT_NONE) != 0) {
+                perror("failed to set up stack guard page");
+                abort();
+            }
+            set_bit(slot, chunk->guarded);
+        }
+    }
+    qemu_mutex_unlock(&arena_lock);
+
+    if (!stack) {
+        /* Out of address space for a whole chunk; try a single stack.  */
+        return qemu_alloc_stack(sz);
+    }
+    *sz = arena_slot_size;
+    return stack;
+}
+
+void qemu_coroutine_stack_free(void *stack, size_t sz)
+{
+    StackChunk *chunk;
+    unsigned long slot;
+
+    if (!STACK_ARENA) {
+        qemu_free_stack(stack, sz);
+        return;
+    }
+
+    qemu_mutex_lock(&arena_lock);
+    chunk = stack_chunk_find(stack);
+    if (!chunk) {
+        qemu_mutex_unlock(&arena_lock);
+        qemu_free_stack(stack, sz);
+        return;
+    }
+
+    assert(sz == arena_slot_size);
+    slot = (stack - chunk->base) / arena_slot_size;
+    assert(test_bit(slot, chunk->used));
+
+    /* Give the memory back like munmap() would have, but keep the guard
+     * page and the address range.  The slot is still marked used, so
+     * nobody else can get it while the lock is dropped.
+     */
+    qemu_mutex_unlock(&arena_lock);
+    qemu_madvise(stack + arena_pagesz, sz - arena_pagesz, QEMU_MADV_DONTNEED);
+    qemu_mutex_lock(&arena_lock);
+
+    clear_bit(slot, chunk->used);
+    chunk->nr_used--;
+
+    /* An empty chunk is released unless it is the only room left.  */
+    if (chunk->nr_used == 0 && stack_arena_has_room(chunk)) {
+        QLIST_REMOVE(chunk, next);
+        munmap(chunk->base, CHUNK_STACKS * arena_slot_size);
+        g_free(chunk);
+    }
+    qemu_mutex_unlock(&arena_lock);
+}
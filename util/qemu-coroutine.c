@@ -25,9 +25,23 @@ enum {
     POOL_BATCH_SIZE = 64,
 };
 
-/** Free list to speed up creation */
-static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
-static unsigned int release_pool_size;
+/* Terminated coroutines are released to the pool of the AioContext they
+ * last ran in, from whichever thread they terminate in.  Creation takes
+ * the whole list at once, and then allocates from the thread-local
+ * alloc_pool without atomics.
+ */
+struct CoroutinePool {
+    QSLIST_HEAD(, Coroutine) release;
+    unsigned int release_size;
+    unsigned int max_size;
+    CoroutinePoolStats stats;
+};
+
+/** Free list for coroutines without an AioContext */
+static CoroutinePool global_pool = {
+    .release = QSLIST_HEAD_INITIALIZER(global_pool.release),
+    .max_size = COROUTINE_POOL_DEFAULT_SIZE,
+};
 static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(pool);
 static __thread unsigned int alloc_pool_size;
 static __thread Notifier coroutine_pool_cleanup_notifier;
@@ -43,32 +57,54 @@ static void coroutine_pool_cleanup(Notifier *n, void *value)
     }
 }
 
+static CoroutinePool *coroutine_pool_get(AioContext *ctx)
+{
+    return ctx && ctx->coroutine_pool ? ctx->coroutine_pool : &global_pool;
+}
+
+/* Move @pool's released coroutines to alloc_pool, if there are enough of
+ * them to be worth it.
+ */
+static void coroutine_pool_refill(CoroutinePool *pool)
+{
+    unsigned int threshold = MIN(POOL_BATCH_SIZE, pool->max_size / 2);
+
+    if (atomic_read(&pool->release_size) <= threshold) {
+        return;
+    }
+
+    /* Slow path; a good place to register the destructor, too.  */
+    if (!coroutine_pool_cleanup_notifier.notify) {
+        coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
+        qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
+    }
+
+    /* This is not exact; there could be a little skew between
+     * release_size and the actual size of the list.  But it is
+     * just a heuristic, it does not need to be perfect.
+     */
+    alloc_pool_size = atomic_xchg(&pool->release_size, 0);
+    QSLIST_MOVE_ATOMIC(&alloc_pool, &pool->release);
+}
+
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 {
     Coroutine *co = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        co = QSLIST_FIRST(&alloc_pool);
-        if (!co) {
-            if (release_pool_size > POOL_BATCH_SIZE) {
-                /* Slow path; a good place to register the destructor, too.  */
-                if (!coroutine_pool_cleanup_notifier.notify) {
-                    coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
-                }
-
-                /* This is not exact; there could be a little skew between
-                 * release_pool_size and the actual size of release_pool.  But
-                 * it is just a heuristic, it does not need to be perfect.
-                 */
-                alloc_pool_size = atomic_xchg(&release_pool_size, 0);
-                QSLIST_MOVE_ATOMIC(&alloc_pool, &release_pool);
-                co = QSLIST_FIRST(&alloc_pool);
-            }
+        CoroutinePool *pool =
+            coroutine_pool_get(qemu_get_current_aio_context());
+
+        if (QSLIST_EMPTY(&alloc_pool)) {
+            coroutine_pool_refill(pool);
         }
+        co = QSLIST_FIRST(&alloc_pool);
         if (co) {
             QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
             alloc_pool_size--;
+            pool->stats.hits++;
+        } else {
+            pool->stats.misses++;
         }
     }
 
@@ -87,9 +123,11 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < POOL_BATCH_SIZE * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            atomic_inc(&release_pool_size);
+        CoroutinePool *pool = coroutine_pool_get(co->ctx);
+
+        if (atomic_read(&pool->release_size) < pool->max_size) {
+            QSLIST_INSERT_HEAD_ATOMIC(&pool->release, co, pool_next);
+            atomic_inc(&pool->release_size);
             return;
         }
         if (alloc_pool_size < POOL_BATCH_SIZE) {
@@ -97,11 +135,45 @@ static void coroutine_delete(Coroutine *co)
             alloc_pool_size++;
             return;
         }
+        pool->stats.frees++;
     }
 
     qemu_coroutine_delete(co);
 }
 
+CoroutinePool *qemu_coroutine_pool_new(void)
+{
+    CoroutinePool *pool = g_new0(CoroutinePool, 1);
+
+    QSLIST_INIT(&pool->release);
+    pool->max_size = COROUTINE_POOL_DEFAULT_SIZE;
+    return pool;
+}
+
+void qemu_coroutine_pool_free(CoroutinePool *pool)
+{
+    Coroutine *co;
+
+    while ((co = QSLIST_FIRST(&pool->release))) {
+        QSLIST_REMOVE_HEAD(&pool->release, pool_next);
+        qemu_coroutine_delete(co);
+    }
+    g_free(pool);
+}
+
+void qemu_coroutine_pool_set_size(CoroutinePool *pool, unsigned int size)
+{
+    atomic_set(&pool->max_size, size);
+}
+
+void qemu_coroutine_pool_get_stats(CoroutinePool *pool,
+                                   CoroutinePoolStats *stats)
+{
+    pool = pool ?: &global_pool;
+    *stats = pool->stats;
+    stats->size = atomic_read(&pool->release_size);
+}
+
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
 {
     Coroutine *self = qemu_coroutine_self();
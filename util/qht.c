@@ -22,8 +22,8 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with readers and
+ *   writers; writers are only serialized with the copy of their own bucket.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -43,10 +43,19 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Resizing is incremental. A resize publishes an empty map that points back
+ * to the old one, and head buckets are then copied over one at a time, each
+ * under its old head's spinlock. Writers copy the old bucket for their hash
+ * before touching the new map, and help with a few more buckets; qht_resize()
+ * itself copies whatever is left. Once all buckets have been copied, the old
+ * map is freed when no RCU readers can see it anymore. Lookups consult the
+ * old bucket until it has been copied, and the new map afterwards. Entries
+ * are never removed from the old map, so readers that still hold a pointer
+ * to it keep finding them.
+ *
+ * Iterating, resetting and starting a new resize first finish any resize in
+ * progress. Resetting takes all bucket spinlocks and swaps in a new map
+ * in one go.
  *
  * Writers check for concurrent resizes by comparing ht->map before and after
  * acquiring their bucket lock. If they don't match, a resize has occured
@@ -119,6 +128,11 @@ QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @old: map whose entries are being copied into this one, or NULL.
+ * @migrated: for a map that is being resized away from, whether each head
+ *            bucket has been copied to the new map.
+ * @n_migrated: number of true elements in @migrated.
+ * @migrate_next: next head bucket to be copied by writers that help.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
  */
@@ -128,14 +142,22 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *old;
+    bool *migrated;
+    size_t n_migrated;
+    size_t migrate_next;
 };
 
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
-                                bool reset);
+/* head buckets copied by a writer that finds a resize in progress */
+#define QHT_MIGRATE_BATCH 16
+
+static void qht_do_resize(struct qht *ht, struct qht_map *new);
 static void qht_grow_maybe(struct qht *ht);
+static void qht_migrate_some(struct qht *ht, uint32_t hash, size_t n);
+static void qht_migrate_all(struct qht *ht);
 
 #ifdef QHT_DEBUG
 
@@ -247,14 +269,19 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
 
     map = atomic_rcu_read(&ht->map);
     qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
+    if (likely(!qht_map_is_stale__locked(ht, map) && !atomic_read(&map->old))) {
         *pmap = map;
         return;
     }
     qht_map_unlock_buckets(map);
 
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
+    /*
+     * We raced with a resize, or one is in progress; acquire ht->lock to
+     * see the updated ht->map, and make sure that all of its entries have
+     * been copied over.
+     */
     qemu_mutex_lock(&ht->lock);
+    qht_migrate_all(ht);
     map = ht->map;
     qht_map_lock_buckets(map);
     qemu_mutex_unlock(&ht->lock);
@@ -262,6 +289,19 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
     return;
 }
 
+/*
+ * Whether all entries for @hash are in @map, i.e. no resize to @map is in
+ * progress or the old bucket for @hash has been copied already.
+ * Call under an RCU read-critical section.
+ */
+static inline bool qht_map_owns_hash(struct qht_map *map, uint32_t hash)
+{
+    struct qht_map *old = atomic_rcu_read(&map->old);
+
+    return !old ||
+           atomic_load_acquire(&old->migrated[hash & (old->n_buckets - 1)]);
+}
+
 /*
  * Get a head bucket and lock it, making sure its parent map is not stale.
  * @pmap is filled with a pointer to the bucket's parent map.
@@ -281,18 +321,31 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     b = qht_map_to_bucket(map, hash);
 
     qemu_spin_lock(&b->lock);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
+    if (likely(!qht_map_is_stale__locked(ht, map) && !atomic_read(&map->old))) {
         *pmap = map;
         return b;
     }
     qemu_spin_unlock(&b->lock);
 
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qemu_mutex_lock(&ht->lock);
-    map = ht->map;
-    b = qht_map_to_bucket(map, hash);
-    qemu_spin_lock(&b->lock);
-    qemu_mutex_unlock(&ht->lock);
+    /*
+     * We raced with a resize, or one is in progress. In the latter case,
+     * copy the old bucket for @hash so that the new map has all the entries
+     * we care about, and help moving a few more.
+     */
+    rcu_read_lock();
+    for (;;) {
+        qht_migrate_some(ht, hash, QHT_MIGRATE_BATCH);
+
+        map = atomic_rcu_read(&ht->map);
+        b = qht_map_to_bucket(map, hash);
+        qemu_spin_lock(&b->lock);
+        if (likely(!qht_map_is_stale__locked(ht, map) &&
+                   qht_map_owns_hash(map, hash))) {
+            break;
+        }
+        qemu_spin_unlock(&b->lock);
+    }
+    rcu_read_unlock();
     *pmap = map;
     return b;
 }
@@ -323,6 +376,7 @@ static void qht_map_destroy(struct qht_map *map)
         qht_chain_destroy(&map->buckets[i]);
     }
     qemu_vfree(map->buckets);
+    g_free(map->migrated);
     g_free(map);
 }
 
@@ -331,7 +385,7 @@ static struct qht_map *qht_map_create(size_t n_buckets)
     struct qht_map *map;
     size_t i;
 
-    map = g_malloc(sizeof(*map));
+    map = g_malloc0(sizeof(*map));
     map->n_buckets = n_buckets;
 
     map->n_added_buckets = 0;
@@ -365,6 +419,9 @@ void qht_init(struct qht *ht, size_t n_elems, unsigned int mode)
 /* call only when there are no readers/writers left */
 void qht_destroy(struct qht *ht)
 {
+    if (ht->map->old) {
+        qht_map_destroy(ht->map->old);
+    }
     qht_map_destroy(ht->map);
     memset(ht, 0, sizeof(*ht));
 }
@@ -409,14 +466,27 @@ void qht_reset(struct qht *ht)
     qht_map_unlock_buckets(map);
 }
 
-static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
+/*
+ * Atomically perform a reset and, if @new is not NULL, replace the map.
+ * Call with ht->lock held and no resize in progress.
+ */
+static void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
 {
-    qht_do_resize_reset(ht, new, false);
-}
+    struct qht_map *old;
 
-static inline void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
-{
-    qht_do_resize_reset(ht, new, true);
+    old = ht->map;
+    qht_map_lock_buckets(old);
+    qht_map_reset__all_locked(old);
+
+    if (new == NULL) {
+        qht_map_unlock_buckets(old);
+        return;
+    }
+
+    g_assert_cmpuint(new->n_buckets, !=, old->n_buckets);
+    atomic_rcu_set(&ht->map, new);
+    qht_map_unlock_buckets(old);
+    call_rcu(old, qht_map_destroy, rcu);
 }
 
 bool qht_reset_size(struct qht *ht, size_t n_elems)
@@ -428,6 +498,7 @@ bool qht_reset_size(struct qht *ht, size_t n_elems)
     n_buckets = qht_elems_to_buckets(n_elems);
 
     qemu_mutex_lock(&ht->lock);
+    qht_migrate_all(ht);
     map = ht->map;
     if (n_buckets != map->n_buckets) {
         new = qht_map_create(n_buckets);
@@ -479,15 +550,44 @@ void *qht_lookup__slowpath(struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
+/*
+ * A resize is in progress: look in the old map until the bucket for @hash
+ * has been copied over. Entries are copied before the bucket is marked
+ * as such, and are not removed from the old map, so one of the two
+ * lookups will see them.
+ */
+static __attribute__((noinline))
+void *qht_lookup__resizing(struct qht_map *map, struct qht_map *old,
+                           qht_lookup_func_t func, const void *userp,
+                           uint32_t hash)
+{
+    size_t i = hash & (old->n_buckets - 1);
+    void *ret;
+
+    if (!atomic_load_acquire(&old->migrated[i])) {
+        ret = qht_lookup__slowpath(&old->buckets[i], func, userp, hash);
+        if (ret) {
+            return ret;
+        }
+    }
+    return qht_lookup__slowpath(qht_map_to_bucket(map, hash), func, userp,
+                                hash);
+}
+
 void *qht_lookup(struct qht *ht, qht_lookup_func_t func, const void *userp,
                  uint32_t hash)
 {
     struct qht_bucket *b;
     struct qht_map *map;
+    struct qht_map *old;
     unsigned int version;
     void *ret;
 
     map = atomic_rcu_read(&ht->map);
+    old = atomic_rcu_read(&map->old);
+    if (unlikely(old)) {
+        return qht_lookup__resizing(map, old, func, userp, hash);
+    }
     b = qht_map_to_bucket(map, hash);
 
     version = seqlock_read_begin(&b->sequence);
@@ -560,8 +660,12 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
         return;
     }
     map = ht->map;
-    /* another thread might have just performed the resize we were after */
-    if (qht_map_needs_resize(map)) {
+    /*
+     * Another thread might have just performed the resize we were after.
+     * Leave a resize in progress to the writers; this one will be retried
+     * by the next insertion that adds a bucket.
+     */
+    if (!map->old && qht_map_needs_resize(map)) {
         struct qht_map *new = qht_map_create(map->n_buckets * 2);
 
         qht_do_resize(ht, new);
@@ -723,49 +827,126 @@ void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp)
 {
     struct qht_map *map;
 
-    map = atomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
+    qht_map_lock_buckets__no_stale(ht, &map);
     /* Note: ht here is merely for carrying ht->mode; ht->map won't be read */
     qht_map_iter__all_locked(ht, map, func, userp);
     qht_map_unlock_buckets(map);
 }
 
+/* copy one entry to a map that might be visible to other threads */
 static void qht_map_copy(struct qht *ht, void *p, uint32_t hash, void *userp)
 {
     struct qht_map *new = userp;
     struct qht_bucket *b = qht_map_to_bucket(new, hash);
 
-    /* no need to acquire b->lock because no thread has seen this map yet */
+    qemu_spin_lock(&b->lock);
     qht_insert__locked(ht, new, b, p, hash, NULL);
+    qht_bucket_debug__locked(b);
+    qemu_spin_unlock(&b->lock);
 }
 
 /*
- * Atomically perform a resize and/or reset.
- * Call with ht->lock held.
+ * Resizing from @old to @map is over; free @old unless another thread
+ * got here first. Once this returns, @map->old is NULL.
  */
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
+static void qht_map_migration_done(struct qht_map *map, struct qht_map *old)
 {
-    struct qht_map *old;
+    if (atomic_cmpxchg(&map->old, old, NULL) == old) {
+        call_rcu(old, qht_map_destroy, rcu);
+    }
+}
 
-    old = ht->map;
-    qht_map_lock_buckets(old);
+/*
+ * Copy the entries of head bucket @i of @old to @map. Lock order is the old
+ * head first, then the new heads; writers to @map never hold a lock of @old.
+ * Call under an RCU read-critical section.
+ */
+static void qht_map_migrate_bucket(struct qht *ht, struct qht_map *map,
+                                   struct qht_map *old, size_t i)
+{
+    struct qht_bucket *head = &old->buckets[i];
 
-    if (reset) {
-        qht_map_reset__all_locked(old);
+    if (atomic_load_acquire(&old->migrated[i])) {
+        return;
     }
-
-    if (new == NULL) {
-        qht_map_unlock_buckets(old);
+    qemu_spin_lock(&head->lock);
+    if (old->migrated[i]) {
+        qemu_spin_unlock(&head->lock);
         return;
     }
+    qht_bucket_iter(ht, head, qht_map_copy, map);
+    /* pairs with the load-acquire in qht_lookup__resizing() */
+    atomic_store_release(&old->migrated[i], true);
+    qemu_spin_unlock(&head->lock);
+
+    if (atomic_fetch_inc(&old->n_migrated) + 1 == old->n_buckets) {
+        qht_map_migration_done(map, old);
+    }
+}
+
+/*
+ * If a resize is in progress, copy the old bucket for @hash and up to
+ * @n more head buckets to the new map.
+ */
+static void qht_migrate_some(struct qht *ht, uint32_t hash, size_t n)
+{
+    struct qht_map *map;
+    struct qht_map *old;
+    size_t i, end;
+
+    rcu_read_lock();
+    map = atomic_rcu_read(&ht->map);
+    old = atomic_rcu_read(&map->old);
+    if (old) {
+        qht_map_migrate_bucket(ht, map, old, hash & (old->n_buckets - 1));
+
+        i = atomic_fetch_add(&old->migrate_next, n);
+        end = MIN(i + n, old->n_buckets);
+        for (; i < end; i++) {
+            qht_map_migrate_bucket(ht, map, old, i);
+        }
+    }
+    rcu_read_unlock();
+}
+
+/*
+ * Finish the resize in progress, if any. When called with ht->lock held,
+ * no resize is in progress anymore on return.
+ */
+static void qht_migrate_all(struct qht *ht)
+{
+    struct qht_map *map;
+    struct qht_map *old;
+    size_t i;
+
+    rcu_read_lock();
+    map = atomic_rcu_read(&ht->map);
+    old = atomic_rcu_read(&map->old);
+    if (old) {
+        for (i = 0; i < old->n_buckets; i++) {
+            qht_map_migrate_bucket(ht, map, old, i);
+        }
+        qht_map_migration_done(map, old);
+    }
+    rcu_read_unlock();
+}
 
+/*
+ * Start resizing to @new; its entries are copied from the current map
+ * by writers and by qht_resize(). Call with ht->lock held and no resize
+ * in progress.
+ */
+static void qht_do_resize(struct qht *ht, struct qht_map *new)
+{
+    struct qht_map *old;
+
+    old = ht->map;
     g_assert_cmpuint(new->n_buckets, !=, old->n_buckets);
-    qht_map_iter__all_locked(ht, old, qht_map_copy, new);
-    qht_map_debug__all_locked(new);
+    g_assert(old->old == NULL);
 
+    old->migrated = g_new0(bool, old->n_buckets);
+    new->old = old;
     atomic_rcu_set(&ht->map, new);
-    qht_map_unlock_buckets(old);
-    call_rcu(old, qht_map_destroy, rcu);
 }
 
 bool qht_resize(struct qht *ht, size_t n_elems)
@@ -774,6 +955,7 @@ bool qht_resize(struct qht *ht, size_t n_elems)
     size_t ret = false;
 
     qemu_mutex_lock(&ht->lock);
+    qht_migrate_all(ht);
     if (n_buckets != ht->map->n_buckets) {
         struct qht_map *new;
 
@@ -783,19 +965,63 @@ bool qht_resize(struct qht *ht, size_t n_elems)
     }
     qemu_mutex_unlock(&ht->lock);
 
+    /* copy the entries without holding off writers that want ht->lock */
+    if (ret) {
+        qht_migrate_all(ht);
+    }
     return ret;
 }
 
+/* returns the number of entries in the chain starting at @head */
+static size_t qht_bucket_statistics(struct qht_bucket *head,
+                                    struct qht_stats *stats)
+{
+    struct qht_bucket *b;
+    unsigned int version;
+    size_t buckets;
+    size_t entries;
+    int j;
+
+    do {
+        version = seqlock_read_begin(&head->sequence);
+        buckets = 0;
+        entries = 0;
+        b = head;
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (atomic_read(&b->pointers[j]) == NULL) {
+                    break;
+                }
+                entries++;
+            }
+            buckets++;
+            b = atomic_rcu_read(&b->next);
+        } while (b);
+    } while (seqlock_read_retry(&head->sequence, version));
+
+    if (entries) {
+        qdist_inc(&stats->chain, buckets);
+        qdist_inc(&stats->occupancy,
+                  (double)entries / QHT_BUCKET_ENTRIES / buckets);
+        stats->entries += entries;
+    } else {
+        qdist_inc(&stats->occupancy, 0);
+    }
+    return entries;
+}
+
 /* pass @stats to qht_statistics_destroy() when done */
 void qht_statistics_init(struct qht *ht, struct qht_stats *stats)
 {
     struct qht_map *map;
-    int i;
+    struct qht_map *old;
+    size_t i;
 
     map = atomic_rcu_read(&ht->map);
 
     stats->used_head_buckets = 0;
     stats->entries = 0;
+    stats->pending_buckets = 0;
     qdist_init(&stats->chain);
     qdist_init(&stats->occupancy);
     /* bail out if the qht has not yet been initialized */
@@ -806,40 +1032,27 @@ void qht_statistics_init(struct qht *ht, struct qht_stats *stats)
     stats->head_buckets = map->n_buckets;
 
     for (i = 0; i < map->n_buckets; i++) {
-        struct qht_bucket *head = &map->buckets[i];
-        struct qht_bucket *b;
-        unsigned int version;
-        size_t buckets;
-        size_t entries;
-        int j;
-
-        do {
-            version = seqlock_read_begin(&head->sequence);
-            buckets = 0;
-            entries = 0;
-            b = head;
-            do {
-                for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
-                    if (atomic_read(&b->pointers[j]) == NULL) {
-                        break;
-                    }
-                    entries++;
-                }
-                buckets++;
-                b = atomic_rcu_read(&b->next);
-            } while (b);
-        } while (seqlock_read_retry(&head->sequence, version));
-
-        if (entries) {
-            qdist_inc(&stats->chain, buckets);
-            qdist_inc(&stats->occupancy,
-                      (double)entries / QHT_BUCKET_ENTRIES / buckets);
+        if (qht_bucket_statistics(&map->buckets[i], stats)) {
             stats->used_head_buckets++;
-            stats->entries += entries;
-        } else {
-            qdist_inc(&stats->occupancy, 0);
         }
     }
+
+    /*
+     * Chains that have not been copied yet still serve lookups, and their
+     * entries are not in @map. Their head buckets are only counted as
+     * pending.
+     */
+    rcu_read_lock();
+    old = atomic_rcu_read(&map->old);
+    if (old) {
+        for (i = 0; i < old->n_buckets; i++) {
+            if (!atomic_load_acquire(&old->migrated[i])) {
+                stats->pending_buckets++;
+                qht_bucket_statistics(&old->buckets[i], stats);
+            }
+        }
+    }
+    rcu_read_unlock();
 }
 
 void qht_statistics_destroy(struct qht_stats *stats)
@@ -32,6 +32,8 @@
 #include "qemu/atomic.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "trace.h"
 
 /*
  * Global grace period counter.  Bit 0 is always one in rcu_gp_ctr.
@@ -46,6 +48,9 @@ QemuEvent rcu_gp_event;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/* Protected by rcu_sync_lock.  */
+static RCUStats rcu_stats;
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -89,10 +94,11 @@ static void wait_for_readers(void)
             atomic_set(&index->waiting, true);
         }
 
-        /* Here, order the stores to index->waiting before the
-         * loads of index->ctr.
+        /* Here, order the stores to index->waiting before the loads of
+         * index->ctr.  Pairs with smp_mb_placeholder() in rcu_read_unlock(),
+         * ensuring that the loads of index->ctr are sequentially consistent.
          */
-        smp_mb();
+        smp_mb_global();
 
         QLIST_FOREACH_SAFE(index, &registry, node, tmp) {
             if (!rcu_gp_ongoing(&index->ctr)) {
@@ -138,7 +144,16 @@ static void wait_for_readers(void)
 
 void synchronize_rcu(void)
 {
+    int64_t start, ns;
+
     qemu_mutex_lock(&rcu_sync_lock);
+    start = get_clock();
+
+    /* Write RCU-protected pointers before reading p_rcu_reader->ctr.
+     * Pairs with smp_mb_placeholder() in rcu_read_lock().
+     */
+    smp_mb_global();
+
     qemu_mutex_lock(&rcu_registry_lock);
 
     if (!QLIST_EMPTY(&registry)) {
@@ -163,6 +178,11 @@ void synchronize_rcu(void)
     }
 
     qemu_mutex_unlock(&rcu_registry_lock);
+
+    ns = get_clock() - start;
+    rcu_stats.grace_periods++;
+    rcu_stats.gp_total_ns += ns;
+    rcu_stats.gp_max_ns = MAX(rcu_stats.gp_max_ns, ns);
     qemu_mutex_unlock(&rcu_sync_lock);
 }
 
@@ -226,6 +246,75 @@ retry:
     return node;
 }
 
+/* Callbacks taken from the per-thread lists, waiting for their grace
+ * period.  Only used by the call_rcu thread.
+ */
+static struct rcu_head *batch_head, **batch_tail = &batch_head;
+static long rcu_call_inflight;
+
+/* Number of callbacks not taken by the call_rcu thread yet.  This walks
+ * all threads, so it must not be called in a fast path.
+ */
+static long rcu_call_pending(void)
+{
+    struct rcu_reader_data *index;
+    long n = atomic_read(&rcu_call_count);
+
+    /* With rcu_sync_lock taken, all threads are in the registry.  */
+    qemu_mutex_lock(&rcu_sync_lock);
+    qemu_mutex_lock(&rcu_registry_lock);
+    QLIST_FOREACH(index, &registry, node) {
+        n += atomic_read(&index->cb_count);
+    }
+    qemu_mutex_unlock(&rcu_registry_lock);
+    qemu_mutex_unlock(&rcu_sync_lock);
+    return n;
+}
+
+/* Reverse a per-thread list, which is newest first.  */
+static struct rcu_head *rcu_list_reverse(struct rcu_head *node, long *n)
+{
+    struct rcu_head *rev = NULL, *next;
+
+    for (; node; node = next) {
+        next = node->next;
+        node->next = rev;
+        rev = node;
+        (*n)++;
+    }
+    return rev;
+}
+
+/* Move the callbacks queued by all threads to the batch, keeping the
+ * order in which each thread queued them.
+ */
+static long rcu_call_harvest(void)
+{
+    struct rcu_reader_data *index;
+    struct rcu_head *node;
+    long n = 0, k;
+
+    qemu_mutex_lock(&rcu_sync_lock);
+    qemu_mutex_lock(&rcu_registry_lock);
+    QLIST_FOREACH(index, &registry, node) {
+        if (!atomic_read(&index->cb_list)) {
+            continue;
+        }
+        k = 0;
+        node = rcu_list_reverse(atomic_xchg(&index->cb_list, NULL), &k);
+        atomic_sub(&index->cb_count, k);
+        *batch_tail = node;
+        while (node->next) {
+            node = node->next;
+        }
+        batch_tail = &node->next;
+        n += k;
+    }
+    qemu_mutex_unlock(&rcu_registry_lock);
+    qemu_mutex_unlock(&rcu_sync_lock);
+    return n;
+}
+
 static void *call_rcu_thread(void *opaque)
 {
     struct rcu_head *node;
@@ -234,28 +323,39 @@ static void *call_rcu_thread(void *opaque)
 
     for (;;) {
         int tries = 0;
-        int n = atomic_read(&rcu_call_count);
+        long n = rcu_call_pending();
+        long n_global, total;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
-         * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
-         */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        /* Heuristically wait for a decent number of callbacks to pile up.  */
+        while (n <= 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
             g_usleep(10000);
-            if (n == 0) {
+            if (n <= 0) {
                 qemu_event_reset(&rcu_call_ready_event);
-                n = atomic_read(&rcu_call_count);
-                if (n == 0) {
+                n = rcu_call_pending();
+                if (n <= 0) {
                     qemu_event_wait(&rcu_call_ready_event);
                 }
             }
-            n = atomic_read(&rcu_call_count);
+            n = rcu_call_pending();
         }
 
-        atomic_sub(&rcu_call_count, n);
+        /* Take what has been queued so far, we only must process elements
+         * that were added before synchronize_rcu() starts.
+         */
+        n_global = atomic_read(&rcu_call_count);
+        atomic_sub(&rcu_call_count, n_global);
+        total = n_global + rcu_call_harvest();
+        atomic_set(&rcu_call_inflight, total);
+
         synchronize_rcu();
         qemu_mutex_lock_iothread();
-        while (n > 0) {
+        while ((node = batch_head) != NULL) {
+            batch_head = node->next;
+            node->func(node);
+        }
+        batch_tail = &batch_head;
+
+        while (n_global > 0) {
             node = try_dequeue();
             while (!node) {
                 qemu_mutex_unlock_iothread();
@@ -268,20 +368,59 @@ static void *call_rcu_thread(void *opaque)
                 qemu_mutex_lock_iothread();
             }
 
-            n--;
+            n_global--;
             node->func(node);
         }
         qemu_mutex_unlock_iothread();
+
+        atomic_set(&rcu_call_inflight, 0);
+        trace_call_rcu_batch(total);
+
+        qemu_mutex_lock(&rcu_sync_lock);
+        rcu_stats.batches++;
+        rcu_stats.callbacks += total;
+        rcu_stats.max_batch = MAX(rcu_stats.max_batch, total);
+        qemu_mutex_unlock(&rcu_sync_lock);
     }
     abort();
 }
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_reader_data *p_rcu_reader = &rcu_reader;
+    struct rcu_head *old;
+
     node->func = func;
-    enqueue(node);
-    atomic_inc(&rcu_call_count);
-    qemu_event_set(&rcu_call_ready_event);
+    if (!p_rcu_reader->registered) {
+        enqueue(node);
+        atomic_inc(&rcu_call_count);
+        qemu_event_set(&rcu_call_ready_event);
+        return;
+    }
+
+    /* Registered threads queue on their own list, which the call_rcu
+     * thread only touches to take it whole.  It only needs a wakeup
+     * when the list was empty.
+     */
+    do {
+        old = atomic_read(&p_rcu_reader->cb_list);
+        node->next = old;
+    } while (atomic_cmpxchg(&p_rcu_reader->cb_list, old, node) != old);
+    atomic_inc(&p_rcu_reader->cb_count);
+
+    if (!old) {
+        qemu_event_set(&rcu_call_ready_event);
+    }
+}
+
+void rcu_get_stats(RCUStats *stats)
+{
+    long backlog = rcu_call_pending() + atomic_read(&rcu_call_inflight);
+
+    qemu_mutex_lock(&rcu_sync_lock);
+    *stats = rcu_stats;
+    qemu_mutex_unlock(&rcu_sync_lock);
+    stats->backlog = MAX(backlog, 0);
 }
 
 void rcu_register_thread(void)
@@ -289,14 +428,33 @@ void rcu_register_thread(void)
     assert(rcu_reader.ctr == 0);
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_INSERT_HEAD(&registry, &rcu_reader, node);
+    rcu_reader.registered = true;
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
 void rcu_unregister_thread(void)
 {
+    struct rcu_head *node, *next;
+    long n = 0;
+
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_REMOVE(&rcu_reader, node);
+    rcu_reader.registered = false;
+    node = atomic_xchg(&rcu_reader.cb_list, NULL);
+    atomic_set(&rcu_reader.cb_count, 0);
     qemu_mutex_unlock(&rcu_registry_lock);
+
+    /* The call_rcu thread cannot see this thread anymore, pass the
+     * callbacks it did not take on to the global queue.
+     */
+    for (node = rcu_list_reverse(node, &n); node; node = next) {
+        next = node->next;
+        enqueue(node);
+        atomic_inc(&rcu_call_count);
+    }
+    if (n) {
+        qemu_event_set(&rcu_call_ready_event);
+    }
 }
 
 static void rcu_init_complete(void)
@@ -309,6 +467,8 @@ static void rcu_init_complete(void)
 
     qemu_event_init(&rcu_call_ready_event, false);
 
+    smp_mb_global_init();
+
     /* The caller is assumed to have iothread lock, so the call_rcu thread
      * must have been quiescent even after forking, just recreate it.
      */
@@ -0,0 +1,54 @@
+/*
+ * Process-wide memory barrier system call
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/sys_membarrier.h"
+#include "qemu/error-report.h"
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+
+/* Not in the headers before Linux 4.14.  */
+#define MEMBARRIER_PRIVATE_EXPEDITED            (1 << 3)
+#define MEMBARRIER_REGISTER_PRIVATE_EXPEDITED   (1 << 4)
+
+static int membarrier_cmd;
+
+static int membarrier(int cmd, int flags)
+{
+    return syscall(__NR_membarrier, cmd, flags);
+}
+
+void smp_mb_global(void)
+{
+    membarrier(membarrier_cmd, 0);
+}
+
+void smp_mb_global_init(void)
+{
+    int ret = membarrier(MEMBARRIER_CMD_QUERY, 0);
+
+    if (ret < 0) {
+        error_report("This QEMU binary requires the membarrier system call.");
+        error_report("Please upgrade your system to a newer version of Linux");
+        exit(1);
+    }
+
+    /* The expedited command interrupts the CPUs running our threads
+     * instead of waiting for a scheduler grace period.  Registration is
+     * per process, so it is also redone in the child after fork().
+     */
+    if ((ret & MEMBARRIER_PRIVATE_EXPEDITED) &&
+        membarrier(MEMBARRIER_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+        membarrier_cmd = MEMBARRIER_PRIVATE_EXPEDITED;
+    } else if (ret & MEMBARRIER_CMD_SHARED) {
+        membarrier_cmd = MEMBARRIER_CMD_SHARED;
+    } else {
+        error_report("This QEMU binary requires MEMBARRIER_CMD_SHARED support.");
+        error_report("Please upgrade your system to a newer version of Linux");
+        exit(1);
+    }
+}
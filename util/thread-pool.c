@@ -19,6 +19,9 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
@@ -26,6 +29,10 @@
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
+
+/* Upper bound for max_threads; worker slots are allocated up front.  */
+#define THREAD_POOL_MAX_THREADS 64
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -39,69 +46,251 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by worker->lock.
+     * After that, only the thread that ran the request can write to it.
+     * Reads and writes of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* The worker whose queue the request was put on.  */
+    ThreadPoolWorker *worker;
+
+    /* While queued, access to this list is protected by worker->lock.
+     * Once completed, the element moves to pool->completed, which is
+     * only accessed from the pool's AioContext.
+     */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
+    /* Completed requests not yet seen by the completion bottom half.  */
+    QSLIST_ENTRY(ThreadPoolElement) done;
+
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+typedef QTAILQ_HEAD(ThreadPoolReqList, ThreadPoolElement) ThreadPoolReqList;
+
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+    QemuSemaphore sem;
+
+    /* Set by the worker before it waits on sem.  Whoever clears it must
+     * post sem, so that every wakeup is paired with exactly one wait.
+     */
+    bool sleeping;
+
+    /* Protects reqs and, together with pool->lock, active.  */
+    QemuMutex lock;
+    ThreadPoolReqList reqs;
+    int nr_queued;      /* length of reqs, can be read without the lock */
+    bool active;        /* accepting requests */
+
+    /* Protected by pool->lock.  */
+    bool started;       /* the thread has been created */
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuSemaphore sem;
     int max_threads;
     QEMUBH *new_thread_bh;
 
+    /* The following variables are shared with the workers and only
+     * accessed atomically.
+     */
+    QSLIST_HEAD(, ThreadPoolElement) done; /* pushed by workers when done */
+    int idle_threads;    /* workers with sleeping set */
+    bool stopping;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    ThreadPoolReqList completed;
+    unsigned int next_worker;
+
+    ThreadPoolWorker workers[THREAD_POOL_MAX_THREADS];
 
     /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
-    bool stopping;
+#ifdef CONFIG_LINUX
+    bool has_affinity;
+    cpu_set_t cpus;
+#endif
 };
 
+/* Wake up @w if it is sleeping; returns true if it was.  */
+static bool worker_wake(ThreadPoolWorker *w)
+{
+    if (atomic_read(&w->sleeping) && atomic_xchg(&w->sleeping, false)) {
+        qemu_sem_post(&w->sem);
+        return true;
+    }
+    return false;
+}
+
+/* Wake up one sleeping worker, starting the search at @first.  */
+static ThreadPoolWorker *thread_pool_wake_one(ThreadPool *pool,
+                                              unsigned int first)
+{
+    int i;
+
+    for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+        ThreadPoolWorker *w = &pool->workers[(first + i) %
+                                             THREAD_POOL_MAX_THREADS];
+        if (atomic_read(&w->sleeping) && atomic_xchg(&w->sleeping, false)) {
+            return w;
+        }
+    }
+    return NULL;
+}
+
+static bool worker_push(ThreadPoolWorker *w, ThreadPoolElement *req)
+{
+    bool active;
+
+    qemu_mutex_lock(&w->lock);
+    active = w->active;
+    if (active) {
+        req->worker = w;
+        QTAILQ_INSERT_TAIL(&w->reqs, req, reqs);
+        atomic_set(&w->nr_queued, w->nr_queued + 1);
+    }
+    qemu_mutex_unlock(&w->lock);
+    return active;
+}
+
+/* Take a request from the front of @w's queue, or from the back when
+ * stealing it from another worker.
+ */
+static ThreadPoolElement *worker_pop(ThreadPoolWorker *w, bool steal)
+{
+    ThreadPoolElement *req;
+
+    if (!atomic_read(&w->nr_queued)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&w->lock);
+    if (steal) {
+        req = QTAILQ_LAST(&w->reqs, ThreadPoolReqList);
+    } else {
+        req = QTAILQ_FIRST(&w->reqs);
+    }
+    if (req) {
+        QTAILQ_REMOVE(&w->reqs, req, reqs);
+        atomic_set(&w->nr_queued, w->nr_queued - 1);
+        req->state = THREAD_ACTIVE;
+    }
+    qemu_mutex_unlock(&w->lock);
+    return req;
+}
+
+static ThreadPoolElement *worker_next_request(ThreadPoolWorker *w)
+{
+    ThreadPool *pool = w->pool;
+    ThreadPoolElement *req;
+    int self = w - pool->workers;
+    int i;
+
+    req = worker_pop(w, false);
+    for (i = 1; !req && i < THREAD_POOL_MAX_THREADS; i++) {
+        req = worker_pop(&pool->workers[(self + i) % THREAD_POOL_MAX_THREADS],
+                         true);
+    }
+    return req;
+}
+
+/* Hand a finished request back to the AioContext.  The bottom half takes
+ * all of them at once, so it only needs scheduling for the first one.
+ */
+static void thread_pool_complete(ThreadPool *pool, ThreadPoolElement *req)
+{
+    ThreadPoolElement *old;
+
+    do {
+        old = atomic_read(&pool->done.slh_first);
+        req->done.sle_next = old;
+    } while (atomic_cmpxchg(&pool->done.slh_first, old, req) != old);
+
+    if (!old) {
+        qemu_bh_schedule(pool->completion_bh);
+    }
+}
+
+static void thread_pool_set_thread_affinity(ThreadPool *pool)
+{
+#ifdef CONFIG_LINUX
+    /* Runs with lock taken.  */
+    if (pool->has_affinity &&
+        sched_setaffinity(0, sizeof(pool->cpus), &pool->cpus) < 0) {
+        error_report("thread pool: failed to set worker affinity: %s",
+                     strerror(errno));
+    }
+#endif
+}
+
 static void *worker_thread(void *opaque)
 {
-    ThreadPool *pool = opaque;
+    ThreadPoolWorker *w = opaque;
+    ThreadPool *pool = w->pool;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
     do_spawn_thread(pool);
+    thread_pool_set_thread_affinity(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (!pool->stopping) {
+    for (;;) {
         ThreadPoolElement *req;
+        bool waited = false, woken = false;
         int ret;
 
-        do {
-            pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
-            break;
+        req = worker_next_request(w);
+        if (!req) {
+            /* Pairs with the barrier in thread_pool_submit_aio(): either
+             * the submitter sees us idle, or we see its request.
+             */
+            atomic_inc(&pool->idle_threads);
+            atomic_mb_set(&w->sleeping, true);
+
+            req = worker_next_request(w);
+            if (!req && !atomic_read(&pool->stopping)) {
+                waited = true;
+                woken = qemu_sem_timedwait(&w->sem, 10000) == 0;
+            }
+            if (!woken && !atomic_xchg(&w->sleeping, false)) {
+                /* Somebody cleared sleeping, eat their wakeup.  */
+                qemu_sem_wait(&w->sem);
+                woken = true;
+            }
+            atomic_dec(&pool->idle_threads);
+
+            if (atomic_read(&pool->stopping)) {
+                assert(!req);
+                break;
+            }
+            if (!req) {
+                if (waited && !woken) {
+                    /* Idle for 10 seconds, exit unless work arrived.  */
+                    qemu_mutex_lock(&pool->lock);
+                    qemu_mutex_lock(&w->lock);
+                    if (!w->nr_queued) {
+                        w->active = false;
+                    }
+                    qemu_mutex_unlock(&w->lock);
+                    if (!w->active) {
+                        goto out;
+                    }
+                    qemu_mutex_unlock(&pool->lock);
+                }
+                continue;
+            }
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
-
         ret = req->func(req->arg);
 
         req->ret = ret;
@@ -109,11 +298,16 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
-        qemu_bh_schedule(pool->completion_bh);
+        thread_pool_complete(pool, req);
     }
 
+    qemu_mutex_lock(&pool->lock);
+    qemu_mutex_lock(&w->lock);
+    w->active = false;
+    qemu_mutex_unlock(&w->lock);
+
+out:
+    w->started = false;
     pool->cur_threads--;
     qemu_cond_signal(&pool->worker_stopped);
     qemu_mutex_unlock(&pool->lock);
@@ -123,16 +317,27 @@ static void *worker_thread(void *opaque)
 static void do_spawn_thread(ThreadPool *pool)
 {
     QemuThread t;
+    int i;
 
     /* Runs with lock taken.  */
     if (!pool->new_threads) {
         return;
     }
 
-    pool->new_threads--;
-    pool->pending_threads++;
+    for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+        ThreadPoolWorker *w = &pool->workers[i];
+
+        if (w->active && !w->started) {
+            w->started = true;
+            pool->new_threads--;
+            pool->pending_threads++;
 
-    qemu_thread_create(&t, "worker", worker_thread, pool, QEMU_THREAD_DETACHED);
+            qemu_thread_create(&t, "worker", worker_thread, w,
+                               QEMU_THREAD_DETACHED);
+            return;
+        }
+    }
+    abort();
 }
 
 static void spawn_thread_bh_fn(void *opaque)
@@ -144,8 +349,28 @@ static void spawn_thread_bh_fn(void *opaque)
     qemu_mutex_unlock(&pool->lock);
 }
 
-static void spawn_thread(ThreadPool *pool)
+/* Returns the worker slot whose thread is going to be started.  */
+static ThreadPoolWorker *spawn_thread(ThreadPool *pool)
 {
+    ThreadPoolWorker *w = NULL;
+    int i;
+
+    /* Runs with lock taken.  */
+    for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+        if (!pool->workers[i].active && !pool->workers[i].started) {
+            w = &pool->workers[i];
+            break;
+        }
+    }
+    if (!w) {
+        /* Every slot still has a thread on its way out.  */
+        return NULL;
+    }
+
+    qemu_mutex_lock(&w->lock);
+    w->active = true;
+    qemu_mutex_unlock(&w->lock);
+
     pool->cur_threads++;
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
@@ -158,22 +383,36 @@ static void spawn_thread(ThreadPool *pool)
     if (!pool->pending_threads) {
         qemu_bh_schedule(pool->new_thread_bh);
     }
+    return w;
 }
 
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     aio_context_acquire(pool->ctx);
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
+    for (;;) {
+        elem = QTAILQ_FIRST(&pool->completed);
+        if (!elem) {
+            QSLIST_HEAD(, ThreadPoolElement) batch;
+
+            QSLIST_MOVE_ATOMIC(&batch, &pool->done);
+            if (QSLIST_EMPTY(&batch)) {
+                break;
+            }
+
+            /* The workers push in LIFO order, restore completion order.  */
+            while ((elem = QSLIST_FIRST(&batch)) != NULL) {
+                QSLIST_REMOVE_HEAD(&batch, done);
+                QTAILQ_INSERT_HEAD(&pool->completed, elem, reqs);
+            }
             continue;
         }
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
+        QTAILQ_REMOVE(&pool->completed, elem, reqs);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
@@ -190,16 +429,12 @@ restart:
             aio_context_acquire(pool->ctx);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we keep looping until
+             * both lists are empty.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
     aio_context_release(pool->ctx);
 }
@@ -207,26 +442,24 @@ restart:
 static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
-    ThreadPool *pool = elem->pool;
+    ThreadPoolWorker *w = elem->worker;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    qemu_mutex_lock(&pool->lock);
-    if (elem->state == THREAD_QUEUED &&
-        /* No thread has yet started working on elem. we can try to "steal"
-         * the item from the worker if we can get a signal from the
-         * semaphore.  Because this is non-blocking, we can do it with
-         * the lock taken and ensure that elem will remain THREAD_QUEUED.
-         */
-        qemu_sem_timedwait(&pool->sem, 0) == 0) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+    /* No thread has yet started working on elem, so we can "steal" it
+     * from the worker's queue.  Requests are only ever stolen from the
+     * queue they were put on.
+     */
+    qemu_mutex_lock(&w->lock);
+    if (elem->state == THREAD_QUEUED) {
+        QTAILQ_REMOVE(&w->reqs, elem, reqs);
+        atomic_set(&w->nr_queued, w->nr_queued - 1);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_complete(elem->pool, elem);
     }
-
-    qemu_mutex_unlock(&pool->lock);
+    qemu_mutex_unlock(&w->lock);
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -242,11 +475,54 @@ static const AIOCBInfo thread_pool_aiocb_info = {
     .get_aio_context    = thread_pool_get_aio_context,
 };
 
+/* Put @req on a worker's queue.  Returns the worker if it is busy.  */
+static ThreadPoolWorker *thread_pool_queue(ThreadPool *pool,
+                                           ThreadPoolElement *req)
+{
+    ThreadPoolWorker *w;
+    int i;
+
+    for (;;) {
+        /* An idle worker gets the request right away...  */
+        if (atomic_read(&pool->idle_threads)) {
+            w = thread_pool_wake_one(pool, pool->next_worker);
+            if (w) {
+                /* It cannot exit before seeing the wakeup.  */
+                if (!worker_push(w, req)) {
+                    abort();
+                }
+                qemu_sem_post(&w->sem);
+                return NULL;
+            }
+        }
+
+        /* ... otherwise start a new one...  */
+        w = NULL;
+        qemu_mutex_lock(&pool->lock);
+        if (pool->cur_threads < pool->max_threads) {
+            w = spawn_thread(pool);
+        }
+        qemu_mutex_unlock(&pool->lock);
+        if (w && worker_push(w, req)) {
+            return NULL;
+        }
+
+        /* ... or line it up behind a busy one, where others can steal it.  */
+        for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+            w = &pool->workers[pool->next_worker++ % THREAD_POOL_MAX_THREADS];
+            if (atomic_read(&w->active) && worker_push(w, req)) {
+                return w;
+            }
+        }
+    }
+}
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolWorker *w;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
@@ -258,13 +534,19 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    w = thread_pool_queue(pool, req);
+    if (w) {
+        /* Pairs with the barrier in worker_thread(): if a worker went idle
+         * without seeing req, let it steal req now.
+         */
+        smp_mb();
+        if (!worker_wake(w) && atomic_read(&pool->idle_threads)) {
+            w = thread_pool_wake_one(pool, w - pool->workers);
+            if (w) {
+                qemu_sem_post(&w->sem);
+            }
+        }
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_sem_post(&pool->sem);
     return &req->common;
 }
 
@@ -298,6 +580,8 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
 
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
+    int i;
+
     if (!ctx) {
         ctx = qemu_get_aio_context();
     }
@@ -307,12 +591,21 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
+    pool->max_threads = THREAD_POOL_MAX_THREADS;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QTAILQ_INIT(&pool->completed);
+    QSLIST_INIT(&pool->done);
+
+    for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+        ThreadPoolWorker *w = &pool->workers[i];
+
+        w->pool = pool;
+        qemu_sem_init(&w->sem, 0);
+        qemu_mutex_init(&w->lock);
+        QTAILQ_INIT(&w->reqs);
+    }
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -322,32 +615,116 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
-void thread_pool_free(ThreadPool *pool)
+void thread_pool_set_max_threads(ThreadPool *pool, int max_threads)
 {
-    if (!pool) {
-        return;
-    }
+    assert(max_threads > 0 && max_threads <= THREAD_POOL_MAX_THREADS);
 
-    assert(QLIST_EMPTY(&pool->head));
+    qemu_mutex_lock(&pool->lock);
+    pool->max_threads = max_threads;
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_set_affinity(ThreadPool *pool, const char *cpus,
+                              Error **errp)
+{
+#ifdef CONFIG_LINUX
+    cpu_set_t set;
+    const char *p = cpus;
+    unsigned long first, last;
+
+    CPU_ZERO(&set);
+    while (p && *p) {
+        if (qemu_strtoul(p, &p, 10, &first) < 0) {
+            goto bad;
+        }
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) < 0) {
+            goto bad;
+        }
+        if (last < first || last >= CPU_SETSIZE) {
+            goto bad;
+        }
+        for (; first <= last; first++) {
+            CPU_SET(first, &set);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            goto bad;
+        }
+    }
 
     qemu_mutex_lock(&pool->lock);
+    pool->has_affinity = CPU_COUNT(&set) > 0;
+    pool->cpus = set;
+    qemu_mutex_unlock(&pool->lock);
+    return;
+
+bad:
+    error_setg(errp, "Invalid CPU list '%s'", cpus);
+#else
+    if (cpus && *cpus) {
+        error_setg(errp, "Thread pool affinity is not supported on this host");
+    }
+#endif
+}
+
+/* Runs with lock taken and no requests outstanding.  */
+static void thread_pool_stop_threads(ThreadPool *pool)
+{
+    int i;
 
-    /* Stop new threads from spawning */
-    qemu_bh_delete(pool->new_thread_bh);
     pool->cur_threads -= pool->new_threads;
     pool->new_threads = 0;
+    for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+        if (!pool->workers[i].started) {
+            pool->workers[i].active = false;
+        }
+    }
 
     /* Wait for worker threads to terminate */
-    pool->stopping = true;
+    atomic_mb_set(&pool->stopping, true);
     while (pool->cur_threads > 0) {
-        qemu_sem_post(&pool->sem);
+        for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+            worker_wake(&pool->workers[i]);
+        }
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
+}
+
+void thread_pool_stop_workers(ThreadPool *pool)
+{
+    assert(QLIST_EMPTY(&pool->head));
+
+    qemu_mutex_lock(&pool->lock);
+    thread_pool_stop_threads(pool);
+    atomic_mb_set(&pool->stopping, false);
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_free(ThreadPool *pool)
+{
+    int i;
+
+    if (!pool) {
+        return;
+    }
+
+    assert(QLIST_EMPTY(&pool->head));
+
+    qemu_mutex_lock(&pool->lock);
+
+    /* Stop new threads from spawning */
+    qemu_bh_delete(pool->new_thread_bh);
+    thread_pool_stop_threads(pool);
 
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
-    qemu_sem_destroy(&pool->sem);
+    for (i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+        qemu_mutex_destroy(&pool->workers[i].lock);
+        qemu_sem_destroy(&pool->workers[i].sem);
+    }
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
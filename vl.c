@@ -527,6 +527,9 @@ static QemuOptsList qemu_semihosting_config_opts = {
         }, {
             .name = "arg",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "buffered",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
@@ -594,6 +597,7 @@ static int default_driver_check(void *opaque, QemuOpts *opts, Error **errp)
 /***********************************************************/
 /* QEMU state */
 
+/* Written under the BQL, but query-status reads it out-of-band */
 static RunState current_run_state = RUN_STATE_PRELAUNCH;
 
 /* We use RUN_STATE__MAX but any invalid value will do */
@@ -698,7 +702,7 @@ static bool runstate_valid_transitions[RUN_STATE__MAX][RUN_STATE__MAX];
 
 bool runstate_check(RunState state)
 {
-    return current_run_state == state;
+    return atomic_read(&current_run_state) == state;
 }
 
 bool runstate_store(char *str, size_t size)
@@ -741,7 +745,7 @@ void runstate_set(RunState new_state)
         abort();
     }
     trace_runstate_set(new_state);
-    current_run_state = new_state;
+    atomic_set(&current_run_state, new_state);
 }
 
 int runstate_is_running(void)
@@ -759,9 +763,9 @@ StatusInfo *qmp_query_status(Error **errp)
 {
     StatusInfo *info = g_malloc0(sizeof(*info));
 
-    info->running = runstate_is_running();
+    info->status = atomic_read(&current_run_state);
+    info->running = info->status == RUN_STATE_RUNNING;
     info->singlestep = singlestep;
-    info->status = current_run_state;
 
     return info;
 }
@@ -1369,6 +1373,7 @@ static void configure_msg(QemuOpts *opts)
 
 typedef struct SemihostingConfig {
     bool enabled;
+    bool buffered;
     SemihostingTarget target;
     const char **argv;
     int argc;
@@ -1382,6 +1387,11 @@ bool semihosting_enabled(void)
     return semihosting.enabled;
 }
 
+bool semihosting_buffered(void)
+{
+    return semihosting.buffered;
+}
+
 SemihostingTarget semihosting_get_target(void)
 {
     return semihosting.target;
@@ -2482,6 +2492,10 @@ static int mon_init_func(void *opaque, QemuOpts *opts, Error **errp)
     if (qemu_opt_get_bool(opts, "pretty", 0))
         flags |= MONITOR_USE_PRETTY;
 
+    if (qemu_opt_get_bool(opts, "x-oob", false)) {
+        flags |= MONITOR_USE_OOB;
+    }
+
     if (qemu_opt_get_bool(opts, "default", 0)) {
         error_report("option 'default' does nothing and is deprecated");
     }
@@ -3974,6 +3988,8 @@ int main(int argc, char **argv, char **envp)
                 if (opts != NULL) {
                     semihosting.enabled = qemu_opt_get_bool(opts, "enable",
                                                             true);
+                    semihosting.buffered = qemu_opt_get_bool(opts, "buffered",
+                                                             false);
                     const char *target = qemu_opt_get(opts, "target");
                     if (target != NULL) {
                         if (strcmp("native", target) == 0) {